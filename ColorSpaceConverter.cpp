@@ -0,0 +1,262 @@
+/*
+Copyright (C) 2012 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "ColorSpaceConverter.h"
+
+// Custom
+#include "ParallelFor.h"
+
+// STL
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <sstream>
+
+namespace
+{
+  /** The number of intervals of the table of f(t), and the largest t in it (the normalized X and Z of white are
+    * slightly above 1). */
+  const unsigned int NumberOfSamples = 4096;
+  const float MaximumT = 1.01f;
+
+  /** The tables of the CIELab conversion. They are computed once, on first use. */
+  struct CIELabTables
+  {
+    /** The linear value (0 to 1) of each sRGB component value. */
+    float LinearRGB[256];
+
+    /** f(t) of CIELab (the cube root above (6/29)^3, linear below) at NumberOfSamples + 1 points of [0, MaximumT]. */
+    float F[NumberOfSamples + 2];
+
+    CIELabTables()
+    {
+      for(unsigned int value = 0; value < 256; ++value)
+      {
+        const double c = value / 255.0;
+        this->LinearRGB[value] = static_cast<float>(c > 0.04045 ? std::pow((c + 0.055) / 1.055, 2.4) : c / 12.92);
+      }
+
+      for(unsigned int sample = 0; sample <= NumberOfSamples; ++sample)
+      {
+        const double t = sample * static_cast<double>(MaximumT) / NumberOfSamples;
+        this->F[sample] = static_cast<float>(t > 0.008856 ? std::cbrt(t) : 7.787 * t + 16.0 / 116.0);
+      }
+      // So that the interpolation at MaximumT does not read past the table.
+      this->F[NumberOfSamples + 1] = this->F[NumberOfSamples];
+    }
+
+    float ComputeF(const float t) const
+    {
+      const float position = std::min(std::max(t, 0.0f), MaximumT) * (NumberOfSamples / MaximumT);
+      const unsigned int sample = static_cast<unsigned int>(position);
+      const float fraction = position - sample;
+      return this->F[sample] + fraction * (this->F[sample + 1] - this->F[sample]);
+    }
+  };
+
+  const CIELabTables& GetCIELabTables()
+  {
+    static const CIELabTables tables;
+    return tables;
+  }
+
+  /** The number of samples of the hue per sixth of a turn in the HSV tables. */
+  const unsigned int HueSamplesPerSixth = 256;
+
+  /** The cosine and sine of the hue (in sixths of a turn) at 6 * HueSamplesPerSixth + 1 points of [0, 6]. */
+  struct HSVTables
+  {
+    float Cosine[6 * HueSamplesPerSixth + 1];
+    float Sine[6 * HueSamplesPerSixth + 1];
+
+    HSVTables()
+    {
+      const double pi = 3.14159265358979323846;
+      for(unsigned int sample = 0; sample <= 6 * HueSamplesPerSixth; ++sample)
+      {
+        const double angle = sample * pi / (3 * HueSamplesPerSixth);
+        this->Cosine[sample] = static_cast<float>(std::cos(angle));
+        this->Sine[sample] = static_cast<float>(std::sin(angle));
+      }
+    }
+  };
+
+  const HSVTables& GetHSVTables()
+  {
+    static const HSVTables tables;
+    return tables;
+  }
+
+  unsigned char ClampToByte(const float value)
+  {
+    return static_cast<unsigned char>(std::min(255.0f, std::max(0.0f, value + 0.5f)));
+  }
+}
+
+ColorSpaceConverter::ColorSpaceConverter(const ColorSpace colorSpace) : Space(colorSpace)
+{
+}
+
+const char* ColorSpaceConverter::GetColorSpaceName(const ColorSpace colorSpace)
+{
+  switch(colorSpace)
+  {
+    case ColorSpace::RGB:
+      return "rgb";
+    case ColorSpace::CIELAB:
+      return "cielab";
+    case ColorSpace::HSV:
+      return "hsv";
+    default:
+      return "unknown";
+  }
+}
+
+ColorSpace ColorSpaceConverter::GetColorSpace(const std::string& name)
+{
+  for(const ColorSpace colorSpace : {ColorSpace::RGB, ColorSpace::CIELAB, ColorSpace::HSV})
+  {
+    if(name == GetColorSpaceName(colorSpace))
+    {
+      return colorSpace;
+    }
+  }
+
+  throw std::runtime_error("Unknown color space " + name + "!");
+}
+
+void ColorSpaceConverter::Convert(const unsigned char* const input, unsigned char* const output,
+                                  const std::size_t numberOfPixels, const unsigned int numberOfComponents,
+                                  const unsigned int numberOfThreads) const
+{
+  if(numberOfComponents < 3)
+  {
+    std::stringstream ss;
+    ss << "An image with " << numberOfComponents << " components can not be converted from RGB to "
+       << GetColorSpaceName(this->Space) << "!";
+    throw std::runtime_error(ss.str());
+  }
+
+  if(this->Space == ColorSpace::RGB)
+  {
+    std::memcpy(output, input, numberOfPixels * numberOfComponents);
+    return;
+  }
+
+  // Compute the tables before the threads need them.
+  GetCIELabTables();
+  GetHSVTables();
+
+  ParallelFor(0, numberOfPixels,
+              [this, input, output, numberOfComponents](const std::size_t begin, const std::size_t end)
+              {
+                if(this->Space == ColorSpace::CIELAB)
+                {
+                  this->ConvertToCIELab(input, output, begin, end, numberOfComponents);
+                }
+                else
+                {
+                  this->ConvertToHSV(input, output, begin, end, numberOfComponents);
+                }
+              }, numberOfThreads);
+}
+
+void ColorSpaceConverter::ConvertToCIELab(const unsigned char* const input, unsigned char* const output,
+                                          const std::size_t begin, const std::size_t end,
+                                          const unsigned int numberOfComponents) const
+{
+  const CIELabTables& tables = GetCIELabTables();
+
+  for(std::size_t pixelId = begin; pixelId < end; ++pixelId)
+  {
+    const unsigned char* const inputPixel = input + pixelId * numberOfComponents;
+    unsigned char* const outputPixel = output + pixelId * numberOfComponents;
+
+    const float r = tables.LinearRGB[inputPixel[0]];
+    const float g = tables.LinearRGB[inputPixel[1]];
+    const float b = tables.LinearRGB[inputPixel[2]];
+
+    // sRGB to XYZ, normalized by the D65 white point
+    const float fx = tables.ComputeF((r * 0.4124f + g * 0.3576f + b * 0.1805f) / 0.95047f);
+    const float fy = tables.ComputeF(r * 0.2126f + g * 0.7152f + b * 0.0722f);
+    const float fz = tables.ComputeF((r * 0.0193f + g * 0.1192f + b * 0.9505f) / 1.08883f);
+
+    outputPixel[0] = ClampToByte((116.0f * fy - 16.0f) * (255.0f / 100.0f));
+    outputPixel[1] = ClampToByte(500.0f * (fx - fy) + 128.0f);
+    outputPixel[2] = ClampToByte(200.0f * (fy - fz) + 128.0f);
+
+    for(unsigned int component = 3; component < numberOfComponents; ++component)
+    {
+      outputPixel[component] = inputPixel[component];
+    }
+  }
+}
+
+void ColorSpaceConverter::ConvertToHSV(const unsigned char* const input, unsigned char* const output,
+                                       const std::size_t begin, const std::size_t end,
+                                       const unsigned int numberOfComponents) const
+{
+  const HSVTables& tables = GetHSVTables();
+
+  for(std::size_t pixelId = begin; pixelId < end; ++pixelId)
+  {
+    const unsigned char* const inputPixel = input + pixelId * numberOfComponents;
+    unsigned char* const outputPixel = output + pixelId * numberOfComponents;
+
+    const int r = inputPixel[0];
+    const int g = inputPixel[1];
+    const int b = inputPixel[2];
+    const int maximum = std::max(r, std::max(g, b));
+    const int delta = maximum - std::min(r, std::min(g, b));
+
+    // The hue in sixths of a turn, from red
+    float hue = 0;
+    if(delta > 0)
+    {
+      if(maximum == r)
+      {
+        hue = static_cast<float>(g - b) / delta;
+        if(hue < 0)
+        {
+          hue += 6;
+        }
+      }
+      else if(maximum == g)
+      {
+        hue = 2 + static_cast<float>(b - r) / delta;
+      }
+      else
+      {
+        hue = 4 + static_cast<float>(r - g) / delta;
+      }
+    }
+
+    // The hue is an angle, so it is stored as the point (S cos H, S sin H) of the HSV cone instead of as a value that
+    // jumps from 255 to 0 at red. The distances of these points are what the n-links and the histograms need.
+    const float saturation = maximum > 0 ? static_cast<float>(delta) / maximum : 0.0f;
+    const unsigned int hueSample = static_cast<unsigned int>(hue * HueSamplesPerSixth + 0.5f);
+    outputPixel[0] = ClampToByte(127.5f + 127.5f * saturation * tables.Cosine[hueSample]);
+    outputPixel[1] = ClampToByte(127.5f + 127.5f * saturation * tables.Sine[hueSample]);
+    outputPixel[2] = static_cast<unsigned char>(maximum);
+
+    for(unsigned int component = 3; component < numberOfComponents; ++component)
+    {
+      outputPixel[component] = inputPixel[component];
+    }
+  }
+}
@@ -0,0 +1,74 @@
+/*
+Copyright (C) 2012 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef ColorSpaceConverter_H
+#define ColorSpaceConverter_H
+
+// STL
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+/** The color spaces that ImageGraphCut can segment in (see ImageGraphCut::SetColorSpace()). */
+enum class ColorSpace {RGB, CIELAB, HSV};
+
+/** Converts buffers of 8 bit sRGB pixels to 8 bit CIELab or HSV, for whole images at once. The first 3 components
+  * of each pixel are converted and the other components (e.g. alpha or depth) are copied.
+  *
+  * CIELab (D65 white point) is stored as L * 255 / 100, a + 128 and b + 128, so the converted image has the type and
+  * the value range of the input. HSV is stored as the point of the HSV cone, S cos H and S sin H scaled from [-1, 1]
+  * to [0, 255], and V: the hue is an angle, so storing it as a value would put red at both ends of the range and make
+  * the pixel differences of the n-links (and the histograms) wrong across it. The sRGB gamma is a table of the 256
+  * values of a component, the cube root of CIELab a finely sampled, interpolated table and the cosine and sine of the
+  * hue are tables too, so the conversion does no pow() or trigonometry per pixel. The pixels are converted in parallel.
+  */
+class ColorSpaceConverter
+{
+public:
+  explicit ColorSpaceConverter(const ColorSpace colorSpace);
+
+  /** Get the name of a color space (e.g. "cielab"). */
+  static const char* GetColorSpaceName(const ColorSpace colorSpace);
+
+  /** Get the color space with the name 'name'. Throws if there is none. */
+  static ColorSpace GetColorSpace(const std::string& name);
+
+  /** Convert 'numberOfPixels' pixels of 'numberOfComponents' (at least 3) interleaved components from 'input'
+    * to 'output'. 'numberOfThreads' = 0 uses all of the cores of the machine. */
+  void Convert(const unsigned char* const input, unsigned char* const output, const std::size_t numberOfPixels,
+               const unsigned int numberOfComponents, const unsigned int numberOfThreads = 0) const;
+
+  /** Other component types can not be converted. */
+  template <typename TComponent>
+  void Convert(const TComponent* const, TComponent* const, const std::size_t, const unsigned int,
+               const unsigned int = 0) const
+  {
+    throw std::runtime_error("Only images with unsigned char components can be converted to another color space!");
+  }
+
+private:
+  ColorSpace Space;
+
+  void ConvertToCIELab(const unsigned char* const input, unsigned char* const output, const std::size_t begin,
+                       const std::size_t end, const unsigned int numberOfComponents) const;
+
+  void ConvertToHSV(const unsigned char* const input, unsigned char* const output, const std::size_t begin,
+                    const std::size_t end, const unsigned int numberOfComponents) const;
+};
+
+#endif
@@ -0,0 +1,51 @@
+/*
+Copyright (C) 2012 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef EdgeMaps_H
+#define EdgeMaps_H
+
+// ITK
+#include "itkImage.h"
+
+// STL
+#include <string>
+
+/** Edge maps for the boundary term of ImageGraphCut (see ImageGraphCut::SetEdgeMap()). An edge map has one value
+  * per pixel that grows with the strength of the edge at the pixel, in any unit: a gradient magnitude, an edge
+  * probability from an external detector, etc. It is computed or read once per image and can be reused by every
+  * segmentation of that image.
+  */
+namespace EdgeMaps
+{
+  typedef itk::Image<float, 2> ImageType;
+
+  /** Compute the gradient magnitude of 'image' (central differences, over all of its components) into 'edgeMap',
+    * which is allocated if its size is not the size of 'image'. The image must store its pixels as interleaved
+    * scalar components, like itk::VectorImage or an itk::Image of scalars. The rows are computed in parallel;
+    * 'numberOfThreads' = 0 uses all of the cores of the machine. */
+  template <typename TImage>
+  void ComputeGradientMagnitude(const TImage* const image, ImageType* const edgeMap,
+                                const unsigned int numberOfThreads = 0);
+
+  /** Read an edge map from a file of any scalar pixel type (e.g. an 8 bit edge probability image). */
+  ImageType::Pointer Read(const std::string& filename);
+}
+
+#include "EdgeMaps.hpp"
+
+#endif
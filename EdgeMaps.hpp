@@ -0,0 +1,88 @@
+/*
+Copyright (C) 2012 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef EdgeMaps_HPP
+#define EdgeMaps_HPP
+
+#include "EdgeMaps.h"
+
+// Custom
+#include "ParallelFor.h"
+
+// STL
+#include <cmath>
+#include <type_traits>
+
+namespace EdgeMaps
+{
+  template <typename TImage>
+  void ComputeGradientMagnitude(const TImage* const image, ImageType* const edgeMap,
+                                const unsigned int numberOfThreads)
+  {
+    static_assert(std::is_arithmetic<typename TImage::InternalPixelType>::value,
+                  "ComputeGradientMagnitude() reads the image buffer as interleaved scalar components, so it needs an "
+                  "itk::VectorImage or an itk::Image of scalars!");
+
+    const itk::ImageRegion<2> region = image->GetLargestPossibleRegion();
+    if(edgeMap->GetLargestPossibleRegion() != region)
+    {
+      edgeMap->SetRegions(region);
+      edgeMap->Allocate();
+    }
+
+    const std::size_t width = region.GetSize()[0];
+    const std::size_t height = region.GetSize()[1];
+    const unsigned int numberOfComponents = image->GetNumberOfComponentsPerPixel();
+    const typename TImage::InternalPixelType* const buffer = image->GetBufferPointer();
+    float* const edges = edgeMap->GetBufferPointer();
+
+    // The chunks are whole rows (the grain is the width).
+    ParallelFor(0, region.GetNumberOfPixels(),
+                [=](const std::size_t begin, const std::size_t end)
+                {
+                  for(std::size_t pixelId = begin; pixelId < end; ++pixelId)
+                  {
+                    const std::size_t x = pixelId % width;
+                    const std::size_t y = pixelId / width;
+
+                    // Central differences, one-sided at the borders of the image
+                    const std::size_t left = x > 0 ? pixelId - 1 : pixelId;
+                    const std::size_t right = x + 1 < width ? pixelId + 1 : pixelId;
+                    const std::size_t top = y > 0 ? pixelId - width : pixelId;
+                    const std::size_t bottom = y + 1 < height ? pixelId + width : pixelId;
+                    const float horizontalScale = (right - left == 2) ? 0.5f : 1.0f;
+                    const float verticalScale = (bottom - top == 2 * width) ? 0.5f : 1.0f;
+
+                    float squaredMagnitude = 0;
+                    for(unsigned int component = 0; component < numberOfComponents; ++component)
+                    {
+                      const float dx = horizontalScale *
+                          (static_cast<float>(buffer[right * numberOfComponents + component]) -
+                           static_cast<float>(buffer[left * numberOfComponents + component]));
+                      const float dy = verticalScale *
+                          (static_cast<float>(buffer[bottom * numberOfComponents + component]) -
+                           static_cast<float>(buffer[top * numberOfComponents + component]));
+                      squaredMagnitude += dx * dx + dy * dy;
+                    }
+                    edges[pixelId] = std::sqrt(squaredMagnitude);
+                  }
+                }, numberOfThreads, width);
+  }
+}
+
+#endif
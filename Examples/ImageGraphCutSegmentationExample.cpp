@@ -80,13 +80,22 @@ int main(int argc, char*argv[])
   GraphCut.SetImage(reader->GetOutput());
   GraphCut.SetNumberOfHistogramBins(20);
   GraphCut.SetLambda(.01);
-  std::vector<itk::Index<2> > foregroundPixels;
-     
-  std::vector<itk::Index<2> > backgroundPixels;
-     
-  GraphCut.SetSources(foregroundPixels);
-  GraphCut.SetSinks(backgroundPixels);
+
+  // Read the seeds. The white pixels of each mask are the seeds (anti-aliased edges are rounded).
+  ForegroundBackgroundSegmentMask::Pointer foregroundSeeds = ForegroundBackgroundSegmentMask::New();
+  foregroundSeeds->ReadFromImage(foregroundFilename, ForegroundPixelValueWrapper<unsigned char>(255),
+                                 BackgroundPixelValueWrapper<unsigned char>(0),
+                                 ForegroundBackgroundSegmentMaskReadPolicy::NEAREST);
+
+  ForegroundBackgroundSegmentMask::Pointer backgroundSeeds = ForegroundBackgroundSegmentMask::New();
+  backgroundSeeds->ReadFromImage(backgroundFilename, ForegroundPixelValueWrapper<unsigned char>(255),
+                                 BackgroundPixelValueWrapper<unsigned char>(0),
+                                 ForegroundBackgroundSegmentMaskReadPolicy::NEAREST);
+
+  GraphCut.SetSeedsFromMasks(foregroundSeeds, backgroundSeeds);
+  GraphCut.SetVerbosity(1);
   GraphCut.PerformSegmentation();
+  std::cout << GraphCut.GetStatistics().ToJSON() << std::endl;
 
   // Get and write the result
   ForegroundBackgroundSegmentMask* segmentMask = GraphCut.GetSegmentMask();
@@ -96,7 +105,7 @@ int main(int argc, char*argv[])
 
   ImageType::Pointer result = ImageType::New();
   ITKHelpers::DeepCopy(reader->GetOutput(), result.GetPointer());
-  ImageType::PixelType backgroundColor(3);
+  ImageType::PixelType backgroundColor(result->GetNumberOfComponentsPerPixel());
   backgroundColor.Fill(0);
   segmentMask->ApplyToImage(result.GetPointer(), backgroundColor);
 
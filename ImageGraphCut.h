@@ -19,10 +19,18 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define ImageGraphCut_H
 
 // Custom
+#include "ColorSpaceConverter.h"
+#include "EdgeMaps.h"
+#include "ImageGraphCutModel.h"
+#include "ParallelFor.h"
 #include "PixelDifference.h"
+#include "SegmentationExecutor.h"
+#include "SegmentationProgress.h"
+#include "SegmentationStatistics.h"
 
 // Submodules
 #include "Mask/ForegroundBackgroundSegmentMask.h"
+#include "Mask/PackedForegroundBackgroundSegmentMask.h"
 
 // ITK
 #include "itkImage.h"
@@ -31,6 +39,12 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "itkListSample.h"
 
 // STL
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <type_traits>
 #include <vector>
 
 // Boost
@@ -51,13 +65,32 @@ class ImageGraphCut
 public:
   // Typedefs
 
-  /** This is a special type to keep track of the graph node labels. */
-  typedef itk::Image<unsigned int, 2> NodeImageType;
+  /** The type of the graph node ids. The node id of a pixel is its linear offset in the image buffer.
+    * 32 bits are enough for images with fewer than 4G pixels, larger graphs need
+    * ImageGraphCut_USE_64BIT_NODE_IDS. */
+#ifdef ImageGraphCut_USE_64BIT_NODE_IDS
+  typedef std::uint64_t NodeIdType;
+#else
+  typedef std::uint32_t NodeIdType;
+#endif
 
   /** The type of the histograms. */
   typedef itk::Statistics::Histogram< float,
           itk::Statistics::DenseFrequencyContainer2 > HistogramType;
 
+  /** The type of the trained appearance models (see TrainModel()). */
+  typedef ImageGraphCutModel<TImage> ModelType;
+
+  /** The type of the edge maps of the boundary term (see SetEdgeMap()). */
+  typedef EdgeMaps::ImageType EdgeMapType;
+
+  /** The results of a segmentation with a deadline (see PerformSegmentation(deadline) and SetDeadlineCut()). */
+  enum class DeadlineCut {PREDICTED, EXACT, BAND, COARSE};
+
+  /** A segmentation with a deadline is exact for images of at most this many pixels, which is also about the number
+    * of pixels of its coarse scale. A cut of this size takes a few milliseconds. */
+  static const std::size_t CoarseNumberOfPixels = 1 << 16;
+
   /** The type of a list of pixels/indexes. */
   typedef std::vector<itk::Index<2> > IndexContainer;
 
@@ -71,7 +104,10 @@ public:
   /** If nothing else is provided, this is the default background likelihood function. */
   float InternalBackgroundLikelihood(const PixelType& pixel);
 
-  ImageGraphCut()
+  ImageGraphCut() : ImageGraphCut(TPixelDifferenceFunctor()){}
+
+  ImageGraphCut(TPixelDifferenceFunctor pixelDifferenceFunctor) :
+    PixelDifferenceFunctor(pixelDifferenceFunctor)
   {
       this->ForegroundLikelihood =
               boost::bind(
@@ -82,17 +118,27 @@ public:
               boost::bind(
                   &ImageGraphCut::
                   InternalBackgroundLikelihood, this, _1);
-  }
 
-  ImageGraphCut(TPixelDifferenceFunctor pixelDifferenceFunctor) :
-    PixelDifferenceFunctor(pixelDifferenceFunctor){}
+      // These objects only hold per-segmentation data that is cleared before each use,
+      // so they are created once and reused by every call to PerformSegmentation().
+      this->ForegroundSample = SampleType::New();
+      this->BackgroundSample = SampleType::New();
+
+      this->ForegroundHistogramFilter = SampleToHistogramFilterType::New();
+      this->BackgroundHistogramFilter = SampleToHistogramFilterType::New();
+  }
 
   TPixelDifferenceFunctor PixelDifferenceFunctor;
 
-  /** Provide the image to segment. */
+  /** Provide the image to segment. The image is copied. */
   void SetImage(TImage* const image);
 
-  /** Several initializations are done here. */
+  /** Provide the image to segment without copying it (e.g. an image created by MappedBuffer over shared memory).
+    * The image is only read, and must not be changed or destroyed until the segmentation is done. */
+  void SetImageNoCopy(TImage* const image);
+
+  /** Several initializations are done here. This is also the reset path between segmentations:
+    * buffers from a previous call are kept and reused as long as the image size has not changed. */
   void Initialize();
 
   /** Get the image that we are segmenting. */
@@ -101,6 +147,27 @@ public:
   /** Create and cut the graph (The main driver function). */
   void PerformSegmentation();
 
+  /** Segment within a time budget, for interactive use where a close result now beats the exact one later.
+    * The image is first segmented at a coarse scale (about 64K pixels, with the likelihoods of the full image),
+    * and the upsampled coarse labels are the fallback result. The time of the coarse cut then predicts the time
+    * of the full cut: if it fits before 'deadline' the exact cut is computed, otherwise, if that fits, the cut
+    * is refined at full resolution in a band around the coarse boundary, and the pixels outside of the band keep
+    * their coarse label. The solver cannot be interrupted, so a wrong prediction can miss the deadline.
+    * Return true if the result is the minimum cut (also GetStatistics().Exact). The statistics have no flow or
+    * energy when the coarse labels are returned. Images of at most CoarseNumberOfPixels pixels are always
+    * segmented exactly. */
+  bool PerformSegmentation(const std::chrono::steady_clock::time_point& deadline);
+
+  /** Run PerformSegmentation() on 'executor' (the thread pool of the library by default) and return the
+    * segment mask through a future, which also carries the exception if the segmentation fails. The returned
+    * mask is a copy that belongs to the caller, so it is not overwritten by the next segmentation (GetSegmentMask()
+    * also has the result). This object, its image and its seeds must not be used or changed until the future is
+    * ready, so run concurrent segmentations with one ImageGraphCut object each. With SetNumberOfThreads(0), each
+    * segmentation uses cores / executor.GetNumberOfConcurrentTasks() threads, so that concurrent segmentations
+    * do not oversubscribe the cores. */
+  std::future<ForegroundBackgroundSegmentMask::Pointer> PerformSegmentationAsync(
+      SegmentationExecutor& executor = SegmentationExecutor::GetDefault());
+
   /** Return a list of the selected (via scribbling) pixels. */
   IndexContainer GetSources();
   IndexContainer GetSinks();
@@ -109,12 +176,112 @@ public:
   void SetSources(const IndexContainer& sources);
   void SetSinks(const IndexContainer& sinks);
 
-  /** Get the output of the segmentation. */
+  /** Set the selected pixels from masks: the FOREGROUND pixels of 'sourceMask' are sources and the
+    * FOREGROUND pixels of 'sinkMask' are sinks. The masks are read directly when the graph is built,
+    * they are never expanded into index lists. They are used in addition to the SetSources()/SetSinks()
+    * lists (and are not returned by GetSources()/GetSinks()). Either mask can be nullptr.
+    * The masks must have the same size as the image. */
+  void SetSeedsFromMasks(const ForegroundBackgroundSegmentMask* const sourceMask,
+                         const ForegroundBackgroundSegmentMask* const sinkMask);
+
+  /** Get the output of the segmentation. The mask is owned by this object and is
+    * overwritten by the next call to PerformSegmentation(). */
   ForegroundBackgroundSegmentMask* GetSegmentMask();
 
-  /** Set the weight between the regional and boundary terms. */
+  /** Also produce the output as a packed mask (1 bit per pixel, see GetPackedSegmentMask()). */
+  void SetComputePackedSegmentMask(const bool computePackedSegmentMask);
+
+  /** Get the output of the segmentation with 1 bit per pixel.
+    * This is only filled if SetComputePackedSegmentMask(true) was called before PerformSegmentation(). */
+  const PackedForegroundBackgroundSegmentMask* GetPackedSegmentMask() const;
+
+  /** Also write the output of the segmentation to 'buffer' (one byte per pixel in buffer order, e.g. a
+    * MappedBuffer over shared memory), with 'foregroundValue' and 'backgroundValue' pixels. The buffer is
+    * written by the same pass that creates the segment mask, and must hold one byte for every pixel of the
+    * image. Pass nullptr to stop writing to the buffer. */
+  void SetOutputBuffer(unsigned char* const buffer, const unsigned char foregroundValue = 255,
+                       const unsigned char backgroundValue = 0);
+
+  /** Set how much is printed to the console: 0 (the default) prints nothing, 1 prints a line with the
+    * stage timings after each segmentation and 2 also prints details of the graph construction. */
+  void SetVerbosity(const unsigned int verbosity);
+
+  /** Get the timings and counters of the last call to PerformSegmentation(). */
+  const SegmentationStatistics& GetStatistics() const;
+
+  /** Set the number of threads used by the parallel parts of the segmentation (0 uses all cores). */
+  void SetNumberOfThreads(const unsigned int numberOfThreads);
+
+  /** Compute the n-link weights from 'edgeMap' instead of the pixel differences. The n-link between two pixels
+    * then has the weight exp(-e^2 / (2 sigma^2)), with e the larger of their two edge values and sigma the mean e
+    * over the image, so the unit of the edge values does not matter (see EdgeMaps). The edge map must have the size
+    * of the image and is only read, so one edge map serves every segmentation of its image; it must not be changed
+    * or destroyed while it is set. nullptr (the default) goes back to the pixel differences. The coarse pass of a
+    * segmentation with a deadline always uses the pixel differences. */
+  void SetEdgeMap(const EdgeMapType* const edgeMap);
+
+  /** Segment in 'colorSpace' instead of RGB: the image is converted once per segmentation (see ColorSpaceConverter),
+    * and the histograms, the noise and the n-link weights are all computed from the converted image. This needs
+    * unsigned char components, the first 3 of which are RGB. Models (see TrainModel()) are trained in the color
+    * space that is set when they are trained. */
+  void SetColorSpace(const ColorSpace colorSpace);
+
+  /** Report the progress of the segmentations to 'progress', which can also cancel them: PerformSegmentation()
+    * then throws SegmentationCancelledError (see SegmentationProgress). 'progress' must outlive the
+    * segmentations, nullptr (the default) turns the reports off. After a cancelled segmentation the output is
+    * undefined, but the next PerformSegmentation() works as usual. */
+  void SetProgress(SegmentationProgress* const progress);
+
+  /** The type of the capacities with SetIntegerCapacities(true). */
+  typedef std::int32_t IntegerCapacityType;
+
+  /** Solve the max flow with integer instead of float capacities. Every edge weight w becomes the capacity
+    * round(w * scale), so an n-link (whose weight is at most 1) becomes 0 to 'scale' units, and every weight is
+    * off by at most 0.5 / scale. The seed t-links, which are float::max() with float capacities, get 1 + the sum
+    * of the other capacities of their pixel instead. Cutting such a t-link always costs more than cutting all of
+    * the n-links of the pixel, so no minimum cut contains it, and no infinite or overflowing value reaches the
+    * solver. Integer arithmetic is exact and the solver is faster with it.
+    * If the capacity out of the source or into the sink does not fit in IntegerCapacityType at 'scale' (e.g. for
+    * images of more than about 9 MP at the default scale), the capacities are scaled down to the largest scale at
+    * which it fits, which GetStatistics().CapacityScale reports. */
+  void SetIntegerCapacities(const bool integerCapacities, const double scale = 1024);
+
+  /** Reduce the graph before the max flow. The seeds are contracted into the terminals: they get no edges, and
+    * the n-links of their neighbors to them are added to the t-links of the neighbors. Then every pixel whose
+    * t-links outweigh all of its n-links to unlabeled pixels is on the same side of every minimum cut, so it is
+    * labeled and contracted the same way, until no such pixel is left. The solver only sees the remaining pixels,
+    * and the cut is the same as without the reduction (up to float rounding). */
+  void SetGraphReduction(const bool graphReduction);
+
+  /** After each segmentation, check that the cut is a minimum cut: no edge from the source side to the sink side
+    * of the solved graph has residual capacity left, and the capacity of the cut equals the flow. The result is
+    * GetStatistics().CutVerification. The flow and the energy are always reported; the check costs one more pass
+    * over the edges with the graph reduction. */
+  void SetCutVerification(const bool cutVerification);
+
+  /** Make PerformSegmentation(deadline) return 'deadlineCut' instead of the result that the predicted times allow
+    * (PREDICTED, the default): the exact cut, the cut refined in the band, or the upsampled coarse labels. The
+    * coarse scale still runs first, and images of at most CoarseNumberOfPixels pixels are still segmented exactly.
+    * This makes the approximations reproducible, to test them or to measure how far they are from the exact cut. */
+  void SetDeadlineCut(const DeadlineCut deadlineCut);
+
+  /** Set the weight between the regional and boundary terms. A model (see SetModel()) brings its own. */
   void SetLambda(const float);
 
+  /** Get the weight between the regional and boundary terms: the Lambda of the model if one is set. */
+  float GetLambda() const;
+
+  /** Compute the histograms of the seeds of the current image and return them, with Lambda, as an immutable model.
+    * Throws if there are no foreground or no background seeds. */
+  std::shared_ptr<const ModelType> TrainModel();
+
+  /** Segment with 'model' instead of the histograms of the seeds, and with its Lambda. The seeds still fix their
+    * pixels. One model can be shared by any number of ImageGraphCut objects on any number of threads; each
+    * object is then the workspace (the graph and the other buffers) of one thread. nullptr (the default) trains
+    * on the seeds of every segmentation. Custom likelihood functions take precedence over the model. A segmentation
+    * throws if the model was trained in another color space (see SetColorSpace()). */
+  void SetModel(const std::shared_ptr<const ModelType>& model);
+
   /** Set the number of bins per dimension of the foreground and background histograms. */
   void SetNumberOfHistogramBins(const int);
 
@@ -146,9 +313,9 @@ protected:
   std::vector<EdgeDescriptor> ReverseEdges;
 
   /** Create an edge on the graph. */
-  unsigned int AddBidirectionalEdge(unsigned int numberOfEdges, const unsigned int source,
-                            const unsigned int target,
-                            const float weight);
+  EdgeIndex AddBidirectionalEdge(EdgeIndex numberOfEdges, const NodeIdType source,
+                                 const NodeIdType target,
+                                 const float weight);
 
   /** The main graph object. */
   GraphType Graph;
@@ -156,23 +323,252 @@ protected:
   /** Maintain a list of all of the edge weights. */
   std::vector<float> EdgeWeights;
 
+  /** The residual capacity of each edge, filled in by the max flow solver. */
+  std::vector<float> ResidualCapacity;
+
+  /** The tree (source or sink) that each vertex belongs to after the max flow. */
+  std::vector<int> Groups;
+
+  /** Should the max flow use IntegerEdgeWeights instead of EdgeWeights (see SetIntegerCapacities())? */
+  bool IntegerCapacities = false;
+
+  /** The number of integer capacity units per unit of edge weight. */
+  double CapacityScale = 1024;
+
+  /** The number of integer capacity units per unit of edge weight in the solved graph: CapacityScale, or lower
+    * if the flow would not fit in IntegerCapacityType at CapacityScale (see FitIntegerCapacities()). */
+  double SolverCapacityScale = 1024;
+
+  /** The edge weights and residual capacities with integer capacities. Only one of EdgeWeights and
+    * IntegerEdgeWeights is filled, so the capacities take the same memory in both modes. */
+  std::vector<IntegerCapacityType> IntegerEdgeWeights;
+  std::vector<IntegerCapacityType> IntegerResidualCapacity;
+
+  /** Resize the edge weights of the current capacity mode and the reverse edges to 'numberOfEdges' edges. */
+  void ResizeEdgeProperties(const EdgeIndex numberOfEdges);
+
+  /** Get the integer capacity of an edge of weight 'weight' out of 'source' (see SetIntegerCapacities()). */
+  IntegerCapacityType QuantizeWeight(const NodeIdType source, const float weight) const;
+
+  /** An upper bound of the flow through the graph with integer capacities. */
+  std::int64_t ComputeMaximumIntegerFlow() const;
+
+  /** If the flow through the graph could overflow IntegerCapacityType, scale the integer capacities down to the
+    * largest scale at which it fits and set SolverCapacityScale. Throws if no scale fits. */
+  void FitIntegerCapacities();
+
+  /** Run the Boykov-Kolmogorov max flow with the capacities 'edgeWeights' (float or integer).
+    * Return the value of the flow. */
+  template <typename TCapacity>
+  TCapacity ComputeMaxFlow(std::vector<TCapacity>& edgeWeights, std::vector<TCapacity>& residualCapacity);
+
+  /** Run the max flow with 'groupMap' as the color map of the solver (Groups, with or without progress reports). */
+  template <typename TCapacity, typename TGroupMap>
+  TCapacity SolveMaxFlow(std::vector<TCapacity>& edgeWeights, std::vector<TCapacity>& residualCapacity,
+                         TGroupMap groupMap);
+
+  /** The progress of the segmentation (see SetProgress()). */
+  SegmentationProgress* Progress = nullptr;
+
+  /** The loops over the pixels report the progress every ProgressRows rows, and the max flow and the graph
+    * reduction every ProgressSteps steps. */
+  static const unsigned int ProgressRows = 64;
+  static const unsigned int ProgressSteps = 1 << 16;
+
+  /** Report the progress of a stage and throw SegmentationCancelledError if the segmentation was cancelled. */
+  void CheckProgress(const SegmentationStatistics::Stage stage, const double fraction) const;
+
+  /** Call CheckProgress() if 'nodeId' is the first pixel of a block of ProgressRows rows. */
+  void CheckProgressAtRow(const SegmentationStatistics::Stage stage, const std::size_t nodeId) const;
+
+  /** Should the cut be verified after the max flow (see SetCutVerification())? */
+  bool CutVerification = false;
+
+  /** The result of a segmentation with a deadline (see SetDeadlineCut()). */
+  DeadlineCut ForcedDeadlineCut = DeadlineCut::PREDICTED;
+
+  /** Sums over the cut edges or the pixels, in units of capacity. */
+  struct CutSums
+  {
+    double TLinks = 0;
+    double NLinks = 0;
+    std::size_t NumberOfUnsaturatedEdges = 0;
+  };
+
+  /** Sum the capacities of the t-links and n-links from the source side to the sink side of the solved graph,
+    * and count those that have residual capacity left. */
+  template <typename TCapacity>
+  CutSums SumCut(const std::vector<TCapacity>& edgeWeights, const std::vector<TCapacity>& residualCapacity) const;
+
+  /** Sum the data energy (TLinks) and the smoothness energy (NLinks) of the segmentation from the weights kept by
+    * the graph reduction, including the pixels and edges that are not in the reduced graph. */
+  CutSums SumReducedEnergy() const;
+
+  /** Call functor(begin, end, sums) on blocks of pixels in parallel and add up the sums of the blocks in order,
+    * so the result does not depend on the number of threads. */
+  template <typename TFunctor>
+  CutSums SumPixelBlocks(TFunctor functor) const;
+
+  /** Fill the flow, energy and cut verification statistics. */
+  void ComputeEnergy(const double flowValue);
+
+  /** Remove all edges from the graph, keeping the vertices (and the storage of their
+    * out-edge lists) if the graph already has 'numberOfVertices' vertices. */
+  void ResetGraph(const VertexIndex numberOfVertices);
+
   /** The output segmentation */
   ForegroundBackgroundSegmentMask::Pointer ResultingSegments;
 
+  /** The output segmentation, 1 bit per pixel. */
+  PackedForegroundBackgroundSegmentMask PackedResultingSegments;
+
+  /** Should PackedResultingSegments be computed? */
+  bool ComputePackedSegmentMask = false;
+
+  /** The number of threads used by the parallel parts of the segmentation (0 uses all cores). */
+  unsigned int NumberOfThreads = 0;
+
+  /** The number of threads of the running segmentation: NumberOfThreads, or the share of the cores of an
+    * asynchronous segmentation. Only the segmentation writes it. */
+  unsigned int NumberOfThreadsInUse = 0;
+
+  /** How much is printed to the console (see SetVerbosity()). */
+  unsigned int Verbosity = 0;
+
+  /** The measurements of the last segmentation. */
+  SegmentationStatistics Statistics;
+
+  /** The caller's output buffer and its pixel values (see SetOutputBuffer()). */
+  unsigned char* OutputBuffer = nullptr;
+  unsigned char OutputForegroundValue = 255;
+  unsigned char OutputBackgroundValue = 0;
+
   /** User specified foreground points */
   IndexContainer Sources;
 
   /** User specified background points */
   IndexContainer Sinks;
 
+  /** User specified foreground and background masks (see SetSeedsFromMasks()). */
+  ForegroundBackgroundSegmentMask::ConstPointer SourceSeedMask;
+  ForegroundBackgroundSegmentMask::ConstPointer SinkSeedMask;
+
+  /** The seed label of a pixel. */
+  enum class SeedLabel : unsigned char {NONE, SOURCE, SINK};
+
+  /** The seed label of every pixel, indexed by node id. This combines the index lists and the masks. */
+  std::vector<SeedLabel> SeedLabels;
+
+  /** The number of pixels labeled SOURCE and SINK in SeedLabels. */
+  std::size_t NumberOfSourcePixels = 0;
+  std::size_t NumberOfSinkPixels = 0;
+
+  /** Fill SeedLabels from Sources, Sinks and the seed masks. */
+  void ComputeSeedLabels();
+
+  /** Should the graph be reduced before the max flow (see SetGraphReduction())? */
+  bool GraphReduction = false;
+
+  /** The labels that a segmentation with a deadline gives the pixels outside of its refinement band, indexed by
+    * node id (NONE inside the band). Empty unless such a refinement is running. */
+  std::vector<SeedLabel> BandLabels;
+
+  /** Was the last graph built by ReduceGraph() (with GraphReduction or BandLabels)? */
+  bool GraphIsReduced = false;
+
+  /** PerformSegmentation() with 'numberOfThreads' instead of NumberOfThreads, which is not changed. */
+  void PerformSegmentationWithThreads(const unsigned int numberOfThreads);
+
+  /** Segment the image subsampled by 'factor' with the likelihoods of this object, and set Groups to the
+    * upsampled result. Fill 'coarseLabels' (1 for foreground) and 'coarseSize' with the coarse result, and return
+    * the statistics of the coarse segmentation. */
+  SegmentationStatistics SegmentCoarse(const unsigned int factor, std::vector<unsigned char>& coarseLabels,
+                                       itk::Size<2>& coarseSize);
+
+  /** Fill BandLabels from the coarse result of SegmentCoarse(): the band is the coarse pixels next to a coarse
+    * pixel of the other label, grown by one coarse pixel. Return the number of pixels in the band. */
+  std::size_t ComputeBandLabels(const unsigned int factor, const std::vector<unsigned char>& coarseLabels,
+                                const itk::Size<2>& coarseSize);
+
+  /** Fill the statistics of the graph and print the statistics if requested. */
+  void FinishStatistics();
+
+  /** The label of every pixel after the graph reduction (the seeds and the pixels the reduction labeled),
+    * indexed by node id. */
+  std::vector<SeedLabel> FixedLabels;
+
+  /** The weights of the n-links from each pixel to its right and bottom neighbors (graph reduction only). */
+  std::vector<float> RightWeights;
+  std::vector<float> BottomWeights;
+
+  /** The weight of the t-link to the source minus the weight of the t-link to the sink of each pixel that is
+    * not a seed (graph reduction only). */
+  std::vector<float> TLinkWeights;
+
+  /** The same for the pixels that the graph reduction did not label, including their n-links to labeled
+    * neighbors. This is the weight of their only t-link in the reduced graph. */
+  std::vector<float> ReducedTLinkWeights;
+
+  /** The work space of the graph reduction (see ReduceGraph()): the excess and the free n-link weight of each
+    * pixel and the list of pixels to visit. They are kept between segmentations, so they are only reallocated
+    * when the image grows. */
+  std::vector<double> ReductionExcess;
+  std::vector<double> ReductionFreeWeight;
+  std::vector<NodeIdType> ReductionWorkList;
+  std::vector<unsigned char> ReductionInWorkList;
+
+  /** The sum of the smaller t-link of every pixel that is not a seed (graph reduction only). Every labeling
+    * pays it, so the reduced graph leaves it out. */
+  double DataEnergyOffset = 0;
+
+  /** Compute the squared differences between the pixels of row 'row' and their right neighbors ('rightDifferences',
+    * width - 1 values) and, except in the last row, their bottom neighbors ('bottomDifferences', width values).
+    * With an edge map the difference of two pixels is the larger of their edge values. */
+  void ComputeRowSquaredDifferences(const std::size_t row, float* const rightDifferences,
+                                    float* const bottomDifferences) const;
+
+  /** Can the rows be read as raw buffers of GetNumberOfComponentsPerPixel() interleaved scalar components (like
+    * itk::VectorImage, or an itk::Image of scalars) and passed to the SquaredDifferences() of the functor? Other
+    * images (e.g. of itk::RGBPixel) and functors that do not have SquaredDifferences() are compared per pixel. */
+  typedef std::integral_constant<bool, std::is_arithmetic<typename TImage::InternalPixelType>::value &&
+      HasSquaredDifferences<TPixelDifferenceFunctor, typename TImage::InternalPixelType>::value> HasComponentBuffers;
+
+  /** ComputeRowSquaredDifferences() from the buffers of the rows. */
+  void ComputeRowPixelSquaredDifferences(const std::size_t row, float* const rightDifferences,
+                                         float* const bottomDifferences, std::true_type) const;
+
+  /** ComputeRowSquaredDifferences() pixel by pixel. */
+  void ComputeRowPixelSquaredDifferences(const std::size_t row, float* const rightDifferences,
+                                         float* const bottomDifferences, std::false_type) const;
+
+  /** Compute the weights of the n-links of row 'row' to the right and bottom neighbors, like
+    * ComputeRowSquaredDifferences(). */
+  void ComputeRowNLinkWeights(const std::size_t row, const double sigma, float* const rightWeights,
+                              float* const bottomWeights) const;
+
+  /** Get the weights of the t-links of a pixel that is not a seed: 'sourceWeight' is the weight of its edge to the
+    * source (the cost of labeling it background) and 'sinkWeight' the weight of its edge to the sink. */
+  void ComputeTLinkWeights(const PixelType& pixel, float& sourceWeight, float& sinkWeight);
+
+  /** Get the 4-connected neighbors of a pixel and the weights of its n-links to them (graph reduction only).
+    * Return the number of neighbors. */
+  unsigned int GetNLinks(const NodeIdType nodeId, NodeIdType neighbors[4], float weights[4]) const;
+
+  /** Compute the weights of the graph and label the pixels that the graph reduction can label. */
+  void ReduceGraph(const double sigma);
+
+  /** Create the edges between the pixels and to the terminals that are left after ReduceGraph(). */
+  void CreateReducedNEdges();
+  void CreateReducedTEdges();
+
   /** The weighting between unary and binary terms */
   float Lambda = 0.01f;
 
   /** The number of bins per dimension of the foreground and background histograms */
   int NumberOfHistogramBins = 10;
 
-  /** An image which keeps tracks of the mapping between pixel index and graph node id */
-  NodeImageType::Pointer NodeImage;
+  /** Get the graph node id of a pixel (its linear offset in the image buffer). */
+  NodeIdType GetNodeId(const itk::Index<2>& index) const;
 
   /** Create the histograms from the users selections */
   void CreateSamples();
@@ -183,8 +579,9 @@ protected:
   /** Create a Kolmogorov graph structure from the image and selections */
   void CreateGraph();
 
-  /** Create the edges between pixels and neighboring pixels (the grid). */
-  void CreateNEdges();
+  /** Create the edges between pixels and neighboring pixels (the grid). 'sigma' is the
+    * estimate of the noise computed by ComputeNoise(). */
+  void CreateNEdges(const double sigma);
 
   /** Create the edges between pixels and the terminals (source and sink). */
   void CreateTEdges();
@@ -192,14 +589,26 @@ protected:
   /** Perform the s-t min cut */
   void CutGraph();
 
+  /** Convert the groups computed by the max flow into the output mask(s). */
+  void ExtractSegmentMask();
+
   /** The ITK data structure for storing the values that we will compute the histogram of. */
   typename SampleType::Pointer ForegroundSample;
   typename SampleType::Pointer BackgroundSample;
 
-  /** The histograms. */
+  /** The histograms, computed by CreateSamples() or those of Model. */
   const HistogramType* ForegroundHistogram = nullptr;
   const HistogramType* BackgroundHistogram = nullptr;
 
+  /** The shared model (see SetModel()). */
+  std::shared_ptr<const ModelType> Model;
+
+  /** Set the histograms that the internal likelihood functions use, from Model or from the seeds. */
+  void ComputeHistograms();
+
+  /** Scratch space used by the internal likelihood functions. */
+  typename ModelType::LikelihoodScratch LikelihoodScratch;
+
   /** ITK filters to create histograms. */
   typename SampleToHistogramFilterType::Pointer ForegroundHistogramFilter;
   typename SampleToHistogramFilterType::Pointer BackgroundHistogramFilter;
@@ -207,11 +616,48 @@ protected:
   /** The image to be segmented */
   typename TImage::Pointer Image;
 
+  /** The edge map of the boundary term, or nullptr for the pixel differences (see SetEdgeMap()). */
+  EdgeMapType::ConstPointer EdgeMap;
+
+  /** The color space that the image is segmented in (see SetColorSpace()). */
+  ColorSpace SegmentationColorSpace = ColorSpace::RGB;
+
+  /** Image converted to SegmentationColorSpace. It is only reallocated if the image size changes. */
+  typename TImage::Pointer ConvertedImage;
+
+  /** Convert Image to SegmentationColorSpace. Return ConvertedImage, or nullptr if the color space is RGB. */
+  TImage* ConvertColorSpace();
+
+  /** Replaces Image while it lives (e.g. by ConvertedImage), then restores it. */
+  class ScopedImage
+  {
+  public:
+    ScopedImage(typename TImage::Pointer& image, TImage* const replacement) : Image(image), OriginalImage(image)
+    {
+      if(replacement)
+      {
+        this->Image = replacement;
+      }
+    }
+
+    ~ScopedImage()
+    {
+      this->Image = this->OriginalImage;
+    }
+
+  private:
+    typename TImage::Pointer& Image;
+    typename TImage::Pointer OriginalImage;
+  };
+
+  /** Is Image the caller's image (see SetImageNoCopy())? If so SetImage() must not copy into it. */
+  bool ImageIsExternal = false;
+
   /** The node id of the foreground terminal. */
-  unsigned int SourceNodeId;
+  NodeIdType SourceNodeId;
 
   /** The node id of the background terminal. */
-  unsigned int SinkNodeId;
+  NodeIdType SinkNodeId;
 
   /** The function pointer that gets called to determine the likelihood that the pixel belongs to the foreground. */
   boost::function<float (const PixelType& pixel)> ForegroundLikelihood;
@@ -25,13 +25,19 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "Mask/ITKHelpers/ITKHelpers.h"
 
 // ITK
+#include "itkImageRegionConstIterator.h"
 #include "itkImageRegionIterator.h"
-#include "itkShapedNeighborhoodIterator.h"
+#include "itkImageRegionIteratorWithIndex.h"
 #include "itkMaskImageFilter.h"
 
 // STL
 #include <cmath>
 #include <algorithm>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
 
 // Boost
 #include <boost/graph/boykov_kolmogorov_max_flow.hpp>
@@ -39,93 +45,680 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 template <typename TImage, typename TPixelDifferenceFunctor>
 void ImageGraphCut<TImage, TPixelDifferenceFunctor>::SetImage(TImage* const image)
 {
-  this->Image = TImage::New();
+  // DeepCopy only reallocates the internal image if the size of the new image is different.
+  if(!this->Image || this->ImageIsExternal)
+  {
+    this->Image = TImage::New();
+    this->ImageIsExternal = false;
+  }
   ITKHelpers::DeepCopy(image, this->Image.GetPointer());
 }
 
 template <typename TImage, typename TPixelDifferenceFunctor>
-void ImageGraphCut<TImage, TPixelDifferenceFunctor>::Initialize()
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::SetImageNoCopy(TImage* const image)
 {
-    // Setup the output (mask) image
-    this->ResultingSegments = ForegroundBackgroundSegmentMask::New();
-    this->ResultingSegments->SetRegions(this->Image->GetLargestPossibleRegion());
-    this->ResultingSegments->Allocate();
-
-    // Setup the image to store the node ids
-    this->NodeImage = NodeImageType::New();
-    this->NodeImage->SetRegions(this->Image->GetLargestPossibleRegion());
-    this->NodeImage->Allocate();
+  this->Image = image;
+  this->ImageIsExternal = true;
+}
 
-    // Initializations
-    this->ForegroundSample = SampleType::New();
-    this->BackgroundSample = SampleType::New();
+template <typename TImage, typename TPixelDifferenceFunctor>
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::Initialize()
+{
+    itk::ImageRegion<2> region = this->Image->GetLargestPossibleRegion();
 
-    this->ForegroundHistogramFilter = SampleToHistogramFilterType::New();
-    this->BackgroundHistogramFilter = SampleToHistogramFilterType::New();
+    // Setup the output (mask) image. It is only reallocated if the image size changed.
+    if(!this->ResultingSegments ||
+       this->ResultingSegments->GetLargestPossibleRegion() != region)
+    {
+      this->ResultingSegments = ForegroundBackgroundSegmentMask::New();
+      this->ResultingSegments->SetRegions(region);
+      this->ResultingSegments->Allocate();
+    }
 
-    // Blank the NodeImage
-    ITKHelpers::SetImageToConstant(this->NodeImage.GetPointer(), 0);
+    // Node ids are the linear pixel offsets followed by the sink and source ids, so they must all fit in NodeIdType.
+    if(region.GetNumberOfPixels() + 2 > std::numeric_limits<NodeIdType>::max())
+    {
+      std::stringstream ss;
+      ss << "Image with " << region.GetNumberOfPixels() << " pixels has too many pixels for "
+         << 8 * sizeof(NodeIdType) << " bit node ids! Build with ImageGraphCut_USE_64BIT_NODE_IDS.";
+      throw std::runtime_error(ss.str());
+    }
 
     // Blank the output image
     ITKHelpers::SetImageToConstant(this->ResultingSegments.GetPointer(),
                                    ForegroundBackgroundSegmentMaskPixelTypeEnum::BACKGROUND);
 
+    // Remove the edges left over from a previous segmentation. Without this the
+    // edges of every call would accumulate in the same graph.
+    // There is one node per pixel plus the source and sink nodes.
+    this->ResetGraph(region.GetNumberOfPixels() + 2);
+
+    // The node id of each pixel is its linear offset in the image buffer (see GetNodeId()),
+    // so the pixel nodes are 0 to (number of pixels - 1).
+    // Set the sink and source ids to be the two numbers immediately following the number of vertices in the grid
+    this->SinkNodeId = region.GetNumberOfPixels();
+    this->SourceNodeId = region.GetNumberOfPixels() + 1;
+
+    // The histograms of a model are of pixels in its color space.
+    if(this->Model && !this->CustomLikelihood && this->Model->GetColorSpace() != this->SegmentationColorSpace)
+    {
+      std::stringstream ss;
+      ss << "The model was trained in " << ColorSpaceConverter::GetColorSpaceName(this->Model->GetColorSpace())
+         << " but the segmentation is in " << ColorSpaceConverter::GetColorSpaceName(this->SegmentationColorSpace)
+         << "!";
+      throw std::runtime_error(ss.str());
+    }
+
+    // The edge map is indexed by node id, like the image.
+    if(this->EdgeMap && this->EdgeMap->GetLargestPossibleRegion() != region)
+    {
+      std::stringstream ss;
+      ss << "The edge map has size " << this->EdgeMap->GetLargestPossibleRegion().GetSize()
+         << " but the image has size " << region.GetSize() << "!";
+      throw std::runtime_error(ss.str());
+    }
+
+    this->ComputeSeedLabels();
+}
+
+template <typename TImage, typename TPixelDifferenceFunctor>
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::ComputeSeedLabels()
+{
+  itk::ImageRegion<2> region = this->Image->GetLargestPossibleRegion();
+  const std::size_t numberOfPixels = region.GetNumberOfPixels();
+
+  // assign() keeps the storage, so this does not reallocate for same size images.
+  this->SeedLabels.assign(numberOfPixels, SeedLabel::NONE);
+  SeedLabel* const seedLabels = this->SeedLabels.data();
+
+  const ForegroundBackgroundSegmentMask* const masks[2] = {this->SinkSeedMask, this->SourceSeedMask};
+  const IndexContainer* const indexLists[2] = {&this->Sinks, &this->Sources};
+  const SeedLabel labels[2] = {SeedLabel::SINK, SeedLabel::SOURCE};
+
+  // The sources are labeled last, so a pixel that is selected as both is a source.
+  for(unsigned int seedType = 0; seedType < 2; ++seedType)
+  {
+    const SeedLabel label = labels[seedType];
+
+    for(std::size_t i = 0; i < indexLists[seedType]->size(); ++i)
+    {
+      const itk::Index<2>& index = (*indexLists[seedType])[i];
+      if(!region.IsInside(index))
+      {
+        std::stringstream ss;
+        ss << "Seed pixel " << index << " is outside of the image " << region << "!";
+        throw std::runtime_error(ss.str());
+      }
+      seedLabels[this->GetNodeId(index)] = label;
+    }
+
+    const ForegroundBackgroundSegmentMask* const mask = masks[seedType];
+    if(!mask)
+    {
+      continue;
+    }
+
+    if(mask->GetLargestPossibleRegion() != region)
+    {
+      std::stringstream ss;
+      ss << "Seed mask " << mask->GetLargestPossibleRegion() << " must be the same size as the image "
+         << region << "!";
+      throw std::runtime_error(ss.str());
+    }
+
+    const ForegroundBackgroundSegmentMaskPixelTypeEnum* const maskBuffer = mask->GetBufferPointer();
+    ParallelFor(0, numberOfPixels,
+                [maskBuffer, seedLabels, label](const std::size_t begin, const std::size_t end)
+                {
+                  for(std::size_t i = begin; i < end; ++i)
+                  {
+                    if(maskBuffer[i] == ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND)
+                    {
+                      seedLabels[i] = label;
+                    }
+                  }
+                }, this->NumberOfThreadsInUse);
+  }
+
+  // Count the seeds in a single pass over the labels.
+  std::atomic<std::size_t> numberOfSourcePixels(0);
+  std::atomic<std::size_t> numberOfSinkPixels(0);
+  ParallelFor(0, numberOfPixels,
+              [seedLabels, &numberOfSourcePixels, &numberOfSinkPixels](const std::size_t begin, const std::size_t end)
+              {
+                std::size_t sources = 0;
+                std::size_t sinks = 0;
+                for(std::size_t i = begin; i < end; ++i)
+                {
+                  sources += (seedLabels[i] == SeedLabel::SOURCE);
+                  sinks += (seedLabels[i] == SeedLabel::SINK);
+                }
+                numberOfSourcePixels += sources;
+                numberOfSinkPixels += sinks;
+              }, this->NumberOfThreadsInUse);
+
+  this->NumberOfSourcePixels = numberOfSourcePixels;
+  this->NumberOfSinkPixels = numberOfSinkPixels;
+}
+
+template <typename TImage, typename TPixelDifferenceFunctor>
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::ResetGraph(const VertexIndex numberOfVertices)
+{
+  if(num_vertices(this->Graph) != numberOfVertices)
+  {
+    this->Graph = GraphType(numberOfVertices);
+    return;
+  }
+
+  // clear_out_edges() empties each out-edge vector without releasing its storage,
+  // so rebuilding a graph of the same size does not grow these vectors again.
+  for(VertexIndex vertex = 0; vertex < numberOfVertices; ++vertex)
+  {
+    clear_out_edges(vertex, this->Graph);
+  }
+}
+
+template <typename TImage, typename TPixelDifferenceFunctor>
+template <typename TCapacity>
+TCapacity ImageGraphCut<TImage, TPixelDifferenceFunctor>::ComputeMaxFlow(std::vector<TCapacity>& edgeWeights,
+                                                                         std::vector<TCapacity>& residualCapacity)
+{
+  // These keep their capacity between calls, so assign() does not reallocate for same size images.
+  this->Groups.assign(num_vertices(this->Graph), 0);
+  residualCapacity.assign(num_edges(this->Graph), 0); //this needs to be initialized to 0
+
+  ScopedStageTimer timer(this->Statistics, SegmentationStatistics::MAX_FLOW);
+  this->CheckProgress(SegmentationStatistics::MAX_FLOW, 0);
+
+  auto groupMap = boost::make_iterator_property_map(this->Groups.data(), get(boost::vertex_index, this->Graph));
+  if(!this->Progress)
+  {
+    return this->SolveMaxFlow(edgeWeights, residualCapacity, groupMap);
+  }
+
+  // The solver changes the group of a vertex whenever it grows or repairs its search trees, so counting these
+  // changes checks the progress without slowing down the solver.
+  std::size_t numberOfGroupChanges = 0;
+  ProgressPropertyMap<decltype(groupMap)> progressGroupMap(groupMap, this->Progress, SegmentationStatistics::MAX_FLOW,
+                                                           ProgressSteps, &numberOfGroupChanges);
+  return this->SolveMaxFlow(edgeWeights, residualCapacity, progressGroupMap);
+}
+
+template <typename TImage, typename TPixelDifferenceFunctor>
+template <typename TCapacity, typename TGroupMap>
+TCapacity ImageGraphCut<TImage, TPixelDifferenceFunctor>::SolveMaxFlow(std::vector<TCapacity>& edgeWeights,
+                                                                       std::vector<TCapacity>& residualCapacity,
+                                                                       TGroupMap groupMap)
+{
+  // data() rather than &v[0], because a fully reduced graph has no edges.
+  return boykov_kolmogorov_max_flow(this->Graph,
+          boost::make_iterator_property_map(edgeWeights.data(), get(boost::edge_index, this->Graph)),
+          boost::make_iterator_property_map(residualCapacity.data(), get(boost::edge_index, this->Graph)),
+          boost::make_iterator_property_map(this->ReverseEdges.data(), get(boost::edge_index, this->Graph)),
+          groupMap,
+          get(boost::vertex_index, this->Graph),
+          vertex(this->SourceNodeId, this->Graph),
+          vertex(this->SinkNodeId, this->Graph));
+}
+
+template <typename TImage, typename TPixelDifferenceFunctor>
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::CheckProgress(const SegmentationStatistics::Stage stage,
+                                                                   const double fraction) const
+{
+  if(this->Progress)
+  {
+    this->Progress->Report(stage, fraction);
+  }
+}
+
+template <typename TImage, typename TPixelDifferenceFunctor>
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::CheckProgressAtRow(const SegmentationStatistics::Stage stage,
+                                                                        const std::size_t nodeId) const
+{
+  if(!this->Progress)
+  {
+    return;
+  }
+
+  const itk::ImageRegion<2> region = this->Image->GetLargestPossibleRegion();
+  if(nodeId % (ProgressRows * region.GetSize()[0]) == 0)
+  {
+    this->Progress->Report(stage, nodeId / static_cast<double>(region.GetNumberOfPixels()));
+  }
 }
 
 template <typename TImage, typename TPixelDifferenceFunctor>
 void ImageGraphCut<TImage, TPixelDifferenceFunctor>::CutGraph()
 {
   // Compute mininum cut
-  std::cout << "CutGraph()..." << std::endl;
-  boost::graph_traits<GraphType>::vertex_descriptor s = vertex(this->SourceNodeId, this->Graph);
-  boost::graph_traits<GraphType>::vertex_descriptor t = vertex(this->SinkNodeId, this->Graph);
-
-  std::vector<int> groups(num_vertices(this->Graph));
-  std::vector<float> residual_capacity(num_edges(this->Graph)); //this needs to be initialized to 0
-
-  boykov_kolmogorov_max_flow(this->Graph,
-          boost::make_iterator_property_map(&EdgeWeights[0], get(boost::edge_index, this->Graph)),
-          boost::make_iterator_property_map(&residual_capacity[0], get(boost::edge_index, this->Graph)),
-          boost::make_iterator_property_map(&ReverseEdges[0], get(boost::edge_index, this->Graph)),
-          boost::make_iterator_property_map(&groups[0], get(boost::vertex_index, this->Graph)),
-          get(boost::vertex_index, this->Graph),
-          s,
-          t);
+  double flowValue;
+  if(this->IntegerCapacities)
+  {
+    this->FitIntegerCapacities();
+    flowValue = this->ComputeMaxFlow(this->IntegerEdgeWeights, this->IntegerResidualCapacity) /
+                this->SolverCapacityScale;
+  }
+  else
+  {
+    flowValue = this->ComputeMaxFlow(this->EdgeWeights, this->ResidualCapacity);
+  }
+
+  {
+    ScopedStageTimer timer(this->Statistics, SegmentationStatistics::EXTRACT_MASK);
+    this->ExtractSegmentMask();
+  }
+
+  ScopedStageTimer timer(this->Statistics, SegmentationStatistics::COMPUTE_ENERGY);
+  this->ComputeEnergy(flowValue);
+}
+
+template <typename TImage, typename TPixelDifferenceFunctor>
+template <typename TFunctor>
+typename ImageGraphCut<TImage, TPixelDifferenceFunctor>::CutSums
+ImageGraphCut<TImage, TPixelDifferenceFunctor>::SumPixelBlocks(TFunctor functor) const
+{
+  // The blocks are the same for any number of threads, and ParallelFor() never splits one (it is the grain).
+  const std::size_t blockSize = 1 << 14;
+  const std::size_t numberOfPixels = this->Image->GetLargestPossibleRegion().GetNumberOfPixels();
+  std::vector<CutSums> blockSums((numberOfPixels + blockSize - 1) / blockSize);
+  CutSums* const sums = blockSums.data();
+
+  ParallelFor(0, numberOfPixels,
+              [&functor, sums](const std::size_t begin, const std::size_t end)
+              {
+                for(std::size_t blockBegin = begin; blockBegin < end; blockBegin += blockSize)
+                {
+                  functor(blockBegin, std::min(end, blockBegin + blockSize), sums[blockBegin / blockSize]);
+                }
+              }, this->NumberOfThreadsInUse, blockSize);
+
+  CutSums total;
+  for(const CutSums& blockSum : blockSums)
+  {
+    total.TLinks += blockSum.TLinks;
+    total.NLinks += blockSum.NLinks;
+    total.NumberOfUnsaturatedEdges += blockSum.NumberOfUnsaturatedEdges;
+  }
+  return total;
+}
+
+template <typename TImage, typename TPixelDifferenceFunctor>
+template <typename TCapacity>
+typename ImageGraphCut<TImage, TPixelDifferenceFunctor>::CutSums
+ImageGraphCut<TImage, TPixelDifferenceFunctor>::SumCut(const std::vector<TCapacity>& edgeWeights,
+                                                       const std::vector<TCapacity>& residualCapacity) const
+{
+  // Every cut edge is summed once, from its pixel end: the edges out of a source side pixel, and the t-link into
+  // a sink side pixel from the source. The n-links into a sink side pixel are summed from their other end.
+  const int sourceGroup = this->Groups[this->SourceNodeId];
+  const NodeIdType numberOfPixels = this->Image->GetLargestPossibleRegion().GetNumberOfPixels();
+
+  return this->SumPixelBlocks([this, &edgeWeights, &residualCapacity, sourceGroup, numberOfPixels]
+                              (const std::size_t begin, const std::size_t end, CutSums& sums)
+                              {
+                                typename boost::graph_traits<GraphType>::out_edge_iterator edge, edgeEnd;
+                                for(std::size_t nodeId = begin; nodeId < end; ++nodeId)
+                                {
+                                  const bool sourceSide = this->Groups[nodeId] == sourceGroup;
+                                  for(boost::tie(edge, edgeEnd) = out_edges(nodeId, this->Graph);
+                                      edge != edgeEnd; ++edge)
+                                  {
+                                    const NodeIdType target = boost::target(*edge, this->Graph);
+                                    EdgeIndex edgeId = get(boost::edge_index, this->Graph, *edge);
+                                    if(!sourceSide && target == this->SourceNodeId)
+                                    {
+                                      edgeId = get(boost::edge_index, this->Graph, this->ReverseEdges[edgeId]);
+                                    }
+                                    else if(!sourceSide || this->Groups[target] == sourceGroup)
+                                    {
+                                      continue;
+                                    }
+
+                                    if(target >= numberOfPixels)
+                                    {
+                                      sums.TLinks += edgeWeights[edgeId];
+                                    }
+                                    else
+                                    {
+                                      sums.NLinks += edgeWeights[edgeId];
+                                    }
+
+                                    if(residualCapacity[edgeId] > 0)
+                                    {
+                                      sums.NumberOfUnsaturatedEdges++;
+                                    }
+                                  }
+                                }
+                              });
+}
+
+template <typename TImage, typename TPixelDifferenceFunctor>
+typename ImageGraphCut<TImage, TPixelDifferenceFunctor>::CutSums
+ImageGraphCut<TImage, TPixelDifferenceFunctor>::SumReducedEnergy() const
+{
+  // The groups of the labeled pixels were set by ExtractSegmentMask(), so every pixel has its final label here.
+  const int sourceGroup = this->Groups[this->SourceNodeId];
+  const std::size_t width = this->Image->GetLargestPossibleRegion().GetSize()[0];
+  const std::size_t numberOfPixels = this->Image->GetLargestPossibleRegion().GetNumberOfPixels();
+
+  CutSums energy = this->SumPixelBlocks([this, sourceGroup, width, numberOfPixels]
+                                        (const std::size_t begin, const std::size_t end, CutSums& sums)
+                                        {
+                                          for(std::size_t nodeId = begin; nodeId < end; ++nodeId)
+                                          {
+                                            const bool sourceSide = this->Groups[nodeId] == sourceGroup;
+                                            if(this->SeedLabels[nodeId] == SeedLabel::NONE)
+                                            {
+                                              // The part of the t-link that is not in DataEnergyOffset
+                                              const float weight = this->TLinkWeights[nodeId];
+                                              sums.TLinks += std::max(0.0f, sourceSide ? -weight : weight);
+                                            }
+
+                                            if(nodeId % width + 1 < width &&
+                                               (this->Groups[nodeId + 1] == sourceGroup) != sourceSide)
+                                            {
+                                              sums.NLinks += this->RightWeights[nodeId];
+                                            }
+                                            if(nodeId + width < numberOfPixels &&
+                                               (this->Groups[nodeId + width] == sourceGroup) != sourceSide)
+                                            {
+                                              sums.NLinks += this->BottomWeights[nodeId];
+                                            }
+                                          }
+                                        });
+
+  energy.TLinks += this->DataEnergyOffset;
+  return energy;
+}
+
+template <typename TImage, typename TPixelDifferenceFunctor>
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::ComputeEnergy(const double flowValue)
+{
+  // The capacities of the solved graph are in units of 1 / scale of edge weight.
+  const double scale = this->IntegerCapacities ? this->SolverCapacityScale : 1;
+
+  CutSums cut;
+  if(!this->GraphIsReduced || this->CutVerification)
+  {
+    cut = this->IntegerCapacities ? this->SumCut(this->IntegerEdgeWeights, this->IntegerResidualCapacity) :
+                                    this->SumCut(this->EdgeWeights, this->ResidualCapacity);
+  }
 
-  std::cout << "Finished max_flow()." << std::endl;
+  this->Statistics.FlowValue = flowValue;
+  if(this->GraphIsReduced)
+  {
+    // The reduced graph leaves out part of the energy, so it is computed from the weights instead.
+    const CutSums energy = this->SumReducedEnergy();
+    this->Statistics.DataEnergy = energy.TLinks;
+    this->Statistics.SmoothnessEnergy = energy.NLinks;
+  }
+  else
+  {
+    this->Statistics.DataEnergy = cut.TLinks / scale;
+    this->Statistics.SmoothnessEnergy = cut.NLinks / scale;
+  }
 
-  // Iterate over the node image, querying the graph object for the association of each pixel and storing them as the output mask
-  itk::ImageRegionConstIterator<NodeImageType>
-      nodeImageIterator(this->NodeImage, this->NodeImage->GetLargestPossibleRegion());
-  nodeImageIterator.GoToBegin();
+  if(this->CutVerification)
+  {
+    // The integer flow is exact, the float flow is a sum of many rounded augmentations.
+    const double cutCapacity = cut.TLinks + cut.NLinks;
+    const double tolerance = this->IntegerCapacities ? 0.5 : 1e-4 * std::max(1.0, cutCapacity);
+    const bool verified = cut.NumberOfUnsaturatedEdges == 0 &&
+                          std::abs(cutCapacity - flowValue * scale) <= tolerance;
+
+    this->Statistics.CutCapacity = cutCapacity / scale;
+    this->Statistics.NumberOfUnsaturatedCutEdges = cut.NumberOfUnsaturatedEdges;
+    this->Statistics.CutVerification = verified ? SegmentationStatistics::VERIFIED : SegmentationStatistics::FAILED;
+  }
+}
 
+template <typename TImage, typename TPixelDifferenceFunctor>
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::ExtractSegmentMask()
+{
   // From the documentation:
   // http://www.boost.org/doc/libs/1_55_0/libs/graph/doc/boykov_kolmogorov_max_flow.html
   // If the color of a vertex after running the algorithm is black the vertex belongs to
   // the source tree else it belongs to the sink-tree (used for minimum cuts).
-  while(!nodeImageIterator.IsAtEnd())
+  // The node id of a pixel is its offset in the buffer, so the groups of the pixel nodes
+  // (the first numberOfPixels entries of Groups) map one to one onto the mask buffer.
+  static_assert(static_cast<int>(ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND) == 0 &&
+                static_cast<int>(ForegroundBackgroundSegmentMaskPixelTypeEnum::BACKGROUND) == 1,
+                "The mask extraction computes the pixel value as (group != source group).");
+
+  const std::size_t numberOfPixels = this->ResultingSegments->GetLargestPossibleRegion().GetNumberOfPixels();
+  const int sourceGroup = this->Groups[this->SourceNodeId];
+
+  if(this->GraphIsReduced)
+  {
+    // The pixels labeled by the graph reduction have no edges, so they get the group of their terminal here.
+    const int sinkGroup = this->Groups[this->SinkNodeId];
+    const SeedLabel* const fixedLabels = this->FixedLabels.data();
+    int* const groups = this->Groups.data();
+    ParallelFor(0, numberOfPixels,
+                [fixedLabels, groups, sourceGroup, sinkGroup](const std::size_t begin, const std::size_t end)
+                {
+                  for(std::size_t i = begin; i < end; ++i)
+                  {
+                    if(fixedLabels[i] == SeedLabel::SOURCE)
+                    {
+                      groups[i] = sourceGroup;
+                    }
+                    else if(fixedLabels[i] == SeedLabel::SINK)
+                    {
+                      groups[i] = sinkGroup;
+                    }
+                  }
+                }, this->NumberOfThreadsInUse);
+  }
+
+  const int* const groups = this->Groups.data();
+  ForegroundBackgroundSegmentMaskPixelTypeEnum* const maskBuffer = this->ResultingSegments->GetBufferPointer();
+
+  if(this->OutputBuffer)
+  {
+    unsigned char* const outputBuffer = this->OutputBuffer;
+    const unsigned char foregroundValue = this->OutputForegroundValue;
+    const unsigned char backgroundValue = this->OutputBackgroundValue;
+    ParallelFor(0, numberOfPixels,
+                [groups, sourceGroup, maskBuffer, outputBuffer, foregroundValue, backgroundValue]
+                (const std::size_t begin, const std::size_t end)
+                {
+                  for(std::size_t i = begin; i < end; ++i)
+                  {
+                    const bool isForeground = (groups[i] == sourceGroup);
+                    maskBuffer[i] = static_cast<ForegroundBackgroundSegmentMaskPixelTypeEnum>(!isForeground);
+                    outputBuffer[i] = isForeground ? foregroundValue : backgroundValue;
+                  }
+                }, this->NumberOfThreadsInUse);
+  }
+  else
+  {
+    // A branch free select over two linear arrays, which the compiler can vectorize.
+    ParallelFor(0, numberOfPixels,
+                [groups, sourceGroup, maskBuffer](const std::size_t begin, const std::size_t end)
+                {
+                  for(std::size_t i = begin; i < end; ++i)
+                  {
+                    maskBuffer[i] = static_cast<ForegroundBackgroundSegmentMaskPixelTypeEnum>(groups[i] != sourceGroup);
+                  }
+                }, this->NumberOfThreadsInUse);
+  }
+
+  if(!this->ComputePackedSegmentMask)
+  {
+    return;
+  }
+
+  // Each thread packs whole words, so no two threads write to the same word.
+  // SetRegion() only reallocates the words if the image grew.
+  this->PackedResultingSegments.SetRegion(this->ResultingSegments->GetLargestPossibleRegion());
+  std::uint64_t* const packedBuffer = this->PackedResultingSegments.GetWords();
+
+  ParallelFor(0, this->PackedResultingSegments.GetNumberOfWords(),
+              [groups, sourceGroup, packedBuffer, numberOfPixels](const std::size_t begin, const std::size_t end)
+              {
+                for(std::size_t word = begin; word < end; ++word)
+                {
+                  const std::size_t firstPixel = 64 * word;
+                  const std::size_t numberOfBits = std::min<std::size_t>(64, numberOfPixels - firstPixel);
+
+                  std::uint64_t bits = 0;
+                  for(std::size_t bit = 0; bit < numberOfBits; ++bit)
+                  {
+                    bits |= static_cast<std::uint64_t>(groups[firstPixel + bit] == sourceGroup) << bit;
+                  }
+                  packedBuffer[word] = bits;
+                }
+              }, this->NumberOfThreadsInUse);
+}
+
+template <typename TImage, typename TPixelDifferenceFunctor>
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::ResizeEdgeProperties(const EdgeIndex numberOfEdges)
+{
+  this->ReverseEdges.resize(numberOfEdges);
+
+  // The weights of the other mode are freed, so switching modes does not keep both.
+  if(this->IntegerCapacities)
+  {
+    this->IntegerEdgeWeights.resize(numberOfEdges);
+    std::vector<float>().swap(this->EdgeWeights);
+    std::vector<float>().swap(this->ResidualCapacity);
+  }
+  else
+  {
+    this->EdgeWeights.resize(numberOfEdges);
+    std::vector<IntegerCapacityType>().swap(this->IntegerEdgeWeights);
+    std::vector<IntegerCapacityType>().swap(this->IntegerResidualCapacity);
+  }
+}
+
+template <typename TImage, typename TPixelDifferenceFunctor>
+typename ImageGraphCut<TImage, TPixelDifferenceFunctor>::IntegerCapacityType
+ImageGraphCut<TImage, TPixelDifferenceFunctor>::QuantizeWeight(const NodeIdType source, const float weight) const
+{
+  // A residual capacity can grow to the capacity of an edge plus that of its reverse edge,
+  // so a single capacity is limited to half of the range.
+  const IntegerCapacityType maximumCapacity = std::numeric_limits<IntegerCapacityType>::max() / 2;
+
+  if(weight == std::numeric_limits<float>::max())
   {
-    if(groups[nodeImageIterator.Get()] == groups[this->SourceNodeId])
+    // An infinite (seed) t-link. The n-links of 'source' are already in the graph.
+    std::int64_t capacity = 1;
+    typename boost::graph_traits<GraphType>::out_edge_iterator edge, edgeEnd;
+    for(boost::tie(edge, edgeEnd) = out_edges(source, this->Graph); edge != edgeEnd; ++edge)
     {
-      this->ResultingSegments->SetPixel(nodeImageIterator.GetIndex(),
-                                        ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND);
+      capacity += this->IntegerEdgeWeights[get(boost::edge_index, this->Graph, *edge)];
     }
-    else
+    return static_cast<IntegerCapacityType>(std::min<std::int64_t>(capacity, maximumCapacity));
+  }
+
+  const double capacity = std::round(static_cast<double>(weight) * this->CapacityScale);
+  return static_cast<IntegerCapacityType>(std::min<double>(maximumCapacity, std::max(0.0, capacity)));
+}
+
+template <typename TImage, typename TPixelDifferenceFunctor>
+std::int64_t ImageGraphCut<TImage, TPixelDifferenceFunctor>::ComputeMaximumIntegerFlow() const
+{
+  // The flow is at most the capacity out of the source and at most the capacity into the sink (which is the
+  // capacity out of it, as every edge has a reverse edge with the same capacity).
+  std::int64_t terminalCapacities[2] = {0, 0};
+  const NodeIdType terminals[2] = {this->SourceNodeId, this->SinkNodeId};
+  for(unsigned int terminal = 0; terminal < 2; ++terminal)
+  {
+    typename boost::graph_traits<GraphType>::out_edge_iterator edge, edgeEnd;
+    for(boost::tie(edge, edgeEnd) = out_edges(terminals[terminal], this->Graph); edge != edgeEnd; ++edge)
+    {
+      terminalCapacities[terminal] += this->IntegerEdgeWeights[get(boost::edge_index, this->Graph, *edge)];
+    }
+  }
+
+  return std::min(terminalCapacities[0], terminalCapacities[1]);
+}
+
+template <typename TImage, typename TPixelDifferenceFunctor>
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::FitIntegerCapacities()
+{
+  // The solver accumulates the flow in IntegerCapacityType.
+  this->SolverCapacityScale = this->CapacityScale;
+  const std::int64_t maximumFlow = this->ComputeMaximumIntegerFlow();
+  const std::int64_t maximumCapacity = std::numeric_limits<IntegerCapacityType>::max();
+  if(maximumFlow <= maximumCapacity)
+  {
+    this->Statistics.CapacityScale = this->SolverCapacityScale;
+    return;
+  }
+
+  // Scale every capacity by 'factor' < 1. Rounding adds at most 0.5 to a t-link, and the seed t-links, which are
+  // recomputed from the rounded n-links below, grow by at most 3 more than the scaled value, so the flow is at most
+  // factor * maximumFlow + 3 * (the number of t-links).
+  const std::int64_t numberOfTLinks = out_degree(this->SourceNodeId, this->Graph) +
+                                      out_degree(this->SinkNodeId, this->Graph);
+  const double factor = static_cast<double>(maximumCapacity - 3 * numberOfTLinks) / maximumFlow;
+  if(factor > 0)
+  {
+    this->SolverCapacityScale = this->CapacityScale * factor;
+    for(IntegerCapacityType& capacity : this->IntegerEdgeWeights)
     {
-      this->ResultingSegments->SetPixel(nodeImageIterator.GetIndex(),
-                                        ForegroundBackgroundSegmentMaskPixelTypeEnum::BACKGROUND);
+      capacity = static_cast<IntegerCapacityType>(std::round(capacity * factor));
+    }
+
+    // A seed t-link must stay larger than the sum of the n-links of its pixel (see QuantizeWeight()).
+    if(!this->GraphIsReduced)
+    {
+      for(NodeIdType nodeId = 0; nodeId < this->SeedLabels.size(); ++nodeId)
+      {
+        if(this->SeedLabels[nodeId] == SeedLabel::NONE)
+        {
+          continue;
+        }
+
+        const NodeIdType terminal = this->SeedLabels[nodeId] == SeedLabel::SOURCE ? this->SourceNodeId :
+                                                                                     this->SinkNodeId;
+        std::int64_t capacity = 1;
+        typename boost::graph_traits<GraphType>::out_edge_iterator edge, edgeEnd;
+        for(boost::tie(edge, edgeEnd) = out_edges(nodeId, this->Graph); edge != edgeEnd; ++edge)
+        {
+          if(target(*edge, this->Graph) < this->SinkNodeId)
+          {
+            capacity += this->IntegerEdgeWeights[get(boost::edge_index, this->Graph, *edge)];
+          }
+        }
+
+        const std::pair<EdgeDescriptor, bool> tLink = boost::edge(nodeId, terminal, this->Graph);
+        if(tLink.second)
+        {
+          const IntegerCapacityType tLinkCapacity =
+              static_cast<IntegerCapacityType>(std::min<std::int64_t>(capacity, maximumCapacity / 2));
+          this->IntegerEdgeWeights[get(boost::edge_index, this->Graph, tLink.first)] = tLinkCapacity;
+          this->IntegerEdgeWeights[get(boost::edge_index, this->Graph, this->ReverseEdges[
+              get(boost::edge_index, this->Graph, tLink.first)])] = tLinkCapacity;
+        }
+      }
     }
-    ++nodeImageIterator;
   }
 
-  std::cout << "Finished CutGraph()." << std::endl;
+  const std::int64_t scaledMaximumFlow = this->ComputeMaximumIntegerFlow();
+  if(factor <= 0 || scaledMaximumFlow > maximumCapacity)
+  {
+    std::stringstream ss;
+    ss << "The flow can reach " << maximumFlow << ", which does not fit in the integer capacities at any "
+       << "capacity scale! Use float capacities.";
+    throw std::runtime_error(ss.str());
+  }
+
+  this->Statistics.CapacityScale = this->SolverCapacityScale;
+  if(this->Verbosity >= 2)
+  {
+    std::cout << "The flow can reach " << maximumFlow << " at capacity scale " << this->CapacityScale
+              << ", so the capacities were scaled to " << this->SolverCapacityScale << "." << std::endl;
+  }
 }
 
-// This function assumes that the ReverseEdges and EdgeWeights members are already large enough to accept the
-// new data (otherwise we would have to push_back/resize millions of times).
+// This function assumes that the ReverseEdges and EdgeWeights (or IntegerEdgeWeights) members are already large
+// enough to accept the new data (otherwise we would have to push_back/resize millions of times).
 template <typename TImage, typename TPixelDifferenceFunctor>
-unsigned int ImageGraphCut<TImage, TPixelDifferenceFunctor>::
-AddBidirectionalEdge(unsigned int numberOfEdges, const unsigned int source, const unsigned int target, const float weight)
+typename ImageGraphCut<TImage, TPixelDifferenceFunctor>::EdgeIndex ImageGraphCut<TImage, TPixelDifferenceFunctor>::
+AddBidirectionalEdge(EdgeIndex numberOfEdges, const NodeIdType source, const NodeIdType target, const float weight)
 {
     // skip "edge already exists check" if the node ids are too high (because it segfaults)
     if(source < num_vertices(this->Graph)+1 && target < num_vertices(this->Graph)+1)
@@ -145,7 +738,7 @@ AddBidirectionalEdge(unsigned int numberOfEdges, const unsigned int source, cons
     // then add the reverseEdge as the corresponding reverse edge to 'edge', and then add 'edge'
     // as the corresponding reverse edge to 'reverseEdge'
 //    int nextEdgeId = num_edges(this->Graph); // Calling this every time is VERY slow
-    int nextEdgeId = numberOfEdges;
+    EdgeIndex nextEdgeId = numberOfEdges;
 
     EdgeDescriptor edge;
     bool inserted;
@@ -153,7 +746,10 @@ AddBidirectionalEdge(unsigned int numberOfEdges, const unsigned int source, cons
     boost::tie(edge,inserted) = add_edge(source, target, nextEdgeId, this->Graph);
     if(!inserted)
     {
-        std::cerr << "Not inserted!" << std::endl;
+        if(this->Verbosity >= 2)
+        {
+          std::cerr << "Not inserted!" << std::endl;
+        }
         return numberOfEdges;
     }
 
@@ -161,33 +757,397 @@ AddBidirectionalEdge(unsigned int numberOfEdges, const unsigned int source, cons
 
     this->ReverseEdges[nextEdgeId] = reverseEdge;
     this->ReverseEdges[nextEdgeId + 1] = edge;
-    this->EdgeWeights[nextEdgeId] = weight;
-    this->EdgeWeights[nextEdgeId + 1] = weight;
+    if(this->IntegerCapacities)
+    {
+      // The new edge is already an out-edge of 'source', so its stale capacity must not be summed for a seed t-link.
+      this->IntegerEdgeWeights[nextEdgeId] = 0;
+      this->IntegerEdgeWeights[nextEdgeId] = this->QuantizeWeight(source, weight);
+      this->IntegerEdgeWeights[nextEdgeId + 1] = this->IntegerEdgeWeights[nextEdgeId];
+    }
+    else
+    {
+      this->EdgeWeights[nextEdgeId] = weight;
+      this->EdgeWeights[nextEdgeId + 1] = weight;
+    }
 
     return numberOfEdges + 2;
 }
 
 template <typename TImage, typename TPixelDifferenceFunctor>
 void ImageGraphCut<TImage, TPixelDifferenceFunctor>::PerformSegmentation()
+{
+  this->PerformSegmentationWithThreads(this->NumberOfThreads);
+}
+
+template <typename TImage, typename TPixelDifferenceFunctor>
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::PerformSegmentationWithThreads(const unsigned int numberOfThreads)
 {
   // This function performs some initializations and then creates and cuts the graph
+  this->NumberOfThreadsInUse = numberOfThreads;
+  this->Statistics.Reset();
+  this->BandLabels.clear();
+  this->CheckProgress(SegmentationStatistics::INITIALIZE, 0);
 
+  {
+  ScopedStageTimer timer(this->Statistics, SegmentationStatistics::INITIALIZE);
   this->Initialize();
+  }
+
+  ScopedImage convertedImage(this->Image, this->ConvertColorSpace());
+
+  // Compute the histograms of the selected foreground and background pixels
+  this->ComputeHistograms();
 
   this->CreateGraph();
   this->CutGraph();
+
+  this->FinishStatistics();
+}
+
+template <typename TImage, typename TPixelDifferenceFunctor>
+bool ImageGraphCut<TImage, TPixelDifferenceFunctor>::PerformSegmentation(
+    const std::chrono::steady_clock::time_point& deadline)
+{
+  // The predicted times are multiplied by this, because the time of the max flow grows faster than the graph.
+  const double safetyFactor = 2;
+
+  const std::size_t numberOfPixels = this->Image->GetLargestPossibleRegion().GetNumberOfPixels();
+  const unsigned int factor =
+      static_cast<unsigned int>(std::ceil(std::sqrt(numberOfPixels / static_cast<double>(CoarseNumberOfPixels))));
+  if(factor < 2)
+  {
+    this->PerformSegmentation();
+    return true;
+  }
+
+  this->NumberOfThreadsInUse = this->NumberOfThreads;
+  this->Statistics.Reset();
+  this->Statistics.Exact = false;
+  this->BandLabels.clear();
+  this->CheckProgress(SegmentationStatistics::INITIALIZE, 0);
+
+  {
+  ScopedStageTimer timer(this->Statistics, SegmentationStatistics::INITIALIZE);
+  this->Initialize();
+  }
+
+  // The coarse image is subsampled from the converted image, so the coarse segmentation stays in RGB mode.
+  ScopedImage convertedImage(this->Image, this->ConvertColorSpace());
+
+  // The coarse segmentation uses the likelihoods of the full image, so the histograms are needed first.
+  this->ComputeHistograms();
+
+  std::vector<unsigned char> coarseLabels;
+  itk::Size<2> coarseSize;
+  SegmentationStatistics coarseStatistics;
+  {
+    ScopedStageTimer timer(this->Statistics, SegmentationStatistics::COARSE_SEGMENTATION);
+    coarseStatistics = this->SegmentCoarse(factor, coarseLabels, coarseSize);
+  }
+
+  // Everything but the max flow takes about the same time per pixel at any scale.
+  const double flowSecondsPerPixel =
+      coarseStatistics.Stages[SegmentationStatistics::MAX_FLOW].WallSeconds / coarseStatistics.NumberOfPixels;
+  const double otherSecondsPerPixel =
+      coarseStatistics.Total.WallSeconds / coarseStatistics.NumberOfPixels - flowSecondsPerPixel;
+  const double remainingSeconds =
+      std::chrono::duration<double>(deadline - std::chrono::steady_clock::now()).count();
+
+  const double exactSeconds = safetyFactor * (otherSecondsPerPixel + flowSecondsPerPixel) * numberOfPixels;
+  const bool exact = this->ForcedDeadlineCut == DeadlineCut::PREDICTED ? exactSeconds <= remainingSeconds :
+                                                                         this->ForcedDeadlineCut == DeadlineCut::EXACT;
+  if(exact)
+  {
+    this->CreateGraph();
+    this->CutGraph();
+    this->Statistics.Exact = true;
+  }
+  else
+  {
+    const std::size_t numberOfBandPixels = this->ComputeBandLabels(factor, coarseLabels, coarseSize);
+    const double bandSeconds = safetyFactor * (otherSecondsPerPixel * numberOfPixels +
+                                               flowSecondsPerPixel * numberOfBandPixels);
+    const bool band = this->ForcedDeadlineCut == DeadlineCut::PREDICTED ? bandSeconds <= remainingSeconds :
+                                                                          this->ForcedDeadlineCut == DeadlineCut::BAND;
+    if(band)
+    {
+      this->CreateGraph();
+      this->CutGraph();
+    }
+    else
+    {
+      // Groups holds the upsampled coarse labels.
+      this->GraphIsReduced = false;
+      ScopedStageTimer timer(this->Statistics, SegmentationStatistics::EXTRACT_MASK);
+      this->ExtractSegmentMask();
+    }
+    this->BandLabels.clear();
+  }
+
+  if(this->Verbosity >= 2)
+  {
+    std::cout << "Segmentation with a deadline: coarse scale 1/" << factor << " in "
+              << coarseStatistics.Total.WallSeconds << " s, predicted exact cut " << exactSeconds
+              << " s, remaining " << remainingSeconds << " s." << std::endl;
+  }
+
+  this->FinishStatistics();
+  return this->Statistics.Exact;
+}
+
+template <typename TImage, typename TPixelDifferenceFunctor>
+std::future<ForegroundBackgroundSegmentMask::Pointer>
+ImageGraphCut<TImage, TPixelDifferenceFunctor>::PerformSegmentationAsync(SegmentationExecutor& executor)
+{
+  // The cores are shared by the tasks that the executor runs at the same time. The number of threads is
+  // captured by the task, so a later SetNumberOfThreads() does not race with the segmentation.
+  unsigned int numberOfThreads = this->NumberOfThreads;
+  if(numberOfThreads == 0)
+  {
+    numberOfThreads = std::max(1u, GetNumberOfThreadsToUse(0) / std::max(1u, executor.GetNumberOfConcurrentTasks()));
+  }
+
+  // The executor takes copyable tasks, so the packaged task is shared.
+  typedef std::packaged_task<ForegroundBackgroundSegmentMask::Pointer ()> SegmentationTaskType;
+  std::shared_ptr<SegmentationTaskType> task = std::make_shared<SegmentationTaskType>(
+    [this, numberOfThreads]()
+    {
+      this->PerformSegmentationWithThreads(numberOfThreads);
+
+      // The result must outlive the next segmentation of this object, which overwrites ResultingSegments.
+      ForegroundBackgroundSegmentMask::Pointer result = ForegroundBackgroundSegmentMask::New();
+      ITKHelpers::DeepCopy(this->ResultingSegments.GetPointer(), result.GetPointer());
+      return result;
+    });
+
+  std::future<ForegroundBackgroundSegmentMask::Pointer> result = task->get_future();
+  executor.Submit([task](){ (*task)(); });
+  return result;
+}
+
+template <typename TImage, typename TPixelDifferenceFunctor>
+SegmentationStatistics ImageGraphCut<TImage, TPixelDifferenceFunctor>::SegmentCoarse(
+    const unsigned int factor, std::vector<unsigned char>& coarseLabels, itk::Size<2>& coarseSize)
+{
+  const itk::ImageRegion<2> region = this->Image->GetLargestPossibleRegion();
+  const itk::Size<2> size = region.GetSize();
+  const std::size_t width = size[0];
+  const std::size_t numberOfPixels = region.GetNumberOfPixels();
+
+  coarseSize[0] = (size[0] + factor - 1) / factor;
+  coarseSize[1] = (size[1] + factor - 1) / factor;
+  const std::size_t coarseWidth = coarseSize[0];
+  itk::Index<2> corner = {{0,0}};
+  const itk::ImageRegion<2> coarseRegion(corner, coarseSize);
+
+  // The coarse image is the pixels at the centers of the factor x factor blocks.
+  typename TImage::Pointer coarseImage = TImage::New();
+  coarseImage->SetRegions(coarseRegion);
+  coarseImage->SetNumberOfComponentsPerPixel(this->Image->GetNumberOfComponentsPerPixel());
+  coarseImage->Allocate();
+
+  itk::ImageRegionIteratorWithIndex<TImage> coarseIterator(coarseImage, coarseRegion);
+  for(coarseIterator.GoToBegin(); !coarseIterator.IsAtEnd(); ++coarseIterator)
+  {
+    itk::Index<2> index;
+    for(unsigned int dimension = 0; dimension < 2; ++dimension)
+    {
+      const itk::IndexValueType offset = std::min<itk::IndexValueType>(
+          coarseIterator.GetIndex()[dimension] * factor + factor / 2, size[dimension] - 1);
+      index[dimension] = region.GetIndex()[dimension] + offset;
+    }
+    coarseIterator.Set(this->Image->GetPixel(index));
+  }
+
+  // A coarse pixel is a seed if its block contains a seed (a source if it contains both).
+  ForegroundBackgroundSegmentMask::Pointer coarseSeeds[2];
+  ForegroundBackgroundSegmentMaskPixelTypeEnum* coarseSeedBuffers[2];
+  for(unsigned int seedType = 0; seedType < 2; ++seedType)
+  {
+    coarseSeeds[seedType] = ForegroundBackgroundSegmentMask::New();
+    coarseSeeds[seedType]->SetRegions(coarseRegion);
+    coarseSeeds[seedType]->Allocate();
+    ITKHelpers::SetImageToConstant(coarseSeeds[seedType].GetPointer(),
+                                   ForegroundBackgroundSegmentMaskPixelTypeEnum::BACKGROUND);
+    coarseSeedBuffers[seedType] = coarseSeeds[seedType]->GetBufferPointer();
+  }
+
+  // The chunks are whole rows of blocks, so no two threads write the same coarse pixel.
+  const SeedLabel* const seedLabels = this->SeedLabels.data();
+  ParallelFor(0, numberOfPixels,
+              [seedLabels, &coarseSeedBuffers, width, coarseWidth, factor](const std::size_t begin,
+                                                                         const std::size_t end)
+              {
+                for(std::size_t nodeId = begin; nodeId < end; ++nodeId)
+                {
+                  if(seedLabels[nodeId] != SeedLabel::NONE)
+                  {
+                    const std::size_t coarseNodeId = (nodeId / width / factor) * coarseWidth +
+                                                     (nodeId % width) / factor;
+                    coarseSeedBuffers[seedLabels[nodeId] == SeedLabel::SOURCE ? 0 : 1][coarseNodeId] =
+                        ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND;
+                  }
+                }
+              }, this->NumberOfThreadsInUse, factor * width);
+
+  ImageGraphCut coarseGraphCut(this->PixelDifferenceFunctor);
+  coarseGraphCut.SetImageNoCopy(coarseImage);
+  coarseGraphCut.SetSeedsFromMasks(coarseSeeds[0], coarseSeeds[1]);
+  // A coarse pixel stands for factor^2 pixels but a coarse n-link for only 'factor' n-links.
+  coarseGraphCut.SetLambda(this->GetLambda() * factor);
+  coarseGraphCut.SetForegroundLikelihoodFunction(this->ForegroundLikelihood);
+  coarseGraphCut.SetBackgroundLikelihoodFunction(this->BackgroundLikelihood);
+  coarseGraphCut.SetNumberOfThreads(this->NumberOfThreadsInUse);
+  coarseGraphCut.SetIntegerCapacities(this->IntegerCapacities, this->CapacityScale);
+  coarseGraphCut.SetGraphReduction(this->GraphReduction);
+  coarseGraphCut.SetProgress(this->Progress);
+  coarseGraphCut.PerformSegmentation();
+
+  const ForegroundBackgroundSegmentMaskPixelTypeEnum* const coarseMask =
+      coarseGraphCut.GetSegmentMask()->GetBufferPointer();
+  coarseLabels.resize(coarseRegion.GetNumberOfPixels());
+  for(std::size_t coarseNodeId = 0; coarseNodeId < coarseLabels.size(); ++coarseNodeId)
+  {
+    coarseLabels[coarseNodeId] = coarseMask[coarseNodeId] == ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND;
+  }
+
+  // Upsample the coarse labels into the groups, as if the max flow had found them. The seeds keep their label.
+  const int sourceGroup = boost::color_traits<boost::default_color_type>::black();
+  const int sinkGroup = boost::color_traits<boost::default_color_type>::white();
+  this->Groups.assign(numberOfPixels + 2, sinkGroup);
+  this->Groups[this->SourceNodeId] = sourceGroup;
+
+  int* const groups = this->Groups.data();
+  const unsigned char* const labels = coarseLabels.data();
+  ParallelFor(0, numberOfPixels,
+              [seedLabels, groups, labels, width, coarseWidth, factor, sourceGroup, sinkGroup](
+                  const std::size_t begin, const std::size_t end)
+              {
+                for(std::size_t nodeId = begin; nodeId < end; ++nodeId)
+                {
+                  bool source = labels[(nodeId / width / factor) * coarseWidth + (nodeId % width) / factor];
+                  if(seedLabels[nodeId] != SeedLabel::NONE)
+                  {
+                    source = seedLabels[nodeId] == SeedLabel::SOURCE;
+                  }
+                  groups[nodeId] = source ? sourceGroup : sinkGroup;
+                }
+              }, this->NumberOfThreadsInUse);
+
+  return coarseGraphCut.GetStatistics();
+}
+
+template <typename TImage, typename TPixelDifferenceFunctor>
+std::size_t ImageGraphCut<TImage, TPixelDifferenceFunctor>::ComputeBandLabels(
+    const unsigned int factor, const std::vector<unsigned char>& coarseLabels, const itk::Size<2>& coarseSize)
+{
+  const std::size_t coarseWidth = coarseSize[0];
+  const std::size_t coarseHeight = coarseSize[1];
+
+  // Both coarse pixels of each coarse n-link between different labels are on the boundary.
+  std::vector<unsigned char> boundary(coarseLabels.size(), 0);
+  for(std::size_t y = 0; y < coarseHeight; ++y)
+  {
+    for(std::size_t x = 0; x < coarseWidth; ++x)
+    {
+      const std::size_t coarseNodeId = y * coarseWidth + x;
+      if(x + 1 < coarseWidth && coarseLabels[coarseNodeId + 1] != coarseLabels[coarseNodeId])
+      {
+        boundary[coarseNodeId] = boundary[coarseNodeId + 1] = 1;
+      }
+      if(y + 1 < coarseHeight && coarseLabels[coarseNodeId + coarseWidth] != coarseLabels[coarseNodeId])
+      {
+        boundary[coarseNodeId] = boundary[coarseNodeId + coarseWidth] = 1;
+      }
+    }
+  }
+
+  // The band is the boundary grown by one coarse pixel, so the refined boundary can move by a whole block.
+  std::vector<unsigned char> inBand(coarseLabels.size(), 0);
+  std::size_t numberOfBandPixels = 0;
+  for(std::size_t y = 0; y < coarseHeight; ++y)
+  {
+    for(std::size_t x = 0; x < coarseWidth; ++x)
+    {
+      for(std::size_t neighborY = (y > 0 ? y - 1 : 0); neighborY <= std::min(y + 1, coarseHeight - 1); ++neighborY)
+      {
+        for(std::size_t neighborX = (x > 0 ? x - 1 : 0); neighborX <= std::min(x + 1, coarseWidth - 1); ++neighborX)
+        {
+          inBand[y * coarseWidth + x] |= boundary[neighborY * coarseWidth + neighborX];
+        }
+      }
+      numberOfBandPixels += inBand[y * coarseWidth + x] * factor * factor;
+    }
+  }
+
+  const std::size_t width = this->Image->GetLargestPossibleRegion().GetSize()[0];
+  const std::size_t numberOfPixels = this->Image->GetLargestPossibleRegion().GetNumberOfPixels();
+  this->BandLabels.assign(numberOfPixels, SeedLabel::NONE);
+
+  SeedLabel* const bandLabels = this->BandLabels.data();
+  const unsigned char* const labels = coarseLabels.data();
+  const unsigned char* const band = inBand.data();
+  ParallelFor(0, numberOfPixels,
+              [bandLabels, labels, band, width, coarseWidth, factor](const std::size_t begin, const std::size_t end)
+              {
+                for(std::size_t nodeId = begin; nodeId < end; ++nodeId)
+                {
+                  const std::size_t coarseNodeId = (nodeId / width / factor) * coarseWidth + (nodeId % width) / factor;
+                  if(!band[coarseNodeId])
+                  {
+                    bandLabels[nodeId] = labels[coarseNodeId] ? SeedLabel::SOURCE : SeedLabel::SINK;
+                  }
+                }
+              }, this->NumberOfThreadsInUse);
+
+  return std::min(numberOfBandPixels, numberOfPixels);
+}
+
+template <typename TImage, typename TPixelDifferenceFunctor>
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::FinishStatistics()
+{
+  this->Statistics.NumberOfPixels = this->Image->GetLargestPossibleRegion().GetNumberOfPixels();
+  this->Statistics.NumberOfSourcePixels = this->NumberOfSourcePixels;
+  this->Statistics.NumberOfSinkPixels = this->NumberOfSinkPixels;
+  this->Statistics.NumberOfVertices = num_vertices(this->Graph);
+  this->Statistics.NumberOfEdges = num_edges(this->Graph);
+
+  if(this->Verbosity >= 1)
+  {
+    std::cout << "Segmented " << this->Statistics.NumberOfPixels << " pixels in "
+              << this->Statistics.Total.WallSeconds << " s" << (this->Statistics.Exact ? "" : " (approximate)") << ":";
+    for(unsigned int stage = 0; stage < SegmentationStatistics::NUMBER_OF_STAGES; ++stage)
+    {
+      std::cout << " " << SegmentationStatistics::GetStageName(static_cast<SegmentationStatistics::Stage>(stage))
+                << " " << this->Statistics.Stages[stage].WallSeconds << " s";
+    }
+    std::cout << std::endl;
+
+    std::cout << "Flow " << this->Statistics.FlowValue << ", energy "
+              << this->Statistics.DataEnergy + this->Statistics.SmoothnessEnergy << " (data "
+              << this->Statistics.DataEnergy << ", smoothness " << this->Statistics.SmoothnessEnergy << ")";
+    if(this->CutVerification)
+    {
+      std::cout << ", cut " << SegmentationStatistics::GetCutVerificationName(this->Statistics.CutVerification)
+                << " (capacity " << this->Statistics.CutCapacity << ", "
+                << this->Statistics.NumberOfUnsaturatedCutEdges << " unsaturated edges)";
+    }
+    std::cout << std::endl;
+  }
 }
 
 template <typename TImage, typename TPixelDifferenceFunctor>
 void ImageGraphCut<TImage, TPixelDifferenceFunctor>::CreateSamples()
 {
   // This function creates ITK samples from the scribbled pixels and then computes the foreground and background histograms
-  std::cout << "CreateSamples()" << std::endl;
 
   // Ensure at least one pixel has been specified for both the foreground and background
-  std::cout << "Currently there are " << this->Sources.size() << " sources and "
-            << this->Sinks.size() << " sinks." << std::endl;
-  if((this->Sources.size() <= 0) || (this->Sinks.size() <= 0))
+  if(this->Verbosity >= 2)
+  {
+    std::cout << "Currently there are " << this->NumberOfSourcePixels << " sources and "
+              << this->NumberOfSinkPixels << " sinks." << std::endl;
+  }
+  if((this->NumberOfSourcePixels == 0) || (this->NumberOfSinkPixels == 0))
   {
     std::cerr << "At least one source (foreground) pixel and one sink (background) "
                  "pixel must be specified!" << std::endl;
@@ -220,15 +1180,25 @@ void ImageGraphCut<TImage, TPixelDifferenceFunctor>::CreateSamples()
       histogramSize(numberOfComponentsPerPixel);
   histogramSize.Fill(this->NumberOfHistogramBins);
 
-  // Create foreground samples and histogram
+  // Create the foreground and background samples in one pass over the image.
+  // The image is traversed in buffer order, so the node id of the current pixel is a running counter.
   this->ForegroundSample->Clear();
   this->ForegroundSample->SetMeasurementVectorSize(numberOfComponentsPerPixel);
-  //std::cout << "Measurement vector size: " << this->ForegroundSample->GetMeasurementVectorSize() << std::endl;
-  //std::cout << "Pixel size: " << this->Image->GetPixel(this->Sources[0]).GetNumberOfElements() << std::endl;
-  
-  for(unsigned int i = 0; i < this->Sources.size(); i++)
+  this->BackgroundSample->Clear();
+  this->BackgroundSample->SetMeasurementVectorSize(numberOfComponentsPerPixel);
+
+  itk::ImageRegionConstIterator<TImage> imageIterator(this->Image, this->Image->GetLargestPossibleRegion());
+  NodeIdType nodeId = 0;
+  for(imageIterator.GoToBegin(); !imageIterator.IsAtEnd(); ++imageIterator, ++nodeId)
   {
-    this->ForegroundSample->PushBack(this->Image->GetPixel(this->Sources[i]));
+    if(this->SeedLabels[nodeId] == SeedLabel::SOURCE)
+    {
+      this->ForegroundSample->PushBack(imageIterator.Get());
+    }
+    else if(this->SeedLabels[nodeId] == SeedLabel::SINK)
+    {
+      this->BackgroundSample->PushBack(imageIterator.Get());
+    }
   }
 
   this->ForegroundHistogramFilter->SetHistogramSize(histogramSize);
@@ -239,363 +1209,836 @@ void ImageGraphCut<TImage, TPixelDifferenceFunctor>::CreateSamples()
   this->ForegroundHistogramFilter->Modified();
   this->ForegroundHistogramFilter->Update();
 
-  this->ForegroundHistogram = this->ForegroundHistogramFilter->GetOutput();
+  this->ForegroundHistogram = this->ForegroundHistogramFilter->GetOutput();
+
+  // Create the background histogram
+  this->BackgroundHistogramFilter->SetHistogramSize(histogramSize);
+  this->BackgroundHistogramFilter->SetHistogramBinMinimum(binMinimum);
+  this->BackgroundHistogramFilter->SetHistogramBinMaximum(binMaximum);
+  this->BackgroundHistogramFilter->SetAutoMinimumMaximum(false);
+  this->BackgroundHistogramFilter->SetInput(this->BackgroundSample);
+  this->BackgroundHistogramFilter->Modified();
+  this->BackgroundHistogramFilter->Update();
+
+  this->BackgroundHistogram = BackgroundHistogramFilter->GetOutput();
+}
+
+template <typename TImage, typename TPixelDifferenceFunctor>
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::CreateNEdges(const double sigma)
+{  // Create n-edges and set n-edge weights (links between image nodes)
+
+  itk::Size<2> imageSize = this->Image->GetLargestPossibleRegion().GetSize();
+
+  EdgeIndex expectedNumberOfNEdges = 2*(
+                                          imageSize[0] * (imageSize[1] - 1) + // vertical edges
+                                          (imageSize[0]-1) * imageSize[1]  // horizontal edges
+                                          );
+  this->ResizeEdgeProperties(num_edges(this->Graph) + expectedNumberOfNEdges);
+
+  // Add an edge between each pixel and the pixel below it and between each pixel and the pixel to the right of it.
+  // This prevents duplicate edges (i.e. we cannot add an edge to
+  // all 4-connected neighbors of every pixel or almost every edge would be duplicated.
+  const NodeIdType width = static_cast<NodeIdType>(imageSize[0]);
+  std::vector<float> rightWeights(width);
+  std::vector<float> bottomWeights(width);
+
+  EdgeIndex currentNumberOfEdges = num_edges(this->Graph);
+
+  NodeIdType rowStart = 0;
+  for(std::size_t row = 0; row < imageSize[1]; ++row, rowStart += width)
+  {
+    this->CheckProgressAtRow(SegmentationStatistics::CREATE_N_EDGES, rowStart);
+
+    // The weights of a whole row are computed at once, so the pixel differences are vectorized.
+    this->ComputeRowNLinkWeights(row, sigma, rightWeights.data(), bottomWeights.data());
+
+    const bool hasBottomNeighbors = row + 1 < imageSize[1];
+    for(NodeIdType column = 0; column < width; ++column)
+    {
+      const NodeIdType centerNodeId = rowStart + column;
+      if(hasBottomNeighbors)
+      {
+        currentNumberOfEdges = AddBidirectionalEdge(currentNumberOfEdges, centerNodeId, centerNodeId + width,
+                                                    bottomWeights[column]);
+      }
+      if(column + 1 < width)
+      {
+        currentNumberOfEdges = AddBidirectionalEdge(currentNumberOfEdges, centerNodeId, centerNodeId + 1,
+                                                    rightWeights[column]);
+      }
+    }
+  }
+}
+
+template <typename TImage, typename TPixelDifferenceFunctor>
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::ComputeRowSquaredDifferences(const std::size_t row,
+                                                                                  float* const rightDifferences,
+                                                                                  float* const bottomDifferences) const
+{
+  const itk::Size<2> imageSize = this->Image->GetLargestPossibleRegion().GetSize();
+  const std::size_t width = imageSize[0];
+
+  if(this->EdgeMap)
+  {
+    const float* const edges = this->EdgeMap->GetBufferPointer() + row * width;
+    for(std::size_t column = 0; column + 1 < width; ++column)
+    {
+      const float edge = std::max(edges[column], edges[column + 1]);
+      rightDifferences[column] = edge * edge;
+    }
+    if(row + 1 < imageSize[1])
+    {
+      for(std::size_t column = 0; column < width; ++column)
+      {
+        const float edge = std::max(edges[column], edges[column + width]);
+        bottomDifferences[column] = edge * edge;
+      }
+    }
+    return;
+  }
+
+  this->ComputeRowPixelSquaredDifferences(row, rightDifferences, bottomDifferences, HasComponentBuffers());
+}
+
+template <typename TImage, typename TPixelDifferenceFunctor>
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::ComputeRowPixelSquaredDifferences(const std::size_t row,
+    float* const rightDifferences, float* const bottomDifferences, std::true_type) const
+{
+  const itk::Size<2> imageSize = this->Image->GetLargestPossibleRegion().GetSize();
+  const std::size_t width = imageSize[0];
+  const unsigned int numberOfComponents = this->Image->GetNumberOfComponentsPerPixel();
+  const typename TImage::InternalPixelType* const rowBuffer =
+      this->Image->GetBufferPointer() + row * width * numberOfComponents;
+
+  this->PixelDifferenceFunctor.SquaredDifferences(rowBuffer, rowBuffer + numberOfComponents, width - 1,
+                                                  numberOfComponents, rightDifferences);
+  if(row + 1 < imageSize[1])
+  {
+    this->PixelDifferenceFunctor.SquaredDifferences(rowBuffer, rowBuffer + width * numberOfComponents, width,
+                                                    numberOfComponents, bottomDifferences);
+  }
+}
+
+template <typename TImage, typename TPixelDifferenceFunctor>
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::ComputeRowPixelSquaredDifferences(const std::size_t row,
+    float* const rightDifferences, float* const bottomDifferences, std::false_type) const
+{
+  const itk::ImageRegion<2> region = this->Image->GetLargestPossibleRegion();
+  const std::size_t width = region.GetSize()[0];
+  const bool hasBottomRow = row + 1 < region.GetSize()[1];
+
+  // A copy per row, so that functors with a non-const Difference() can be called from several threads.
+  TPixelDifferenceFunctor pixelDifferenceFunctor = this->PixelDifferenceFunctor;
+
+  itk::Index<2> index = region.GetIndex();
+  index[1] += static_cast<itk::IndexValueType>(row);
+  for(std::size_t column = 0; column < width; ++column, ++index[0])
+  {
+    const PixelType pixel = this->Image->GetPixel(index);
+    if(column + 1 < width)
+    {
+      itk::Index<2> rightIndex = index;
+      rightIndex[0]++;
+      rightDifferences[column] = SquaredPixelDifference(pixelDifferenceFunctor, pixel,
+                                                        this->Image->GetPixel(rightIndex));
+    }
+    if(hasBottomRow)
+    {
+      itk::Index<2> bottomIndex = index;
+      bottomIndex[1]++;
+      bottomDifferences[column] = SquaredPixelDifference(pixelDifferenceFunctor, pixel,
+                                                         this->Image->GetPixel(bottomIndex));
+    }
+  }
+}
+
+template <typename TImage, typename TPixelDifferenceFunctor>
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::ComputeRowNLinkWeights(const std::size_t row,
+                                                                            const double sigma,
+                                                                            float* const rightWeights,
+                                                                            float* const bottomWeights) const
+{
+  this->ComputeRowSquaredDifferences(row, rightWeights, bottomWeights);
+
+  // The weight of an n-link is exp(-d^2 / (2 sigma^2)) of the squared difference d^2 of its pixels.
+  const itk::Size<2> imageSize = this->Image->GetLargestPossibleRegion().GetSize();
+  const std::size_t width = imageSize[0];
+  const double scale = -1.0 / (2.0 * sigma * sigma);
+  for(std::size_t column = 0; column + 1 < width; ++column)
+  {
+    rightWeights[column] = std::exp(rightWeights[column] * scale);
+  }
+  if(row + 1 < imageSize[1])
+  {
+    for(std::size_t column = 0; column < width; ++column)
+    {
+      bottomWeights[column] = std::exp(bottomWeights[column] * scale);
+    }
+  }
+}
+
+template <typename TImage, typename TPixelDifferenceFunctor>
+float ImageGraphCut<TImage, TPixelDifferenceFunctor>::InternalForegroundLikelihood(const PixelType& pixel)
+{
+  return ModelType::ComputeLikelihood(this->ForegroundHistogram, pixel, this->LikelihoodScratch);
+}
+
+template <typename TImage, typename TPixelDifferenceFunctor>
+float ImageGraphCut<TImage, TPixelDifferenceFunctor>::InternalBackgroundLikelihood(const PixelType& pixel)
+{
+  return ModelType::ComputeLikelihood(this->BackgroundHistogram, pixel, this->LikelihoodScratch);
+}
+
+template <typename TImage, typename TPixelDifferenceFunctor>
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::CreateTEdges()
+{
+  // Setup links from pixel nodes to terminal nodes
+
+  itk::Size<2> imageSize = this->Image->GetLargestPossibleRegion().GetSize();
+
+  EdgeIndex expectedNumberOfTEdges = 2*2*(imageSize[0] * imageSize[1]);
+
+  this->ResizeEdgeProperties(num_edges(this->Graph) + expectedNumberOfTEdges);
+
+  // Add t-edges and set t-edge weights (links from image nodes to virtual background and virtual foreground node)
+
+  itk::ImageRegionConstIterator<TImage>
+      imageIterator(this->Image,
+                    this->Image->GetLargestPossibleRegion());
+  imageIterator.GoToBegin();
+
+  // The image is traversed in buffer order, so the node id of the current pixel is a running counter.
+  NodeIdType nodeId = 0;
+
+  EdgeIndex currentNumberOfEdges = num_edges(this->Graph);
+
+  while(!imageIterator.IsAtEnd())
+  {
+    this->CheckProgressAtRow(SegmentationStatistics::CREATE_T_EDGES, nodeId);
+
+    // Skip the computation and edge creation if the current pixel already has a fixed assignment
+    if(this->SeedLabels[nodeId] != SeedLabel::NONE)
+    {
+        ++imageIterator;
+        ++nodeId;
+        continue;
+    }
+    float sourceWeight;
+    float sinkWeight;
+    this->ComputeTLinkWeights(imageIterator.Get(), sourceWeight, sinkWeight);
+
+    // Add the edge to the graph and set its weight
+    currentNumberOfEdges = AddBidirectionalEdge(currentNumberOfEdges, nodeId, this->SinkNodeId, sinkWeight);
+    currentNumberOfEdges = AddBidirectionalEdge(currentNumberOfEdges, nodeId, this->SourceNodeId, sourceWeight);
+
+    ++imageIterator;
+    ++nodeId;
+  }
+
+  // Set very high source weights for the pixels that were selected as foreground by the user
+  // and very high sink weights for the pixels that were selected as background.
+  for(NodeIdType seedNodeId = 0; seedNodeId < this->SeedLabels.size(); ++seedNodeId)
+  {
+    if(this->SeedLabels[seedNodeId] == SeedLabel::SOURCE)
+    {
+      currentNumberOfEdges = AddBidirectionalEdge(currentNumberOfEdges, seedNodeId,
+                                                  this->SourceNodeId, std::numeric_limits<float>::max());
+
+      currentNumberOfEdges = AddBidirectionalEdge(currentNumberOfEdges, seedNodeId,
+                                                  this->SinkNodeId, 0);
+    }
+    else if(this->SeedLabels[seedNodeId] == SeedLabel::SINK)
+    {
+      currentNumberOfEdges = AddBidirectionalEdge(currentNumberOfEdges, seedNodeId,
+                                                  this->SourceNodeId, 0);
+
+      currentNumberOfEdges = AddBidirectionalEdge(currentNumberOfEdges, seedNodeId,
+                                                  this->SinkNodeId, std::numeric_limits<float>::max());
+    }
+  }
+}
+
+template <typename TImage, typename TPixelDifferenceFunctor>
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::ComputeTLinkWeights(const PixelType& pixel,
+                                                                         float& sourceWeight, float& sinkWeight)
+{
+  // Since the t-weight function takes the log of the histogram value,
+  // we must handle bins with frequency = 0 specially (because log(0) = -inf)
+  // For empty histogram bins we use tinyValue instead of 0.
+  const float tinyValue = 1e-10;
+
+  float sourceLikelihood = ForegroundLikelihood(pixel);
+  float sinkLikelihood = BackgroundLikelihood(pixel);
 
-  // Create background samples and histogram
-  this->BackgroundSample->Clear();
-  this->BackgroundSample->SetMeasurementVectorSize(numberOfComponentsPerPixel);
-  for(unsigned int i = 0; i < this->Sinks.size(); i++)
+  if(sourceLikelihood <= 0)
   {
-    this->BackgroundSample->PushBack(this->Image->GetPixel(this->Sinks[i]));
+    sourceLikelihood = tinyValue;
   }
 
-  this->BackgroundHistogramFilter->SetHistogramSize(histogramSize);
-  this->BackgroundHistogramFilter->SetHistogramBinMinimum(binMinimum);
-  this->BackgroundHistogramFilter->SetHistogramBinMaximum(binMaximum);
-  this->BackgroundHistogramFilter->SetAutoMinimumMaximum(false);
-  this->BackgroundHistogramFilter->SetInput(this->BackgroundSample);
-  this->BackgroundHistogramFilter->Modified();
-  this->BackgroundHistogramFilter->Update();
-
-  this->BackgroundHistogram = BackgroundHistogramFilter->GetOutput();
+  if(sinkLikelihood <= 0)
+  {
+    sinkLikelihood = tinyValue;
+  }
 
-  std::cout << "Finished CreateSamples()" << std::endl;
+  // log() is the natural log
+  const float lambda = this->GetLambda();
+  sinkWeight = -lambda*log(sourceLikelihood);
+  sourceWeight = -lambda*log(sinkLikelihood);
 }
 
 template <typename TImage, typename TPixelDifferenceFunctor>
-void ImageGraphCut<TImage, TPixelDifferenceFunctor>::CreateNEdges()
+unsigned int ImageGraphCut<TImage, TPixelDifferenceFunctor>::GetNLinks(const NodeIdType nodeId,
+                                                                       NodeIdType neighbors[4],
+                                                                       float weights[4]) const
 {
-  std::cout << "CreateNEdges()" << std::endl;
-  // Create n-edges and set n-edge weights (links between image nodes)
+  const NodeIdType width = static_cast<NodeIdType>(this->Image->GetLargestPossibleRegion().GetSize()[0]);
+  const NodeIdType numberOfPixels = static_cast<NodeIdType>(this->RightWeights.size());
+  const NodeIdType x = nodeId % width;
 
-  itk::Size<2> imageSize = this->Image->GetLargestPossibleRegion().GetSize();
+  unsigned int numberOfNeighbors = 0;
+  if(x > 0)
+  {
+    neighbors[numberOfNeighbors] = nodeId - 1;
+    weights[numberOfNeighbors++] = this->RightWeights[nodeId - 1];
+  }
+  if(x + 1 < width)
+  {
+    neighbors[numberOfNeighbors] = nodeId + 1;
+    weights[numberOfNeighbors++] = this->RightWeights[nodeId];
+  }
+  if(nodeId >= width)
+  {
+    neighbors[numberOfNeighbors] = nodeId - width;
+    weights[numberOfNeighbors++] = this->BottomWeights[nodeId - width];
+  }
+  if(nodeId + width < numberOfPixels)
+  {
+    neighbors[numberOfNeighbors] = nodeId + width;
+    weights[numberOfNeighbors++] = this->BottomWeights[nodeId];
+  }
+  return numberOfNeighbors;
+}
 
-  unsigned int expectedNumberOfNEdges = 2*(
-                                          imageSize[0] * (imageSize[1] - 1) + // vertical edges
-                                          (imageSize[0]-1) * imageSize[1]  // horizontal edges
-                                          );
-  std::cout << "Resizing for " << expectedNumberOfNEdges << " N-edges." << std::endl;
-  this->EdgeWeights.resize(num_edges(this->Graph) + expectedNumberOfNEdges);
-  this->ReverseEdges.resize(num_edges(this->Graph) + expectedNumberOfNEdges);
+template <typename TImage, typename TPixelDifferenceFunctor>
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::ReduceGraph(const double sigma)
+{
+  const itk::ImageRegion<2> region = this->Image->GetLargestPossibleRegion();
+  const NodeIdType width = static_cast<NodeIdType>(region.GetSize()[0]);
+  const NodeIdType numberOfPixels = static_cast<NodeIdType>(region.GetNumberOfPixels());
+
+  // The n-link weights, in the same order as CreateNEdges() computes them.
+  this->RightWeights.assign(numberOfPixels, 0.0f);
+  this->BottomWeights.assign(numberOfPixels, 0.0f);
+  for(NodeIdType rowStart = 0; rowStart < numberOfPixels; rowStart += width)
+  {
+    this->CheckProgressAtRow(SegmentationStatistics::REDUCE_GRAPH, rowStart);
+    this->ComputeRowNLinkWeights(rowStart / width, sigma, this->RightWeights.data() + rowStart,
+                                 this->BottomWeights.data() + rowStart);
+  }
 
-  // We are only using a 4-connected structure,
-  // so the kernel (iteration neighborhood) must only be
-  // 3x3 (specified by a radius of 1)
-  itk::Size<2> radius;
-  radius.Fill(1);
+  // The t-link weights of the pixels that are not seeds.
+  this->FixedLabels = this->SeedLabels;
+  this->TLinkWeights.assign(numberOfPixels, 0.0f);
+  this->DataEnergyOffset = 0;
+  {
+  itk::ImageRegionConstIterator<TImage> imageIterator(this->Image, region);
+  NodeIdType nodeId = 0;
+  for(imageIterator.GoToBegin(); !imageIterator.IsAtEnd(); ++imageIterator, ++nodeId)
+  {
+    this->CheckProgressAtRow(SegmentationStatistics::REDUCE_GRAPH, nodeId);
 
-  typedef itk::ShapedNeighborhoodIterator<TImage> IteratorType;
+    if(this->FixedLabels[nodeId] == SeedLabel::NONE)
+    {
+      float sourceWeight;
+      float sinkWeight;
+      this->ComputeTLinkWeights(imageIterator.Get(), sourceWeight, sinkWeight);
+      this->TLinkWeights[nodeId] = sourceWeight - sinkWeight;
+      this->DataEnergyOffset += std::min(sourceWeight, sinkWeight);
+
+      // The pixels outside of the refinement band of a segmentation with a deadline are labeled like seeds.
+      if(!this->BandLabels.empty())
+      {
+        this->FixedLabels[nodeId] = this->BandLabels[nodeId];
+      }
+    }
+  }
+  }
 
-  // Traverse the image adding an edge between the current pixel
-  // and the pixel below it and the current pixel and the pixel to the right of it.
-  // This prevents duplicate edges (i.e. we cannot add an edge to
-  // all 4-connected neighbors of every pixel or almost every edge would be duplicated.
-  std::vector<typename IteratorType::OffsetType> neighbors;
-  typename IteratorType::OffsetType bottom = {{0,1}};
-  neighbors.push_back(bottom);
-  typename IteratorType::OffsetType right = {{1,0}};
-  neighbors.push_back(right);
+  // Labeling a pixel background costs 'excess' more than labeling it foreground, where 'excess' includes the
+  // n-links to labeled neighbors, and its n-links to unlabeled neighbors can save at most 'freeWeight'.
+  // So if excess > freeWeight the pixel is foreground in every minimum cut (and background if
+  // -excess > freeWeight). Labeling it moves its n-links into the excess of its neighbors, which may
+  // in turn be labeled.
+  std::vector<double>& excess = this->ReductionExcess;
+  std::vector<double>& freeWeight = this->ReductionFreeWeight;
+  excess.assign(this->TLinkWeights.begin(), this->TLinkWeights.end());
+  freeWeight.assign(numberOfPixels, 0.0);
+  NodeIdType neighbors[4];
+  float weights[4];
+
+  for(NodeIdType nodeId = 0; nodeId < numberOfPixels; ++nodeId)
+  {
+    this->CheckProgressAtRow(SegmentationStatistics::REDUCE_GRAPH, nodeId);
 
-  typename IteratorType::OffsetType center = {{0,0}};
+    if(this->FixedLabels[nodeId] != SeedLabel::NONE)
+    {
+      continue;
+    }
 
-  IteratorType iterator(radius, this->Image, this->Image->GetLargestPossibleRegion());
-  iterator.ClearActiveList();
-  iterator.ActivateOffset(bottom);
-  iterator.ActivateOffset(right);
-  iterator.ActivateOffset(center);
+    const unsigned int numberOfNeighbors = this->GetNLinks(nodeId, neighbors, weights);
+    for(unsigned int i = 0; i < numberOfNeighbors; ++i)
+    {
+      switch(this->FixedLabels[neighbors[i]])
+      {
+        case SeedLabel::SOURCE:
+          excess[nodeId] += weights[i];
+          break;
+        case SeedLabel::SINK:
+          excess[nodeId] -= weights[i];
+          break;
+        default:
+          freeWeight[nodeId] += weights[i];
+      }
+    }
+  }
 
-  // Estimate the "camera noise"
-  double sigma = this->ComputeNoise();
+  // The work list is popped from the back, so it is filled backwards to visit the pixels in buffer order.
+  std::vector<NodeIdType>& workList = this->ReductionWorkList;
+  std::vector<unsigned char>& inWorkList = this->ReductionInWorkList;
+  workList.clear();
+  inWorkList.assign(numberOfPixels, 0);
+  for(NodeIdType nodeId = numberOfPixels; nodeId-- > 0;)
+  {
+    if(this->FixedLabels[nodeId] == SeedLabel::NONE)
+    {
+      workList.push_back(nodeId);
+      inWorkList[nodeId] = 1;
+    }
+  }
 
-  unsigned int currentNumberOfEdges = num_edges(this->Graph);
-  for(iterator.GoToBegin(); !iterator.IsAtEnd(); ++iterator)
+  std::size_t numberOfFixedPixels = numberOfPixels - workList.size();
+  std::size_t numberOfSteps = 0;
+  while(!workList.empty())
   {
-    PixelType centerPixel = iterator.GetPixel(center);
+    if(++numberOfSteps % ProgressSteps == 0)
+    {
+      this->CheckProgress(SegmentationStatistics::REDUCE_GRAPH, -1);
+    }
 
-    for(unsigned int i = 0; i < neighbors.size(); i++)
+    const NodeIdType nodeId = workList.back();
+    workList.pop_back();
+    inWorkList[nodeId] = 0;
+
+    double sign;
+    if(excess[nodeId] > freeWeight[nodeId])
+    {
+      this->FixedLabels[nodeId] = SeedLabel::SOURCE;
+      sign = 1;
+    }
+    else if(-excess[nodeId] > freeWeight[nodeId])
+    {
+      this->FixedLabels[nodeId] = SeedLabel::SINK;
+      sign = -1;
+    }
+    else
     {
-      bool valid;
-      iterator.GetPixel(neighbors[i], valid);
+      continue;
+    }
+    numberOfFixedPixels++;
 
-      // If the current neighbor is outside the image, skip it
-      if(!valid)
+    const unsigned int numberOfNeighbors = this->GetNLinks(nodeId, neighbors, weights);
+    for(unsigned int i = 0; i < numberOfNeighbors; ++i)
+    {
+      const NodeIdType neighbor = neighbors[i];
+      if(this->FixedLabels[neighbor] != SeedLabel::NONE)
       {
         continue;
       }
 
-      PixelType neighborPixel = iterator.GetPixel(neighbors[i]);
-
-      // Compute the Euclidean distance between the pixel intensities
-      float pixelDifference = PixelDifferenceFunctor.Difference(centerPixel, neighborPixel);
-
-      // Compute the edge weight
-      float weight = exp(-pow(pixelDifference,2)/(2.0*sigma*sigma));
-      assert(weight >= 0);
-
-      // Add the edge to the graph
-      unsigned int node1 = this->NodeImage->GetPixel(iterator.GetIndex(center));
-      unsigned int node2 = this->NodeImage->GetPixel(iterator.GetIndex(neighbors[i]));
-
-      currentNumberOfEdges = AddBidirectionalEdge(currentNumberOfEdges, node1, node2, weight);
+      excess[neighbor] += sign * weights[i];
+      // Clamped, so that rounding never turns an exact tie into a label.
+      freeWeight[neighbor] = std::max(0.0, freeWeight[neighbor] - weights[i]);
+      if(!inWorkList[neighbor])
+      {
+        workList.push_back(neighbor);
+        inWorkList[neighbor] = 1;
+      }
     }
   }
 
-  std::cout << "Finished CreateNEdges()" << std::endl;
+  this->ReducedTLinkWeights.assign(excess.begin(), excess.end());
+
+  this->Statistics.NumberOfFixedPixels = numberOfFixedPixels;
+  if(this->Verbosity >= 2)
+  {
+    std::cout << "The graph reduction labeled " << numberOfFixedPixels << " of " << numberOfPixels
+              << " pixels (" << this->NumberOfSourcePixels + this->NumberOfSinkPixels << " seeds)." << std::endl;
+  }
 }
 
 template <typename TImage, typename TPixelDifferenceFunctor>
-float ImageGraphCut<TImage, TPixelDifferenceFunctor>::InternalForegroundLikelihood(const PixelType& pixel)
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::CreateReducedNEdges()
 {
-    HistogramType::MeasurementVectorType measurementVector(pixel.Size());
-    for(unsigned int i = 0; i < pixel.Size(); i++)
+  // Only the n-links between two unlabeled pixels are left, the others are in ReducedTLinkWeights.
+  const NodeIdType width = static_cast<NodeIdType>(this->Image->GetLargestPossibleRegion().GetSize()[0]);
+  const NodeIdType numberOfPixels = static_cast<NodeIdType>(this->FixedLabels.size());
+
+  this->ResizeEdgeProperties(num_edges(this->Graph) + 2 * 2 * static_cast<EdgeIndex>(numberOfPixels));
+
+  EdgeIndex currentNumberOfEdges = num_edges(this->Graph);
+  for(NodeIdType nodeId = 0; nodeId < numberOfPixels; ++nodeId)
+  {
+    this->CheckProgressAtRow(SegmentationStatistics::CREATE_N_EDGES, nodeId);
+
+    if(this->FixedLabels[nodeId] != SeedLabel::NONE)
     {
-      measurementVector[i] = pixel[i];
+      continue;
     }
 
-    HistogramType::IndexType foregroundIndex;
-    this->ForegroundHistogram->GetIndex(measurementVector, foregroundIndex);
-    float sourceHistogramValue =
-        this->ForegroundHistogram->GetFrequency(foregroundIndex);
-
-    sourceHistogramValue /= this->ForegroundHistogram->GetTotalFrequency();
+    if(nodeId % width + 1 < width && this->FixedLabels[nodeId + 1] == SeedLabel::NONE)
+    {
+      currentNumberOfEdges = AddBidirectionalEdge(currentNumberOfEdges, nodeId, nodeId + 1,
+                                                  this->RightWeights[nodeId]);
+    }
+    if(nodeId + width < numberOfPixels && this->FixedLabels[nodeId + width] == SeedLabel::NONE)
+    {
+      currentNumberOfEdges = AddBidirectionalEdge(currentNumberOfEdges, nodeId, nodeId + width,
+                                                  this->BottomWeights[nodeId]);
+    }
+  }
 
-    return sourceHistogramValue;
+  // Fewer edges than reserved were added
+  this->ResizeEdgeProperties(currentNumberOfEdges);
 }
 
 template <typename TImage, typename TPixelDifferenceFunctor>
-float ImageGraphCut<TImage, TPixelDifferenceFunctor>::InternalBackgroundLikelihood(const PixelType& pixel)
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::CreateReducedTEdges()
 {
-    HistogramType::MeasurementVectorType measurementVector(pixel.Size());
-    for(unsigned int i = 0; i < pixel.Size(); i++)
+  // Only the difference between the two t-links of a pixel changes the cut (the smaller one is a cost that every
+  // labeling pays), so each unlabeled pixel gets a single t-link.
+  const NodeIdType numberOfPixels = static_cast<NodeIdType>(this->FixedLabels.size());
+
+  this->ResizeEdgeProperties(num_edges(this->Graph) + 2 * static_cast<EdgeIndex>(numberOfPixels));
+
+  EdgeIndex currentNumberOfEdges = num_edges(this->Graph);
+  for(NodeIdType nodeId = 0; nodeId < numberOfPixels; ++nodeId)
+  {
+    this->CheckProgressAtRow(SegmentationStatistics::CREATE_T_EDGES, nodeId);
+
+    if(this->FixedLabels[nodeId] != SeedLabel::NONE)
     {
-      measurementVector[i] = pixel[i];
+      continue;
     }
 
-    HistogramType::IndexType backgroundIndex;
-    this->BackgroundHistogram->GetIndex(measurementVector, backgroundIndex);
-    float sinkHistogramValue =
-        this->BackgroundHistogram->GetFrequency(backgroundIndex);
-
-    sinkHistogramValue /= this->BackgroundHistogram->GetTotalFrequency();
+    const float weight = this->ReducedTLinkWeights[nodeId];
+    if(weight > 0)
+    {
+      currentNumberOfEdges = AddBidirectionalEdge(currentNumberOfEdges, nodeId, this->SourceNodeId, weight);
+    }
+    else if(weight < 0)
+    {
+      currentNumberOfEdges = AddBidirectionalEdge(currentNumberOfEdges, nodeId, this->SinkNodeId, -weight);
+    }
+  }
 
-    return sinkHistogramValue;
+  // Fewer edges than reserved were added
+  this->ResizeEdgeProperties(currentNumberOfEdges);
 }
 
 template <typename TImage, typename TPixelDifferenceFunctor>
-void ImageGraphCut<TImage, TPixelDifferenceFunctor>::CreateTEdges()
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::CreateGraph()
 {
-  // Setup links from pixel nodes to terminal nodes
-  std::cout << "CreateTEdges()" << std::endl;
+  // Estimate the "camera noise"
+  double sigma;
+  {
+    ScopedStageTimer timer(this->Statistics, SegmentationStatistics::COMPUTE_NOISE);
+    this->CheckProgress(SegmentationStatistics::COMPUTE_NOISE, 0);
+    sigma = this->ComputeNoise();
+  }
 
-  itk::Size<2> imageSize = this->Image->GetLargestPossibleRegion().GetSize();
+  this->GraphIsReduced = this->GraphReduction || !this->BandLabels.empty();
+  if(this->GraphIsReduced)
+  {
+    {
+      ScopedStageTimer timer(this->Statistics, SegmentationStatistics::REDUCE_GRAPH);
+      ReduceGraph(sigma);
+    }
 
-  unsigned int expectedNumberOfTEdges = 2*2*(imageSize[0] * imageSize[1]);
+    {
+      ScopedStageTimer timer(this->Statistics, SegmentationStatistics::CREATE_N_EDGES);
+      CreateReducedNEdges();
+    }
 
-  this->EdgeWeights.resize(num_edges(this->Graph) + expectedNumberOfTEdges);
-  this->ReverseEdges.resize(num_edges(this->Graph) + expectedNumberOfTEdges);
+    {
+      ScopedStageTimer timer(this->Statistics, SegmentationStatistics::CREATE_T_EDGES);
+      CreateReducedTEdges();
+    }
+  }
+  else
+  {
+    {
+      ScopedStageTimer timer(this->Statistics, SegmentationStatistics::CREATE_N_EDGES);
+      CreateNEdges(sigma);
+    }
 
-  // Add t-edges and set t-edge weights (links from image nodes to virtual background and virtual foreground node)
+    {
+      ScopedStageTimer timer(this->Statistics, SegmentationStatistics::CREATE_T_EDGES);
+      CreateTEdges();
+    }
+  }
 
-  // Compute the histograms of the selected foreground and background pixels
-  if(!this->CustomLikelihood)
+  if(this->Verbosity >= 2)
   {
-    CreateSamples();
-  }
+  itk::Size<2> imageSize = this->Image->GetLargestPossibleRegion().GetSize();
 
-  itk::ImageRegionIteratorWithIndex<TImage>
-      imageIterator(this->Image,
-                    this->Image->GetLargestPossibleRegion());
-  itk::ImageRegionIterator<NodeImageType>
-      nodeIterator(this->NodeImage,
-                   this->NodeImage->GetLargestPossibleRegion());
-  imageIterator.GoToBegin();
-  nodeIterator.GoToBegin();
+  std::cout << "Number of edges " << num_edges(this->Graph) << std::endl;
+  int expectedEdges = imageSize[0]*imageSize[1] * 2 * 2 + // one '2' is because there is an edge to both the source and sink from each pixel, and the other '2' is because they are double edges (bidirectional)
+                      2*(imageSize[0]-1)*imageSize[1] + 2*imageSize[0]*(imageSize[1]-1); // both '2's are for the double edges (this is the number of horizontal edges + the number of vertical edges)
+  std::cout << "(Should be " << expectedEdges << " edges.)" << std::endl;
+  }
+}
 
-  // Since the t-weight function takes the log of the histogram value,
-  // we must handle bins with frequency = 0 specially (because log(0) = -inf)
-  // For empty histogram bins we use tinyValue instead of 0.
-  float tinyValue = 1e-10;
+template <typename TImage, typename TPixelDifferenceFunctor>
+double ImageGraphCut<TImage, TPixelDifferenceFunctor>::ComputeNoise()
+{
+  // Compute an estimate of the "camera noise": the mean difference between 4-connected neighbors.
+  // This is used in the N-weight function.
+  const itk::Size<2> imageSize = this->Image->GetLargestPossibleRegion().GetSize();
+  const std::size_t width = imageSize[0];
+  std::vector<float> rightDifferences(width);
+  std::vector<float> bottomDifferences(width);
 
-  unsigned int currentNumberOfEdges = num_edges(this->Graph);
+  double sigma = 0.0;
+  std::size_t numberOfEdges = 0;
 
-  while(!imageIterator.IsAtEnd())
+  // Traverse the image collecting the differences between neighboring pixel intensities
+  for(std::size_t row = 0; row < imageSize[1]; ++row)
   {
-    itk::Index<2> currentIndex = imageIterator.GetIndex();
+    this->ComputeRowSquaredDifferences(row, rightDifferences.data(), bottomDifferences.data());
 
-    // Skip the computation and edge creation if the current pixel already has a fixed assignment
-    if(Helpers::Contains(this->Sinks, currentIndex) || Helpers::Contains(this->Sources, currentIndex))
+    for(std::size_t column = 0; column + 1 < width; ++column)
     {
-        ++imageIterator;
-        ++nodeIterator;
-        continue;
+      sigma += std::sqrt(rightDifferences[column]);
     }
-    PixelType pixel = imageIterator.Get();
-    //std::cout << "Pixels have size: " << pixel.Size() << std::endl;
+    numberOfEdges += width - 1;
 
-    HistogramType::MeasurementVectorType measurementVector(pixel.Size());
-    for(unsigned int i = 0; i < pixel.Size(); i++)
+    if(row + 1 < imageSize[1])
     {
-      measurementVector[i] = pixel[i];
+      for(std::size_t column = 0; column < width; ++column)
+      {
+        sigma += std::sqrt(bottomDifferences[column]);
+      }
+      numberOfEdges += width;
     }
+  }
 
-    float sourceLikelihood = ForegroundLikelihood(pixel);
-    float sinkLikelihood = BackgroundLikelihood(pixel);
+  // Normalize
+  sigma /= static_cast<double>(numberOfEdges);
 
-    if(sourceLikelihood <= 0)
-    {
-      sourceLikelihood = tinyValue;
-    }
+  return sigma;
+}
 
-    if(sinkLikelihood <= 0)
-    {
-      sinkLikelihood = tinyValue;
-    }
+template <typename TImage, typename TPixelDifferenceFunctor>
+typename ImageGraphCut<TImage, TPixelDifferenceFunctor>::NodeIdType
+ImageGraphCut<TImage, TPixelDifferenceFunctor>::GetNodeId(const itk::Index<2>& index) const
+{
+  return static_cast<NodeIdType>(this->Image->ComputeOffset(index));
+}
 
-    // Add the edge to the graph and set its weight
-    // log() is the natural log
-    currentNumberOfEdges = AddBidirectionalEdge(currentNumberOfEdges, nodeIterator.Get(),
-                                                this->SinkNodeId, -this->Lambda*log(sourceLikelihood));
-    currentNumberOfEdges = AddBidirectionalEdge(currentNumberOfEdges, nodeIterator.Get(),
-                                                this->SourceNodeId, -this->Lambda*log(sinkLikelihood));
+template <typename TImage, typename TPixelDifferenceFunctor>
+typename ImageGraphCut<TImage, TPixelDifferenceFunctor>::IndexContainer ImageGraphCut<TImage, TPixelDifferenceFunctor>::GetSources()
+{
+  return this->Sources;
+}
 
-    ++imageIterator;
-    ++nodeIterator;
-  }
+template <typename TImage, typename TPixelDifferenceFunctor>
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::SetLambda(const float lambda)
+{
+  this->Lambda = lambda;
+}
 
-  // Set very high source weights for the pixels that were
-  // selected as foreground by the user
-  for(unsigned int i = 0; i < this->Sources.size(); i++)
-  {
-    currentNumberOfEdges = AddBidirectionalEdge(currentNumberOfEdges, this->NodeImage->GetPixel(this->Sources[i]),
-                                                this->SourceNodeId,  std::numeric_limits<float>::max());
+template <typename TImage, typename TPixelDifferenceFunctor>
+float ImageGraphCut<TImage, TPixelDifferenceFunctor>::GetLambda() const
+{
+  return this->Model ? this->Model->GetLambda() : this->Lambda;
+}
 
-    currentNumberOfEdges = AddBidirectionalEdge(currentNumberOfEdges, this->NodeImage->GetPixel(this->Sources[i]),
-                                                this->SinkNodeId, 0);
+template <typename TImage, typename TPixelDifferenceFunctor>
+std::shared_ptr<const typename ImageGraphCut<TImage, TPixelDifferenceFunctor>::ModelType>
+ImageGraphCut<TImage, TPixelDifferenceFunctor>::TrainModel()
+{
+  this->NumberOfThreadsInUse = this->NumberOfThreads;
+  this->ComputeSeedLabels();
+  if((this->NumberOfSourcePixels == 0) || (this->NumberOfSinkPixels == 0))
+  {
+    throw std::runtime_error("At least one source (foreground) pixel and one sink (background) "
+                             "pixel must be specified to train a model!");
   }
 
-  // Set very high sink weights for the pixels that
-  // were selected as background by the user
-  for(unsigned int i = 0; i < this->Sinks.size(); i++)
-  {
-      currentNumberOfEdges = AddBidirectionalEdge(currentNumberOfEdges, this->NodeImage->GetPixel(this->Sinks[i]),
-                                                  this->SourceNodeId, 0);
+  ScopedImage convertedImage(this->Image, this->ConvertColorSpace());
+  this->CreateSamples();
+  std::shared_ptr<const ModelType> model =
+      std::make_shared<const ModelType>(this->Lambda, this->SegmentationColorSpace, this->ForegroundHistogram,
+                                        this->BackgroundHistogram);
 
-      currentNumberOfEdges = AddBidirectionalEdge(currentNumberOfEdges, this->NodeImage->GetPixel(this->Sinks[i]),
-                                                  this->SinkNodeId, std::numeric_limits<float>::max());
-  }
+  // The histograms are the outputs of the filters, so the next CreateSamples() must not update them.
+  this->ForegroundHistogramFilter = SampleToHistogramFilterType::New();
+  this->BackgroundHistogramFilter = SampleToHistogramFilterType::New();
+  this->ForegroundHistogram = nullptr;
+  this->BackgroundHistogram = nullptr;
 
-  std::cout << "Finished CreateTEdges()" << std::endl;
+  return model;
 }
 
 template <typename TImage, typename TPixelDifferenceFunctor>
-void ImageGraphCut<TImage, TPixelDifferenceFunctor>::CreateGraph()
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::SetModel(const std::shared_ptr<const ModelType>& model)
 {
-  std::cout << "CreateGraph()" << std::endl;
+  this->Model = model;
+}
 
-  // Add all of the nodes to the graph and store their IDs in a "node image"
-  itk::ImageRegionIterator<NodeImageType> nodeImageIterator(this->NodeImage,
-                                                            this->NodeImage->GetLargestPossibleRegion());
-  nodeImageIterator.GoToBegin();
+template <typename TImage, typename TPixelDifferenceFunctor>
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::ComputeHistograms()
+{
+  if(this->CustomLikelihood)
+  {
+    return;
+  }
 
-  unsigned int nodeId = 0;
-  while(!nodeImageIterator.IsAtEnd())
+  if(this->Model)
   {
-    nodeImageIterator.Set(nodeId);
-    nodeId++;
-    ++nodeImageIterator;
+    this->ForegroundHistogram = this->Model->GetForegroundHistogram();
+    this->BackgroundHistogram = this->Model->GetBackgroundHistogram();
+    return;
   }
 
-  // Set the sink and source ids to be the two numbers immediately following the number of vertices in the grid
-  this->SinkNodeId = nodeId;
-  nodeId++;
-  this->SourceNodeId = nodeId;
+  ScopedStageTimer timer(this->Statistics, SegmentationStatistics::CREATE_SAMPLES);
+  this->CreateSamples();
+}
+
+template <typename TImage, typename TPixelDifferenceFunctor>
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::SetNumberOfHistogramBins(int bins)
+{
+  this->NumberOfHistogramBins = bins;
+}
 
-  CreateNEdges();
-  CreateTEdges();
+template <typename TImage, typename TPixelDifferenceFunctor>
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::SetComputePackedSegmentMask(const bool computePackedSegmentMask)
+{
+  this->ComputePackedSegmentMask = computePackedSegmentMask;
+}
 
-  {
-  itk::Size<2> imageSize = this->NodeImage->GetLargestPossibleRegion().GetSize();
+template <typename TImage, typename TPixelDifferenceFunctor>
+const PackedForegroundBackgroundSegmentMask* ImageGraphCut<TImage, TPixelDifferenceFunctor>::GetPackedSegmentMask() const
+{
+  return &this->PackedResultingSegments;
+}
 
-  std::cout << "Number of edges " << num_edges(this->Graph) << std::endl;
-  int expectedEdges = imageSize[0]*imageSize[1] * 2 * 2 + // one '2' is because there is an edge to both the source and sink from each pixel, and the other '2' is because they are double edges (bidirectional)
-                      2*(imageSize[0]-1)*imageSize[1] + 2*imageSize[0]*(imageSize[1]-1); // both '2's are for the double edges (this is the number of horizontal edges + the number of vertical edges)
-  std::cout << "(Should be " << expectedEdges << " edges.)" << std::endl;
-  }
+template <typename TImage, typename TPixelDifferenceFunctor>
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::SetOutputBuffer(unsigned char* const buffer,
+                                                                     const unsigned char foregroundValue,
+                                                                     const unsigned char backgroundValue)
+{
+  this->OutputBuffer = buffer;
+  this->OutputForegroundValue = foregroundValue;
+  this->OutputBackgroundValue = backgroundValue;
 }
 
 template <typename TImage, typename TPixelDifferenceFunctor>
-double ImageGraphCut<TImage, TPixelDifferenceFunctor>::ComputeNoise()
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::SetIntegerCapacities(const bool integerCapacities,
+                                                                          const double scale)
 {
-  // Compute an estimate of the "camera noise". This is used in the N-weight function.
+  if(!(scale > 0))
+  {
+    std::stringstream ss;
+    ss << "The capacity scale must be positive (got " << scale << ")!";
+    throw std::runtime_error(ss.str());
+  }
 
-  // Since we use a 4-connected neighborhood, the kernel must be 3x3 (a rectangular radius of 1 creates a kernel side length of 3)
-  itk::Size<2> radius;
-  radius[0] = 1;
-  radius[1] = 1;
+  this->IntegerCapacities = integerCapacities;
+  this->CapacityScale = scale;
+}
 
-  typedef itk::ShapedNeighborhoodIterator<TImage> IteratorType;
+template <typename TImage, typename TPixelDifferenceFunctor>
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::SetGraphReduction(const bool graphReduction)
+{
+  this->GraphReduction = graphReduction;
+}
 
-  std::vector<typename IteratorType::OffsetType> neighbors;
-  typename IteratorType::OffsetType bottom = {{0,1}};
-  neighbors.push_back(bottom);
-  typename IteratorType::OffsetType right = {{1,0}};
-  neighbors.push_back(right);
+template <typename TImage, typename TPixelDifferenceFunctor>
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::SetEdgeMap(const EdgeMapType* const edgeMap)
+{
+  this->EdgeMap = edgeMap;
+}
 
-  typename IteratorType::OffsetType center = {{0,0}};
+template <typename TImage, typename TPixelDifferenceFunctor>
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::SetColorSpace(const ColorSpace colorSpace)
+{
+  this->SegmentationColorSpace = colorSpace;
+}
 
-  IteratorType iterator(radius, this->Image, this->Image->GetLargestPossibleRegion());
-  iterator.ClearActiveList();
-  iterator.ActivateOffset(bottom);
-  iterator.ActivateOffset(right);
-  iterator.ActivateOffset(center);
+template <typename TImage, typename TPixelDifferenceFunctor>
+TImage* ImageGraphCut<TImage, TPixelDifferenceFunctor>::ConvertColorSpace()
+{
+  if(this->SegmentationColorSpace == ColorSpace::RGB)
+  {
+    return nullptr;
+  }
 
-  double sigma = 0.0;
-  int numberOfEdges = 0;
+  ScopedStageTimer timer(this->Statistics, SegmentationStatistics::CONVERT_COLOR_SPACE);
+  this->CheckProgress(SegmentationStatistics::CONVERT_COLOR_SPACE, 0);
 
-  // Traverse the image collecting the differences between neighboring pixel intensities
-  for(iterator.GoToBegin(); !iterator.IsAtEnd(); ++iterator)
+  const itk::ImageRegion<2> region = this->Image->GetLargestPossibleRegion();
+  const unsigned int numberOfComponents = this->Image->GetNumberOfComponentsPerPixel();
+  if(!this->ConvertedImage || this->ConvertedImage->GetLargestPossibleRegion() != region ||
+     this->ConvertedImage->GetNumberOfComponentsPerPixel() != numberOfComponents)
   {
-    PixelType centerPixel = iterator.GetPixel(center);
+    this->ConvertedImage = TImage::New();
+    this->ConvertedImage->SetRegions(region);
+    this->ConvertedImage->SetNumberOfComponentsPerPixel(numberOfComponents);
+    this->ConvertedImage->Allocate();
+  }
 
-    for(unsigned int i = 0; i < neighbors.size(); i++)
-    {
-      bool valid;
-      iterator.GetPixel(neighbors[i], valid);
-      if(!valid)
-      {
-        continue;
-      }
+  ColorSpaceConverter converter(this->SegmentationColorSpace);
+  converter.Convert(this->Image->GetBufferPointer(), this->ConvertedImage->GetBufferPointer(),
+                    region.GetNumberOfPixels(), numberOfComponents, this->NumberOfThreadsInUse);
 
-      PixelType neighborPixel = iterator.GetPixel(neighbors[i]);
+  return this->ConvertedImage;
+}
 
-      float colorDifference = PixelDifferenceFunctor.Difference(centerPixel, neighborPixel);
-      sigma += colorDifference;
-      numberOfEdges++;
-    }
-  }
+template <typename TImage, typename TPixelDifferenceFunctor>
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::SetProgress(SegmentationProgress* const progress)
+{
+  this->Progress = progress;
+}
 
-  // Normalize
-  sigma /= static_cast<double>(numberOfEdges);
+template <typename TImage, typename TPixelDifferenceFunctor>
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::SetCutVerification(const bool cutVerification)
+{
+  this->CutVerification = cutVerification;
+}
 
-  return sigma;
+template <typename TImage, typename TPixelDifferenceFunctor>
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::SetDeadlineCut(const DeadlineCut deadlineCut)
+{
+  this->ForcedDeadlineCut = deadlineCut;
 }
 
 template <typename TImage, typename TPixelDifferenceFunctor>
-typename ImageGraphCut<TImage, TPixelDifferenceFunctor>::IndexContainer ImageGraphCut<TImage, TPixelDifferenceFunctor>::GetSources()
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::SetVerbosity(const unsigned int verbosity)
 {
-  return this->Sources;
+  this->Verbosity = verbosity;
 }
 
 template <typename TImage, typename TPixelDifferenceFunctor>
-void ImageGraphCut<TImage, TPixelDifferenceFunctor>::SetLambda(const float lambda)
+const SegmentationStatistics& ImageGraphCut<TImage, TPixelDifferenceFunctor>::GetStatistics() const
 {
-  this->Lambda = lambda;
+  return this->Statistics;
 }
 
 template <typename TImage, typename TPixelDifferenceFunctor>
-void ImageGraphCut<TImage, TPixelDifferenceFunctor>::SetNumberOfHistogramBins(int bins)
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::SetNumberOfThreads(const unsigned int numberOfThreads)
 {
-  this->NumberOfHistogramBins = bins;
+  this->NumberOfThreads = numberOfThreads;
 }
 
 template <typename TImage, typename TPixelDifferenceFunctor>
@@ -622,6 +2065,14 @@ void ImageGraphCut<TImage, TPixelDifferenceFunctor>::SetSinks(const IndexContain
   this->Sinks = sinks;
 }
 
+template <typename TImage, typename TPixelDifferenceFunctor>
+void ImageGraphCut<TImage, TPixelDifferenceFunctor>::SetSeedsFromMasks(
+    const ForegroundBackgroundSegmentMask* const sourceMask, const ForegroundBackgroundSegmentMask* const sinkMask)
+{
+  this->SourceSeedMask = sourceMask;
+  this->SinkSeedMask = sinkMask;
+}
+
 template <typename TImage, typename TPixelDifferenceFunctor>
 TImage* ImageGraphCut<TImage, TPixelDifferenceFunctor>::GetImage()
 {
@@ -0,0 +1,81 @@
+/*
+Copyright (C) 2012 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef ImageGraphCutModel_H
+#define ImageGraphCutModel_H
+
+// Custom
+#include "ColorSpaceConverter.h"
+
+// ITK
+#include "itkHistogram.h"
+
+/** The trained appearance model of a segmentation: the foreground and background histograms of the seeds, the
+  * weight Lambda between the regional and boundary terms and the color space of the histograms. A model is
+  * immutable once created, so any number of ImageGraphCut objects, on any number of threads, can share one (see
+  * ImageGraphCut::TrainModel() and ImageGraphCut::SetModel()). The lookups only read the histograms; their scratch
+  * space is passed in by the caller, one per thread.
+  */
+template <typename TImage>
+class ImageGraphCutModel
+{
+public:
+  typedef itk::Statistics::Histogram< float,
+          itk::Statistics::DenseFrequencyContainer2 > HistogramType;
+
+  typedef typename TImage::PixelType PixelType;
+
+  /** Reusable storage for the likelihood lookups, so that they do not allocate for every pixel. */
+  struct LikelihoodScratch
+  {
+    HistogramType::MeasurementVectorType MeasurementVector;
+    HistogramType::IndexType Index;
+  };
+
+  /** The model keeps a reference to the histograms, which must not be changed afterwards. The histograms are of
+    * pixels in 'colorSpace', so the model only segments in that color space. */
+  ImageGraphCutModel(const float lambda, const ColorSpace colorSpace, const HistogramType* const foregroundHistogram,
+                     const HistogramType* const backgroundHistogram);
+
+  float GetLambda() const;
+
+  ColorSpace GetColorSpace() const;
+
+  const HistogramType* GetForegroundHistogram() const;
+  const HistogramType* GetBackgroundHistogram() const;
+
+  /** The likelihoods that 'pixel' belongs to the foreground and to the background. */
+  float ForegroundLikelihood(const PixelType& pixel, LikelihoodScratch& scratch) const;
+  float BackgroundLikelihood(const PixelType& pixel, LikelihoodScratch& scratch) const;
+
+  /** The normalized frequency of the bin of 'histogram' that 'pixel' falls in. */
+  static float ComputeLikelihood(const HistogramType* const histogram, const PixelType& pixel,
+                                 LikelihoodScratch& scratch);
+
+private:
+  const float Lambda;
+
+  const ColorSpace HistogramColorSpace;
+
+  const HistogramType::ConstPointer ForegroundHistogram;
+  const HistogramType::ConstPointer BackgroundHistogram;
+};
+
+#include "ImageGraphCutModel.hpp"
+
+#endif
@@ -0,0 +1,87 @@
+/*
+Copyright (C) 2012 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef ImageGraphCutModel_HPP
+#define ImageGraphCutModel_HPP
+
+#include "ImageGraphCutModel.h"
+
+template <typename TImage>
+ImageGraphCutModel<TImage>::ImageGraphCutModel(const float lambda, const ColorSpace colorSpace,
+                                               const HistogramType* const foregroundHistogram,
+                                               const HistogramType* const backgroundHistogram) :
+  Lambda(lambda), HistogramColorSpace(colorSpace), ForegroundHistogram(foregroundHistogram),
+  BackgroundHistogram(backgroundHistogram)
+{
+}
+
+template <typename TImage>
+float ImageGraphCutModel<TImage>::GetLambda() const
+{
+  return this->Lambda;
+}
+
+template <typename TImage>
+ColorSpace ImageGraphCutModel<TImage>::GetColorSpace() const
+{
+  return this->HistogramColorSpace;
+}
+
+template <typename TImage>
+const typename ImageGraphCutModel<TImage>::HistogramType* ImageGraphCutModel<TImage>::GetForegroundHistogram() const
+{
+  return this->ForegroundHistogram;
+}
+
+template <typename TImage>
+const typename ImageGraphCutModel<TImage>::HistogramType* ImageGraphCutModel<TImage>::GetBackgroundHistogram() const
+{
+  return this->BackgroundHistogram;
+}
+
+template <typename TImage>
+float ImageGraphCutModel<TImage>::ForegroundLikelihood(const PixelType& pixel, LikelihoodScratch& scratch) const
+{
+  return ComputeLikelihood(this->ForegroundHistogram, pixel, scratch);
+}
+
+template <typename TImage>
+float ImageGraphCutModel<TImage>::BackgroundLikelihood(const PixelType& pixel, LikelihoodScratch& scratch) const
+{
+  return ComputeLikelihood(this->BackgroundHistogram, pixel, scratch);
+}
+
+template <typename TImage>
+float ImageGraphCutModel<TImage>::ComputeLikelihood(const HistogramType* const histogram, const PixelType& pixel,
+                                                    LikelihoodScratch& scratch)
+{
+  scratch.MeasurementVector.SetSize(pixel.Size());
+  for(unsigned int i = 0; i < pixel.Size(); i++)
+  {
+    scratch.MeasurementVector[i] = pixel[i];
+  }
+
+  histogram->GetIndex(scratch.MeasurementVector, scratch.Index);
+  float histogramValue = histogram->GetFrequency(scratch.Index);
+
+  histogramValue /= histogram->GetTotalFrequency();
+
+  return histogramValue;
+}
+
+#endif
@@ -0,0 +1,145 @@
+/*
+Copyright (C) 2012 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MappedBuffer.h"
+
+// STL
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+// POSIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedBuffer MappedBuffer::OpenSharedMemory(const std::string& name, const Mode mode)
+{
+  int fileDescriptor = shm_open(name.c_str(), mode == Mode::SHARED ? O_RDWR : O_RDONLY, 0);
+  if(fileDescriptor < 0)
+  {
+    std::stringstream ss;
+    ss << "Cannot open shared memory object " << name << ": " << std::strerror(errno);
+    throw std::runtime_error(ss.str());
+  }
+
+  MappedBuffer buffer;
+  buffer.Map(fileDescriptor, name, mode);
+  return buffer;
+}
+
+MappedBuffer MappedBuffer::OpenFile(const std::string& filename, const Mode mode)
+{
+  int fileDescriptor = open(filename.c_str(), mode == Mode::SHARED ? O_RDWR : O_RDONLY);
+  if(fileDescriptor < 0)
+  {
+    std::stringstream ss;
+    ss << "Cannot open " << filename << ": " << std::strerror(errno);
+    throw std::runtime_error(ss.str());
+  }
+
+  MappedBuffer buffer;
+  buffer.Map(fileDescriptor, filename, mode);
+  return buffer;
+}
+
+MappedBuffer MappedBuffer::Allocate(const std::size_t size)
+{
+  MappedBuffer buffer;
+  if(size == 0)
+  {
+    return buffer;
+  }
+
+  void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(data == MAP_FAILED)
+  {
+    std::stringstream ss;
+    ss << "Cannot allocate " << size << " bytes: " << std::strerror(errno);
+    throw std::runtime_error(ss.str());
+  }
+
+  buffer.Data = static_cast<char*>(data);
+  buffer.Size = size;
+  return buffer;
+}
+
+void MappedBuffer::Map(const int fileDescriptor, const std::string& name, const Mode mode)
+{
+  // The mapping stays valid after the file descriptor is closed.
+  struct stat status;
+  if(fstat(fileDescriptor, &status) != 0)
+  {
+    close(fileDescriptor);
+    std::stringstream ss;
+    ss << "Cannot determine the size of " << name << ": " << std::strerror(errno);
+    throw std::runtime_error(ss.str());
+  }
+
+  this->Size = static_cast<std::size_t>(status.st_size);
+  if(this->Size == 0)
+  {
+    close(fileDescriptor);
+    return;
+  }
+
+  void* data = mmap(nullptr, this->Size, PROT_READ | PROT_WRITE,
+                    mode == Mode::SHARED ? MAP_SHARED : MAP_PRIVATE, fileDescriptor, 0);
+  close(fileDescriptor);
+  if(data == MAP_FAILED)
+  {
+    this->Size = 0;
+    std::stringstream ss;
+    ss << "Cannot map " << name << ": " << std::strerror(errno);
+    throw std::runtime_error(ss.str());
+  }
+
+  this->Data = static_cast<char*>(data);
+}
+
+void MappedBuffer::Unmap()
+{
+  if(this->Data)
+  {
+    munmap(this->Data, this->Size);
+  }
+  this->Data = nullptr;
+  this->Size = 0;
+}
+
+MappedBuffer::~MappedBuffer()
+{
+  this->Unmap();
+}
+
+MappedBuffer::MappedBuffer(MappedBuffer&& other) : Data(other.Data), Size(other.Size)
+{
+  other.Data = nullptr;
+  other.Size = 0;
+}
+
+MappedBuffer& MappedBuffer::operator=(MappedBuffer&& other)
+{
+  if(this != &other)
+  {
+    this->Unmap();
+    std::swap(this->Data, other.Data);
+    std::swap(this->Size, other.Size);
+  }
+  return *this;
+}
@@ -0,0 +1,95 @@
+/*
+Copyright (C) 2012 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MappedBuffer_H
+#define MappedBuffer_H
+
+// ITK
+#include "itkVectorImage.h"
+
+// STL
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/** A POSIX shared memory object or a file mapped into memory. The mapping is released when the object is
+  * destroyed, so it must outlive every image created from it with CreateVectorImage().
+  *
+  * With COPY_ON_WRITE the pages are mapped privately: writes through the mapping are never seen by
+  * other processes or written to the file. This is the mode for inputs, since it protects the source
+  * from the (rare) code that writes to its input image. With SHARED writes go to the object or file,
+  * which is the mode for buffers that receive an output.
+  */
+class MappedBuffer
+{
+public:
+  enum class Mode {COPY_ON_WRITE, SHARED};
+
+  /** Map the POSIX shared memory object 'name' (as passed to shm_open()). */
+  static MappedBuffer OpenSharedMemory(const std::string& name, const Mode mode = Mode::COPY_ON_WRITE);
+
+  /** Map the file 'filename'. */
+  static MappedBuffer OpenFile(const std::string& filename, const Mode mode = Mode::COPY_ON_WRITE);
+
+  /** Map 'size' bytes of private, zero filled memory that is not backed by any file. */
+  static MappedBuffer Allocate(const std::size_t size);
+
+  MappedBuffer(){}
+  ~MappedBuffer();
+
+  MappedBuffer(MappedBuffer&& other);
+  MappedBuffer& operator=(MappedBuffer&& other);
+
+  MappedBuffer(const MappedBuffer&) = delete;
+  MappedBuffer& operator=(const MappedBuffer&) = delete;
+
+  /** Get the mapped bytes. */
+  char* GetData() const
+  {
+    return this->Data;
+  }
+
+  /** Get the number of mapped bytes. */
+  std::size_t GetSize() const
+  {
+    return this->Size;
+  }
+
+  /** Create an image that uses the mapped pixels at 'offset' as its buffer (nothing is copied).
+    * The pixels must be stored interleaved in buffer order, i.e. 'numberOfComponents' values of
+    * TComponent per pixel, row by row. */
+  template <typename TComponent>
+  typename itk::VectorImage<TComponent, 2>::Pointer CreateVectorImage(const itk::Size<2>& size,
+                                                                      const unsigned int numberOfComponents,
+                                                                      const std::size_t offset = 0) const;
+
+  /** Get a pointer to 'numberOfElements' values of T at 'offset', or throw if they are not all mapped. */
+  template <typename T>
+  T* GetPointer(const std::size_t offset, const std::size_t numberOfElements) const;
+
+private:
+  void Map(const int fileDescriptor, const std::string& name, const Mode mode);
+
+  void Unmap();
+
+  char* Data = nullptr;
+  std::size_t Size = 0;
+};
+
+#include "MappedBuffer.hpp"
+
+#endif
@@ -0,0 +1,81 @@
+/*
+Copyright (C) 2012 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MappedBuffer_HPP
+#define MappedBuffer_HPP
+
+#include "MappedBuffer.h"
+
+// STL
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+template <typename T>
+T* MappedBuffer::GetPointer(const std::size_t offset, const std::size_t numberOfElements) const
+{
+  if(offset > this->Size || numberOfElements > (this->Size - offset) / sizeof(T))
+  {
+    std::stringstream ss;
+    ss << numberOfElements << " elements of " << sizeof(T) << " bytes at offset " << offset
+       << " do not fit in the " << this->Size << " mapped bytes!";
+    throw std::runtime_error(ss.str());
+  }
+
+  // The mapping itself is page aligned, so only the offset can break the alignment.
+  if(offset % alignof(T) != 0)
+  {
+    std::stringstream ss;
+    ss << "Offset " << offset << " is not aligned for elements of " << sizeof(T) << " bytes!";
+    throw std::runtime_error(ss.str());
+  }
+
+  return reinterpret_cast<T*>(this->Data + offset);
+}
+
+template <typename TComponent>
+typename itk::VectorImage<TComponent, 2>::Pointer MappedBuffer::CreateVectorImage(const itk::Size<2>& size,
+                                                                                  const unsigned int numberOfComponents,
+                                                                                  const std::size_t offset) const
+{
+  typedef itk::VectorImage<TComponent, 2> ImageType;
+
+  // The size usually comes from a request or a header, so the number of values must not wrap around.
+  const std::size_t maximumNumberOfValues = std::numeric_limits<std::size_t>::max();
+  if((size[0] > 0 && size[1] > maximumNumberOfValues / size[0]) ||
+     (numberOfComponents > 0 && size[0] * size[1] > maximumNumberOfValues / numberOfComponents))
+  {
+    std::stringstream ss;
+    ss << "An image of size " << size << " with " << numberOfComponents << " components is too large!";
+    throw std::runtime_error(ss.str());
+  }
+
+  itk::ImageRegion<2> region(size);
+  const std::size_t numberOfValues = region.GetNumberOfPixels() * numberOfComponents;
+  TComponent* const pixels = this->GetPointer<TComponent>(offset, numberOfValues);
+
+  typename ImageType::Pointer image = ImageType::New();
+  image->SetRegions(region);
+  image->SetNumberOfComponentsPerPixel(numberOfComponents);
+
+  // The container does not own the memory, so it does not free it when the image is destroyed.
+  image->GetPixelContainer()->SetImportPointer(pixels, numberOfValues, false);
+
+  return image;
+}
+
+#endif
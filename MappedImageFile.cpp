@@ -0,0 +1,308 @@
+/*
+Copyright (C) 2012 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MappedImageFile.h"
+
+// STL
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <utility>
+
+namespace
+{
+  typedef itk::ImageIOBase::IOComponentType IOComponentType;
+
+  /** Remove leading and trailing whitespace. */
+  std::string Trim(const std::string& s)
+  {
+    std::size_t first = s.find_first_not_of(" \t\r\n");
+    if(first == std::string::npos)
+    {
+      return "";
+    }
+    std::size_t last = s.find_last_not_of(" \t\r\n");
+    return s.substr(first, last - first + 1);
+  }
+
+  bool IsTrue(const std::string& value)
+  {
+    return value == "True" || value == "true" || value == "1";
+  }
+
+  bool IsLittleEndianMachine()
+  {
+    const std::uint16_t one = 1;
+    unsigned char firstByte;
+    std::memcpy(&firstByte, &one, 1);
+    return firstByte == 1;
+  }
+
+  IOComponentType GetComponentTypeFromMetaElementType(const std::string& elementType)
+  {
+    static const std::map<std::string, IOComponentType> componentTypes = {
+      {"MET_UCHAR", IOComponentType::UCHAR}, {"MET_CHAR", IOComponentType::CHAR},
+      {"MET_USHORT", IOComponentType::USHORT}, {"MET_SHORT", IOComponentType::SHORT},
+      {"MET_UINT", IOComponentType::UINT}, {"MET_INT", IOComponentType::INT},
+      {"MET_FLOAT", IOComponentType::FLOAT}, {"MET_DOUBLE", IOComponentType::DOUBLE}};
+
+    std::map<std::string, IOComponentType>::const_iterator iterator = componentTypes.find(elementType);
+    if(iterator == componentTypes.end())
+    {
+      throw std::runtime_error("Unsupported MetaImage ElementType " + elementType + "!");
+    }
+    return iterator->second;
+  }
+
+  /** Parse the values of a header field such as "DimSize = 512 512" into 'values'. */
+  template <typename T>
+  void ParseValues(const std::string& key, const std::string& value, T* const values, const unsigned int numberOfValues)
+  {
+    std::stringstream ss(value);
+    for(unsigned int i = 0; i < numberOfValues; ++i)
+    {
+      ss >> values[i];
+    }
+    if(ss.fail())
+    {
+      throw std::runtime_error("Invalid MetaImage " + key + " = " + value);
+    }
+  }
+}
+
+MappedImageFile MappedImageFile::OpenMetaImage(const std::string& filename)
+{
+  std::ifstream fin(filename.c_str(), std::ios::binary);
+  if(!fin)
+  {
+    std::stringstream ss;
+    ss << "Cannot open " << filename << "!";
+    throw std::runtime_error(ss.str());
+  }
+
+  MappedImageFile imageFile;
+  std::string dataFilename;
+  long long headerSize = 0;
+  bool msb = false;
+
+  // The header is "Key = Value" lines, and ElementDataFile is always the last one.
+  std::string line;
+  while(dataFilename.empty() && getline(fin, line))
+  {
+    std::size_t equals = line.find('=');
+    if(equals == std::string::npos)
+    {
+      continue;
+    }
+
+    std::string key = Trim(line.substr(0, equals));
+    std::string value = Trim(line.substr(equals + 1));
+
+    if(key == "NDims")
+    {
+      if(value != "2")
+      {
+        throw std::runtime_error(filename + " is not a 2D image (NDims = " + value + ")!");
+      }
+    }
+    else if(key == "DimSize")
+    {
+      ParseValues(key, value, &imageFile.Size[0], 2);
+    }
+    else if(key == "ElementType")
+    {
+      imageFile.ComponentType = GetComponentTypeFromMetaElementType(value);
+    }
+    else if(key == "ElementNumberOfChannels")
+    {
+      ParseValues(key, value, &imageFile.NumberOfComponents, 1);
+    }
+    else if(key == "ElementSpacing")
+    {
+      ParseValues(key, value, imageFile.Spacing, 2);
+    }
+    else if(key == "Offset" || key == "Origin" || key == "Position")
+    {
+      ParseValues(key, value, imageFile.Origin, 2);
+    }
+    else if(key == "HeaderSize")
+    {
+      ParseValues(key, value, &headerSize, 1);
+    }
+    else if(key == "BinaryDataByteOrderMSB" || key == "ElementByteOrderMSB")
+    {
+      msb = IsTrue(value);
+    }
+    else if(key == "CompressedData")
+    {
+      if(IsTrue(value))
+      {
+        throw std::runtime_error(filename + " is compressed and cannot be memory mapped!");
+      }
+    }
+    else if(key == "BinaryData")
+    {
+      if(!IsTrue(value))
+      {
+        throw std::runtime_error(filename + " has ASCII data and cannot be memory mapped!");
+      }
+    }
+    else if(key == "ElementDataFile")
+    {
+      dataFilename = value;
+    }
+  }
+
+  if(dataFilename.empty() || imageFile.Size[0] == 0 || imageFile.Size[1] == 0)
+  {
+    throw std::runtime_error(filename + " is not a valid MetaImage (no ElementDataFile or DimSize)!");
+  }
+
+  if(msb != !IsLittleEndianMachine() && imageFile.GetComponentSize() > 1)
+  {
+    throw std::runtime_error(filename + " is not in the byte order of this machine and cannot be memory mapped!");
+  }
+
+  if(dataFilename == "LOCAL")
+  {
+    // The data follows the header line.
+    imageFile.DataOffset = static_cast<std::size_t>(fin.tellg());
+    imageFile.MapData(filename);
+    return imageFile;
+  }
+
+  if(dataFilename == "LIST" || dataFilename.find('%') != std::string::npos)
+  {
+    throw std::runtime_error(filename + ": data split over several files cannot be memory mapped!");
+  }
+
+  // A relative data file is relative to the header. HeaderSize = -1 means the data is at the end of the file.
+  std::size_t slash = filename.find_last_of('/');
+  if(dataFilename[0] != '/' && slash != std::string::npos)
+  {
+    dataFilename = filename.substr(0, slash + 1) + dataFilename;
+  }
+
+  if(headerSize >= 0)
+  {
+    imageFile.DataOffset = static_cast<std::size_t>(headerSize);
+    imageFile.MapData(dataFilename);
+  }
+  else
+  {
+    imageFile.Buffer = MappedBuffer::OpenFile(dataFilename);
+    const std::size_t dataSize = imageFile.GetDataSize();
+    if(dataSize > imageFile.Buffer.GetSize())
+    {
+      throw std::runtime_error(dataFilename + " is too small for the image!");
+    }
+    imageFile.DataOffset = imageFile.Buffer.GetSize() - dataSize;
+    imageFile.AlignData();
+  }
+
+  return imageFile;
+}
+
+MappedImageFile MappedImageFile::OpenRaw(const std::string& filename, const itk::Size<2>& size,
+                                         const unsigned int numberOfComponents,
+                                         const itk::ImageIOBase::IOComponentType componentType,
+                                         const std::size_t headerSize)
+{
+  MappedImageFile imageFile;
+  imageFile.Size = size;
+  imageFile.NumberOfComponents = numberOfComponents;
+  imageFile.ComponentType = componentType;
+  imageFile.DataOffset = headerSize;
+  imageFile.GetComponentSize(); // Throws for unsupported component types
+  imageFile.MapData(filename);
+  return imageFile;
+}
+
+void MappedImageFile::MapData(const std::string& dataFilename)
+{
+  this->Buffer = MappedBuffer::OpenFile(dataFilename);
+
+  const std::size_t dataSize = this->GetDataSize();
+  if(this->DataOffset > this->Buffer.GetSize() || dataSize > this->Buffer.GetSize() - this->DataOffset)
+  {
+    std::stringstream ss;
+    ss << dataFilename << " is too small for a " << this->Size << " image with " << this->NumberOfComponents
+       << " components of " << this->GetComponentSize() << " bytes at offset " << this->DataOffset << "!";
+    throw std::runtime_error(ss.str());
+  }
+
+  this->AlignData();
+}
+
+void MappedImageFile::AlignData()
+{
+  // The mapping is page aligned, so only the offset can misalign the components.
+  if(this->DataOffset % this->GetComponentSize() == 0)
+  {
+    return;
+  }
+
+  const std::size_t dataSize = this->GetDataSize();
+  MappedBuffer alignedBuffer = MappedBuffer::Allocate(dataSize);
+  std::memcpy(alignedBuffer.GetData(), this->Buffer.GetData() + this->DataOffset, dataSize);
+
+  this->Buffer = std::move(alignedBuffer);
+  this->DataOffset = 0;
+}
+
+std::size_t MappedImageFile::GetComponentSize() const
+{
+  switch(this->ComponentType)
+  {
+    case IOComponentType::UCHAR:
+    case IOComponentType::CHAR:
+      return 1;
+    case IOComponentType::USHORT:
+    case IOComponentType::SHORT:
+      return 2;
+    case IOComponentType::UINT:
+    case IOComponentType::INT:
+    case IOComponentType::FLOAT:
+      return 4;
+    case IOComponentType::DOUBLE:
+      return 8;
+    default:
+      throw std::runtime_error("Unsupported component type " +
+                               itk::ImageIOBase::GetComponentTypeAsString(this->ComponentType) + "!");
+  }
+}
+
+std::size_t MappedImageFile::GetDataSize() const
+{
+  // The size comes from a header, so the product must not wrap around and pass the size checks of the file.
+  const std::size_t factors[4] = {this->Size[0], this->Size[1], this->NumberOfComponents, this->GetComponentSize()};
+  std::size_t dataSize = 1;
+  for(const std::size_t factor : factors)
+  {
+    if(factor > 0 && dataSize > std::numeric_limits<std::size_t>::max() / factor)
+    {
+      std::stringstream ss;
+      ss << "A " << this->Size << " image with " << this->NumberOfComponents << " components of "
+         << this->GetComponentSize() << " bytes is too large!";
+      throw std::runtime_error(ss.str());
+    }
+    dataSize *= factor;
+  }
+  return dataSize;
+}
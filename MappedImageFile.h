@@ -0,0 +1,112 @@
+/*
+Copyright (C) 2012 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MappedImageFile_H
+#define MappedImageFile_H
+
+#include "MappedBuffer.h"
+
+// ITK
+#include "itkImageIOBase.h"
+#include "itkVectorImage.h"
+
+// STL
+#include <string>
+
+/** A 2D image file whose pixels are memory mapped instead of read. Opening the file only parses the
+  * header, and the pixels are paged in from the file when they are first accessed. This makes opening
+  * a very large image nearly free, and segmenting a band of rows (see GetRows()) only touches the pages of
+  * those rows.
+  *
+  * Supported files are uncompressed MetaImages (.mha with local data, .mhd with a separate data file) and
+  * raw files with a known layout. The data must be in the byte order of this machine and the pixels
+  * must be interleaved. The images share the mapping, so they must not be used after this object is
+  * destroyed. The mapping is copy-on-write, so writing to an image never changes the file.
+  *
+  * The components must be aligned in memory, which the header of a .mha usually breaks: it ends wherever its
+  * text ends. When the pixels do not start at a multiple of the component size, they are copied into memory
+  * when the file is opened, which reads the whole image. A .mhd (or a raw file with an aligned header) is
+  * always mapped.
+  */
+class MappedImageFile
+{
+public:
+  /** Open an uncompressed 2D MetaImage (.mha or .mhd). */
+  static MappedImageFile OpenMetaImage(const std::string& filename);
+
+  /** Open a raw file whose pixels start after 'headerSize' bytes. */
+  static MappedImageFile OpenRaw(const std::string& filename, const itk::Size<2>& size,
+                                 const unsigned int numberOfComponents,
+                                 const itk::ImageIOBase::IOComponentType componentType,
+                                 const std::size_t headerSize = 0);
+
+  /** Get the component type of the pixels. GetImage() and GetRows() must be called with the matching type. */
+  itk::ImageIOBase::IOComponentType GetComponentType() const
+  {
+    return this->ComponentType;
+  }
+
+  unsigned int GetNumberOfComponentsPerPixel() const
+  {
+    return this->NumberOfComponents;
+  }
+
+  const itk::Size<2>& GetSize() const
+  {
+    return this->Size;
+  }
+
+  /** Create an image over the mapped pixels (nothing is read or copied). */
+  template <typename TComponent>
+  typename itk::VectorImage<TComponent, 2>::Pointer GetImage() const;
+
+  /** Create an image over rows [firstRow, firstRow + numberOfRows) of the mapped pixels.
+    * The rows are contiguous in the file, so this needs no copy either. The image starts at index (0, 0),
+    * and its origin is the physical position of the first row. */
+  template <typename TComponent>
+  typename itk::VectorImage<TComponent, 2>::Pointer GetRows(const itk::SizeValueType firstRow,
+                                                             const itk::SizeValueType numberOfRows) const;
+
+private:
+  MappedImageFile(){}
+
+  /** Map 'dataFilename' and verify that it has room for the pixels at DataOffset. */
+  void MapData(const std::string& dataFilename);
+
+  /** Copy the pixels to the start of an allocated buffer if DataOffset is not aligned for the components. */
+  void AlignData();
+
+  /** Get the size of one component in bytes. */
+  std::size_t GetComponentSize() const;
+
+  /** Get the size of the pixels in bytes. Throws if it does not fit in a std::size_t. */
+  std::size_t GetDataSize() const;
+
+  MappedBuffer Buffer;
+  std::size_t DataOffset = 0;
+
+  itk::Size<2> Size = {{0, 0}};
+  unsigned int NumberOfComponents = 1;
+  itk::ImageIOBase::IOComponentType ComponentType = itk::ImageIOBase::IOComponentType::UCHAR;
+
+  double Spacing[2] = {1.0, 1.0};
+  double Origin[2] = {0.0, 0.0};
+};
+
+#include "MappedImageFile.hpp"
+
+#endif
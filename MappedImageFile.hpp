@@ -0,0 +1,70 @@
+/*
+Copyright (C) 2012 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MappedImageFile_HPP
+#define MappedImageFile_HPP
+
+#include "MappedImageFile.h"
+
+// STL
+#include <sstream>
+#include <stdexcept>
+
+template <typename TComponent>
+typename itk::VectorImage<TComponent, 2>::Pointer MappedImageFile::GetImage() const
+{
+  return this->GetRows<TComponent>(0, this->Size[1]);
+}
+
+template <typename TComponent>
+typename itk::VectorImage<TComponent, 2>::Pointer MappedImageFile::GetRows(const itk::SizeValueType firstRow,
+                                                                            const itk::SizeValueType numberOfRows) const
+{
+  if(itk::ImageIOBase::MapPixelType<TComponent>::CType != this->ComponentType)
+  {
+    std::stringstream ss;
+    ss << "The mapped image has components of type "
+       << itk::ImageIOBase::GetComponentTypeAsString(this->ComponentType) << ", not "
+       << itk::ImageIOBase::GetComponentTypeAsString(itk::ImageIOBase::MapPixelType<TComponent>::CType) << "!";
+    throw std::runtime_error(ss.str());
+  }
+
+  if(firstRow > this->Size[1] || numberOfRows > this->Size[1] - firstRow)
+  {
+    std::stringstream ss;
+    ss << "Rows " << firstRow << " to " << firstRow + numberOfRows << " are outside of the image of size "
+       << this->Size << "!";
+    throw std::runtime_error(ss.str());
+  }
+
+  const std::size_t rowSize = this->Size[0] * this->NumberOfComponents * sizeof(TComponent);
+
+  itk::Size<2> size = {{this->Size[0], numberOfRows}};
+  typename itk::VectorImage<TComponent, 2>::Pointer image =
+      this->Buffer.CreateVectorImage<TComponent>(size, this->NumberOfComponents,
+                                                 this->DataOffset + firstRow * rowSize);
+
+  // The rows start at index 0 (so seed masks and outputs are simply the size of the band), but the
+  // origin is moved so that the pixels keep their physical positions in the full image.
+  double origin[2] = {this->Origin[0], this->Origin[1] + firstRow * this->Spacing[1]};
+  image->SetSpacing(this->Spacing);
+  image->SetOrigin(origin);
+
+  return image;
+}
+
+#endif
@@ -17,6 +17,7 @@
  *=========================================================================*/
 
 #include "ForegroundBackgroundSegmentMask.h"
+#include "ForegroundBackgroundSegmentMaskRLE.h"
 
 // Submodules
 #include "ITKHelpers/Helpers/Helpers.h"
@@ -38,12 +39,20 @@ void ForegroundBackgroundSegmentMask::Read(const std::string& filename)
    *
    * That is, the "foreground [VALUE]" line can be either on the first or second line.
    * Note that the 0 and 255 here are arbitrary and can be anything.
+   *
+   * .fbrle files are binary run-length encoded masks (see ForegroundBackgroundSegmentMaskRLE.h).
    */
   std::string extension = Helpers::GetFileExtension(filename);
+  if(extension == "fbrle")
+  {
+    ForegroundBackgroundSegmentMaskRLE::Read(filename, this);
+    return;
+  }
+
   if(extension != "fbmask")
   {
     std::stringstream ss;
-    ss << "Cannot read files with extension other than .fbmask! Specified file had extension ." << extension
+    ss << "Cannot read files with extension other than .fbmask or .fbrle! Specified file had extension ." << extension
        << " You might want ReadFromImage instead.";
     throw std::runtime_error(ss.str());
   }
@@ -128,6 +137,22 @@ void ForegroundBackgroundSegmentMask::Read(const std::string& filename)
 }
 
 
+void ForegroundBackgroundSegmentMask::WriteRLE(const std::string& filename) const
+{
+  ForegroundBackgroundSegmentMaskRLE::Write(this, filename);
+}
+
+void ForegroundBackgroundSegmentMask::VerifySameSize(const itk::ImageBase<2>* const image) const
+{
+  if(image->GetLargestPossibleRegion().GetSize() != this->GetLargestPossibleRegion().GetSize())
+  {
+    std::stringstream ss;
+    ss << "The image (size " << image->GetLargestPossibleRegion().GetSize()
+       << ") must have the same size as the mask (size " << this->GetLargestPossibleRegion().GetSize() << ")!";
+    throw std::runtime_error(ss.str());
+  }
+}
+
 bool ForegroundBackgroundSegmentMask::IsForeground(const itk::Index<2>& index) const
 {
   if(this->GetPixel(index) == ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND)
@@ -146,22 +171,35 @@ bool ForegroundBackgroundSegmentMask::IsBackground(const itk::Index<2>& index) c
   return false;
 }
 
-unsigned int ForegroundBackgroundSegmentMask::CountForegroundPixels() const
+std::size_t ForegroundBackgroundSegmentMask::CountPixelsWithValue(
+    const ForegroundBackgroundSegmentMaskPixelTypeEnum value) const
 {
-  std::vector<itk::Index<2> > foregroundPixels =
-      ITKHelpers::GetPixelsWithValueInRegion(this, this->GetLargestPossibleRegion(),
-                                             ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND);
-
-  return foregroundPixels.size();
+  // A streaming reduction over the buffer: each thread counts its chunk and adds it to the total once.
+  const ForegroundBackgroundSegmentMaskPixelTypeEnum* const buffer = this->GetBufferPointer();
+  std::atomic<std::size_t> count(0);
+
+  ParallelFor(0, this->GetLargestPossibleRegion().GetNumberOfPixels(),
+              [buffer, value, &count](const std::size_t begin, const std::size_t end)
+              {
+                std::size_t chunkCount = 0;
+                for(std::size_t i = begin; i < end; ++i)
+                {
+                  chunkCount += (buffer[i] == value);
+                }
+                count += chunkCount;
+              });
+
+  return count;
 }
 
-unsigned int ForegroundBackgroundSegmentMask::CountBackgroundPixels() const
+std::size_t ForegroundBackgroundSegmentMask::CountForegroundPixels() const
 {
-  std::vector<itk::Index<2> > backgroundPixels =
-      ITKHelpers::GetPixelsWithValueInRegion(this, this->GetLargestPossibleRegion(),
-                                             ForegroundBackgroundSegmentMaskPixelTypeEnum::BACKGROUND);
+  return this->CountPixelsWithValue(ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND);
+}
 
-  return backgroundPixels.size();
+std::size_t ForegroundBackgroundSegmentMask::CountBackgroundPixels() const
+{
+  return this->CountPixelsWithValue(ForegroundBackgroundSegmentMaskPixelTypeEnum::BACKGROUND);
 }
 
 std::ostream& operator<<(std::ostream& output,
@@ -32,6 +32,11 @@
 
 // ITK
 #include "itkImage.h"
+#include "itkVectorImage.h"
+
+// STL
+#include <cstddef>
+#include <vector>
 
 /** The pixels in the mask have only these possible values. */
 enum class ForegroundBackgroundSegmentMaskPixelTypeEnum {FOREGROUND, BACKGROUND};
@@ -41,6 +46,13 @@ enum class ForegroundBackgroundSegmentMaskPixelTypeEnum {FOREGROUND, BACKGROUND}
 std::ostream& operator<<(std::ostream& output, const ForegroundBackgroundSegmentMaskPixelTypeEnum &pixelType);
 
 
+/** How ReadFromImage() treats pixels whose value is neither the foreground nor the background value.
+  * EXACT:     such pixels are set to BACKGROUND and counted as unknown pixels.
+  * NEAREST:   such pixels get the label of whichever of the two values is closer (ties go to BACKGROUND).
+  *            This is the natural choice for anti-aliased masks.
+  * THRESHOLD: pixels on the foreground value's side of a threshold (inclusive) are FOREGROUND, all others BACKGROUND. */
+enum class ForegroundBackgroundSegmentMaskReadPolicy {EXACT, NEAREST, THRESHOLD};
+
 /** This class forces us to pass functions values as ForegroundValueWrapper(0) instead of just "0"
   * so that we can be sure that a foreground value is getting passed where a foreground value is expected,
   * and not accidentally confuse the order of foreground/background arguments silently. */
@@ -120,29 +132,69 @@ public:
   /** Determine if a pixel is a background pixel.*/
   bool IsBackground(const itk::Index<2>& index) const;
 
+  /** Read the mask from an image, where pixels equal to 'foregroundValue' are foreground and pixels equal to
+    * 'backgroundValue' are background. Other pixels are set to background and reported in a single warning. */
   template <typename TPixel>
   void ReadFromImage(const std::string& filename, const ForegroundPixelValueWrapper<TPixel>& foregroundValue,
                      const BackgroundPixelValueWrapper<TPixel>& backgroundValue);
 
+  /** Read the mask from an image, handling pixels that are neither the foreground nor the background value
+    * according to 'policy' ('threshold' is only used by ForegroundBackgroundSegmentMaskReadPolicy::THRESHOLD).
+    * The image is read in the component type of the file and converted in one pass over its buffer.
+    * Return the number of pixels that were neither value (always 0 unless the policy is EXACT). */
+  template <typename TPixel>
+  std::size_t ReadFromImage(const std::string& filename, const ForegroundPixelValueWrapper<TPixel>& foregroundValue,
+                            const BackgroundPixelValueWrapper<TPixel>& backgroundValue,
+                            const ForegroundBackgroundSegmentMaskReadPolicy policy,
+                            const double threshold = 0);
+
+  /** Write the mask as an image with 'foregroundValue' and 'backgroundValue' pixels. */
   template <typename TPixel>
   void Write(const std::string& filename, const ForegroundPixelValueWrapper<TPixel>& foregroundValue,
              const BackgroundPixelValueWrapper<TPixel>& backgroundValue);
 
+  /** Set the pixels of 'image' that are background in the mask to 'backgroundValue'.
+    * 'image' must have the same size as the mask. */
   template <typename TImage>
   void ApplyToImage(TImage* image,
                     const typename TImage::PixelType& backgroundValue);
 
-  /** Read the mask from a .mask file.*/
+  /** Create a cut-out of 'image' with an alpha channel: 'output' gets the channels of 'image'
+    * followed by a channel that is 'foregroundAlpha' for foreground pixels and 'backgroundAlpha'
+    * for background pixels. 'image' must have the same size as the mask. */
+  template <typename TComponent>
+  void ApplyToImageAsAlpha(const itk::VectorImage<TComponent, 2>* const image,
+                           itk::VectorImage<TComponent, 2>* const output,
+                           const TComponent foregroundAlpha, const TComponent backgroundAlpha) const;
+
+  /** Read the mask from a .fbmask file or a run-length encoded .fbrle file.*/
   void Read(const std::string& filename);
 
+  /** Write the mask as a run-length encoded .fbrle file (see ForegroundBackgroundSegmentMaskRLE.h).
+    * This is much faster and smaller than writing an image. */
+  void WriteRLE(const std::string& filename) const;
+
   /** Count foreground pixels in the whole mask.*/
-  unsigned int CountForegroundPixels() const;
+  std::size_t CountForegroundPixels() const;
 
   /** Count background pixels in the whole mask.*/
-  unsigned int CountBackgroundPixels() const;
+  std::size_t CountBackgroundPixels() const;
 
 private:
 
+  /** Count the pixels of the whole mask that have 'value', without building a list of them. */
+  std::size_t CountPixelsWithValue(const ForegroundBackgroundSegmentMaskPixelTypeEnum value) const;
+
+  /** Throw if 'image' does not have the same size as the mask. */
+  void VerifySameSize(const itk::ImageBase<2>* const image) const;
+
+  /** Read the image 'filename' as an image of 'TComponent' and convert it to the mask. */
+  template <typename TComponent>
+  std::size_t ReadFromImageWithComponentType(const std::string& filename, const double foregroundValue,
+                                             const double backgroundValue,
+                                             const ForegroundBackgroundSegmentMaskReadPolicy policy,
+                                             const double threshold);
+
   ForegroundBackgroundSegmentMask(const Self &);    //purposely not implemented
   void operator=(const Self &); //purposely not implemented
 
@@ -21,17 +21,46 @@
 
 #include "ForegroundBackgroundSegmentMask.h"
 
+// Custom
+#include "ParallelFor.h"
+
 // Submodules
 #include "ITKHelpers/ITKHelpers.h"
 
+// ITK
+#include "itkImageFileReader.h"
+#include "itkImageFileWriter.h"
+#include "itkImageIOBase.h"
+
+// STL
+#include <atomic>
+
 template <typename TPixel>
 void ForegroundBackgroundSegmentMask::
 ReadFromImage(const std::string& filename,
               const ForegroundPixelValueWrapper<TPixel>& foregroundValue,
               const BackgroundPixelValueWrapper<TPixel>& backgroundValue)
 {
-  std::cout << "Reading mask from image: " << filename << std::endl;
+  std::size_t numberOfUnknownPixels =
+      ReadFromImage(filename, foregroundValue, backgroundValue, ForegroundBackgroundSegmentMaskReadPolicy::EXACT);
+
+  if(numberOfUnknownPixels > 0)
+  {
+    std::cerr << "Warning: " << numberOfUnknownPixels << " pixels in " << filename
+              << " are neither the foreground value (" << foregroundValue.Value
+              << ") nor the background value (" << backgroundValue.Value
+              << ") and were set to background." << std::endl;
+  }
+}
 
+template <typename TPixel>
+std::size_t ForegroundBackgroundSegmentMask::
+ReadFromImage(const std::string& filename,
+              const ForegroundPixelValueWrapper<TPixel>& foregroundValue,
+              const BackgroundPixelValueWrapper<TPixel>& backgroundValue,
+              const ForegroundBackgroundSegmentMaskReadPolicy policy,
+              const double threshold)
+{
   // Ensure the input image can be interpreted as a mask.
   unsigned int numberOfComponents =
       ITKHelpers::GetNumberOfComponentsPerPixelInFile(filename);
@@ -44,43 +73,124 @@ ReadFromImage(const std::string& filename,
     throw std::runtime_error(ss.str());
   }
 
-  // Read the image
-  typedef int ReadPixelType;
-  typedef itk::Image<ReadPixelType, 2> ImageType;
-  typedef  itk::ImageFileReader<ImageType> ImageReaderType;
-  ImageReaderType::Pointer imageReader = ImageReaderType::New();
+  // Read the image in its own component type (e.g. 1 byte per pixel for typical masks)
+  // rather than converting every file to a wider type.
+  const double foreground = static_cast<double>(foregroundValue.Value);
+  const double background = static_cast<double>(backgroundValue.Value);
+
+  typedef itk::ImageIOBase::IOComponentType IOComponentType;
+  switch(ITKHelpers::GetPixelTypeFromFile(filename))
+  {
+    case IOComponentType::UCHAR:
+      return ReadFromImageWithComponentType<unsigned char>(filename, foreground, background, policy, threshold);
+    case IOComponentType::CHAR:
+      return ReadFromImageWithComponentType<char>(filename, foreground, background, policy, threshold);
+    case IOComponentType::USHORT:
+      return ReadFromImageWithComponentType<unsigned short>(filename, foreground, background, policy, threshold);
+    case IOComponentType::SHORT:
+      return ReadFromImageWithComponentType<short>(filename, foreground, background, policy, threshold);
+    case IOComponentType::UINT:
+      return ReadFromImageWithComponentType<unsigned int>(filename, foreground, background, policy, threshold);
+    case IOComponentType::INT:
+      return ReadFromImageWithComponentType<int>(filename, foreground, background, policy, threshold);
+    case IOComponentType::FLOAT:
+      return ReadFromImageWithComponentType<float>(filename, foreground, background, policy, threshold);
+    default:
+      return ReadFromImageWithComponentType<double>(filename, foreground, background, policy, threshold);
+  }
+}
+
+template <typename TComponent>
+std::size_t ForegroundBackgroundSegmentMask::
+ReadFromImageWithComponentType(const std::string& filename, const double foregroundValue,
+                               const double backgroundValue,
+                               const ForegroundBackgroundSegmentMaskReadPolicy policy,
+                               const double threshold)
+{
+  typedef itk::Image<TComponent, 2> ImageType;
+  typedef itk::ImageFileReader<ImageType> ImageReaderType;
+  typename ImageReaderType::Pointer imageReader = ImageReaderType::New();
   imageReader->SetFileName(filename);
   imageReader->Update();
 
-  this->SetRegions(imageReader->GetOutput()->GetLargestPossibleRegion());
-  this->Allocate();
+  const itk::ImageRegion<2> region = imageReader->GetOutput()->GetLargestPossibleRegion();
+  if(this->GetLargestPossibleRegion() != region)
+  {
+    this->SetRegions(region);
+    this->Allocate();
+  }
+
+  static_assert(static_cast<int>(ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND) == 0 &&
+                static_cast<int>(ForegroundBackgroundSegmentMaskPixelTypeEnum::BACKGROUND) == 1,
+                "The conversion computes the pixel value as !isForeground.");
+
+  const TComponent* const imageBuffer = imageReader->GetOutput()->GetBufferPointer();
+  ForegroundBackgroundSegmentMaskPixelTypeEnum* const maskBuffer = this->GetBufferPointer();
 
-  itk::ImageRegionConstIteratorWithIndex<ImageType>
-      imageIterator(imageReader->GetOutput(),
-                    imageReader->GetOutput()->GetLargestPossibleRegion());
-  while(!imageIterator.IsAtEnd())
+  // Each policy is a branch free loop over the two linear buffers. Only EXACT can produce unknown pixels,
+  // which are counted per chunk and summed.
+  std::atomic<std::size_t> numberOfUnknownPixels(0);
+
+  if(policy == ForegroundBackgroundSegmentMaskReadPolicy::EXACT)
   {
-    if(imageIterator.Get() == foregroundValue.Value)
-    {
-      this->SetPixel(imageIterator.GetIndex(),
-                     ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND);
-    }
-    else if(imageIterator.Get() == backgroundValue.Value)
+    ParallelFor(0, region.GetNumberOfPixels(),
+                [=, &numberOfUnknownPixels](const std::size_t begin, const std::size_t end)
+                {
+                  std::size_t unknownInChunk = 0;
+                  for(std::size_t i = begin; i < end; ++i)
+                  {
+                    const double value = imageBuffer[i];
+                    const bool isForeground = (value == foregroundValue);
+                    unknownInChunk += !isForeground & (value != backgroundValue);
+                    maskBuffer[i] = static_cast<ForegroundBackgroundSegmentMaskPixelTypeEnum>(!isForeground);
+                  }
+                  numberOfUnknownPixels += unknownInChunk;
+                });
+  }
+  else
+  {
+    // NEAREST is a THRESHOLD at the midpoint between the two values, with ties going to the background.
+    const bool foregroundIsLarger = foregroundValue > backgroundValue;
+    double foregroundThreshold = threshold;
+    if(policy == ForegroundBackgroundSegmentMaskReadPolicy::NEAREST)
     {
-      this->SetPixel(imageIterator.GetIndex(),
-                     ForegroundBackgroundSegmentMaskPixelTypeEnum::BACKGROUND);
+      foregroundThreshold = (foregroundValue + backgroundValue) / 2.0;
     }
-    else
-    {
-      std::cerr << "Warning: Pixels with value " << imageIterator.Get()
-                << " found and is being ignored." << std::endl;
-//      std::cerr << "Warning: Pixels with values other than the specified foreground "
-//                   "and background values exist in the image and are being ignored." << std::endl;
+    const bool inclusive = (policy == ForegroundBackgroundSegmentMaskReadPolicy::THRESHOLD);
 
-    }
-    ++imageIterator;
+    ParallelFor(0, region.GetNumberOfPixels(),
+                [=](const std::size_t begin, const std::size_t end)
+                {
+                  for(std::size_t i = begin; i < end; ++i)
+                  {
+                    const double value = imageBuffer[i];
+                    const bool above = inclusive ? (value >= foregroundThreshold) : (value > foregroundThreshold);
+                    const bool below = inclusive ? (value <= foregroundThreshold) : (value < foregroundThreshold);
+                    const bool isForeground = foregroundIsLarger ? above : below;
+                    maskBuffer[i] = static_cast<ForegroundBackgroundSegmentMaskPixelTypeEnum>(!isForeground);
+                  }
+                });
+  }
+
+  return numberOfUnknownPixels;
+}
+
+namespace ForegroundBackgroundSegmentMaskDetail
+{
+  /** Get the components of a pixel as they are laid out in the image buffer. For itk::Image
+    * the buffer holds whole pixels, so the pixel itself is the only "component". */
+  template <typename TPixel>
+  std::vector<TPixel> GetBufferComponents(const TPixel& pixel)
+  {
+    return std::vector<TPixel>(1, pixel);
   }
 
+  /** For itk::VectorImage the buffer holds the individual components of each pixel. */
+  template <typename TComponent>
+  std::vector<TComponent> GetBufferComponents(const itk::VariableLengthVector<TComponent>& pixel)
+  {
+    return std::vector<TComponent>(pixel.GetDataPointer(), pixel.GetDataPointer() + pixel.GetSize());
+  }
 }
 
 template <typename TPixel>
@@ -95,23 +205,21 @@ Write(const std::string& filename,
   image->SetRegions(this->GetLargestPossibleRegion());
   image->Allocate();
 
-  itk::ImageRegionConstIteratorWithIndex<ForegroundBackgroundSegmentMask>
-      maskIterator(this,
-                   this->GetLargestPossibleRegion());
-  while(!maskIterator.IsAtEnd())
-  {
-    if(maskIterator.Get() == ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND)
-    {
-      image->SetPixel(maskIterator.GetIndex(),
-                      foregroundValue.Value);
-    }
-    else if(maskIterator.Get() == ForegroundBackgroundSegmentMaskPixelTypeEnum::BACKGROUND)
-    {
-      image->SetPixel(maskIterator.GetIndex(), backgroundValue.Value);
-    }
+  const TPixel foreground = foregroundValue.Value;
+  const TPixel background = backgroundValue.Value;
+  const ForegroundBackgroundSegmentMaskPixelTypeEnum* const maskBuffer = this->GetBufferPointer();
+  TPixel* const imageBuffer = image->GetBufferPointer();
 
-    ++maskIterator;
-  }
+  // A select between two constants over the linear buffers, which the compiler can vectorize.
+  ParallelFor(0, this->GetLargestPossibleRegion().GetNumberOfPixels(),
+              [=](const std::size_t begin, const std::size_t end)
+              {
+                for(std::size_t i = begin; i < end; ++i)
+                {
+                  const bool isForeground = (maskBuffer[i] == ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND);
+                  imageBuffer[i] = isForeground ? foreground : background;
+                }
+              });
 
   typedef  itk::ImageFileWriter<ImageType> WriterType;
   typename WriterType::Pointer writer = WriterType::New();
@@ -126,26 +234,88 @@ void ForegroundBackgroundSegmentMask::
 ApplyToImage(TImage* image,
              const typename TImage::PixelType& backgroundValue)
 {
+  this->VerifySameSize(image);
+
+  // Work on the raw buffer. For itk::Image each buffer element is a pixel,
+  // for itk::VectorImage each pixel is 'componentsPerPixel' consecutive elements.
+  typedef typename TImage::InternalPixelType InternalPixelType;
+  const std::vector<InternalPixelType> backgroundComponents =
+      ForegroundBackgroundSegmentMaskDetail::GetBufferComponents(backgroundValue);
+  const std::size_t componentsPerPixel = backgroundComponents.size();
+  if(componentsPerPixel * this->GetLargestPossibleRegion().GetNumberOfPixels() != image->GetPixelContainer()->Size())
+  {
+    throw std::runtime_error("ApplyToImage: the background value must have one component per image channel!");
+  }
 
-  itk::ImageRegionConstIterator<ForegroundBackgroundSegmentMask>
-      maskIterator(this,
-                   this->GetLargestPossibleRegion());
+  const ForegroundBackgroundSegmentMaskPixelTypeEnum* const maskBuffer = this->GetBufferPointer();
+  InternalPixelType* const imageBuffer = image->GetBufferPointer();
+  const InternalPixelType* const background = backgroundComponents.data();
 
-  itk::ImageRegionIterator<TImage>
-      imageIterator(image,
-                    image->GetLargestPossibleRegion());
+  // Change the image pixels marked as background in the mask to the specified value.
+  // Every element is rewritten with a select so the loops have no data dependent branches.
+  ParallelFor(0, this->GetLargestPossibleRegion().GetNumberOfPixels(),
+              [=](const std::size_t begin, const std::size_t end)
+              {
+                if(componentsPerPixel == 1)
+                {
+                  for(std::size_t i = begin; i < end; ++i)
+                  {
+                    const bool isBackground = (maskBuffer[i] == ForegroundBackgroundSegmentMaskPixelTypeEnum::BACKGROUND);
+                    imageBuffer[i] = isBackground ? background[0] : imageBuffer[i];
+                  }
+                  return;
+                }
 
-  // Change the image pixels marked as background in the mask to the specified value
-  while(!maskIterator.IsAtEnd())
+                for(std::size_t i = begin; i < end; ++i)
+                {
+                  const bool isBackground = (maskBuffer[i] == ForegroundBackgroundSegmentMaskPixelTypeEnum::BACKGROUND);
+                  InternalPixelType* const pixel = imageBuffer + i * componentsPerPixel;
+                  for(std::size_t component = 0; component < componentsPerPixel; ++component)
+                  {
+                    pixel[component] = isBackground ? background[component] : pixel[component];
+                  }
+                }
+              });
+}
+
+template <typename TComponent>
+void ForegroundBackgroundSegmentMask::
+ApplyToImageAsAlpha(const itk::VectorImage<TComponent, 2>* const image,
+                    itk::VectorImage<TComponent, 2>* const output,
+                    const TComponent foregroundAlpha, const TComponent backgroundAlpha) const
+{
+  this->VerifySameSize(image);
+
+  const std::size_t inputComponents = image->GetNumberOfComponentsPerPixel();
+  const std::size_t outputComponents = inputComponents + 1;
+
+  if(output->GetLargestPossibleRegion() != image->GetLargestPossibleRegion() ||
+     output->GetNumberOfComponentsPerPixel() != outputComponents)
   {
-    if(maskIterator.Get() == ForegroundBackgroundSegmentMaskPixelTypeEnum::BACKGROUND)
-    {
-      imageIterator.Set(backgroundValue);
-    }
-    ++maskIterator;
-    ++imageIterator;
+    output->SetRegions(image->GetLargestPossibleRegion());
+    output->SetNumberOfComponentsPerPixel(outputComponents);
+    output->Allocate();
   }
 
+  const ForegroundBackgroundSegmentMaskPixelTypeEnum* const maskBuffer = this->GetBufferPointer();
+  const TComponent* const inputBuffer = image->GetBufferPointer();
+  TComponent* const outputBuffer = output->GetBufferPointer();
+
+  ParallelFor(0, this->GetLargestPossibleRegion().GetNumberOfPixels(),
+              [=](const std::size_t begin, const std::size_t end)
+              {
+                for(std::size_t i = begin; i < end; ++i)
+                {
+                  const TComponent* const inputPixel = inputBuffer + i * inputComponents;
+                  TComponent* const outputPixel = outputBuffer + i * outputComponents;
+                  for(std::size_t component = 0; component < inputComponents; ++component)
+                  {
+                    outputPixel[component] = inputPixel[component];
+                  }
+                  const bool isForeground = (maskBuffer[i] == ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND);
+                  outputPixel[inputComponents] = isForeground ? foregroundAlpha : backgroundAlpha;
+                }
+              });
 }
 
 #endif
@@ -0,0 +1,454 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "ForegroundBackgroundSegmentMaskRLE.h"
+
+// STL
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+namespace ForegroundBackgroundSegmentMaskRLE
+{
+
+namespace
+{
+  typedef ForegroundBackgroundSegmentMaskPixelTypeEnum PixelType;
+
+  const char Magic[4] = {'F', 'B', 'R', 'L'};
+  const unsigned char Version = 1;
+
+  /** Call visitor(runLength) for each run of 'mask', starting with a (possibly empty) BACKGROUND run. */
+  template <typename TVisitor>
+  void VisitRuns(const ForegroundBackgroundSegmentMask* const mask, const Order order, TVisitor visitor)
+  {
+    const itk::Size<2> size = mask->GetLargestPossibleRegion().GetSize();
+    const std::uint64_t numberOfPixels = static_cast<std::uint64_t>(size[0]) * size[1];
+    const PixelType* const buffer = mask->GetBufferPointer();
+
+    PixelType currentValue = PixelType::BACKGROUND;
+    std::uint64_t runStart = 0;
+
+    if(order == Order::RowMajor)
+    {
+      for(std::uint64_t i = 0; i < numberOfPixels; ++i)
+      {
+        if(buffer[i] != currentValue)
+        {
+          visitor(i - runStart);
+          runStart = i;
+          currentValue = buffer[i];
+        }
+      }
+    }
+    else
+    {
+      std::uint64_t position = 0;
+      for(std::uint64_t x = 0; x < size[0]; ++x)
+      {
+        for(std::uint64_t y = 0; y < size[1]; ++y, ++position)
+        {
+          const PixelType value = buffer[x + y * size[0]];
+          if(value != currentValue)
+          {
+            visitor(position - runStart);
+            runStart = position;
+            currentValue = value;
+          }
+        }
+      }
+    }
+
+    if(numberOfPixels > 0)
+    {
+      visitor(numberOfPixels - runStart);
+    }
+  }
+
+  /** Throw if a mask of 'width' x 'height' pixels cannot be allocated, because its number of pixels (or of bytes)
+    * does not fit in the size types of ITK and of the STL. A corrupt header could otherwise wrap the number of
+    * pixels around and allocate a buffer that is smaller than the runs that are written into it. */
+  void CheckSize(const std::uint64_t width, const std::uint64_t height)
+  {
+    const std::uint64_t maximumNumberOfPixels =
+        std::min<std::uint64_t>(std::numeric_limits<itk::SizeValueType>::max(),
+                                std::numeric_limits<std::size_t>::max() / sizeof(PixelType));
+    if(width > maximumNumberOfPixels || height > maximumNumberOfPixels ||
+       (width != 0 && height > maximumNumberOfPixels / width))
+    {
+      std::stringstream ss;
+      ss << "An RLE mask of " << width << " x " << height << " pixels is too large!";
+      throw std::runtime_error(ss.str());
+    }
+  }
+
+  /** Allocate 'mask' to 'size' if it does not have that size already. */
+  void AllocateMask(const itk::Size<2>& size, ForegroundBackgroundSegmentMask* const mask)
+  {
+    itk::ImageRegion<2> region;
+    region.SetSize(size);
+    if(mask->GetLargestPossibleRegion() != region)
+    {
+      mask->SetRegions(region);
+      mask->Allocate();
+    }
+  }
+
+  /** Decodes consecutive runs into a mask buffer. */
+  class RunWriter
+  {
+  public:
+    RunWriter(const itk::Size<2>& size, const Order order, PixelType* const buffer) :
+      Width(size[0]), Height(size[1]), NumberOfPixels(static_cast<std::uint64_t>(size[0]) * size[1]),
+      RunOrder(order), Buffer(buffer){}
+
+    /** Write the next run. Return false if the run goes past the end of the mask. */
+    bool AddRun(const std::uint64_t runLength)
+    {
+      if(runLength > this->NumberOfPixels - this->Position)
+      {
+        return false;
+      }
+
+      if(this->RunOrder == Order::RowMajor)
+      {
+        std::fill(this->Buffer + this->Position, this->Buffer + this->Position + runLength, this->Value);
+      }
+      else
+      {
+        for(std::uint64_t i = this->Position; i < this->Position + runLength; ++i)
+        {
+          this->Buffer[(i / this->Height) + (i % this->Height) * this->Width] = this->Value;
+        }
+      }
+
+      this->Position += runLength;
+      this->Value = (this->Value == PixelType::BACKGROUND) ? PixelType::FOREGROUND : PixelType::BACKGROUND;
+      return true;
+    }
+
+    bool IsComplete() const
+    {
+      return this->Position == this->NumberOfPixels;
+    }
+
+  private:
+    std::uint64_t Width;
+    std::uint64_t Height;
+    std::uint64_t NumberOfPixels;
+    Order RunOrder;
+    PixelType* Buffer;
+    std::uint64_t Position = 0;
+    PixelType Value = PixelType::BACKGROUND;
+  };
+
+  void WriteUInt64(std::ostream& stream, std::uint64_t value)
+  {
+    char bytes[8];
+    for(unsigned int i = 0; i < 8; ++i)
+    {
+      bytes[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+    }
+    stream.write(bytes, 8);
+  }
+
+  std::uint64_t ReadUInt64(std::istream& stream)
+  {
+    unsigned char bytes[8];
+    stream.read(reinterpret_cast<char*>(bytes), 8);
+    std::uint64_t value = 0;
+    for(unsigned int i = 0; i < 8; ++i)
+    {
+      value |= static_cast<std::uint64_t>(bytes[i]) << (8 * i);
+    }
+    return value;
+  }
+}
+
+CountsType Encode(const ForegroundBackgroundSegmentMask* const mask, const Order order)
+{
+  CountsType counts;
+  VisitRuns(mask, order, [&counts](const std::uint64_t runLength){ counts.push_back(runLength); });
+  return counts;
+}
+
+void Decode(const CountsType& counts, const itk::Size<2>& size, ForegroundBackgroundSegmentMask* const mask,
+            const Order order)
+{
+  CheckSize(size[0], size[1]);
+  AllocateMask(size, mask);
+
+  RunWriter writer(size, order, mask->GetBufferPointer());
+  for(std::size_t i = 0; i < counts.size(); ++i)
+  {
+    if(!writer.AddRun(counts[i]))
+    {
+      throw std::runtime_error("RLE counts cover more pixels than the mask has!");
+    }
+  }
+
+  if(!writer.IsComplete())
+  {
+    throw std::runtime_error("RLE counts cover fewer pixels than the mask has!");
+  }
+}
+
+std::string CountsToCOCOString(const CountsType& counts)
+{
+  // Each count is stored as the difference to the count two positions earlier (after the first three),
+  // in 5 bit groups with a continuation bit, offset into printable ASCII by 48.
+  std::string cocoString;
+  for(std::size_t i = 0; i < counts.size(); ++i)
+  {
+    long long x = static_cast<long long>(counts[i]);
+    if(i > 2)
+    {
+      x -= static_cast<long long>(counts[i - 2]);
+    }
+
+    bool more = true;
+    while(more)
+    {
+      char c = static_cast<char>(x & 0x1f);
+      x >>= 5;
+      more = (c & 0x10) ? (x != -1) : (x != 0);
+      if(more)
+      {
+        c |= 0x20;
+      }
+      cocoString.push_back(static_cast<char>(c + 48));
+    }
+  }
+  return cocoString;
+}
+
+CountsType COCOStringToCounts(const std::string& cocoString)
+{
+  // 12 characters of 5 bits hold any count of a mask, and keep the shifts below 64 bits.
+  const unsigned int maximumCharactersPerValue = 12;
+
+  CountsType counts;
+  std::size_t position = 0;
+  while(position < cocoString.size())
+  {
+    long long x = 0;
+    unsigned int k = 0;
+    bool more = true;
+    while(more)
+    {
+      if(position >= cocoString.size())
+      {
+        throw std::runtime_error("Truncated COCO RLE string!");
+      }
+      if(k == maximumCharactersPerValue)
+      {
+        throw std::runtime_error("Invalid COCO RLE string (a count has too many characters)!");
+      }
+      long long c = static_cast<long long>(cocoString[position]) - 48;
+      x |= (c & 0x1f) << (5 * k);
+      more = (c & 0x20) != 0;
+      position++;
+      k++;
+      if(!more && (c & 0x10))
+      {
+        x |= static_cast<long long>(~0ULL << (5 * k));
+      }
+    }
+
+    if(counts.size() > 2)
+    {
+      // The counts are below 2^63, and the differences below 2^59, so only a sum can overflow.
+      const long long previous = static_cast<long long>(counts[counts.size() - 2]);
+      if(x > std::numeric_limits<long long>::max() - previous)
+      {
+        throw std::runtime_error("Invalid COCO RLE string (a count is too large)!");
+      }
+      x += previous;
+    }
+
+    if(x < 0)
+    {
+      throw std::runtime_error("Invalid COCO RLE string (negative count)!");
+    }
+    counts.push_back(static_cast<std::uint64_t>(x));
+  }
+  return counts;
+}
+
+void Write(const ForegroundBackgroundSegmentMask* const mask, std::ostream& stream, const Order order)
+{
+  const itk::Size<2> size = mask->GetLargestPossibleRegion().GetSize();
+
+  stream.write(Magic, 4);
+  const char header[4] = {static_cast<char>(Version), static_cast<char>(order == Order::RowMajor ? 0 : 1), 0, 0};
+  stream.write(header, 4);
+  WriteUInt64(stream, size[0]);
+  WriteUInt64(stream, size[1]);
+
+  // The varints are collected in a small buffer to avoid a stream call per run.
+  std::vector<char> buffer;
+  const std::size_t bufferSize = 1 << 16;
+  buffer.reserve(bufferSize + 10);
+
+  VisitRuns(mask, order, [&buffer, &stream, bufferSize](std::uint64_t runLength)
+  {
+    do
+    {
+      unsigned char byte = runLength & 0x7f;
+      runLength >>= 7;
+      if(runLength != 0)
+      {
+        byte |= 0x80;
+      }
+      buffer.push_back(static_cast<char>(byte));
+    } while(runLength != 0);
+
+    if(buffer.size() >= bufferSize)
+    {
+      stream.write(buffer.data(), buffer.size());
+      buffer.clear();
+    }
+  });
+
+  stream.write(buffer.data(), buffer.size());
+
+  if(!stream)
+  {
+    throw std::runtime_error("Failed to write RLE mask!");
+  }
+}
+
+void Write(const ForegroundBackgroundSegmentMask* const mask, const std::string& filename, const Order order)
+{
+  std::ofstream fout(filename.c_str(), std::ios::binary);
+  if(!fout)
+  {
+    std::stringstream ss;
+    ss << "Cannot open " << filename << " for writing!";
+    throw std::runtime_error(ss.str());
+  }
+
+  Write(mask, fout, order);
+}
+
+namespace
+{
+  /** Read a mask in the binary format. If 'expectedSize' is not null, the size in the header must match it;
+    * this is checked before the mask is allocated, so an untrusted header cannot make us allocate anything. */
+  void ReadMask(std::istream& stream, const itk::Size<2>* const expectedSize, ForegroundBackgroundSegmentMask* const mask)
+  {
+    char magic[4];
+    char header[4];
+    stream.read(magic, 4);
+    stream.read(header, 4);
+    if(!stream || std::memcmp(magic, Magic, 4) != 0)
+    {
+      throw std::runtime_error("Not an RLE mask (bad magic number)!");
+    }
+
+    if(static_cast<unsigned char>(header[0]) != Version)
+    {
+      std::stringstream ss;
+      ss << "Unsupported RLE mask version " << static_cast<int>(header[0]) << "!";
+      throw std::runtime_error(ss.str());
+    }
+
+    const Order order = (header[1] == 0) ? Order::RowMajor : Order::ColumnMajor;
+
+    const std::uint64_t width = ReadUInt64(stream);
+    const std::uint64_t height = ReadUInt64(stream);
+    if(!stream)
+    {
+      throw std::runtime_error("Truncated RLE mask header!");
+    }
+    CheckSize(width, height);
+
+    itk::Size<2> size;
+    size[0] = static_cast<itk::SizeValueType>(width);
+    size[1] = static_cast<itk::SizeValueType>(height);
+
+    if(expectedSize && size != *expectedSize)
+    {
+      std::stringstream ss;
+      ss << "The RLE mask is " << size << " but " << *expectedSize << " was expected!";
+      throw std::runtime_error(ss.str());
+    }
+
+    AllocateMask(size, mask);
+    RunWriter writer(size, order, mask->GetBufferPointer());
+
+    // Decode the varints from the stream buffer, writing each run as soon as it is complete.
+    // Reading stops exactly at the end of the mask data, so the mask can be embedded in a larger stream.
+    std::streambuf* const streamBuffer = stream.rdbuf();
+    while(!writer.IsComplete())
+    {
+      std::uint64_t runLength = 0;
+      for(unsigned int shift = 0; ; shift += 7)
+      {
+        const int byte = streamBuffer->sbumpc();
+        if(byte == std::char_traits<char>::eof())
+        {
+          throw std::runtime_error("Truncated RLE mask data!");
+        }
+        if(shift > 63)
+        {
+          throw std::runtime_error("Invalid run length in RLE mask!");
+        }
+
+        runLength |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+        if(!(byte & 0x80))
+        {
+          break;
+        }
+      }
+
+      if(!writer.AddRun(runLength))
+      {
+        throw std::runtime_error("RLE mask runs cover more pixels than the mask has!");
+      }
+    }
+  }
+}
+
+void Read(std::istream& stream, ForegroundBackgroundSegmentMask* const mask)
+{
+  ReadMask(stream, nullptr, mask);
+}
+
+void Read(std::istream& stream, const itk::Size<2>& expectedSize, ForegroundBackgroundSegmentMask* const mask)
+{
+  ReadMask(stream, &expectedSize, mask);
+}
+
+void Read(const std::string& filename, ForegroundBackgroundSegmentMask* const mask)
+{
+  std::ifstream fin(filename.c_str(), std::ios::binary);
+  if(!fin)
+  {
+    std::stringstream ss;
+    ss << "Cannot open " << filename << "!";
+    throw std::runtime_error(ss.str());
+  }
+
+  Read(fin, mask);
+}
+
+} // end namespace ForegroundBackgroundSegmentMaskRLE
@@ -0,0 +1,89 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef ForegroundBackgroundSegmentMaskRLE_H
+#define ForegroundBackgroundSegmentMaskRLE_H
+
+#include "ForegroundBackgroundSegmentMask.h"
+
+// STL
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+/** Run-length encoding of ForegroundBackgroundSegmentMask.
+  *
+  * The runs alternate between BACKGROUND and FOREGROUND and always start with a
+  * BACKGROUND run (which has length 0 if the first pixel is FOREGROUND). This is
+  * the convention of the COCO RLE format, where FOREGROUND is the object (1).
+  * COCO traverses the pixels in column-major order, so use ColumnMajor for counts
+  * that are exchanged with COCO tools. RowMajor follows the buffer order and is faster.
+  *
+  * The binary .fbrle file format is (all integers little endian):
+  *   4 bytes  magic "FBRL"
+  *   1 byte   version (1)
+  *   1 byte   order (0 = RowMajor, 1 = ColumnMajor)
+  *   2 bytes  reserved (0)
+  *   8 bytes  width
+  *   8 bytes  height
+  *   the runs, each as an unsigned LEB128 varint, until they cover width*height pixels.
+  * The number of runs is not stored, so the runs can be written as they are found.
+  */
+namespace ForegroundBackgroundSegmentMaskRLE
+{
+  /** The order in which the pixels are traversed. */
+  enum class Order {RowMajor, ColumnMajor};
+
+  /** The run lengths. */
+  typedef std::vector<std::uint64_t> CountsType;
+
+  /** Compute the runs of 'mask'. */
+  CountsType Encode(const ForegroundBackgroundSegmentMask* const mask, const Order order = Order::RowMajor);
+
+  /** Fill 'mask' (which is allocated to 'size' if necessary) from the runs in 'counts'. */
+  void Decode(const CountsType& counts, const itk::Size<2>& size, ForegroundBackgroundSegmentMask* const mask,
+              const Order order = Order::RowMajor);
+
+  /** Convert column-major counts to the compressed string used by the COCO API (rleToString in maskApi.c). */
+  std::string CountsToCOCOString(const CountsType& counts);
+
+  /** Convert a compressed COCO string (rleFrString in maskApi.c) to counts. */
+  CountsType COCOStringToCounts(const std::string& cocoString);
+
+  /** Stream the runs of 'mask' to 'stream' in the binary format. The runs are written as
+    * they are found, the full list of counts is never stored. */
+  void Write(const ForegroundBackgroundSegmentMask* const mask, std::ostream& stream,
+             const Order order = Order::RowMajor);
+
+  /** Write 'mask' to a binary .fbrle file. */
+  void Write(const ForegroundBackgroundSegmentMask* const mask, const std::string& filename,
+             const Order order = Order::RowMajor);
+
+  /** Read a mask in the binary format from 'stream', decoding each run directly into the mask buffer. */
+  void Read(std::istream& stream, ForegroundBackgroundSegmentMask* const mask);
+
+  /** Read a mask in the binary format from 'stream' and throw (before allocating anything) if its size
+    * is not 'expectedSize'. Use this for masks from untrusted sources. */
+  void Read(std::istream& stream, const itk::Size<2>& expectedSize, ForegroundBackgroundSegmentMask* const mask);
+
+  /** Read a mask from a binary .fbrle file. */
+  void Read(const std::string& filename, ForegroundBackgroundSegmentMask* const mask);
+}
+
+#endif
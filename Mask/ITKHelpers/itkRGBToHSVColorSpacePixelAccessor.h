@@ -82,9 +82,9 @@ public:
       {
           S = delta / max;
 
-          double r2 = (((max - r) / 6.0) + (max / 2.0)) / max;
-          double g2 = (((max - g) / 6.0) + (max / 2.0)) / max;
-          double b2 = (((max - b) / 6.0) + (max / 2.0)) / max;
+          double r2 = (((max - r) / 6.0) + (delta / 2.0)) / delta;
+          double g2 = (((max - g) / 6.0) + (delta / 2.0)) / delta;
+          double b2 = (((max - b) / 6.0) + (delta / 2.0)) / delta;
 
           if(r == max)
             H = b2 - g2;
@@ -133,9 +133,9 @@ public:
       {
           S = delta / max;
 
-          double r2 = (((max - r) / 6.0) + (max / 2.0)) / max;
-          double g2 = (((max - g) / 6.0) + (max / 2.0)) / max;
-          double b2 = (((max - b) / 6.0) + (max / 2.0)) / max;
+          double r2 = (((max - r) / 6.0) + (delta / 2.0)) / delta;
+          double g2 = (((max - g) / 6.0) + (delta / 2.0)) / delta;
+          double b2 = (((max - b) / 6.0) + (delta / 2.0)) / delta;
 
           if(r == max)
             H = b2 - g2;
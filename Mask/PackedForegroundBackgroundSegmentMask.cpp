@@ -0,0 +1,245 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "PackedForegroundBackgroundSegmentMask.h"
+
+// Custom
+#include "ParallelFor.h"
+
+// STL
+#include <algorithm>
+#include <bitset>
+#include <sstream>
+#include <stdexcept>
+
+namespace
+{
+  /** Count the set bits of a word. */
+  inline std::size_t PopCount(const PackedForegroundBackgroundSegmentMask::WordType word)
+  {
+#if defined(__GNUC__)
+    return __builtin_popcountll(word);
+#else
+    return std::bitset<64>(word).count();
+#endif
+  }
+}
+
+const unsigned int PackedForegroundBackgroundSegmentMask::PixelsPerWord;
+
+PackedForegroundBackgroundSegmentMask::PackedForegroundBackgroundSegmentMask(const itk::ImageRegion<2>& region)
+{
+  this->SetRegion(region);
+}
+
+void PackedForegroundBackgroundSegmentMask::SetRegion(const itk::ImageRegion<2>& region)
+{
+  this->Region = region;
+  this->Words.assign((region.GetNumberOfPixels() + PixelsPerWord - 1) / PixelsPerWord, 0);
+}
+
+std::size_t PackedForegroundBackgroundSegmentMask::GetOffset(const itk::Index<2>& index) const
+{
+  return (index[0] - this->Region.GetIndex()[0]) +
+         (index[1] - this->Region.GetIndex()[1]) * this->Region.GetSize()[0];
+}
+
+bool PackedForegroundBackgroundSegmentMask::IsForeground(const itk::Index<2>& index) const
+{
+  std::size_t offset = this->GetOffset(index);
+  return (this->Words[offset / PixelsPerWord] >> (offset % PixelsPerWord)) & 1;
+}
+
+bool PackedForegroundBackgroundSegmentMask::IsBackground(const itk::Index<2>& index) const
+{
+  return !this->IsForeground(index);
+}
+
+ForegroundBackgroundSegmentMaskPixelTypeEnum
+PackedForegroundBackgroundSegmentMask::GetPixel(const itk::Index<2>& index) const
+{
+  if(this->IsForeground(index))
+  {
+    return ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND;
+  }
+  return ForegroundBackgroundSegmentMaskPixelTypeEnum::BACKGROUND;
+}
+
+void PackedForegroundBackgroundSegmentMask::SetPixel(const itk::Index<2>& index,
+                                                     const ForegroundBackgroundSegmentMaskPixelTypeEnum value)
+{
+  std::size_t offset = this->GetOffset(index);
+  WordType bit = WordType(1) << (offset % PixelsPerWord);
+  if(value == ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND)
+  {
+    this->Words[offset / PixelsPerWord] |= bit;
+  }
+  else
+  {
+    this->Words[offset / PixelsPerWord] &= ~bit;
+  }
+}
+
+std::size_t PackedForegroundBackgroundSegmentMask::CountForegroundPixels() const
+{
+  // The padding bits are always 0, so every word can be counted as a whole.
+  std::size_t count = 0;
+  for(std::size_t i = 0; i < this->Words.size(); ++i)
+  {
+    count += PopCount(this->Words[i]);
+  }
+  return count;
+}
+
+std::size_t PackedForegroundBackgroundSegmentMask::CountBackgroundPixels() const
+{
+  return this->GetNumberOfPixels() - this->CountForegroundPixels();
+}
+
+void PackedForegroundBackgroundSegmentMask::VerifySameRegion(const PackedForegroundBackgroundSegmentMask& other) const
+{
+  if(this->Region != other.Region)
+  {
+    std::stringstream ss;
+    ss << "Packed masks must cover the same region! (" << this->Region << " vs " << other.Region << ")";
+    throw std::runtime_error(ss.str());
+  }
+}
+
+void PackedForegroundBackgroundSegmentMask::And(const PackedForegroundBackgroundSegmentMask& other)
+{
+  this->VerifySameRegion(other);
+  for(std::size_t i = 0; i < this->Words.size(); ++i)
+  {
+    this->Words[i] &= other.Words[i];
+  }
+}
+
+void PackedForegroundBackgroundSegmentMask::Or(const PackedForegroundBackgroundSegmentMask& other)
+{
+  this->VerifySameRegion(other);
+  for(std::size_t i = 0; i < this->Words.size(); ++i)
+  {
+    this->Words[i] |= other.Words[i];
+  }
+}
+
+void PackedForegroundBackgroundSegmentMask::Xor(const PackedForegroundBackgroundSegmentMask& other)
+{
+  this->VerifySameRegion(other);
+  for(std::size_t i = 0; i < this->Words.size(); ++i)
+  {
+    this->Words[i] ^= other.Words[i];
+  }
+}
+
+void PackedForegroundBackgroundSegmentMask::Subtract(const PackedForegroundBackgroundSegmentMask& other)
+{
+  this->VerifySameRegion(other);
+  for(std::size_t i = 0; i < this->Words.size(); ++i)
+  {
+    this->Words[i] &= ~other.Words[i];
+  }
+}
+
+void PackedForegroundBackgroundSegmentMask::Invert()
+{
+  for(std::size_t i = 0; i < this->Words.size(); ++i)
+  {
+    this->Words[i] = ~this->Words[i];
+  }
+  this->ClearPaddingBits();
+}
+
+void PackedForegroundBackgroundSegmentMask::ClearPaddingBits()
+{
+  std::size_t usedBitsInLastWord = this->GetNumberOfPixels() % PixelsPerWord;
+  if(usedBitsInLastWord != 0)
+  {
+    this->Words.back() &= (WordType(1) << usedBitsInLastWord) - 1;
+  }
+}
+
+void PackedForegroundBackgroundSegmentMask::FromMask(const ForegroundBackgroundSegmentMask* const mask,
+                                                     const unsigned int numberOfThreads)
+{
+  this->SetRegion(mask->GetLargestPossibleRegion());
+
+  const std::size_t numberOfPixels = this->GetNumberOfPixels();
+  const ForegroundBackgroundSegmentMaskPixelTypeEnum* const maskBuffer = mask->GetBufferPointer();
+  WordType* const words = this->Words.data();
+
+  // Each thread packs whole words, so no two threads write to the same word.
+  ParallelFor(0, this->Words.size(),
+              [maskBuffer, words, numberOfPixels](const std::size_t begin, const std::size_t end)
+              {
+                for(std::size_t word = begin; word < end; ++word)
+                {
+                  const std::size_t firstPixel = PixelsPerWord * word;
+                  const std::size_t numberOfBits = std::min<std::size_t>(PixelsPerWord, numberOfPixels - firstPixel);
+
+                  WordType bits = 0;
+                  for(std::size_t bit = 0; bit < numberOfBits; ++bit)
+                  {
+                    bits |= static_cast<WordType>(maskBuffer[firstPixel + bit] ==
+                                                  ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND) << bit;
+                  }
+                  words[word] = bits;
+                }
+              }, numberOfThreads);
+}
+
+void PackedForegroundBackgroundSegmentMask::ToMask(ForegroundBackgroundSegmentMask* const mask,
+                                                   const unsigned int numberOfThreads) const
+{
+  if(mask->GetLargestPossibleRegion() != this->Region)
+  {
+    mask->SetRegions(this->Region);
+    mask->Allocate();
+  }
+
+  static_assert(static_cast<int>(ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND) == 0 &&
+                static_cast<int>(ForegroundBackgroundSegmentMaskPixelTypeEnum::BACKGROUND) == 1,
+                "The expansion computes the pixel value as (1 - bit).");
+
+  ForegroundBackgroundSegmentMaskPixelTypeEnum* const maskBuffer = mask->GetBufferPointer();
+  const WordType* const words = this->Words.data();
+
+  ParallelFor(0, this->GetNumberOfPixels(),
+              [maskBuffer, words](const std::size_t begin, const std::size_t end)
+              {
+                for(std::size_t i = begin; i < end; ++i)
+                {
+                  const WordType bit = (words[i / PixelsPerWord] >> (i % PixelsPerWord)) & 1;
+                  maskBuffer[i] = static_cast<ForegroundBackgroundSegmentMaskPixelTypeEnum>(1 - bit);
+                }
+              }, numberOfThreads);
+}
+
+ForegroundBackgroundSegmentMask::Pointer
+PackedForegroundBackgroundSegmentMask::CreateMask(const unsigned int numberOfThreads) const
+{
+  ForegroundBackgroundSegmentMask::Pointer mask = ForegroundBackgroundSegmentMask::New();
+  this->ToMask(mask, numberOfThreads);
+  return mask;
+}
+
+bool PackedForegroundBackgroundSegmentMask::operator==(const PackedForegroundBackgroundSegmentMask& other) const
+{
+  return this->Region == other.Region && this->Words == other.Words;
+}
@@ -0,0 +1,155 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+/**
+\class PackedForegroundBackgroundSegmentMask
+\brief A foreground/background mask stored with 1 bit per pixel in 64 bit words.
+       ForegroundBackgroundSegmentMask uses the size of an enum (4 bytes) per pixel,
+       which is wasteful for masks that are kept around (e.g. in a results cache).
+       Pixel i (in buffer order, i.e. x + y * width) is bit (i % 64) of word (i / 64),
+       and a set bit means FOREGROUND. The unused bits of the last word are always 0.
+       Use FromMask()/ToMask() to convert to and from the ITK image representation when
+       an itk::Image is needed.
+*/
+
+#ifndef PackedForegroundBackgroundSegmentMask_H
+#define PackedForegroundBackgroundSegmentMask_H
+
+#include "ForegroundBackgroundSegmentMask.h"
+
+// ITK
+#include "itkImageRegion.h"
+
+// STL
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class PackedForegroundBackgroundSegmentMask
+{
+public:
+  /** The type of the words that the pixels are packed into. */
+  typedef std::uint64_t WordType;
+
+  /** The number of pixels stored in each word. */
+  static const unsigned int PixelsPerWord = 64;
+
+  /** Create an empty mask. */
+  PackedForegroundBackgroundSegmentMask(){}
+
+  /** Create a mask covering 'region' with all pixels set to BACKGROUND. */
+  explicit PackedForegroundBackgroundSegmentMask(const itk::ImageRegion<2>& region);
+
+  /** Resize the mask to cover 'region' and set all pixels to BACKGROUND.
+    * The storage is only reallocated if the mask grows. */
+  void SetRegion(const itk::ImageRegion<2>& region);
+
+  /** Get the region covered by the mask. */
+  const itk::ImageRegion<2>& GetRegion() const
+  {
+    return this->Region;
+  }
+
+  /** Get the number of pixels in the mask. */
+  std::size_t GetNumberOfPixels() const
+  {
+    return this->Region.GetNumberOfPixels();
+  }
+
+  /** Get the number of words used to store the mask. */
+  std::size_t GetNumberOfWords() const
+  {
+    return this->Words.size();
+  }
+
+  /** Direct access to the packed words. Callers writing words must keep the unused bits of the last word 0. */
+  WordType* GetWords()
+  {
+    return this->Words.data();
+  }
+
+  const WordType* GetWords() const
+  {
+    return this->Words.data();
+  }
+
+  /** Determine if a pixel is a foreground pixel.*/
+  bool IsForeground(const itk::Index<2>& index) const;
+
+  /** Determine if a pixel is a background pixel.*/
+  bool IsBackground(const itk::Index<2>& index) const;
+
+  /** Get the value of a pixel. */
+  ForegroundBackgroundSegmentMaskPixelTypeEnum GetPixel(const itk::Index<2>& index) const;
+
+  /** Set the value of a pixel. */
+  void SetPixel(const itk::Index<2>& index, const ForegroundBackgroundSegmentMaskPixelTypeEnum value);
+
+  /** Count foreground pixels in the whole mask.*/
+  std::size_t CountForegroundPixels() const;
+
+  /** Count background pixels in the whole mask.*/
+  std::size_t CountBackgroundPixels() const;
+
+  /** Word-wise boolean operations with another mask covering the same region. The result is stored in this mask
+    * and a pixel of the result is FOREGROUND if the operation is true for the two input pixels. */
+  void And(const PackedForegroundBackgroundSegmentMask& other);
+  void Or(const PackedForegroundBackgroundSegmentMask& other);
+  void Xor(const PackedForegroundBackgroundSegmentMask& other);
+
+  /** Remove the foreground pixels of 'other' from this mask (this AND NOT other). */
+  void Subtract(const PackedForegroundBackgroundSegmentMask& other);
+
+  /** Swap foreground and background. */
+  void Invert();
+
+  /** Pack 'mask' into this object (resizing it if necessary). */
+  void FromMask(const ForegroundBackgroundSegmentMask* const mask, const unsigned int numberOfThreads = 0);
+
+  /** Expand this mask into 'mask' (allocating it if its region is different). */
+  void ToMask(ForegroundBackgroundSegmentMask* const mask, const unsigned int numberOfThreads = 0) const;
+
+  /** Create an ITK image view of the mask. */
+  ForegroundBackgroundSegmentMask::Pointer CreateMask(const unsigned int numberOfThreads = 0) const;
+
+  /** Two masks are equal if they cover the same region and have the same pixels. */
+  bool operator==(const PackedForegroundBackgroundSegmentMask& other) const;
+  bool operator!=(const PackedForegroundBackgroundSegmentMask& other) const
+  {
+    return !(*this == other);
+  }
+
+private:
+
+  /** Throw if 'other' does not cover the same region as this mask. */
+  void VerifySameRegion(const PackedForegroundBackgroundSegmentMask& other) const;
+
+  /** Zero the unused bits of the last word (the operations that can set them call this). */
+  void ClearPaddingBits();
+
+  /** Get the linear offset of 'index' in the mask. */
+  std::size_t GetOffset(const itk::Index<2>& index) const;
+
+  /** The region covered by the mask. */
+  itk::ImageRegion<2> Region;
+
+  /** The packed pixels. */
+  std::vector<WordType> Words;
+};
+
+#endif
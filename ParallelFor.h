@@ -0,0 +1,167 @@
+/*
+Copyright (C) 2012 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ParallelFor_H
+#define ParallelFor_H
+
+// Custom
+#include "SegmentationExecutor.h"
+
+// STL
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/** Return the number of threads to use when 'requestedNumberOfThreads' are requested.
+  * 0 means "use all of the cores of the machine". */
+inline unsigned int GetNumberOfThreadsToUse(const unsigned int requestedNumberOfThreads)
+{
+  if(requestedNumberOfThreads > 0)
+  {
+    return requestedNumberOfThreads;
+  }
+
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/** Get the threads that help the calling threads of ParallelFor(): one per core, started on the first use and
+  * shared by every call, so that the calls do not start threads and the concurrent calls (e.g. of the jobs of the
+  * batch tool) do not oversubscribe the cores. It is not the default SegmentationExecutor, so that the chunks
+  * do not wait behind whole segmentations. */
+ThreadPoolExecutor& GetParallelForThreadPool();
+
+namespace detail
+{
+  /** The chunks of one ParallelFor() call. The calling thread and the tasks of the thread pool take the chunks in
+    * turn, so a call finishes even if no thread of the pool is free (e.g. when it is made from one of them). */
+  template <typename TFunctor>
+  class ParallelForChunks
+  {
+  public:
+    ParallelForChunks(const std::size_t begin, const std::size_t end, const std::size_t chunkSize,
+                      const std::size_t numberOfChunks, TFunctor& functor) :
+      Begin(begin), End(end), ChunkSize(chunkSize), NumberOfChunks(numberOfChunks), Functor(functor){}
+
+    /** Run chunks until none are left. The first exception of a chunk is kept for Wait(). */
+    void RunChunks()
+    {
+      for(std::size_t chunk = this->NextChunk++; chunk < this->NumberOfChunks; chunk = this->NextChunk++)
+      {
+        const std::size_t chunkBegin = this->Begin + chunk * this->ChunkSize;
+        std::exception_ptr exception;
+        try
+        {
+          this->Functor(chunkBegin, std::min(this->End, chunkBegin + this->ChunkSize));
+        }
+        catch(...)
+        {
+          exception = std::current_exception();
+        }
+
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        if(exception && !this->Exception)
+        {
+          this->Exception = exception;
+        }
+        if(++this->NumberOfFinishedChunks == this->NumberOfChunks)
+        {
+          this->AllChunksFinished.notify_all();
+        }
+      }
+    }
+
+    /** Wait until every chunk is finished, then rethrow the first exception of a chunk. */
+    void Wait()
+    {
+      std::unique_lock<std::mutex> lock(this->Mutex);
+      this->AllChunksFinished.wait(lock, [this](){ return this->NumberOfFinishedChunks == this->NumberOfChunks; });
+      if(this->Exception)
+      {
+        std::rethrow_exception(this->Exception);
+      }
+    }
+
+  private:
+    std::size_t Begin;
+    std::size_t End;
+    std::size_t ChunkSize;
+    std::size_t NumberOfChunks;
+
+    /** The functor of the call, which is only used while there are chunks left, so while the call waits. */
+    TFunctor& Functor;
+
+    std::atomic<std::size_t> NextChunk{0};
+
+    std::mutex Mutex;
+    std::condition_variable AllChunksFinished;
+    std::size_t NumberOfFinishedChunks = 0;
+    std::exception_ptr Exception;
+  };
+}
+
+/** Split [begin, end) into one contiguous chunk per thread and call functor(chunkBegin, chunkEnd)
+  * on each chunk. The chunk boundaries are multiples of 'grain' (relative to 'begin'), so that, for
+  * example, threads writing packed bits never share a word. Small ranges are processed on the
+  * calling thread. 'numberOfThreads' = 0 uses all of the cores of the machine. The calling thread runs chunks
+  * too, the others run on GetParallelForThreadPool(). An exception of a chunk is rethrown once all of the
+  * chunks are finished. */
+template <typename TFunctor>
+void ParallelFor(const std::size_t begin, const std::size_t end, TFunctor functor,
+                 const unsigned int numberOfThreads = 0, const std::size_t grain = 1)
+{
+  if(end <= begin)
+  {
+    return;
+  }
+
+  // Below this many elements per thread, handing out the chunks costs more than it saves.
+  const std::size_t minimumChunkSize = 1 << 16;
+
+  const std::size_t length = end - begin;
+  std::size_t numberOfChunks = std::min<std::size_t>(GetNumberOfThreadsToUse(numberOfThreads),
+                                                     (length + minimumChunkSize - 1) / minimumChunkSize);
+
+  if(numberOfChunks <= 1)
+  {
+    functor(begin, end);
+    return;
+  }
+
+  std::size_t chunkSize = (length + numberOfChunks - 1) / numberOfChunks;
+  chunkSize = ((chunkSize + grain - 1) / grain) * grain;
+  numberOfChunks = (length + chunkSize - 1) / chunkSize;
+
+  // The pool tasks share the chunks, which outlive the call if a task only starts after the chunks are done.
+  typedef detail::ParallelForChunks<TFunctor> ChunksType;
+  const std::shared_ptr<ChunksType> chunks = std::make_shared<ChunksType>(begin, end, chunkSize, numberOfChunks,
+                                                                          functor);
+  ThreadPoolExecutor& threadPool = GetParallelForThreadPool();
+  for(std::size_t helper = 1; helper < numberOfChunks; ++helper)
+  {
+    threadPool.Submit([chunks](){ chunks->RunChunks(); });
+  }
+
+  chunks->RunChunks();
+  chunks->Wait();
+}
+
+#endif
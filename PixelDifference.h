@@ -18,25 +18,154 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef PixelDifference_H
 #define PixelDifference_H
 
+// STL
+#include <cassert>
 #include <cmath>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
 
-/** Compute the difference between two RGB pixels. */
+/** The pixel difference functors of ImageGraphCut provide
+  *   Difference(a, b)          the distance between two pixels,
+  *   SquaredDifference(a, b)   its square, which is what the n-link weights use, and
+  *   SquaredDifferences(a, b, numberOfPixels, numberOfComponents, squaredDifferences)
+  *                             the squared distances between the pixels of two buffers of interleaved components
+  *                             (e.g. a row of an itk::VectorImage and the row below it), for whole rows at once.
+  * The buffer loops have no calls or branches in them, so the compiler vectorizes them; with unsigned char
+  * components they also sum in integers, which is exact.
+  * Only Difference() is required: ImageGraphCut calls the functors that do not have the other two (and the images
+  * that are not buffers of scalar components) per pixel, see HasSquaredDifferences and SquaredPixelDifference().
+  */
+
+/** The type that the squared differences of TComponent are summed in. */
+template <typename TComponent>
+struct SquaredDifferenceAccumulator
+{
+  typedef float Type;
+};
+
+template <>
+struct SquaredDifferenceAccumulator<unsigned char>
+{
+  typedef int Type;
+};
+
+/** Whether TFunctor has the buffer SquaredDifferences() for buffers of TComponent. */
+template <typename TFunctor, typename TComponent>
+class HasSquaredDifferences
+{
+  template <typename T>
+  static auto Test(int) -> decltype(std::declval<const T&>().SquaredDifferences(
+      std::declval<const TComponent*>(), std::declval<const TComponent*>(), std::size_t(), 0u,
+      std::declval<float*>()), std::true_type());
+
+  template <typename T>
+  static std::false_type Test(...);
+
+public:
+  static const bool value = decltype(Test<TFunctor>(0))::value;
+};
+
+namespace detail
+{
+  template <typename TFunctor, typename TPixel>
+  auto SquaredPixelDifference(TFunctor& functor, const TPixel& a, const TPixel& b, int)
+      -> decltype(static_cast<float>(functor.SquaredDifference(a, b)))
+  {
+    return functor.SquaredDifference(a, b);
+  }
+
+  template <typename TFunctor, typename TPixel>
+  float SquaredPixelDifference(TFunctor& functor, const TPixel& a, const TPixel& b, long)
+  {
+    const float difference = functor.Difference(a, b);
+    return difference * difference;
+  }
+}
+
+/** Compute the squared difference between two pixels with the SquaredDifference() of 'functor', or with the square
+  * of its Difference() if it only has that. */
+template <typename TFunctor, typename TPixel>
+float SquaredPixelDifference(TFunctor& functor, const TPixel& a, const TPixel& b)
+{
+  return detail::SquaredPixelDifference(functor, a, b, 0);
+}
+
+/** Compute the difference between two RGB pixels. Only the first 3 components are compared, so the alpha of
+  * RGBA pixels is ignored; pixels with fewer components (e.g. grayscale) are compared on all of them. */
 template <typename TPixel>
 class
 RGBPixelDifference
 {
 public:
-  float Difference(const TPixel& a, const TPixel& b)
+  float Difference(const TPixel& a, const TPixel& b) const
   {
     // Compute the Euclidean distance between N dimensional pixels
+    return std::sqrt(this->SquaredDifference(a, b));
+  }
+
+  float SquaredDifference(const TPixel& a, const TPixel& b) const
+  {
     float difference = 0;
 
-    for(unsigned int i = 0; i < 3; i++)
+    const unsigned int numberOfRGBComponents = a.Size() > 3 ? 3 : a.Size();
+    for(unsigned int i = 0; i < numberOfRGBComponents; i++)
       {
-      difference += pow(a[i] - b[i], 2);
+      const float componentDifference = static_cast<float>(a[i]) - static_cast<float>(b[i]);
+      difference += componentDifference * componentDifference;
       }
 
-    return sqrt(difference);
+    return difference;
+  }
+
+  template <typename TComponent>
+  void SquaredDifferences(const TComponent* const a, const TComponent* const b, const std::size_t numberOfPixels,
+                          const unsigned int numberOfComponents, float* const squaredDifferences) const
+  {
+    // A constant stride lets the compiler vectorize the usual RGB and RGBA buffers.
+    if(numberOfComponents == 3)
+      {
+      SquaredDifferencesWithStride<3>(a, b, numberOfPixels, squaredDifferences);
+      }
+    else if(numberOfComponents == 4)
+      {
+      SquaredDifferencesWithStride<4>(a, b, numberOfPixels, squaredDifferences);
+      }
+    else
+      {
+      typedef typename SquaredDifferenceAccumulator<TComponent>::Type AccumulatorType;
+      const unsigned int numberOfRGBComponents = numberOfComponents > 3 ? 3 : numberOfComponents;
+      for(std::size_t pixelId = 0; pixelId < numberOfPixels; pixelId++)
+        {
+        const TComponent* const pixelA = a + pixelId * numberOfComponents;
+        const TComponent* const pixelB = b + pixelId * numberOfComponents;
+        AccumulatorType difference = 0;
+        for(unsigned int i = 0; i < numberOfRGBComponents; i++)
+          {
+          const AccumulatorType componentDifference =
+              static_cast<AccumulatorType>(pixelA[i]) - static_cast<AccumulatorType>(pixelB[i]);
+          difference += componentDifference * componentDifference;
+          }
+        squaredDifferences[pixelId] = static_cast<float>(difference);
+        }
+      }
+  }
+
+private:
+  template <unsigned int TStride, typename TComponent>
+  static void SquaredDifferencesWithStride(const TComponent* const a, const TComponent* const b,
+                                           const std::size_t numberOfPixels, float* const squaredDifferences)
+  {
+    typedef typename SquaredDifferenceAccumulator<TComponent>::Type AccumulatorType;
+    for(std::size_t pixelId = 0; pixelId < numberOfPixels; pixelId++)
+      {
+      const TComponent* const pixelA = a + pixelId * TStride;
+      const TComponent* const pixelB = b + pixelId * TStride;
+      const AccumulatorType red = static_cast<AccumulatorType>(pixelA[0]) - static_cast<AccumulatorType>(pixelB[0]);
+      const AccumulatorType green = static_cast<AccumulatorType>(pixelA[1]) - static_cast<AccumulatorType>(pixelB[1]);
+      const AccumulatorType blue = static_cast<AccumulatorType>(pixelA[2]) - static_cast<AccumulatorType>(pixelB[2]);
+      squaredDifferences[pixelId] = static_cast<float>(red * red + green * green + blue * blue);
+      }
   }
 };
 
@@ -48,37 +177,88 @@ class NDPixelDifference
   //float RGBWeight = 1.0f; // Needs better c++11 support than is provided by VS2010
   float RGBWeight;
 
+  /** The weight of each of the RGB components, RGBWeight / 3. */
+  float RGBComponentWeight;
+
 public:
-  NDPixelDifference(const float rgbWeight) : RGBWeight(rgbWeight){}
+  NDPixelDifference(const float rgbWeight) : RGBWeight(rgbWeight), RGBComponentWeight(rgbWeight / 3.f){}
 
-  float Difference(const TPixel& a, const TPixel& b)
+  float Difference(const TPixel& a, const TPixel& b) const
   {
-    assert(a.GetNumberOfComponents() == b.GetNumberOfComponents());
+    // Compute the Euclidean distance between N dimensional pixels
+    return std::sqrt(this->SquaredDifference(a, b));
+  }
 
-    unsigned int numberOfComponents = a.GetNumberOfComponents();
+  float SquaredDifference(const TPixel& a, const TPixel& b) const
+  {
+    assert(a.Size() == b.Size());
 
-    // Compute the Euclidean distance between N dimensional pixels
-    float difference = 0;
+    const unsigned int numberOfComponents = a.Size();
+    const unsigned int numberOfRGBComponents = numberOfComponents > 3 ? 3 : numberOfComponents;
 
-    if(a.GetNumberOfComponents() > 3)
+    float rgbDifference = 0;
+    for(unsigned int i = 0; i < numberOfRGBComponents; i++)
       {
-      for(unsigned int i = 0; i < 3; i++)
-        {
-        difference += (this->RGBWeight / 3.) * pow(a[i] - b[i],2);
-        }
-      for(unsigned int i = 3; i < numberOfComponents; i++)
-        {
-        difference += (1 - this->RGBWeight) / (numberOfComponents - 3.) * pow(a[i] - b[i],2);
-        }
+      const float componentDifference = static_cast<float>(a[i]) - static_cast<float>(b[i]);
+      rgbDifference += componentDifference * componentDifference;
       }
-    else // image is RGB or less (grayscale)
+
+    if(numberOfComponents <= 3) // image is RGB or less (grayscale)
       {
-      for(unsigned int i = 0; i < numberOfComponents; i++)
+      return rgbDifference;
+      }
+
+    float otherDifference = 0;
+    for(unsigned int i = 3; i < numberOfComponents; i++)
+      {
+      const float componentDifference = static_cast<float>(a[i]) - static_cast<float>(b[i]);
+      otherDifference += componentDifference * componentDifference;
+      }
+
+    return this->RGBComponentWeight * rgbDifference + this->GetOtherComponentWeight(numberOfComponents) * otherDifference;
+  }
+
+  template <typename TComponent>
+  void SquaredDifferences(const TComponent* const a, const TComponent* const b, const std::size_t numberOfPixels,
+                          const unsigned int numberOfComponents, float* const squaredDifferences) const
+  {
+    typedef typename SquaredDifferenceAccumulator<TComponent>::Type AccumulatorType;
+
+    const unsigned int numberOfRGBComponents = numberOfComponents > 3 ? 3 : numberOfComponents;
+    const float rgbWeight = numberOfComponents > 3 ? this->RGBComponentWeight : 1.f;
+    const float otherWeight = this->GetOtherComponentWeight(numberOfComponents);
+
+    for(std::size_t pixelId = 0; pixelId < numberOfPixels; pixelId++)
+      {
+      const TComponent* const pixelA = a + pixelId * numberOfComponents;
+      const TComponent* const pixelB = b + pixelId * numberOfComponents;
+
+      AccumulatorType rgbDifference = 0;
+      for(unsigned int i = 0; i < numberOfRGBComponents; i++)
+        {
+        const AccumulatorType componentDifference =
+            static_cast<AccumulatorType>(pixelA[i]) - static_cast<AccumulatorType>(pixelB[i]);
+        rgbDifference += componentDifference * componentDifference;
+        }
+
+      AccumulatorType otherDifference = 0;
+      for(unsigned int i = numberOfRGBComponents; i < numberOfComponents; i++)
         {
-        difference += pow(a[i] - b[i],2);
+        const AccumulatorType componentDifference =
+            static_cast<AccumulatorType>(pixelA[i]) - static_cast<AccumulatorType>(pixelB[i]);
+        otherDifference += componentDifference * componentDifference;
         }
+
+      squaredDifferences[pixelId] = rgbWeight * static_cast<float>(rgbDifference) +
+                                    otherWeight * static_cast<float>(otherDifference);
       }
-    return sqrt(difference);
+  }
+
+private:
+  /** The weight of each of the components after RGB, (1 - RGBWeight) / (number of them). */
+  float GetOtherComponentWeight(const unsigned int numberOfComponents) const
+  {
+    return numberOfComponents > 3 ? (1 - this->RGBWeight) / (numberOfComponents - 3.f) : 0.f;
   }
 };
 
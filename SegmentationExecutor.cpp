@@ -0,0 +1,95 @@
+/*
+Copyright (C) 2012 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "SegmentationExecutor.h"
+
+// Custom
+#include "ParallelFor.h"
+
+SegmentationExecutor& SegmentationExecutor::GetDefault()
+{
+  static ThreadPoolExecutor executor;
+  return executor;
+}
+
+ThreadPoolExecutor& GetParallelForThreadPool()
+{
+  static ThreadPoolExecutor threadPool;
+  return threadPool;
+}
+
+ThreadPoolExecutor::ThreadPoolExecutor(const unsigned int numberOfThreads)
+{
+  const unsigned int numberOfThreadsToUse = GetNumberOfThreadsToUse(numberOfThreads);
+  this->Threads.reserve(numberOfThreadsToUse);
+  for(unsigned int threadId = 0; threadId < numberOfThreadsToUse; ++threadId)
+  {
+    this->Threads.emplace_back(&ThreadPoolExecutor::Run, this);
+  }
+}
+
+ThreadPoolExecutor::~ThreadPoolExecutor()
+{
+  {
+    std::lock_guard<std::mutex> lock(this->Mutex);
+    this->Stopping = true;
+  }
+  this->TaskAvailable.notify_all();
+
+  for(std::thread& thread : this->Threads)
+  {
+    thread.join();
+  }
+}
+
+void ThreadPoolExecutor::Submit(const TaskType& task)
+{
+  {
+    std::lock_guard<std::mutex> lock(this->Mutex);
+    this->Tasks.push_back(task);
+  }
+  this->TaskAvailable.notify_one();
+}
+
+unsigned int ThreadPoolExecutor::GetNumberOfConcurrentTasks() const
+{
+  return static_cast<unsigned int>(this->Threads.size());
+}
+
+void ThreadPoolExecutor::Run()
+{
+  while(true)
+  {
+    TaskType task;
+    {
+      std::unique_lock<std::mutex> lock(this->Mutex);
+      this->TaskAvailable.wait(lock, [this](){ return this->Stopping || !this->Tasks.empty(); });
+
+      // The tasks that were submitted before the destructor still run.
+      if(this->Tasks.empty())
+      {
+        return;
+      }
+
+      task = std::move(this->Tasks.front());
+      this->Tasks.pop_front();
+    }
+
+    task();
+  }
+}
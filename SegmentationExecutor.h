@@ -0,0 +1,81 @@
+/*
+Copyright (C) 2012 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SegmentationExecutor_H
+#define SegmentationExecutor_H
+
+// STL
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/** Runs the tasks of ImageGraphCut::PerformSegmentationAsync(). Implement this to run the segmentations on
+  * the executor of an application, or use ThreadPoolExecutor.
+  */
+class SegmentationExecutor
+{
+public:
+  typedef std::function<void ()> TaskType;
+
+  virtual ~SegmentationExecutor() {}
+
+  /** Run 'task' later, on some thread. The tasks of ImageGraphCut do not throw. */
+  virtual void Submit(const TaskType& task) = 0;
+
+  /** Get the number of tasks that may run at the same time. Each segmentation then uses a share of the cores,
+    * so that concurrent segmentations do not oversubscribe them. */
+  virtual unsigned int GetNumberOfConcurrentTasks() const = 0;
+
+  /** Get the executor of the library, a ThreadPoolExecutor with one thread per core. */
+  static SegmentationExecutor& GetDefault();
+};
+
+/** A fixed number of threads that run the submitted tasks in order. The destructor waits for the tasks that
+  * were already submitted.
+  */
+class ThreadPoolExecutor : public SegmentationExecutor
+{
+public:
+  /** 'numberOfThreads' = 0 uses all of the cores of the machine. */
+  explicit ThreadPoolExecutor(const unsigned int numberOfThreads = 0);
+
+  ~ThreadPoolExecutor();
+
+  ThreadPoolExecutor(const ThreadPoolExecutor&) = delete;
+  ThreadPoolExecutor& operator=(const ThreadPoolExecutor&) = delete;
+
+  void Submit(const TaskType& task) override;
+
+  unsigned int GetNumberOfConcurrentTasks() const override;
+
+private:
+  /** The loop of each thread. */
+  void Run();
+
+  std::vector<std::thread> Threads;
+
+  std::mutex Mutex;
+  std::condition_variable TaskAvailable;
+  std::deque<TaskType> Tasks;
+  bool Stopping = false;
+};
+
+#endif
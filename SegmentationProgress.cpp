@@ -0,0 +1,53 @@
+/*
+Copyright (C) 2012 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "SegmentationProgress.h"
+
+void SegmentationProgress::SetCallback(const CallbackType& callback)
+{
+  this->Callback = callback;
+}
+
+void SegmentationProgress::Cancel()
+{
+  this->Cancelled.store(true, std::memory_order_relaxed);
+}
+
+bool SegmentationProgress::IsCancelled() const
+{
+  return this->Cancelled.load(std::memory_order_relaxed);
+}
+
+void SegmentationProgress::Reset()
+{
+  this->Cancelled.store(false, std::memory_order_relaxed);
+}
+
+void SegmentationProgress::Report(const SegmentationStatistics::Stage stage, const double fraction) const
+{
+  if(this->Callback)
+  {
+    this->Callback(stage, fraction);
+  }
+
+  if(this->IsCancelled())
+  {
+    throw SegmentationCancelledError(std::string("The segmentation was cancelled during ") +
+                                     SegmentationStatistics::GetStageName(stage) + ".");
+  }
+}
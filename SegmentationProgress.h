@@ -0,0 +1,115 @@
+/*
+Copyright (C) 2012 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SegmentationProgress_H
+#define SegmentationProgress_H
+
+// Custom
+#include "SegmentationStatistics.h"
+
+// Boost
+#include <boost/property_map/property_map.hpp>
+
+// STL
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <stdexcept>
+#include <string>
+
+/** Thrown by ImageGraphCut::PerformSegmentation() when its segmentation is cancelled. */
+class SegmentationCancelledError : public std::runtime_error
+{
+public:
+  explicit SegmentationCancelledError(const std::string& message) : std::runtime_error(message) {}
+};
+
+/** Follows and cancels a segmentation from another thread (see ImageGraphCut::SetProgress()).
+  * The segmentation calls Report() every few rows of the graph construction and every few thousand steps of
+  * the max flow, on the thread that runs the segmentation. Report() calls the callback and then throws
+  * SegmentationCancelledError if Cancel() was called, so a superseded segmentation stops within milliseconds.
+  */
+class SegmentationProgress
+{
+public:
+  /** Called with the stage and the fraction of the stage that is done (-1 if it is not known, as in the
+    * max flow). It may call Cancel(). */
+  typedef std::function<void (const SegmentationStatistics::Stage stage, const double fraction)> CallbackType;
+
+  void SetCallback(const CallbackType& callback);
+
+  /** Request that the segmentation stops. This can be called from any thread. */
+  void Cancel();
+
+  bool IsCancelled() const;
+
+  /** Clear the cancellation, so this object can be used for the next segmentation. */
+  void Reset();
+
+  /** Call the callback, then throw SegmentationCancelledError if the segmentation was cancelled. */
+  void Report(const SegmentationStatistics::Stage stage, const double fraction) const;
+
+private:
+  std::atomic<bool> Cancelled{false};
+
+  CallbackType Callback;
+};
+
+/** A read/write property map that forwards to 'TPropertyMap' and calls SegmentationProgress::Report() every
+  * 'interval' writes. This is how the max flow solver, which has no callbacks of its own, reports its progress
+  * and stops when it is cancelled. The number of writes is kept in 'numberOfWrites', because the solver copies
+  * its property maps. */
+template <typename TPropertyMap>
+class ProgressPropertyMap
+{
+public:
+  typedef typename boost::property_traits<TPropertyMap>::key_type key_type;
+  typedef typename boost::property_traits<TPropertyMap>::value_type value_type;
+  typedef value_type reference;
+  typedef boost::read_write_property_map_tag category;
+
+  ProgressPropertyMap(const TPropertyMap& propertyMap, const SegmentationProgress* const progress,
+                      const SegmentationStatistics::Stage stage, const std::size_t interval,
+                      std::size_t* const numberOfWrites) :
+    PropertyMap(propertyMap), Progress(progress), Stage(stage), Interval(interval), NumberOfWrites(numberOfWrites)
+  {
+  }
+
+  friend value_type get(const ProgressPropertyMap& propertyMap, const key_type& key)
+  {
+    return get(propertyMap.PropertyMap, key);
+  }
+
+  friend void put(const ProgressPropertyMap& propertyMap, const key_type& key, const value_type& value)
+  {
+    put(propertyMap.PropertyMap, key, value);
+    if(++*propertyMap.NumberOfWrites % propertyMap.Interval == 0)
+    {
+      propertyMap.Progress->Report(propertyMap.Stage, -1);
+    }
+  }
+
+private:
+  TPropertyMap PropertyMap;
+  const SegmentationProgress* Progress;
+  SegmentationStatistics::Stage Stage;
+  std::size_t Interval;
+  std::size_t* NumberOfWrites;
+};
+
+#endif
@@ -0,0 +1,161 @@
+/*
+Copyright (C) 2012 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SegmentationStatistics.h"
+
+// STL
+#include <algorithm>
+#include <ostream>
+#include <sstream>
+
+// POSIX
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+const char* SegmentationStatistics::GetStageName(const Stage stage)
+{
+  switch(stage)
+  {
+    case INITIALIZE:
+      return "initialize";
+    case CONVERT_COLOR_SPACE:
+      return "convert_color_space";
+    case CREATE_SAMPLES:
+      return "create_samples";
+    case COARSE_SEGMENTATION:
+      return "coarse_segmentation";
+    case COMPUTE_NOISE:
+      return "compute_noise";
+    case REDUCE_GRAPH:
+      return "reduce_graph";
+    case CREATE_N_EDGES:
+      return "create_n_edges";
+    case CREATE_T_EDGES:
+      return "create_t_edges";
+    case MAX_FLOW:
+      return "max_flow";
+    case EXTRACT_MASK:
+      return "extract_mask";
+    case COMPUTE_ENERGY:
+      return "compute_energy";
+    default:
+      return "unknown";
+  }
+}
+
+const char* SegmentationStatistics::GetCutVerificationName(const CutVerificationResult result)
+{
+  switch(result)
+  {
+    case NOT_VERIFIED:
+      return "not_verified";
+    case VERIFIED:
+      return "verified";
+    case FAILED:
+      return "failed";
+    default:
+      return "unknown";
+  }
+}
+
+void SegmentationStatistics::Reset()
+{
+  *this = SegmentationStatistics();
+}
+
+namespace
+{
+  void WriteStageJSON(std::ostream& stream, const StageStatistics& stage)
+  {
+    stream << "{\"wall_seconds\": " << stage.WallSeconds << ", \"process_cpu_seconds\": " << stage.ProcessCPUSeconds
+           << ", \"peak_memory_bytes\": " << stage.PeakMemoryBytes << "}";
+  }
+}
+
+void SegmentationStatistics::WriteJSON(std::ostream& stream) const
+{
+  stream << "{\"stages\": {";
+  for(unsigned int stage = 0; stage < NUMBER_OF_STAGES; ++stage)
+  {
+    stream << (stage > 0 ? ", " : "") << "\"" << GetStageName(static_cast<Stage>(stage)) << "\": ";
+    WriteStageJSON(stream, this->Stages[stage]);
+  }
+  stream << "}, \"total\": ";
+  WriteStageJSON(stream, this->Total);
+  stream << ", \"pixels\": " << this->NumberOfPixels
+         << ", \"source_pixels\": " << this->NumberOfSourcePixels
+         << ", \"sink_pixels\": " << this->NumberOfSinkPixels
+         << ", \"vertices\": " << this->NumberOfVertices
+         << ", \"edges\": " << this->NumberOfEdges
+         << ", \"fixed_pixels\": " << this->NumberOfFixedPixels
+         << ", \"exact\": " << (this->Exact ? "true" : "false")
+         << ", \"capacity_scale\": " << this->CapacityScale
+         << ", \"flow\": " << this->FlowValue
+         << ", \"data_energy\": " << this->DataEnergy
+         << ", \"smoothness_energy\": " << this->SmoothnessEnergy
+         << ", \"cut_verification\": \"" << GetCutVerificationName(this->CutVerification) << "\""
+         << ", \"cut_capacity\": " << this->CutCapacity
+         << ", \"unsaturated_cut_edges\": " << this->NumberOfUnsaturatedCutEdges << "}";
+}
+
+std::string SegmentationStatistics::ToJSON() const
+{
+  std::stringstream ss;
+  this->WriteJSON(ss);
+  return ss.str();
+}
+
+ScopedStageTimer::ScopedStageTimer(SegmentationStatistics& statistics, const SegmentationStatistics::Stage stage) :
+  Statistics(statistics), TimedStage(stage), WallStart(std::chrono::steady_clock::now()), CPUStart(std::clock())
+{
+}
+
+ScopedStageTimer::~ScopedStageTimer()
+{
+  const double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - this->WallStart).count();
+  const double cpuSeconds = static_cast<double>(std::clock() - this->CPUStart) / CLOCKS_PER_SEC;
+  const std::size_t peakMemoryBytes = GetPeakMemoryBytes();
+
+  StageStatistics& stage = this->Statistics.Stages[this->TimedStage];
+  stage.WallSeconds += wallSeconds;
+  stage.ProcessCPUSeconds += cpuSeconds;
+  stage.PeakMemoryBytes = std::max(stage.PeakMemoryBytes, peakMemoryBytes);
+
+  StageStatistics& total = this->Statistics.Total;
+  total.WallSeconds += wallSeconds;
+  total.ProcessCPUSeconds += cpuSeconds;
+  total.PeakMemoryBytes = std::max(total.PeakMemoryBytes, peakMemoryBytes);
+}
+
+std::size_t ScopedStageTimer::GetPeakMemoryBytes()
+{
+#if defined(__unix__) || defined(__APPLE__)
+  struct rusage usage;
+  if(getrusage(RUSAGE_SELF, &usage) != 0)
+  {
+    return 0;
+  }
+#if defined(__APPLE__)
+  return static_cast<std::size_t>(usage.ru_maxrss); // bytes
+#else
+  return static_cast<std::size_t>(usage.ru_maxrss) * 1024; // kilobytes
+#endif
+#else
+  return 0;
+#endif
+}
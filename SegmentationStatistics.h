@@ -0,0 +1,125 @@
+/*
+Copyright (C) 2012 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SegmentationStatistics_H
+#define SegmentationStatistics_H
+
+// STL
+#include <chrono>
+#include <cstddef>
+#include <ctime>
+#include <iosfwd>
+#include <string>
+
+/** The measurements of one stage of a segmentation. */
+struct StageStatistics
+{
+  /** Elapsed time. */
+  double WallSeconds = 0;
+
+  /** CPU time of the whole process during the stage: all of its threads, including those of other segmentations
+    * that run at the same time (e.g. the other jobs of the batch tool or the other requests of the server), so it
+    * only measures the stage alone when nothing else runs. */
+  double ProcessCPUSeconds = 0;
+
+  /** The peak resident memory of the process at the end of the stage (0 if it is not available).
+    * This is a high water mark, so it never decreases from one stage to the next. */
+  std::size_t PeakMemoryBytes = 0;
+};
+
+/** What a segmentation did and how long each part took. */
+struct SegmentationStatistics
+{
+  enum Stage {INITIALIZE, CONVERT_COLOR_SPACE, CREATE_SAMPLES, COARSE_SEGMENTATION, COMPUTE_NOISE, REDUCE_GRAPH,
+              CREATE_N_EDGES, CREATE_T_EDGES, MAX_FLOW, EXTRACT_MASK, COMPUTE_ENERGY, NUMBER_OF_STAGES};
+
+  /** The result of the check that the cut is a minimum cut (see ImageGraphCut::SetCutVerification()). */
+  enum CutVerificationResult {NOT_VERIFIED, VERIFIED, FAILED};
+
+  /** Get the name of a stage as it appears in the JSON output (e.g. "max_flow"). */
+  static const char* GetStageName(const Stage stage);
+
+  /** Get the name of a cut verification result as it appears in the JSON output (e.g. "verified"). */
+  static const char* GetCutVerificationName(const CutVerificationResult result);
+
+  /** Clear all measurements. */
+  void Reset();
+
+  /** Write the statistics as a JSON object. */
+  void WriteJSON(std::ostream& stream) const;
+  std::string ToJSON() const;
+
+  StageStatistics Stages[NUMBER_OF_STAGES];
+
+  /** The sum of all stages. */
+  StageStatistics Total;
+
+  /** The size of the problem. */
+  std::size_t NumberOfPixels = 0;
+  std::size_t NumberOfSourcePixels = 0;
+  std::size_t NumberOfSinkPixels = 0;
+  std::size_t NumberOfVertices = 0;
+  std::size_t NumberOfEdges = 0;
+
+  /** The number of pixels that the graph reduction labeled before the max flow (seeds included). */
+  std::size_t NumberOfFixedPixels = 0;
+
+  /** Is the segmentation the minimum cut? Only a segmentation with a deadline can be approximate. */
+  bool Exact = true;
+
+  /** The number of integer capacity units per unit of edge weight of the max flow, or 0 with float capacities.
+    * This is lower than the requested scale if the flow would not have fit in the integer capacities. */
+  double CapacityScale = 0;
+
+  /** The value of the maximum flow, in units of edge weight. With the graph reduction this is the flow through
+    * the reduced graph, which leaves out the parts of the energy that every labeling pays. */
+  double FlowValue = 0;
+
+  /** The energy of the segmentation, in units of edge weight: the t-links (data term) and the n-links
+    * (smoothness term) that it cuts. With integer capacities these are the quantized weights. */
+  double DataEnergy = 0;
+  double SmoothnessEnergy = 0;
+
+  /** The result of the cut verification, the capacity of the cut in the solved graph and the number of its
+    * edges that still have residual capacity (the last two are only computed by the cut verification). */
+  CutVerificationResult CutVerification = NOT_VERIFIED;
+  double CutCapacity = 0;
+  std::size_t NumberOfUnsaturatedCutEdges = 0;
+};
+
+/** Measures a stage from construction to destruction and adds the measurements to the stage
+  * and to the total. */
+class ScopedStageTimer
+{
+public:
+  ScopedStageTimer(SegmentationStatistics& statistics, const SegmentationStatistics::Stage stage);
+  ~ScopedStageTimer();
+
+  ScopedStageTimer(const ScopedStageTimer&) = delete;
+  ScopedStageTimer& operator=(const ScopedStageTimer&) = delete;
+
+  /** Get the peak resident memory of the process so far (0 if it is not available). */
+  static std::size_t GetPeakMemoryBytes();
+
+private:
+  SegmentationStatistics& Statistics;
+  SegmentationStatistics::Stage TimedStage;
+  std::chrono::steady_clock::time_point WallStart;
+  std::clock_t CPUStart;
+};
+
+#endif
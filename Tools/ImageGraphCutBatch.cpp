@@ -0,0 +1,451 @@
+/*
+Copyright (C) 2012 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ImageGraphCut.h"
+#include "MappedImageFile.h"
+
+// Submodules
+#include "../Mask/ITKHelpers/Helpers/Helpers.h"
+
+// ITK
+#include "itkImageFileReader.h"
+#include "itkVectorImage.h"
+
+// STL
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+/** This program segments many images with one process. The segmentations are described by a manifest
+  * with one job per line:
+  *
+  *   image foregroundMask backgroundMask output [lambda [numberOfHistogramBins]]
+  *
+  * Blank lines and lines starting with '#' are ignored. The seed masks are images where white (255) pixels
+  * are seeds (anti-aliased masks are rounded to the nearest of black/white), or .fbmask/.fbrle mask files.
+  * Uncompressed 8 bit MetaImages (.mha/.mhd) are memory mapped instead of read. The output is written
+  * as a .fbrle file if it has that extension, and otherwise as an image with white foreground and black
+  * background pixels.
+  *
+  * The jobs are run by a fixed number of worker threads. Each worker keeps its own ImageGraphCut object
+  * (and reader and masks), so the buffers of one segmentation are reused by the next one the worker runs.
+  * A line with the timings of each job is printed when it finishes, followed by a throughput summary.
+  */
+
+namespace
+{
+  typedef itk::VectorImage<unsigned char, 2> ImageType;
+
+  struct Job
+  {
+    unsigned int LineNumber = 0;
+    std::string ImageFilename;
+    std::string ForegroundFilename;
+    std::string BackgroundFilename;
+    std::string OutputFilename;
+    float Lambda = 0.01f;
+    int NumberOfHistogramBins = 20;
+    double CapacityScale = 0;
+    bool GraphReduction = false;
+    ColorSpace SegmentationColorSpace = ColorSpace::RGB;
+  };
+
+  struct Options
+  {
+    std::string ManifestFilename;
+    unsigned int NumberOfWorkers = 0;
+    unsigned int NumberOfThreadsPerJob = 0;
+    float Lambda = 0.01f;
+    int NumberOfHistogramBins = 20;
+    double CapacityScale = 0;
+    bool GraphReduction = false;
+    ColorSpace SegmentationColorSpace = ColorSpace::RGB;
+  };
+
+  /** Everything a worker reuses from one job to the next. */
+  struct Worker
+  {
+    Worker()
+    {
+      this->Reader = ReaderType::New();
+      this->ForegroundSeeds = ForegroundBackgroundSegmentMask::New();
+      this->BackgroundSeeds = ForegroundBackgroundSegmentMask::New();
+    }
+
+    typedef itk::ImageFileReader<ImageType> ReaderType;
+
+    ReaderType::Pointer Reader;
+    ForegroundBackgroundSegmentMask::Pointer ForegroundSeeds;
+    ForegroundBackgroundSegmentMask::Pointer BackgroundSeeds;
+    ImageGraphCut<ImageType> GraphCut;
+  };
+
+  /** Points a graph cut at an image that it does not own for the duration of a job, and clears the pointer when the
+    * job ends (also by an exception), so that the graph cut of the worker never refers to an unmapped file. */
+  class ScopedGraphCutImage
+  {
+  public:
+    ScopedGraphCutImage(ImageGraphCut<ImageType>& graphCut, ImageType* const image) : GraphCut(graphCut)
+    {
+      this->GraphCut.SetImageNoCopy(image);
+    }
+
+    ~ScopedGraphCutImage()
+    {
+      this->GraphCut.SetImageNoCopy(nullptr);
+    }
+
+  private:
+    ImageGraphCut<ImageType>& GraphCut;
+  };
+
+  double SecondsSince(const std::chrono::steady_clock::time_point& start)
+  {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  void PrintUsage()
+  {
+    std::cerr << "Usage: ImageGraphCutBatch manifest.txt [--workers N] [--threads-per-job N] "
+                 "[--lambda L] [--bins B] [--capacity-scale S] [--reduce 0|1] [--color-space rgb|cielab|hsv]" << std::endl
+              << "Each manifest line is: image foregroundMask backgroundMask output [lambda [bins]]" << std::endl
+              << "--workers defaults to the number of cores, --threads-per-job to cores / workers." << std::endl
+              << "--capacity-scale S > 0 solves with integer capacities of S units per unit of weight." << std::endl
+              << "--reduce 1 labels the seeds and the pixels they determine before the max flow." << std::endl
+              << "--color-space segments in CIELab or HSV instead of RGB." << std::endl;
+  }
+
+  Options ParseArguments(int argc, char* argv[])
+  {
+    if(argc < 2)
+    {
+      throw std::runtime_error("No manifest specified!");
+    }
+
+    Options options;
+    options.ManifestFilename = argv[1];
+
+    for(int i = 2; i < argc; i += 2)
+    {
+      std::string name = argv[i];
+      if(i + 1 >= argc)
+      {
+        throw std::runtime_error("Missing value for " + name + "!");
+      }
+
+      std::stringstream value(argv[i + 1]);
+      if(name == "--workers")
+      {
+        value >> options.NumberOfWorkers;
+      }
+      else if(name == "--threads-per-job")
+      {
+        value >> options.NumberOfThreadsPerJob;
+      }
+      else if(name == "--lambda")
+      {
+        value >> options.Lambda;
+      }
+      else if(name == "--bins")
+      {
+        value >> options.NumberOfHistogramBins;
+      }
+      else if(name == "--capacity-scale")
+      {
+        value >> options.CapacityScale;
+      }
+      else if(name == "--reduce")
+      {
+        value >> options.GraphReduction;
+      }
+      else if(name == "--color-space")
+      {
+        options.SegmentationColorSpace = ColorSpaceConverter::GetColorSpace(argv[i + 1]);
+      }
+      else
+      {
+        throw std::runtime_error("Unknown option " + name + "!");
+      }
+
+      if(value.fail())
+      {
+        throw std::runtime_error("Invalid value for " + name + ": " + argv[i + 1]);
+      }
+    }
+
+    return options;
+  }
+
+  std::vector<Job> ReadManifest(const Options& options)
+  {
+    std::ifstream fin(options.ManifestFilename.c_str());
+    if(!fin)
+    {
+      throw std::runtime_error("Cannot open manifest " + options.ManifestFilename + "!");
+    }
+
+    std::vector<Job> jobs;
+    std::string line;
+    unsigned int lineNumber = 0;
+    while(getline(fin, line))
+    {
+      lineNumber++;
+
+      std::stringstream linestream(line);
+      Job job;
+      job.LineNumber = lineNumber;
+      job.Lambda = options.Lambda;
+      job.NumberOfHistogramBins = options.NumberOfHistogramBins;
+      job.CapacityScale = options.CapacityScale;
+      job.GraphReduction = options.GraphReduction;
+      job.SegmentationColorSpace = options.SegmentationColorSpace;
+
+      if(!(linestream >> job.ImageFilename) || job.ImageFilename[0] == '#')
+      {
+        continue;
+      }
+
+      linestream >> job.ForegroundFilename >> job.BackgroundFilename >> job.OutputFilename;
+      if(linestream.fail())
+      {
+        std::stringstream ss;
+        ss << options.ManifestFilename << ":" << lineNumber
+           << ": expected image foregroundMask backgroundMask output [lambda [bins]]";
+        throw std::runtime_error(ss.str());
+      }
+
+      // The parameters are optional.
+      float lambda;
+      if(linestream >> lambda)
+      {
+        job.Lambda = lambda;
+        int bins;
+        if(linestream >> bins)
+        {
+          job.NumberOfHistogramBins = bins;
+        }
+      }
+
+      jobs.push_back(job);
+    }
+
+    return jobs;
+  }
+
+  /** Read a seed mask from a mask file or from an image with white seed pixels. */
+  void ReadSeeds(const std::string& filename, ForegroundBackgroundSegmentMask* const seeds)
+  {
+    std::string extension = Helpers::GetFileExtension(filename);
+    if(extension == "fbrle" || extension == "fbmask")
+    {
+      seeds->Read(filename);
+      return;
+    }
+
+    seeds->ReadFromImage(filename, ForegroundPixelValueWrapper<unsigned char>(255),
+                         BackgroundPixelValueWrapper<unsigned char>(0),
+                         ForegroundBackgroundSegmentMaskReadPolicy::NEAREST);
+  }
+
+  /** The timings (in seconds) of a job. */
+  struct JobTimings
+  {
+    double Read = 0;
+    double Segment = 0;
+    double Write = 0;
+  };
+
+  /** Run 'job' with the objects of 'worker'. Return the number of pixels of the image. */
+  std::size_t RunJob(const Job& job, const unsigned int numberOfThreads, Worker& worker, JobTimings& timings)
+  {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // Uncompressed 8 bit MetaImages are memory mapped and segmented without reading or copying them.
+    ImageGraphCut<ImageType>& graphCut = worker.GraphCut;
+    std::unique_ptr<MappedImageFile> mappedImage;
+    std::string extension = Helpers::GetFileExtension(job.ImageFilename);
+    if(extension == "mha" || extension == "mhd")
+    {
+      try
+      {
+        mappedImage.reset(new MappedImageFile(MappedImageFile::OpenMetaImage(job.ImageFilename)));
+        if(mappedImage->GetComponentType() != itk::ImageIOBase::IOComponentType::UCHAR)
+        {
+          mappedImage.reset();
+        }
+      }
+      catch(const std::exception&)
+      {
+        // E.g. a compressed MetaImage, which the ITK reader handles.
+        mappedImage.reset();
+      }
+    }
+
+    // Destroyed before 'mappedImage', which unmaps the file.
+    std::unique_ptr<ScopedGraphCutImage> scopedImage;
+    if(mappedImage)
+    {
+      scopedImage.reset(new ScopedGraphCutImage(graphCut, mappedImage->GetImage<unsigned char>()));
+    }
+    else
+    {
+      worker.Reader->SetFileName(job.ImageFilename);
+      worker.Reader->Update();
+      graphCut.SetImage(worker.Reader->GetOutput());
+    }
+    ReadSeeds(job.ForegroundFilename, worker.ForegroundSeeds);
+    ReadSeeds(job.BackgroundFilename, worker.BackgroundSeeds);
+    timings.Read = SecondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    graphCut.SetNumberOfThreads(numberOfThreads);
+    graphCut.SetSeedsFromMasks(worker.ForegroundSeeds, worker.BackgroundSeeds);
+    graphCut.SetLambda(job.Lambda);
+    graphCut.SetNumberOfHistogramBins(job.NumberOfHistogramBins);
+    if(job.CapacityScale > 0)
+    {
+      graphCut.SetIntegerCapacities(true, job.CapacityScale);
+    }
+    else
+    {
+      graphCut.SetIntegerCapacities(false);
+    }
+    graphCut.SetGraphReduction(job.GraphReduction);
+    graphCut.SetColorSpace(job.SegmentationColorSpace);
+    graphCut.PerformSegmentation();
+    timings.Segment = SecondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    ForegroundBackgroundSegmentMask* segmentMask = graphCut.GetSegmentMask();
+    if(Helpers::GetFileExtension(job.OutputFilename) == "fbrle")
+    {
+      segmentMask->WriteRLE(job.OutputFilename);
+    }
+    else
+    {
+      segmentMask->Write<unsigned char>(job.OutputFilename, ForegroundPixelValueWrapper<unsigned char>(255),
+                                        BackgroundPixelValueWrapper<unsigned char>(0));
+    }
+    timings.Write = SecondsSince(start);
+
+    return segmentMask->GetLargestPossibleRegion().GetNumberOfPixels();
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  Options options;
+  std::vector<Job> jobs;
+  try
+  {
+    options = ParseArguments(argc, argv);
+    jobs = ReadManifest(options);
+  }
+  catch(const std::exception& e)
+  {
+    std::cerr << e.what() << std::endl;
+    PrintUsage();
+    return EXIT_FAILURE;
+  }
+
+  // Never start more workers than there are jobs. By default the cores are divided between the workers.
+  unsigned int numberOfCores = GetNumberOfThreadsToUse(0);
+  unsigned int numberOfWorkers = GetNumberOfThreadsToUse(options.NumberOfWorkers);
+  numberOfWorkers = std::max<unsigned int>(1, std::min<std::size_t>(numberOfWorkers, jobs.size()));
+  unsigned int numberOfThreadsPerJob = options.NumberOfThreadsPerJob;
+  if(numberOfThreadsPerJob == 0)
+  {
+    numberOfThreadsPerJob = std::max(1u, numberOfCores / numberOfWorkers);
+  }
+
+  std::cout << "Running " << jobs.size() << " jobs from " << options.ManifestFilename << " with "
+            << numberOfWorkers << " workers and " << numberOfThreadsPerJob << " threads per job." << std::endl;
+
+  // The workers take the next job from this counter until it runs past the end of the manifest.
+  std::atomic<std::size_t> nextJob(0);
+  std::atomic<std::size_t> numberOfFailedJobs(0);
+  std::atomic<std::size_t> totalNumberOfPixels(0);
+  std::mutex outputMutex;
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  auto workerFunction = [&](const unsigned int workerId)
+  {
+    Worker worker;
+    for(std::size_t jobId = nextJob++; jobId < jobs.size(); jobId = nextJob++)
+    {
+      const Job& job = jobs[jobId];
+      JobTimings timings;
+      std::string error;
+      std::size_t numberOfPixels = 0;
+      try
+      {
+        numberOfPixels = RunJob(job, numberOfThreadsPerJob, worker, timings);
+        totalNumberOfPixels += numberOfPixels;
+      }
+      catch(const std::exception& e)
+      {
+        error = e.what();
+        numberOfFailedJobs++;
+      }
+
+      std::lock_guard<std::mutex> lock(outputMutex);
+      std::cout << "job " << jobId + 1 << "/" << jobs.size() << " (line " << job.LineNumber << ", worker "
+                << workerId << ") " << job.ImageFilename;
+      if(error.empty())
+      {
+        std::cout << " -> " << job.OutputFilename << ": " << numberOfPixels << " pixels, read "
+                  << timings.Read << " s, segment " << timings.Segment << " s, write " << timings.Write
+                  << " s" << std::endl;
+      }
+      else
+      {
+        std::cout << " FAILED: " << error << std::endl;
+      }
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for(unsigned int workerId = 1; workerId < numberOfWorkers; ++workerId)
+  {
+    workers.emplace_back(workerFunction, workerId);
+  }
+  workerFunction(0);
+  for(std::thread& worker : workers)
+  {
+    worker.join();
+  }
+
+  double elapsedSeconds = SecondsSince(start);
+  std::size_t numberOfSucceededJobs = jobs.size() - numberOfFailedJobs;
+
+  std::cout << numberOfSucceededJobs << " of " << jobs.size() << " jobs succeeded in " << elapsedSeconds
+            << " s (" << numberOfSucceededJobs / elapsedSeconds << " images/s, "
+            << totalNumberOfPixels / elapsedSeconds / 1e6 << " megapixels/s)." << std::endl;
+
+  return numberOfFailedJobs == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,673 @@
+/*
+Copyright (C) 2012 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ImageGraphCut.h"
+#include "MappedBuffer.h"
+
+// Submodules
+#include "../Mask/ForegroundBackgroundSegmentMaskRLE.h"
+
+// ITK
+#include "itkVectorImage.h"
+
+// STL
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <istream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <thread>
+
+// POSIX
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/** A long running segmentation server. It listens on a Unix domain socket, so the cost of starting
+  * a process (loading the libraries, registering the ITK factories, allocating the graph) is paid once
+  * instead of once per image.
+  *
+  * Each connection is served by its own thread, and at most as many connections as sessions are served at once
+  * (the others wait in the backlog of the socket until a connection is closed).
+  *
+  * The segmentations are done in sessions. A session is identified by a number chosen by the client
+  * and keeps its ImageGraphCut object (and its buffers) between requests, so repeated requests on images
+  * of the same size (e.g. interactive refinement of the seeds) do not allocate.
+  *
+  * Protocol: every message in both directions is a 4 byte payload length followed by the payload.
+  * All integers are little endian, floats are IEEE 754 single precision (little endian).
+  *
+  * Requests (the first byte of the payload is the request type):
+  *   1 SEGMENT:       uint32 session, uint32 width, uint32 height, uint32 components per pixel,
+  *                    float lambda, uint32 histogram bins, uint8 model, uint8 image source, image,
+  *                    foreground seeds, background seeds.
+  *                    Model 0: train the model (the histograms of the seeds, see ImageGraphCutModel) on this
+  *                             request and keep it in the session.
+  *                    Model 1: segment with the model kept in the session (it is trained on this request if the
+  *                             session has none). The lambda and the histogram bins of the model are used, so
+  *                             retrain after changing them.
+  *                    Image source 0: the width*height*components 8 bit pixels follow (interleaved).
+  *                    Image source 1: uint16 name length, the name of a POSIX shared memory object and
+  *                                    uint64 offset of the pixels (same layout) in that object.
+  *                                    The pixels are segmented in place, they are not copied.
+  *                    The seeds are .fbrle masks (see ForegroundBackgroundSegmentMaskRLE.h) whose
+  *                    FOREGROUND pixels are the seeds.
+  *                    The histograms have (histogram bins)^(components per pixel) bins, at most
+  *                    MaximumNumberOfHistogramBins.
+  *   2 STATS:         no arguments.
+  *   3 CLOSE SESSION: uint32 session.
+  *
+  * Responses (the first byte of the payload is the status):
+  *   0 OK:    SEGMENT: the resulting mask as .fbrle. STATS: a JSON object with the request latency
+  *            histograms. CLOSE SESSION: nothing.
+  *   1 ERROR: an error message.
+  */
+
+namespace
+{
+  typedef itk::VectorImage<unsigned char, 2> ImageType;
+
+  enum RequestType : std::uint8_t {SEGMENT = 1, STATS = 2, CLOSE_SESSION = 3};
+  enum ResponseStatus : std::uint8_t {RESPONSE_OK = 0, RESPONSE_ERROR = 1};
+  enum ImageSource : std::uint8_t {INLINE = 0, SHARED_MEMORY = 1};
+  enum ModelUse : std::uint8_t {RETRAIN_MODEL = 0, KEEP_MODEL = 1};
+
+  /** The largest message that is accepted. */
+  const std::uint32_t MaximumMessageSize = 1u << 30;
+
+  /** The largest number of bins of the (dense) histograms of a request, which bounds their memory. */
+  const std::uint64_t MaximumNumberOfHistogramBins = 1u << 24;
+
+  /** Throw if the histograms of 'numberOfComponents' components with 'numberOfHistogramBins' bins per component
+    * would have no bins or more than MaximumNumberOfHistogramBins bins. */
+  void CheckNumberOfHistogramBins(const std::uint32_t numberOfHistogramBins, const std::uint32_t numberOfComponents)
+  {
+    std::uint64_t numberOfBins = numberOfHistogramBins;
+    if(numberOfHistogramBins > 1)
+    {
+      for(std::uint32_t component = 1; component < numberOfComponents && numberOfBins <= MaximumNumberOfHistogramBins;
+          ++component)
+      {
+        numberOfBins *= numberOfHistogramBins;
+      }
+    }
+
+    if(numberOfBins == 0 || numberOfBins > MaximumNumberOfHistogramBins)
+    {
+      std::stringstream ss;
+      ss << "The histograms of " << numberOfComponents << " components with " << numberOfHistogramBins
+         << " bins per component would have more than " << MaximumNumberOfHistogramBins << " bins (or none)!";
+      throw std::runtime_error(ss.str());
+    }
+  }
+
+  /** A read only stream buffer over bytes that it does not own, so that a part of a message can be parsed by a
+    * stream without copying it. */
+  class MessageStreamBuffer : public std::streambuf
+  {
+  public:
+    MessageStreamBuffer(const char* const bytes, const std::size_t numberOfBytes)
+    {
+      // The get area is only read, the const_cast is what std::streambuf's interface needs.
+      char* const begin = const_cast<char*>(bytes);
+      this->setg(begin, begin, begin + numberOfBytes);
+    }
+
+    std::size_t GetNumberOfReadBytes() const
+    {
+      return static_cast<std::size_t>(this->gptr() - this->eback());
+    }
+  };
+
+  /** Multiply two sizes from a request, throwing if the product does not fit in a std::size_t. */
+  std::size_t MultiplySizes(const std::size_t a, const std::size_t b)
+  {
+    if(a != 0 && b > std::numeric_limits<std::size_t>::max() / a)
+    {
+      throw std::runtime_error("The image size in the request is too large!");
+    }
+    return a * b;
+  }
+
+  /** Reads the fields of a request payload. */
+  class MessageReader
+  {
+  public:
+    explicit MessageReader(const std::string& message) : Message(message){}
+
+    const char* ReadBytes(const std::size_t numberOfBytes)
+    {
+      if(numberOfBytes > this->Message.size() - this->Position)
+      {
+        throw std::runtime_error("Truncated request!");
+      }
+      const char* bytes = this->Message.data() + this->Position;
+      this->Position += numberOfBytes;
+      return bytes;
+    }
+
+    template <typename TInteger>
+    TInteger ReadInteger()
+    {
+      const unsigned char* bytes = reinterpret_cast<const unsigned char*>(this->ReadBytes(sizeof(TInteger)));
+      TInteger value = 0;
+      for(unsigned int i = 0; i < sizeof(TInteger); ++i)
+      {
+        value |= static_cast<TInteger>(bytes[i]) << (8 * i);
+      }
+      return value;
+    }
+
+    float ReadFloat()
+    {
+      std::uint32_t bits = this->ReadInteger<std::uint32_t>();
+      float value;
+      std::memcpy(&value, &bits, sizeof(value));
+      return value;
+    }
+
+    std::size_t GetNumberOfRemainingBytes() const
+    {
+      return this->Message.size() - this->Position;
+    }
+
+    /** Read an embedded .fbrle mask, which must have the given size (checked before it is allocated). The mask is
+      * decoded from the message in place. */
+    void ReadMask(const itk::Size<2>& size, ForegroundBackgroundSegmentMask* const mask)
+    {
+      MessageStreamBuffer streamBuffer(this->Message.data() + this->Position, this->GetNumberOfRemainingBytes());
+      std::istream stream(&streamBuffer);
+      ForegroundBackgroundSegmentMaskRLE::Read(stream, size, mask);
+      this->Position += streamBuffer.GetNumberOfReadBytes();
+    }
+
+  private:
+    const std::string& Message;
+    std::size_t Position = 0;
+  };
+
+  /** A histogram of request latencies with power of two microsecond buckets. */
+  class LatencyHistogram
+  {
+  public:
+    void Add(const double seconds)
+    {
+      const double microseconds = seconds * 1e6;
+      unsigned int bucket = 0;
+      while(bucket + 1 < NumberOfBuckets && microseconds >= static_cast<double>(1ull << (bucket + 1)))
+      {
+        bucket++;
+      }
+
+      std::lock_guard<std::mutex> lock(this->Mutex);
+      this->Counts[bucket]++;
+      this->Count++;
+      this->TotalSeconds += seconds;
+      this->MaximumSeconds = std::max(this->MaximumSeconds, seconds);
+    }
+
+    /** Write the histogram as a JSON object. Bucket i counts the latencies in [2^i, 2^(i+1)) microseconds. */
+    void WriteJSON(std::ostream& stream) const
+    {
+      std::lock_guard<std::mutex> lock(this->Mutex);
+      stream << "{\"count\": " << this->Count
+             << ", \"mean_seconds\": " << (this->Count > 0 ? this->TotalSeconds / this->Count : 0.0)
+             << ", \"max_seconds\": " << this->MaximumSeconds
+             << ", \"p50_seconds\": " << this->Quantile(0.5)
+             << ", \"p90_seconds\": " << this->Quantile(0.9)
+             << ", \"p99_seconds\": " << this->Quantile(0.99)
+             << ", \"bucket_lower_bounds_microseconds\": [";
+      for(unsigned int i = 0; i < NumberOfBuckets; ++i)
+      {
+        stream << (i > 0 ? ", " : "") << (i == 0 ? 0ull : 1ull << i);
+      }
+      stream << "], \"bucket_counts\": [";
+      for(unsigned int i = 0; i < NumberOfBuckets; ++i)
+      {
+        stream << (i > 0 ? ", " : "") << this->Counts[i];
+      }
+      stream << "]}";
+    }
+
+  private:
+    /** The upper bound of the bucket that contains the q-quantile (the mutex must be held). */
+    double Quantile(const double q) const
+    {
+      std::uint64_t rank = static_cast<std::uint64_t>(q * this->Count);
+      std::uint64_t cumulativeCount = 0;
+      for(unsigned int i = 0; i < NumberOfBuckets; ++i)
+      {
+        cumulativeCount += this->Counts[i];
+        if(cumulativeCount > rank)
+        {
+          return std::min(this->MaximumSeconds, static_cast<double>(1ull << (i + 1)) * 1e-6);
+        }
+      }
+      return this->MaximumSeconds;
+    }
+
+    static const unsigned int NumberOfBuckets = 32;
+
+    mutable std::mutex Mutex;
+    std::array<std::uint64_t, NumberOfBuckets> Counts = {};
+    std::uint64_t Count = 0;
+    double TotalSeconds = 0;
+    double MaximumSeconds = 0;
+  };
+
+  /** Points a graph cut at an image that it does not own for the duration of a request, and clears the pointer
+    * when the request ends (also by an exception), so that the graph cut never refers to unmapped shared memory. */
+  class ScopedGraphCutImage
+  {
+  public:
+    ScopedGraphCutImage(ImageGraphCut<ImageType>& graphCut, ImageType* const image) : GraphCut(graphCut)
+    {
+      this->GraphCut.SetImageNoCopy(image);
+    }
+
+    ~ScopedGraphCutImage()
+    {
+      this->GraphCut.SetImageNoCopy(nullptr);
+    }
+
+  private:
+    ImageGraphCut<ImageType>& GraphCut;
+  };
+
+  /** The objects that are kept warm between the requests of a session. */
+  struct Session
+  {
+    Session()
+    {
+      this->Image = ImageType::New();
+      this->ForegroundSeeds = ForegroundBackgroundSegmentMask::New();
+      this->BackgroundSeeds = ForegroundBackgroundSegmentMask::New();
+    }
+
+    /** Only one request of a session runs at a time. */
+    std::mutex Mutex;
+
+    ImageType::Pointer Image;
+    ForegroundBackgroundSegmentMask::Pointer ForegroundSeeds;
+    ForegroundBackgroundSegmentMask::Pointer BackgroundSeeds;
+    ImageGraphCut<ImageType> GraphCut;
+
+    /** The model of the last request that trained one, shared by the requests that keep it. */
+    std::shared_ptr<const ImageGraphCut<ImageType>::ModelType> Model;
+  };
+
+  class Server
+  {
+  public:
+    Server(const unsigned int maximumNumberOfSessions, const unsigned int numberOfThreadsPerRequest) :
+      MaximumNumberOfSessions(maximumNumberOfSessions), NumberOfThreadsPerRequest(numberOfThreadsPerRequest){}
+
+    /** Wait until fewer than the maximum number of connections (one per session) are open, and count one more. */
+    void AcquireConnection()
+    {
+      std::unique_lock<std::mutex> lock(this->ConnectionsMutex);
+      this->ConnectionClosed.wait(lock, [this](){ return this->NumberOfConnections < this->MaximumNumberOfSessions; });
+      this->NumberOfConnections++;
+    }
+
+    /** Count one connection less. */
+    void ReleaseConnection()
+    {
+      {
+        std::lock_guard<std::mutex> lock(this->ConnectionsMutex);
+        this->NumberOfConnections--;
+      }
+      this->ConnectionClosed.notify_one();
+    }
+
+    /** Answer the requests of a connection (counted by AcquireConnection()) until the client closes it. */
+    void HandleConnection(const int connection)
+    {
+      std::string request;
+      std::string response;
+      while(ReceiveMessage(connection, request))
+      {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::uint8_t requestType = request.empty() ? 0 : static_cast<std::uint8_t>(request[0]);
+
+        response.assign(1, static_cast<char>(RESPONSE_OK));
+        try
+        {
+          this->HandleRequest(request, response);
+        }
+        catch(const std::exception& e)
+        {
+          response.assign(1, static_cast<char>(RESPONSE_ERROR));
+          response += e.what();
+        }
+
+        if(!SendMessage(connection, response))
+        {
+          break;
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if(requestType == SEGMENT)
+        {
+          this->SegmentLatencies.Add(seconds);
+        }
+        this->AllLatencies.Add(seconds);
+      }
+      close(connection);
+      this->ReleaseConnection();
+    }
+
+  private:
+    void HandleRequest(const std::string& request, std::string& response)
+    {
+      MessageReader reader(request);
+      std::uint8_t requestType = reader.ReadInteger<std::uint8_t>();
+
+      if(requestType == SEGMENT)
+      {
+        this->Segment(reader, response);
+      }
+      else if(requestType == STATS)
+      {
+        std::stringstream ss;
+        ss << "{\"sessions\": " << this->GetNumberOfSessions() << ", \"segment\": ";
+        this->SegmentLatencies.WriteJSON(ss);
+        ss << ", \"all\": ";
+        this->AllLatencies.WriteJSON(ss);
+        ss << "}";
+        response += ss.str();
+      }
+      else if(requestType == CLOSE_SESSION)
+      {
+        std::uint32_t sessionId = reader.ReadInteger<std::uint32_t>();
+        std::lock_guard<std::mutex> lock(this->SessionsMutex);
+        this->Sessions.erase(sessionId);
+      }
+      else
+      {
+        std::stringstream ss;
+        ss << "Unknown request type " << static_cast<int>(requestType) << "!";
+        throw std::runtime_error(ss.str());
+      }
+    }
+
+    void Segment(MessageReader& reader, std::string& response)
+    {
+      std::uint32_t sessionId = reader.ReadInteger<std::uint32_t>();
+      itk::Size<2> size;
+      size[0] = reader.ReadInteger<std::uint32_t>();
+      size[1] = reader.ReadInteger<std::uint32_t>();
+      std::uint32_t numberOfComponents = reader.ReadInteger<std::uint32_t>();
+      float lambda = reader.ReadFloat();
+      std::uint32_t numberOfHistogramBins = reader.ReadInteger<std::uint32_t>();
+      std::uint8_t modelUse = reader.ReadInteger<std::uint8_t>();
+      std::uint8_t imageSource = reader.ReadInteger<std::uint8_t>();
+
+      if(numberOfComponents == 0)
+      {
+        throw std::runtime_error("The image must have at least one component per pixel!");
+      }
+
+      CheckNumberOfHistogramBins(numberOfHistogramBins, numberOfComponents);
+
+      if(modelUse != RETRAIN_MODEL && modelUse != KEEP_MODEL)
+      {
+        std::stringstream ss;
+        ss << "Unknown model use " << static_cast<int>(modelUse) << "!";
+        throw std::runtime_error(ss.str());
+      }
+
+      std::shared_ptr<Session> session = this->GetSession(sessionId);
+      std::lock_guard<std::mutex> lock(session->Mutex);
+
+      // Shared memory images are segmented where they are (the mapping must live until the segmentation is done).
+      // Inline images are copied once, into the session image, which is only reallocated if the size changed.
+      itk::ImageRegion<2> region(size);
+      MappedBuffer sharedMemory;
+      ImageType::Pointer image;
+      if(imageSource == INLINE)
+      {
+        // Check the size against the bytes that were actually sent before allocating anything.
+        const std::size_t numberOfBytes = MultiplySizes(MultiplySizes(size[0], size[1]), numberOfComponents);
+        if(numberOfBytes > reader.GetNumberOfRemainingBytes() || numberOfBytes > MaximumMessageSize)
+        {
+          throw std::runtime_error("The request does not contain the width*height*components image bytes!");
+        }
+
+        image = session->Image;
+        if(image->GetLargestPossibleRegion() != region || image->GetNumberOfComponentsPerPixel() != numberOfComponents)
+        {
+          image->SetRegions(region);
+          image->SetNumberOfComponentsPerPixel(numberOfComponents);
+          image->Allocate();
+        }
+
+        std::memcpy(image->GetBufferPointer(), reader.ReadBytes(numberOfBytes), numberOfBytes);
+      }
+      else if(imageSource == SHARED_MEMORY)
+      {
+        std::uint16_t nameLength = reader.ReadInteger<std::uint16_t>();
+        std::string name(reader.ReadBytes(nameLength), nameLength);
+        std::uint64_t offset = reader.ReadInteger<std::uint64_t>();
+        sharedMemory = MappedBuffer::OpenSharedMemory(name);
+        image = sharedMemory.CreateVectorImage<unsigned char>(size, numberOfComponents, offset);
+      }
+      else
+      {
+        std::stringstream ss;
+        ss << "Unknown image source " << static_cast<int>(imageSource) << "!";
+        throw std::runtime_error(ss.str());
+      }
+
+      reader.ReadMask(size, session->ForegroundSeeds);
+      reader.ReadMask(size, session->BackgroundSeeds);
+
+      ImageGraphCut<ImageType>& graphCut = session->GraphCut;
+      graphCut.SetNumberOfThreads(this->NumberOfThreadsPerRequest);
+      ScopedGraphCutImage graphCutImage(graphCut, image);
+      graphCut.SetSeedsFromMasks(session->ForegroundSeeds, session->BackgroundSeeds);
+      graphCut.SetLambda(lambda);
+      graphCut.SetNumberOfHistogramBins(numberOfHistogramBins);
+
+      // Training samples the seeds once, so a retrained model costs no more than a segmentation without one.
+      if(modelUse == RETRAIN_MODEL || !session->Model)
+      {
+        session->Model = graphCut.TrainModel();
+      }
+      graphCut.SetModel(session->Model);
+      graphCut.PerformSegmentation();
+
+      std::ostringstream maskStream;
+      ForegroundBackgroundSegmentMaskRLE::Write(graphCut.GetSegmentMask(), maskStream);
+      response += maskStream.str();
+    }
+
+    std::shared_ptr<Session> GetSession(const std::uint32_t sessionId)
+    {
+      std::lock_guard<std::mutex> lock(this->SessionsMutex);
+      std::shared_ptr<Session>& session = this->Sessions[sessionId];
+      if(!session)
+      {
+        if(this->Sessions.size() > this->MaximumNumberOfSessions)
+        {
+          this->Sessions.erase(sessionId);
+          throw std::runtime_error("Too many sessions! Close a session before opening a new one.");
+        }
+        session = std::make_shared<Session>();
+      }
+      return session;
+    }
+
+    std::size_t GetNumberOfSessions()
+    {
+      std::lock_guard<std::mutex> lock(this->SessionsMutex);
+      return this->Sessions.size();
+    }
+
+    static bool ReceiveAll(const int connection, char* buffer, std::size_t numberOfBytes)
+    {
+      while(numberOfBytes > 0)
+      {
+        ssize_t received = recv(connection, buffer, numberOfBytes, 0);
+        if(received <= 0)
+        {
+          return false;
+        }
+        buffer += received;
+        numberOfBytes -= received;
+      }
+      return true;
+    }
+
+    static bool SendAll(const int connection, const char* buffer, std::size_t numberOfBytes)
+    {
+      while(numberOfBytes > 0)
+      {
+        ssize_t sent = send(connection, buffer, numberOfBytes, MSG_NOSIGNAL);
+        if(sent <= 0)
+        {
+          return false;
+        }
+        buffer += sent;
+        numberOfBytes -= sent;
+      }
+      return true;
+    }
+
+    /** Receive a length prefixed message. Return false if the connection was closed or the message is too large. */
+    static bool ReceiveMessage(const int connection, std::string& message)
+    {
+      unsigned char lengthBytes[4];
+      if(!ReceiveAll(connection, reinterpret_cast<char*>(lengthBytes), 4))
+      {
+        return false;
+      }
+
+      std::uint32_t length = lengthBytes[0] | (lengthBytes[1] << 8) | (lengthBytes[2] << 16) |
+                             (static_cast<std::uint32_t>(lengthBytes[3]) << 24);
+      if(length > MaximumMessageSize)
+      {
+        std::cerr << "Closing a connection that sent a message of " << length << " bytes." << std::endl;
+        return false;
+      }
+
+      message.resize(length);
+      return ReceiveAll(connection, &message[0], length);
+    }
+
+    static bool SendMessage(const int connection, const std::string& message)
+    {
+      std::uint32_t length = static_cast<std::uint32_t>(message.size());
+      const char lengthBytes[4] = {static_cast<char>(length & 0xff), static_cast<char>((length >> 8) & 0xff),
+                                   static_cast<char>((length >> 16) & 0xff), static_cast<char>(length >> 24)};
+      return SendAll(connection, lengthBytes, 4) && SendAll(connection, message.data(), message.size());
+    }
+
+    unsigned int MaximumNumberOfSessions;
+    unsigned int NumberOfThreadsPerRequest;
+
+    std::mutex SessionsMutex;
+    std::map<std::uint32_t, std::shared_ptr<Session> > Sessions;
+
+    std::mutex ConnectionsMutex;
+    std::condition_variable ConnectionClosed;
+    unsigned int NumberOfConnections = 0;
+
+    LatencyHistogram SegmentLatencies;
+    LatencyHistogram AllLatencies;
+  };
+}
+
+int main(int argc, char* argv[])
+{
+  if(argc < 2 || argc > 4)
+  {
+    std::cerr << "Usage: ImageGraphCutServer socketPath [maximumNumberOfSessions [threadsPerRequest]]" << std::endl;
+    std::cerr << "threadsPerRequest defaults to cores / maximumNumberOfSessions (at least 1), so that the "
+                 "concurrent requests of all of the sessions do not oversubscribe the cores." << std::endl;
+    std::cerr << "At most maximumNumberOfSessions connections are served at once." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::string socketPath = argv[1];
+  unsigned int maximumNumberOfSessions = std::max(1, argc > 2 ? std::atoi(argv[2]) : 64);
+  unsigned int numberOfThreadsPerRequest = argc > 3 ? std::atoi(argv[3]) :
+      std::max(1u, std::max(1u, std::thread::hardware_concurrency()) / maximumNumberOfSessions);
+
+  sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if(socketPath.size() >= sizeof(address.sun_path))
+  {
+    std::cerr << "Socket path " << socketPath << " is too long!" << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::strcpy(address.sun_path, socketPath.c_str());
+
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(socketPath.c_str());
+  if(listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+     listen(listener, SOMAXCONN) != 0)
+  {
+    std::cerr << "Cannot listen on " << socketPath << ": " << std::strerror(errno) << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::signal(SIGPIPE, SIG_IGN);
+
+  std::cout << "Listening on " << socketPath << std::endl;
+
+  // Each connection is served by its own thread. Requests of different sessions run concurrently.
+  // A connection is only accepted when there is room for it, the others wait in the backlog.
+  Server server(maximumNumberOfSessions, numberOfThreadsPerRequest);
+  while(true)
+  {
+    server.AcquireConnection();
+    int connection = accept(listener, nullptr, nullptr);
+    if(connection < 0)
+    {
+      const int error = errno;
+      server.ReleaseConnection();
+      if(error == EINTR)
+      {
+        continue;
+      }
+      std::cerr << "accept() failed: " << std::strerror(error) << std::endl;
+      break;
+    }
+
+    std::thread(&Server::HandleConnection, &server, connection).detach();
+  }
+
+  close(listener);
+  unlink(socketPath.c_str());
+  return EXIT_FAILURE;
+}
@@ -0,0 +1,230 @@
+/*
+Copyright (C) 2012 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** Benchmarks of the whole segmentation on synthetic images.
+  *
+  * Every benchmark reports, per segmentation:
+  *   MP/s              end-to-end throughput (megapixels per wall clock second)
+  *   <stage>_ms        the wall time of each stage, from ImageGraphCut::GetStatistics()
+  *   peak_MB           the peak resident memory of the process
+  *   edges             the number of edges of the graph
+  *   fixed_pixels      the number of pixels labeled before the max flow (graph reduction only)
+  *   energy            the energy of the segmentation (data + smoothness), to compare the approximate modes
+  *   exact             the fraction of the segmentations that were exact (with a deadline)
+  *   error_rate        the fraction of pixels that differ from the ground truth (SHAPES scenes only)
+  *
+  * The arguments are the image size in tenths of a megapixel, the noise in gray levels, the seed density
+  * in seeds per thousand pixels and the number of threads (0 uses all cores).
+  *
+  * Images larger than IMAGEGRAPHCUT_BENCHMARK_MAX_MEGAPIXELS (default 10) are skipped, because the
+  * graph of a 100 megapixel image needs tens of gigabytes. For example, to include them:
+  *   IMAGEGRAPHCUT_BENCHMARK_MAX_MEGAPIXELS=100 ./ImageGraphCutBenchmarks --benchmark_filter=shapes
+  */
+
+#include "SyntheticImages.h"
+
+// Custom
+#include "ImageGraphCut.h"
+
+// Submodules
+#include "Mask/ITKHelpers/ITKHelpers.h"
+
+// Google Benchmark
+#include <benchmark/benchmark.h>
+
+// STL
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+namespace
+{
+  /** The default graph cut. Other solvers or graph backends are compared by registering the benchmarks
+    * below for their types as well. */
+  typedef ImageGraphCut<SyntheticImages::ImageType> DefaultGraphCutType;
+
+  /** The graph cut with integer capacities (see ImageGraphCut::SetIntegerCapacities()). */
+  class IntegerCapacityGraphCutType : public DefaultGraphCutType
+  {
+  public:
+    IntegerCapacityGraphCutType()
+    {
+      this->SetIntegerCapacities(true);
+    }
+  };
+
+  /** The graph cut with the graph reduction (see ImageGraphCut::SetGraphReduction()). */
+  class ReducedGraphCutType : public DefaultGraphCutType
+  {
+  public:
+    ReducedGraphCutType()
+    {
+      this->SetGraphReduction(true);
+    }
+  };
+
+  /** The graph cut in the CIELab color space (see ImageGraphCut::SetColorSpace()). */
+  class CIELabGraphCutType : public DefaultGraphCutType
+  {
+  public:
+    CIELabGraphCutType()
+    {
+      this->SetColorSpace(ColorSpace::CIELAB);
+    }
+  };
+
+  double GetMaximumMegapixels()
+  {
+    const char* value = std::getenv("IMAGEGRAPHCUT_BENCHMARK_MAX_MEGAPIXELS");
+    return value ? std::atof(value) : 10.0;
+  }
+
+  /** Get the scene for the arguments of a benchmark. The last scene is kept, because generating a
+    * large scene takes longer than segmenting it and consecutive benchmarks often use the same one. */
+  const SyntheticImages::Scene& GetScene(const benchmark::State& state, const SyntheticImages::SceneType sceneType)
+  {
+    SyntheticImages::SceneParameters parameters;
+    parameters.Type = sceneType;
+    parameters.Size = SyntheticImages::GetSizeForMegapixels(state.range(0) / 10.0);
+    parameters.NoiseSigma = static_cast<double>(state.range(1));
+    parameters.SeedDensity = state.range(2) / 1000.0;
+
+    static std::string lastDescription;
+    static std::unique_ptr<SyntheticImages::Scene> lastScene;
+
+    const std::string description = SyntheticImages::Describe(parameters);
+    if(!lastScene || description != lastDescription)
+    {
+      lastScene.reset(); // Free the previous scene before creating the next one
+      lastScene.reset(new SyntheticImages::Scene(SyntheticImages::CreateScene(parameters)));
+      lastDescription = description;
+    }
+
+    return *lastScene;
+  }
+
+  /** Segment a scene repeatedly and report the throughput and the time of each stage. With a deadline
+    * ('deadlineMilliseconds' > 0) every segmentation must finish that long after it starts. */
+  template <typename TGraphCut>
+  void BM_Segmentation(benchmark::State& state, const SyntheticImages::SceneType sceneType,
+                       const double deadlineMilliseconds = 0)
+  {
+    const SyntheticImages::Scene& scene = GetScene(state, sceneType);
+
+    TGraphCut graphCut;
+    graphCut.SetImageNoCopy(scene.Image.GetPointer());
+    graphCut.SetSeedsFromMasks(scene.ForegroundSeeds, scene.BackgroundSeeds);
+    graphCut.SetNumberOfThreads(static_cast<unsigned int>(state.range(3)));
+
+    double stageSeconds[SegmentationStatistics::NUMBER_OF_STAGES] = {};
+    double totalSeconds = 0;
+    double numberOfExactSegmentations = 0;
+    for(auto _ : state)
+    {
+      if(deadlineMilliseconds > 0)
+      {
+        graphCut.PerformSegmentation(std::chrono::steady_clock::now() +
+                                     std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                         std::chrono::duration<double, std::milli>(deadlineMilliseconds)));
+      }
+      else
+      {
+        graphCut.PerformSegmentation();
+      }
+
+      const SegmentationStatistics& statistics = graphCut.GetStatistics();
+      for(unsigned int stage = 0; stage < SegmentationStatistics::NUMBER_OF_STAGES; ++stage)
+      {
+        stageSeconds[stage] += statistics.Stages[stage].WallSeconds;
+      }
+      totalSeconds += statistics.Total.WallSeconds;
+      numberOfExactSegmentations += statistics.Exact;
+    }
+
+    const SegmentationStatistics& statistics = graphCut.GetStatistics();
+    const double iterations = static_cast<double>(state.iterations());
+
+    state.counters["MP/s"] = statistics.NumberOfPixels * iterations / 1e6 / totalSeconds;
+    for(unsigned int stage = 0; stage < SegmentationStatistics::NUMBER_OF_STAGES; ++stage)
+    {
+      const std::string name = SegmentationStatistics::GetStageName(static_cast<SegmentationStatistics::Stage>(stage));
+      state.counters[name + "_ms"] = 1000 * stageSeconds[stage] / iterations;
+    }
+    state.counters["peak_MB"] = statistics.Total.PeakMemoryBytes / (1024.0 * 1024.0);
+    state.counters["edges"] = static_cast<double>(statistics.NumberOfEdges);
+    state.counters["fixed_pixels"] = static_cast<double>(statistics.NumberOfFixedPixels);
+    state.counters["energy"] = statistics.DataEnergy + statistics.SmoothnessEnergy;
+    state.counters["exact"] = numberOfExactSegmentations / iterations;
+
+    if(sceneType == SyntheticImages::SceneType::SHAPES)
+    {
+      state.counters["error_rate"] =
+          ITKHelpers::CountDifferentPixels(graphCut.GetSegmentMask(), scene.GroundTruth.GetPointer()) /
+          static_cast<double>(statistics.NumberOfPixels);
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<long long>(statistics.NumberOfPixels));
+  }
+
+  /** The sizes from 0.1 to 100 megapixels with the default noise and seeds, then the noise, the seed density
+    * and the number of threads varied one at a time at 1 megapixel. */
+  void SceneArguments(benchmark::internal::Benchmark* benchmark)
+  {
+    benchmark->ArgNames({"dMP", "noise", "seeds_per_mille", "threads"});
+
+    const double maximumMegapixels = GetMaximumMegapixels();
+    for(const long long tenthsOfMegapixel : {1, 10, 100, 1000})
+    {
+      if(tenthsOfMegapixel <= 10 * maximumMegapixels)
+      {
+        benchmark->Args({tenthsOfMegapixel, 10, 10, 0});
+      }
+    }
+
+    for(const long long noise : {0, 30})
+    {
+      benchmark->Args({10, noise, 10, 0});
+    }
+
+    for(const long long seedsPerMille : {1, 100})
+    {
+      benchmark->Args({10, 10, seedsPerMille, 0});
+    }
+
+    benchmark->Args({10, 10, 10, 1});
+  }
+}
+
+BENCHMARK_CAPTURE(BM_Segmentation<DefaultGraphCutType>, shapes, SyntheticImages::SceneType::SHAPES)
+    ->Apply(SceneArguments)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK_CAPTURE(BM_Segmentation<DefaultGraphCutType>, random, SyntheticImages::SceneType::RANDOM)
+    ->Apply(SceneArguments)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK_CAPTURE(BM_Segmentation<IntegerCapacityGraphCutType>, shapes_integer, SyntheticImages::SceneType::SHAPES)
+    ->Apply(SceneArguments)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK_CAPTURE(BM_Segmentation<IntegerCapacityGraphCutType>, random_integer, SyntheticImages::SceneType::RANDOM)
+    ->Apply(SceneArguments)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK_CAPTURE(BM_Segmentation<ReducedGraphCutType>, shapes_reduced, SyntheticImages::SceneType::SHAPES)
+    ->Apply(SceneArguments)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK_CAPTURE(BM_Segmentation<ReducedGraphCutType>, random_reduced, SyntheticImages::SceneType::RANDOM)
+    ->Apply(SceneArguments)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK_CAPTURE(BM_Segmentation<CIELabGraphCutType>, shapes_cielab, SyntheticImages::SceneType::SHAPES)
+    ->Apply(SceneArguments)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK_CAPTURE(BM_Segmentation<DefaultGraphCutType>, shapes_deadline_50ms, SyntheticImages::SceneType::SHAPES, 50)
+    ->Apply(SceneArguments)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,340 @@
+/*
+Copyright (C) 2012 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SyntheticImages.h"
+
+// Custom
+#include "ParallelFor.h"
+
+// Submodules
+#include "Mask/ITKHelpers/ITKHelpers.h"
+
+// STL
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+  typedef ForegroundBackgroundSegmentMaskPixelTypeEnum MaskPixelType;
+
+  /** A disc or an axis aligned rectangle. */
+  struct Shape
+  {
+    bool IsDisc;
+    long CenterX;
+    long CenterY;
+    long RadiusX;
+    long RadiusY;
+    std::vector<unsigned char> Color;
+
+    bool Contains(const long x, const long y) const
+    {
+      const long dx = x - this->CenterX;
+      const long dy = y - this->CenterY;
+      if(this->IsDisc)
+      {
+        return dx * dx + dy * dy <= this->RadiusX * this->RadiusX;
+      }
+      return std::abs(dx) <= this->RadiusX && std::abs(dy) <= this->RadiusY;
+    }
+  };
+
+  ForegroundBackgroundSegmentMask::Pointer CreateMask(const itk::Size<2>& size, const MaskPixelType value)
+  {
+    ForegroundBackgroundSegmentMask::Pointer mask = ForegroundBackgroundSegmentMask::New();
+    mask->SetRegions(itk::ImageRegion<2>(size));
+    mask->Allocate();
+    mask->FillBuffer(value);
+    return mask;
+  }
+
+  /** Every row gets its own random engine, so that the rows can be generated in any order on any thread. */
+  std::mt19937 CreateRowEngine(const unsigned int randomSeed, const unsigned int purpose, const std::size_t row)
+  {
+    std::seed_seq seeds{randomSeed, purpose, static_cast<unsigned int>(row)};
+    return std::mt19937(seeds);
+  }
+
+  /** Draw the shapes into the image and the ground truth. */
+  void DrawShapes(const SyntheticImages::SceneParameters& parameters, SyntheticImages::Scene& scene)
+  {
+    const long width = static_cast<long>(parameters.Size[0]);
+    const long height = static_cast<long>(parameters.Size[1]);
+    const unsigned int numberOfComponents = parameters.NumberOfComponents;
+
+    std::mt19937 engine(parameters.RandomSeed);
+
+    // The background is dark and the shapes are bright, so the colors are separable but not trivially so
+    // once the noise is added.
+    std::uniform_int_distribution<int> backgroundColorDistribution(40, 90);
+    std::uniform_int_distribution<int> foregroundColorDistribution(140, 220);
+
+    std::vector<unsigned char> backgroundColor(numberOfComponents);
+    for(unsigned int component = 0; component < numberOfComponents; ++component)
+    {
+      backgroundColor[component] = static_cast<unsigned char>(backgroundColorDistribution(engine));
+    }
+
+    std::size_t numberOfShapes = parameters.NumberOfShapes;
+    if(numberOfShapes == 0)
+    {
+      numberOfShapes = std::max<std::size_t>(1, (parameters.Size[0] * parameters.Size[1]) / (64 * 64));
+    }
+
+    const long maximumRadius = std::max(2L, std::min(48L, std::min(width, height) / 4));
+    std::uniform_int_distribution<long> radiusDistribution(std::max(1L, maximumRadius / 4), maximumRadius);
+    std::uniform_int_distribution<long> xDistribution(0, width - 1);
+    std::uniform_int_distribution<long> yDistribution(0, height - 1);
+    std::bernoulli_distribution discDistribution(0.5);
+
+    std::vector<Shape> shapes(numberOfShapes);
+    for(Shape& shape : shapes)
+    {
+      shape.IsDisc = discDistribution(engine);
+      shape.CenterX = xDistribution(engine);
+      shape.CenterY = yDistribution(engine);
+      shape.RadiusX = radiusDistribution(engine);
+      shape.RadiusY = shape.IsDisc ? shape.RadiusX : radiusDistribution(engine);
+      shape.Color.resize(numberOfComponents);
+      for(unsigned int component = 0; component < numberOfComponents; ++component)
+      {
+        shape.Color[component] = static_cast<unsigned char>(foregroundColorDistribution(engine));
+      }
+    }
+
+    unsigned char* const pixels = scene.Image->GetBufferPointer();
+    MaskPixelType* const truth = scene.GroundTruth->GetBufferPointer();
+
+    // Fill the background in parallel, then draw the shapes in order (later shapes cover earlier ones).
+    ParallelFor(0, parameters.Size[0] * parameters.Size[1],
+                [&backgroundColor, pixels, numberOfComponents](const std::size_t begin, const std::size_t end)
+                {
+                  for(std::size_t pixelId = begin; pixelId < end; ++pixelId)
+                  {
+                    std::copy(backgroundColor.begin(), backgroundColor.end(), pixels + pixelId * numberOfComponents);
+                  }
+                });
+
+    for(const Shape& shape : shapes)
+    {
+      const long minimumY = std::max(0L, shape.CenterY - shape.RadiusY);
+      const long maximumY = std::min(height - 1, shape.CenterY + shape.RadiusY);
+      const long minimumX = std::max(0L, shape.CenterX - shape.RadiusX);
+      const long maximumX = std::min(width - 1, shape.CenterX + shape.RadiusX);
+      for(long y = minimumY; y <= maximumY; ++y)
+      {
+        for(long x = minimumX; x <= maximumX; ++x)
+        {
+          if(shape.Contains(x, y))
+          {
+            const std::size_t pixelId = static_cast<std::size_t>(y) * width + x;
+            std::copy(shape.Color.begin(), shape.Color.end(), pixels + pixelId * numberOfComponents);
+            truth[pixelId] = MaskPixelType::FOREGROUND;
+          }
+        }
+      }
+    }
+
+    // Add the noise.
+    if(parameters.NoiseSigma > 0)
+    {
+      const std::size_t rowLength = static_cast<std::size_t>(width) * numberOfComponents;
+      ParallelFor(0, parameters.Size[1],
+                  [&parameters, pixels, rowLength](const std::size_t rowBegin, const std::size_t rowEnd)
+                  {
+                    for(std::size_t row = rowBegin; row < rowEnd; ++row)
+                    {
+                      // The distribution caches values, so it must not be shared between rows either.
+                      std::mt19937 rowEngine = CreateRowEngine(parameters.RandomSeed, 1, row);
+                      std::normal_distribution<double> noiseDistribution(0, parameters.NoiseSigma);
+                      unsigned char* const rowPixels = pixels + row * rowLength;
+                      for(std::size_t value = 0; value < rowLength; ++value)
+                      {
+                        const double noisy = std::round(rowPixels[value] + noiseDistribution(rowEngine));
+                        rowPixels[value] = static_cast<unsigned char>(std::min(255.0, std::max(0.0, noisy)));
+                      }
+                    }
+                  });
+    }
+  }
+
+  /** Place SHAPES seeds on pixels whose 4-neighbors all have the same ground truth label, so that no seed
+    * contradicts the ground truth. */
+  void PlaceShapeSeeds(const SyntheticImages::SceneParameters& parameters, SyntheticImages::Scene& scene)
+  {
+    const std::size_t width = parameters.Size[0];
+    const std::size_t height = parameters.Size[1];
+
+    const MaskPixelType* const truth = scene.GroundTruth->GetBufferPointer();
+    MaskPixelType* const foregroundSeeds = scene.ForegroundSeeds->GetBufferPointer();
+    MaskPixelType* const backgroundSeeds = scene.BackgroundSeeds->GetBufferPointer();
+
+    auto isInterior = [&](const std::size_t x, const std::size_t y)
+    {
+      const MaskPixelType label = truth[y * width + x];
+      return (x == 0 || truth[y * width + x - 1] == label) && (x + 1 == width || truth[y * width + x + 1] == label) &&
+             (y == 0 || truth[(y - 1) * width + x] == label) && (y + 1 == height || truth[(y + 1) * width + x] == label);
+    };
+
+    ParallelFor(0, height,
+                [&](const std::size_t rowBegin, const std::size_t rowEnd)
+                {
+                  std::uniform_real_distribution<double> seedDistribution(0, 1);
+                  for(std::size_t y = rowBegin; y < rowEnd; ++y)
+                  {
+                    std::mt19937 rowEngine = CreateRowEngine(parameters.RandomSeed, 2, y);
+                    for(std::size_t x = 0; x < width; ++x)
+                    {
+                      if(seedDistribution(rowEngine) >= parameters.SeedDensity || !isInterior(x, y))
+                      {
+                        continue;
+                      }
+                      const std::size_t pixelId = y * width + x;
+                      if(truth[pixelId] == MaskPixelType::FOREGROUND)
+                      {
+                        foregroundSeeds[pixelId] = MaskPixelType::FOREGROUND;
+                      }
+                      else
+                      {
+                        backgroundSeeds[pixelId] = MaskPixelType::FOREGROUND;
+                      }
+                    }
+                  }
+                });
+
+    // The segmentation needs at least one seed of each kind, however low the density is.
+    const std::size_t numberOfPixels = width * height;
+    for(int label = 0; label < 2; ++label)
+    {
+      const MaskPixelType truthLabel = label == 0 ? MaskPixelType::FOREGROUND : MaskPixelType::BACKGROUND;
+      MaskPixelType* const seeds = label == 0 ? foregroundSeeds : backgroundSeeds;
+      if(std::find(seeds, seeds + numberOfPixels, MaskPixelType::FOREGROUND) != seeds + numberOfPixels)
+      {
+        continue;
+      }
+      for(std::size_t pixelId = 0; pixelId < numberOfPixels; ++pixelId)
+      {
+        if(truth[pixelId] == truthLabel && isInterior(pixelId % width, pixelId / width))
+        {
+          seeds[pixelId] = MaskPixelType::FOREGROUND;
+          break;
+        }
+      }
+    }
+  }
+
+  /** Place RANDOM seeds anywhere, half of them sources and half of them sinks. */
+  void PlaceRandomSeeds(const SyntheticImages::SceneParameters& parameters, SyntheticImages::Scene& scene)
+  {
+    const std::size_t width = parameters.Size[0];
+    const std::size_t numberOfPixels = width * parameters.Size[1];
+
+    MaskPixelType* const foregroundSeeds = scene.ForegroundSeeds->GetBufferPointer();
+    MaskPixelType* const backgroundSeeds = scene.BackgroundSeeds->GetBufferPointer();
+
+    ParallelFor(0, parameters.Size[1],
+                [&parameters, width, foregroundSeeds, backgroundSeeds](const std::size_t rowBegin,
+                                                                       const std::size_t rowEnd)
+                {
+                  std::uniform_real_distribution<double> seedDistribution(0, 1);
+                  for(std::size_t y = rowBegin; y < rowEnd; ++y)
+                  {
+                    std::mt19937 rowEngine = CreateRowEngine(parameters.RandomSeed, 2, y);
+                    for(std::size_t x = 0; x < width; ++x)
+                    {
+                      const double draw = seedDistribution(rowEngine);
+                      if(draw < parameters.SeedDensity / 2)
+                      {
+                        foregroundSeeds[y * width + x] = MaskPixelType::FOREGROUND;
+                      }
+                      else if(draw < parameters.SeedDensity)
+                      {
+                        backgroundSeeds[y * width + x] = MaskPixelType::FOREGROUND;
+                      }
+                    }
+                  }
+                });
+
+    // The first and last pixels are always seeds, so that both kinds exist.
+    foregroundSeeds[0] = MaskPixelType::FOREGROUND;
+    backgroundSeeds[0] = MaskPixelType::BACKGROUND;
+    backgroundSeeds[numberOfPixels - 1] = MaskPixelType::FOREGROUND;
+    foregroundSeeds[numberOfPixels - 1] = MaskPixelType::BACKGROUND;
+  }
+}
+
+namespace SyntheticImages
+{
+
+itk::Size<2> GetSizeForMegapixels(const double megapixels)
+{
+  const itk::SizeValueType side = std::max<itk::SizeValueType>(
+        2, static_cast<itk::SizeValueType>(std::round(std::sqrt(megapixels * 1e6))));
+  itk::Size<2> size = {{side, side}};
+  return size;
+}
+
+Scene CreateScene(const SceneParameters& parameters)
+{
+  if(parameters.Size[0] < 2 || parameters.Size[1] < 2 || parameters.NumberOfComponents == 0)
+  {
+    std::stringstream ss;
+    ss << "Cannot create a " << parameters.Size << " scene with " << parameters.NumberOfComponents << " components!";
+    throw std::runtime_error(ss.str());
+  }
+
+  Scene scene;
+  scene.Image = ImageType::New();
+  scene.Image->SetRegions(itk::ImageRegion<2>(parameters.Size));
+  scene.Image->SetNumberOfComponentsPerPixel(parameters.NumberOfComponents);
+  scene.Image->Allocate();
+
+  scene.GroundTruth = CreateMask(parameters.Size, MaskPixelType::BACKGROUND);
+  scene.ForegroundSeeds = CreateMask(parameters.Size, MaskPixelType::BACKGROUND);
+  scene.BackgroundSeeds = CreateMask(parameters.Size, MaskPixelType::BACKGROUND);
+
+  switch(parameters.Type)
+  {
+    case SceneType::SHAPES:
+      DrawShapes(parameters, scene);
+      PlaceShapeSeeds(parameters, scene);
+      break;
+    case SceneType::RANDOM:
+      srand(parameters.RandomSeed);
+      ITKHelpers::RandomImage(scene.Image.GetPointer());
+      PlaceRandomSeeds(parameters, scene);
+      break;
+  }
+
+  return scene;
+}
+
+std::string Describe(const SceneParameters& parameters)
+{
+  std::stringstream ss;
+  ss << (parameters.Type == SceneType::SHAPES ? "shapes " : "random ")
+     << parameters.Size[0] << "x" << parameters.Size[1] << "x" << parameters.NumberOfComponents
+     << " noise " << parameters.NoiseSigma << " seeds " << parameters.SeedDensity;
+  return ss.str();
+}
+
+} // end namespace
@@ -0,0 +1,90 @@
+/*
+Copyright (C) 2012 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SyntheticImages_H
+#define SyntheticImages_H
+
+// Submodules
+#include "Mask/ForegroundBackgroundSegmentMask.h"
+
+// ITK
+#include "itkVectorImage.h"
+
+// STL
+#include <string>
+
+/** Generators of synthetic segmentation problems of any size. Everything is generated from a random seed,
+  * so the same arguments always produce the same problem (on any number of threads).
+  */
+namespace SyntheticImages
+{
+  typedef itk::VectorImage<unsigned char, 2> ImageType;
+
+  /** The kind of image to generate.
+    * SHAPES: discs and rectangles of foreground colors on a background color, with Gaussian noise.
+    *         The segmentation should recover the shapes, and the max flow is cheap.
+    * RANDOM: uniform random pixels (ITKHelpers::RandomImage) with randomly placed seeds. There is no
+    *         structure to find, so this is the worst case for the max flow. */
+  enum class SceneType {SHAPES, RANDOM};
+
+  /** A segmentation problem. */
+  struct Scene
+  {
+    ImageType::Pointer Image;
+
+    /** The pixels inside the shapes are FOREGROUND (all BACKGROUND for RANDOM scenes). */
+    ForegroundBackgroundSegmentMask::Pointer GroundTruth;
+
+    /** The seeds: FOREGROUND pixels of ForegroundSeeds are sources and FOREGROUND pixels of
+      * BackgroundSeeds are sinks (as passed to ImageGraphCut::SetSeedsFromMasks()). */
+    ForegroundBackgroundSegmentMask::Pointer ForegroundSeeds;
+    ForegroundBackgroundSegmentMask::Pointer BackgroundSeeds;
+  };
+
+  /** The parameters of a scene. */
+  struct SceneParameters
+  {
+    SceneType Type = SceneType::SHAPES;
+
+    itk::Size<2> Size = {{512, 512}};
+
+    unsigned int NumberOfComponents = 3;
+
+    /** The standard deviation of the Gaussian noise added to SHAPES images (in gray levels). */
+    double NoiseSigma = 10;
+
+    /** The fraction of the pixels that are seeds. SHAPES seeds are only placed away from the shape
+      * boundaries, so the seeds are always consistent with the ground truth. */
+    double SeedDensity = 0.01;
+
+    /** The number of shapes (0 picks one shape per 64x64 pixels). */
+    unsigned int NumberOfShapes = 0;
+
+    unsigned int RandomSeed = 0;
+  };
+
+  /** Get the size of the square image closest to 'megapixels' megapixels. */
+  itk::Size<2> GetSizeForMegapixels(const double megapixels);
+
+  /** Generate a segmentation problem. */
+  Scene CreateScene(const SceneParameters& parameters);
+
+  /** Get a short description of the parameters, e.g. "shapes 1024x1024x3 noise 10 seeds 0.01". */
+  std::string Describe(const SceneParameters& parameters);
+}
+
+#endif
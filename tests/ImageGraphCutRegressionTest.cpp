@@ -0,0 +1,926 @@
+/*
+Copyright (C) 2012 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** Checks that every way of running a segmentation produces the same cut as the reference path
+  * (index list seeds, a copied image, one thread and the boost::adjacency_list + Boykov-Kolmogorov solver).
+  *
+  * Each case of the corpus is segmented by the reference and by every variant. An exact variant fails if its
+  * mask differs from the reference mask in any pixel (ITKHelpers::CountDifferentPixels) or if the energy of its
+  * cut differs from the energy of the reference cut. A variant with other capacities (e.g. integer capacities)
+  * fails if its cut costs more than the rounding of its capacities allows. The energy of a cut is computed here
+  * from the reference graph (the sum of the capacities of the edges from the source side to the sink side),
+  * independently of the solver.
+  * A variant that segments another problem than the reference path (e.g. the image in another color space) is
+  * compared in the same way with the reference segmentation of that problem (e.g. of the converted image).
+  * An approximate result (of a segmentation with a deadline) fails if it changes a seed, if its cut costs less
+  * than the reference cut, or if it costs more than the approximation that it refines.
+  * The reference itself fails if its cut costs more than the ground truth of a synthetic case, or if it
+  * differs from the stored baseline of a stored case.
+  *
+  * Usage: ImageGraphCutRegressionTest [corpus.txt]
+  * The synthetic cases are always run. Each line of the optional corpus file adds a stored case:
+  *   image foregroundSeeds backgroundSeeds [baseline]
+  * Seeds and baselines are .fbrle/.fbmask files or images with 255 foreground and 0 background pixels.
+  * Relative paths are relative to the corpus file, and '#' starts a comment.
+  */
+
+#include "SyntheticImages.h"
+
+// Custom
+#include "ColorSpaceConverter.h"
+#include "EdgeMaps.h"
+#include "ImageGraphCut.h"
+
+// Submodules
+#include "Mask/ITKHelpers/Helpers/Helpers.h"
+#include "Mask/ITKHelpers/ITKHelpers.h"
+
+// ITK
+#include "itkImageFileReader.h"
+#include "itkImageRegionConstIteratorWithIndex.h"
+
+// STL
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+  typedef SyntheticImages::ImageType ImageType;
+  typedef ForegroundBackgroundSegmentMaskPixelTypeEnum MaskPixelType;
+
+  /** A graph cut that can compute the energy of any labeling of its last graph. */
+  template <typename TImage>
+  class CutEnergyGraphCut : public ImageGraphCut<TImage>
+  {
+  public:
+    /** Get the sum of the float capacities of the edges that go from the source side to the sink side, where
+      * the FOREGROUND pixels of 'mask' are on the source side, and optionally the number of these edges. */
+    double ComputeCutEnergy(const ForegroundBackgroundSegmentMask* const mask,
+                            std::size_t* const numberOfCutEdges = nullptr) const
+    {
+      const MaskPixelType* const labels = mask->GetBufferPointer();
+      auto isSourceSide = [this, labels](const std::size_t vertex)
+      {
+        if(vertex == this->SourceNodeId || vertex == this->SinkNodeId)
+        {
+          return vertex == this->SourceNodeId;
+        }
+        return labels[vertex] == MaskPixelType::FOREGROUND;
+      };
+
+      double energy = 0;
+      std::size_t cutEdges = 0;
+      typename ImageGraphCut<TImage>::GraphType::edge_iterator edge, edgeEnd;
+      for(boost::tie(edge, edgeEnd) = edges(this->Graph); edge != edgeEnd; ++edge)
+      {
+        if(isSourceSide(source(*edge, this->Graph)) && !isSourceSide(target(*edge, this->Graph)))
+        {
+          energy += this->EdgeWeights[get(boost::edge_index, this->Graph, *edge)];
+          cutEdges++;
+        }
+      }
+
+      if(numberOfCutEdges)
+      {
+        *numberOfCutEdges = cutEdges;
+      }
+      return energy;
+    }
+  };
+
+  typedef CutEnergyGraphCut<ImageType> GraphCutType;
+
+  /** An image and its seeds, with an optional ground truth (synthetic cases) or baseline (stored cases). */
+  struct TestCase
+  {
+    std::string Name;
+    ImageType::Pointer Image;
+    ForegroundBackgroundSegmentMask::Pointer ForegroundSeeds;
+    ForegroundBackgroundSegmentMask::Pointer BackgroundSeeds;
+    ForegroundBackgroundSegmentMask::Pointer GroundTruth;
+    ForegroundBackgroundSegmentMask::Pointer Baseline;
+
+    /** The edge map of the boundary term, or nullptr for the pixel differences (see ImageGraphCut::SetEdgeMap()). */
+    EdgeMaps::ImageType::Pointer EdgeMap;
+  };
+
+  /** A way of running a segmentation: 'Run' configures and runs 'graphCut' on the case. */
+  struct Variant
+  {
+    const char* Name;
+    std::function<void (GraphCutType& graphCut, const TestCase& testCase)> Run;
+
+    /** How far each capacity of the variant can be from the float capacity of the reference (0 if the
+      * capacities are the same). The minimum cut of such a variant can differ from the reference cut, but
+      * it costs at most this error times the number of edges of the two cuts more in the reference graph. */
+    double MaximumCapacityError;
+
+    /** If set, the variant is compared with the reference segmentation of the case that this creates from the
+      * case (e.g. the case with its image converted to another color space) instead of the reference of the case.
+      * It returns false if the variant does not apply to the case, which is then skipped. */
+    std::function<bool (const TestCase& testCase, TestCase& referenceCase)> CreateReferenceCase;
+
+    /** Is the result an approximation when the segmentation reports that it is not exact (see
+      * ImageGraphCut::PerformSegmentation(deadline))? Such a result is not compared with the reference cut: it must
+      * keep the seeds, and cost at least as much as the reference cut and at most as much as the approximate result
+      * of the variant named ApproximationBound (if set) on the case, which must come earlier in Variants. */
+    bool Approximate;
+    const char* ApproximationBound;
+  };
+
+  /** The scale of the integer capacities variant (see ImageGraphCut::SetIntegerCapacities()). */
+  const double IntegerCapacityScale = 1024;
+
+  /** A scale at which the flow of every test case overflows the integer capacities, and the lowest scale that the
+    * capacities may be scaled down to for such a scale on the test cases. */
+  const double OverflowingCapacityScale = 1e6;
+  const double MinimumFittedCapacityScale = 64;
+
+  /** The graph reduction sums t-links and n-links, so its float capacities can be rounded differently. */
+  const double GraphReductionRoundingError = 1e-6;
+
+  std::vector<itk::Index<2> > GetForegroundIndices(const ForegroundBackgroundSegmentMask* const mask)
+  {
+    std::vector<itk::Index<2> > indices;
+    itk::ImageRegionConstIteratorWithIndex<ForegroundBackgroundSegmentMask>
+        iterator(mask, mask->GetLargestPossibleRegion());
+    for(; !iterator.IsAtEnd(); ++iterator)
+    {
+      if(iterator.Get() == MaskPixelType::FOREGROUND)
+      {
+        indices.push_back(iterator.GetIndex());
+      }
+    }
+    return indices;
+  }
+
+  ForegroundBackgroundSegmentMask::Pointer Segment(const Variant& variant, const TestCase& testCase,
+                                                   SegmentationStatistics& statistics)
+  {
+    GraphCutType graphCut;
+    graphCut.SetNumberOfThreads(1);
+    graphCut.SetCutVerification(true);
+    variant.Run(graphCut, testCase);
+    statistics = graphCut.GetStatistics();
+    return graphCut.GetSegmentMask();
+  }
+
+  /** The reference segmentation of a case. Its graph computes the energy of every cut. */
+  struct Reference
+  {
+    GraphCutType GraphCut;
+    ForegroundBackgroundSegmentMask::Pointer Mask;
+    double Energy = 0;
+    std::size_t NumberOfCutEdges = 0;
+  };
+
+  /** The reference path. */
+  void RunReference(GraphCutType& graphCut, const TestCase& testCase)
+  {
+    graphCut.SetImage(testCase.Image);
+    graphCut.SetEdgeMap(testCase.EdgeMap);
+    graphCut.SetSources(GetForegroundIndices(testCase.ForegroundSeeds));
+    graphCut.SetSinks(GetForegroundIndices(testCase.BackgroundSeeds));
+    graphCut.PerformSegmentation();
+  }
+
+  void RunSeedMasks(GraphCutType& graphCut, const TestCase& testCase)
+  {
+    graphCut.SetImage(testCase.Image);
+    graphCut.SetSeedsFromMasks(testCase.ForegroundSeeds, testCase.BackgroundSeeds);
+    graphCut.PerformSegmentation();
+  }
+
+  void RunImageNoCopy(GraphCutType& graphCut, const TestCase& testCase)
+  {
+    graphCut.SetImageNoCopy(testCase.Image);
+    graphCut.SetSeedsFromMasks(testCase.ForegroundSeeds, testCase.BackgroundSeeds);
+    graphCut.PerformSegmentation();
+  }
+
+  void RunAllThreads(GraphCutType& graphCut, const TestCase& testCase)
+  {
+    graphCut.SetNumberOfThreads(0);
+    RunSeedMasks(graphCut, testCase);
+  }
+
+  /** Also produce the packed mask and the caller's buffer, and check that they match the mask. */
+  void RunPackedAndBuffer(GraphCutType& graphCut, const TestCase& testCase)
+  {
+    const std::size_t numberOfPixels = testCase.Image->GetLargestPossibleRegion().GetNumberOfPixels();
+    std::vector<unsigned char> buffer(numberOfPixels, 1);
+
+    graphCut.SetNumberOfThreads(0);
+    graphCut.SetComputePackedSegmentMask(true);
+    graphCut.SetOutputBuffer(buffer.data(), 255, 0);
+    RunSeedMasks(graphCut, testCase);
+
+    // The buffer only lives until the end of this function.
+    graphCut.SetOutputBuffer(nullptr);
+
+    ForegroundBackgroundSegmentMask::Pointer unpacked = ForegroundBackgroundSegmentMask::New();
+    graphCut.GetPackedSegmentMask()->ToMask(unpacked);
+    if(ITKHelpers::CountDifferentPixels(unpacked.GetPointer(), graphCut.GetSegmentMask()) != 0)
+    {
+      throw std::runtime_error("The packed mask does not match the mask!");
+    }
+
+    const MaskPixelType* const mask = graphCut.GetSegmentMask()->GetBufferPointer();
+    for(std::size_t pixelId = 0; pixelId < numberOfPixels; ++pixelId)
+    {
+      if(buffer[pixelId] != (mask[pixelId] == MaskPixelType::FOREGROUND ? 255 : 0))
+      {
+        std::stringstream ss;
+        ss << "Pixel " << pixelId << " of the output buffer does not match the mask!";
+        throw std::runtime_error(ss.str());
+      }
+    }
+  }
+
+  /** Segment an image of another size first, then the case twice, so that the result comes from the
+    * path that reuses the buffers of a previous segmentation. */
+  void RunReused(GraphCutType& graphCut, const TestCase& testCase)
+  {
+    SyntheticImages::SceneParameters parameters;
+    parameters.Size[0] = testCase.Image->GetLargestPossibleRegion().GetSize()[0] + 7;
+    parameters.Size[1] = testCase.Image->GetLargestPossibleRegion().GetSize()[1] + 3;
+    parameters.NumberOfComponents = testCase.Image->GetNumberOfComponentsPerPixel();
+    parameters.RandomSeed = 1234;
+    SyntheticImages::Scene other = SyntheticImages::CreateScene(parameters);
+
+    graphCut.SetImage(other.Image);
+    graphCut.SetSeedsFromMasks(other.ForegroundSeeds, other.BackgroundSeeds);
+    graphCut.PerformSegmentation();
+
+    RunSeedMasks(graphCut, testCase);
+    graphCut.PerformSegmentation();
+  }
+
+  void RunIntegerCapacities(GraphCutType& graphCut, const TestCase& testCase)
+  {
+    graphCut.SetIntegerCapacities(true, IntegerCapacityScale);
+    RunSeedMasks(graphCut, testCase);
+  }
+
+  /** The capacities are scaled down until the flow fits. */
+  void RunFittedIntegerCapacities(GraphCutType& graphCut, const TestCase& testCase)
+  {
+    graphCut.SetIntegerCapacities(true, OverflowingCapacityScale);
+    RunSeedMasks(graphCut, testCase);
+
+    const double capacityScale = graphCut.GetStatistics().CapacityScale;
+    if(!(capacityScale < OverflowingCapacityScale && capacityScale >= MinimumFittedCapacityScale))
+    {
+      std::stringstream ss;
+      ss << "The integer capacities were scaled to " << capacityScale << "!";
+      throw std::runtime_error(ss.str());
+    }
+  }
+
+  void RunGraphReduction(GraphCutType& graphCut, const TestCase& testCase)
+  {
+    graphCut.SetGraphReduction(true);
+    RunSeedMasks(graphCut, testCase);
+  }
+
+  /** A deadline that leaves time for the exact cut, which goes through the coarse segmentation first. */
+  void RunGenerousDeadline(GraphCutType& graphCut, const TestCase& testCase)
+  {
+    graphCut.SetImage(testCase.Image);
+    graphCut.SetSeedsFromMasks(testCase.ForegroundSeeds, testCase.BackgroundSeeds);
+    if(!graphCut.PerformSegmentation(std::chrono::steady_clock::now() + std::chrono::hours(1)))
+    {
+      throw std::runtime_error("The segmentation with a generous deadline is not exact!");
+    }
+  }
+
+  /** Check that a segmentation with a deadline was exact if and only if the image is too small to approximate. */
+  void CheckDeadlineExact(const TestCase& testCase, const bool exact, const std::string& deadline)
+  {
+    const bool expectedExact =
+        testCase.Image->GetLargestPossibleRegion().GetNumberOfPixels() <= GraphCutType::CoarseNumberOfPixels;
+    if(exact != expectedExact)
+    {
+      throw std::runtime_error("The segmentation with " + deadline + (exact ? " is" : " is not") + " exact!");
+    }
+  }
+
+  /** A deadline that has already passed, so only the upsampled coarse labels are computed. */
+  void RunExpiredDeadline(GraphCutType& graphCut, const TestCase& testCase)
+  {
+    graphCut.SetImage(testCase.Image);
+    graphCut.SetSeedsFromMasks(testCase.ForegroundSeeds, testCase.BackgroundSeeds);
+    const bool exact = graphCut.PerformSegmentation(std::chrono::steady_clock::now() - std::chrono::seconds(1));
+    CheckDeadlineExact(testCase, exact, "an expired deadline");
+  }
+
+  /** The cut refined in the band around the coarse boundary. The deadlines that predict it depend on the speed of
+    * the machine, so it is forced. */
+  void RunBandDeadline(GraphCutType& graphCut, const TestCase& testCase)
+  {
+    graphCut.SetImage(testCase.Image);
+    graphCut.SetSeedsFromMasks(testCase.ForegroundSeeds, testCase.BackgroundSeeds);
+    graphCut.SetDeadlineCut(GraphCutType::DeadlineCut::BAND);
+    const bool exact = graphCut.PerformSegmentation(std::chrono::steady_clock::now() + std::chrono::hours(1));
+    CheckDeadlineExact(testCase, exact, "a band sized deadline");
+  }
+
+  /** Segment on a thread pool, while the calling thread waits for the future. */
+  void RunAsync(GraphCutType& graphCut, const TestCase& testCase)
+  {
+    ThreadPoolExecutor executor(2);
+    graphCut.SetImage(testCase.Image);
+    graphCut.SetSeedsFromMasks(testCase.ForegroundSeeds, testCase.BackgroundSeeds);
+    std::future<ForegroundBackgroundSegmentMask::Pointer> result = graphCut.PerformSegmentationAsync(executor);
+    ForegroundBackgroundSegmentMask::Pointer mask = result.get();
+
+    // The future holds a copy, which must not change when the object segments again.
+    const ForegroundBackgroundSegmentMask* const segmentMask = graphCut.GetSegmentMask();
+    const std::size_t numberOfPixels = segmentMask->GetLargestPossibleRegion().GetNumberOfPixels();
+    if(mask.GetPointer() == segmentMask ||
+       mask->GetLargestPossibleRegion() != segmentMask->GetLargestPossibleRegion() ||
+       !std::equal(segmentMask->GetBufferPointer(), segmentMask->GetBufferPointer() + numberOfPixels,
+                   mask->GetBufferPointer()))
+    {
+      throw std::runtime_error("The future does not hold a copy of the segment mask!");
+    }
+  }
+
+  /** Train a model once and segment with it on two threads at once, with one object per thread. */
+  void RunSharedModel(GraphCutType& graphCut, const TestCase& testCase)
+  {
+    GraphCutType trainer;
+    trainer.SetImage(testCase.Image);
+    trainer.SetSeedsFromMasks(testCase.ForegroundSeeds, testCase.BackgroundSeeds);
+    const std::shared_ptr<const GraphCutType::ModelType> model = trainer.TrainModel();
+
+    GraphCutType other;
+    other.SetModel(model);
+    std::future<void> otherResult = std::async(std::launch::async, [&other, &testCase]()
+      {
+        RunSeedMasks(other, testCase);
+      });
+
+    graphCut.SetModel(model);
+    RunSeedMasks(graphCut, testCase);
+    otherResult.get();
+
+    if(ITKHelpers::CountDifferentPixels(other.GetSegmentMask(), graphCut.GetSegmentMask()) != 0)
+    {
+      throw std::runtime_error("The segmentations with the shared model do not match!");
+    }
+
+    // The RGB histograms of the model do not describe CIELab pixels.
+    other.SetColorSpace(ColorSpace::CIELAB);
+    bool threw = false;
+    try
+    {
+      other.PerformSegmentation();
+    }
+    catch(const std::runtime_error&)
+    {
+      threw = true;
+    }
+    if(!threw)
+    {
+      throw std::runtime_error("A segmentation in another color space than its model did not throw!");
+    }
+  }
+
+  /** Cancel a segmentation while it creates the n-links, then segment again with the same objects. */
+  void RunAfterCancel(GraphCutType& graphCut, const TestCase& testCase)
+  {
+    SegmentationProgress progress;
+    progress.SetCallback([&progress](const SegmentationStatistics::Stage stage, const double)
+      {
+        if(stage == SegmentationStatistics::CREATE_N_EDGES)
+        {
+          progress.Cancel();
+        }
+      });
+    graphCut.SetProgress(&progress);
+
+    bool cancelled = false;
+    try
+    {
+      RunSeedMasks(graphCut, testCase);
+    }
+    catch(const SegmentationCancelledError&)
+    {
+      cancelled = true;
+    }
+
+    if(!cancelled)
+    {
+      graphCut.SetProgress(nullptr);
+      throw std::runtime_error("The cancelled segmentation did not throw SegmentationCancelledError!");
+    }
+
+    progress.Reset();
+    try
+    {
+      RunSeedMasks(graphCut, testCase);
+    }
+    catch(...)
+    {
+      graphCut.SetProgress(nullptr);
+      throw;
+    }
+
+    // The progress only lives until the end of this function.
+    graphCut.SetProgress(nullptr);
+  }
+
+  /** Segment in CIELab. This must cut like the reference segments the image converted to CIELab beforehand. */
+  void RunCIELab(GraphCutType& graphCut, const TestCase& testCase)
+  {
+    graphCut.SetColorSpace(ColorSpace::CIELAB);
+    RunSeedMasks(graphCut, testCase);
+  }
+
+  /** Segment in HSV, like RunCIELab(). */
+  void RunHSV(GraphCutType& graphCut, const TestCase& testCase)
+  {
+    graphCut.SetColorSpace(ColorSpace::HSV);
+    RunSeedMasks(graphCut, testCase);
+  }
+
+  /** Create the case with the image of 'testCase' converted to 'colorSpace', if it has RGB components. */
+  bool CreateConvertedCase(const TestCase& testCase, const ColorSpace colorSpace, TestCase& referenceCase)
+  {
+    const unsigned int numberOfComponents = testCase.Image->GetNumberOfComponentsPerPixel();
+    if(numberOfComponents < 3)
+    {
+      return false;
+    }
+
+    referenceCase = testCase;
+    referenceCase.Image = ImageType::New();
+    referenceCase.Image->SetRegions(testCase.Image->GetLargestPossibleRegion());
+    referenceCase.Image->SetNumberOfComponentsPerPixel(numberOfComponents);
+    referenceCase.Image->Allocate();
+    ColorSpaceConverter(colorSpace).Convert(testCase.Image->GetBufferPointer(), referenceCase.Image->GetBufferPointer(),
+                                            testCase.Image->GetLargestPossibleRegion().GetNumberOfPixels(),
+                                            numberOfComponents);
+    return true;
+  }
+
+  bool CreateCIELabCase(const TestCase& testCase, TestCase& referenceCase)
+  {
+    return CreateConvertedCase(testCase, ColorSpace::CIELAB, referenceCase);
+  }
+
+  bool CreateHSVCase(const TestCase& testCase, TestCase& referenceCase)
+  {
+    return CreateConvertedCase(testCase, ColorSpace::HSV, referenceCase);
+  }
+
+  /** Segment with the gradient magnitude edge map, computed on all cores. This must cut like the reference with the
+    * edge map computed on one thread. An edge map of another size than the image must be rejected first. */
+  void RunEdgeMap(GraphCutType& graphCut, const TestCase& testCase)
+  {
+    const itk::ImageRegion<2> region = testCase.Image->GetLargestPossibleRegion();
+    itk::Size<2> wrongSize = region.GetSize();
+    wrongSize[0]++;
+    EdgeMaps::ImageType::Pointer wrongEdgeMap = EdgeMaps::ImageType::New();
+    wrongEdgeMap->SetRegions(itk::ImageRegion<2>(wrongSize));
+    wrongEdgeMap->Allocate();
+    wrongEdgeMap->FillBuffer(0);
+
+    graphCut.SetEdgeMap(wrongEdgeMap);
+    bool threw = false;
+    try
+    {
+      RunSeedMasks(graphCut, testCase);
+    }
+    catch(const std::runtime_error&)
+    {
+      threw = true;
+    }
+    if(!threw)
+    {
+      throw std::runtime_error("A segmentation with an edge map of another size than the image did not throw!");
+    }
+
+    EdgeMaps::ImageType::Pointer edgeMap = EdgeMaps::ImageType::New();
+    EdgeMaps::ComputeGradientMagnitude(testCase.Image.GetPointer(), edgeMap.GetPointer(), 0);
+    graphCut.SetEdgeMap(edgeMap);
+    RunSeedMasks(graphCut, testCase);
+  }
+
+  bool CreateEdgeMapCase(const TestCase& testCase, TestCase& referenceCase)
+  {
+    referenceCase = testCase;
+    referenceCase.EdgeMap = EdgeMaps::ImageType::New();
+    EdgeMaps::ComputeGradientMagnitude(testCase.Image.GetPointer(), referenceCase.EdgeMap.GetPointer(), 1);
+    return true;
+  }
+
+  /** Every fast path. Register new solvers, graph backends and options here. */
+  const std::vector<Variant> Variants = {
+    {"seed_masks", RunSeedMasks, 0},
+    {"image_no_copy", RunImageNoCopy, 0},
+    {"all_threads", RunAllThreads, 0},
+    {"packed_and_buffer", RunPackedAndBuffer, 0},
+    {"reused", RunReused, 0},
+    {"integer_capacities", RunIntegerCapacities, 0.5 / IntegerCapacityScale},
+    {"fitted_integer_capacities", RunFittedIntegerCapacities, 0.5 / MinimumFittedCapacityScale},
+    {"graph_reduction", RunGraphReduction, GraphReductionRoundingError},
+    {"generous_deadline", RunGenerousDeadline, 0},
+    {"expired_deadline", RunExpiredDeadline, 0, nullptr, true, nullptr},
+    {"band_deadline", RunBandDeadline, 0, nullptr, true, "expired_deadline"},
+    {"after_cancel", RunAfterCancel, 0},
+    {"async", RunAsync, 0},
+    {"shared_model", RunSharedModel, 0},
+    {"cielab", RunCIELab, 0, CreateCIELabCase},
+    {"hsv", RunHSV, 0, CreateHSVCase},
+    {"edge_map", RunEdgeMap, 0, CreateEdgeMapCase}};
+
+  bool EnergiesMatch(const double energy1, const double energy2)
+  {
+    return std::abs(energy1 - energy2) <= 1e-6 * std::max(1.0, std::abs(energy1));
+  }
+
+  /** Check the energy and the cut verification that a segmentation reported against 'energy', the energy of
+    * its mask in the reference graph. Return an empty string if they are correct, otherwise the problem. */
+  std::string CheckReportedEnergy(const SegmentationStatistics& statistics, const double energy,
+                                  const double tolerance)
+  {
+    std::stringstream problem;
+    const double reportedEnergy = statistics.DataEnergy + statistics.SmoothnessEnergy;
+    if(std::abs(reportedEnergy - energy) > tolerance && !EnergiesMatch(energy, reportedEnergy))
+    {
+      problem << " reported energy " << reportedEnergy;
+    }
+
+    if(statistics.CutVerification != SegmentationStatistics::VERIFIED)
+    {
+      problem << " cut " << SegmentationStatistics::GetCutVerificationName(statistics.CutVerification)
+              << " (flow " << statistics.FlowValue << ", capacity " << statistics.CutCapacity << ", "
+              << statistics.NumberOfUnsaturatedCutEdges << " unsaturated edges)";
+    }
+
+    return problem.str();
+  }
+
+  /** Count the seeds of 'testCase' that do not have their label in 'mask'. */
+  std::size_t CountChangedSeeds(const TestCase& testCase, const ForegroundBackgroundSegmentMask* const mask)
+  {
+    const std::size_t numberOfPixels = mask->GetLargestPossibleRegion().GetNumberOfPixels();
+    const MaskPixelType* const labels = mask->GetBufferPointer();
+    const MaskPixelType* const foregroundSeeds = testCase.ForegroundSeeds->GetBufferPointer();
+    const MaskPixelType* const backgroundSeeds = testCase.BackgroundSeeds->GetBufferPointer();
+
+    std::size_t numberOfChangedSeeds = 0;
+    for(std::size_t pixelId = 0; pixelId < numberOfPixels; ++pixelId)
+    {
+      if((foregroundSeeds[pixelId] == MaskPixelType::FOREGROUND && labels[pixelId] != MaskPixelType::FOREGROUND) ||
+         (backgroundSeeds[pixelId] == MaskPixelType::FOREGROUND && labels[pixelId] != MaskPixelType::BACKGROUND))
+      {
+        numberOfChangedSeeds++;
+      }
+    }
+    return numberOfChangedSeeds;
+  }
+
+  /** Check an approximate result with the energy 'energy' (see Variant::Approximate), where 'approximateEnergies'
+    * has the energies of the earlier approximate results of the case. Return an empty string if it is correct,
+    * otherwise the problem. */
+  std::string CheckApproximation(const Variant& variant, const TestCase& testCase,
+                                 const ForegroundBackgroundSegmentMask* const mask, const double energy,
+                                 const Reference& reference, const std::map<std::string, double>& approximateEnergies)
+  {
+    std::stringstream problem;
+    const std::size_t numberOfChangedSeeds = CountChangedSeeds(testCase, mask);
+    if(numberOfChangedSeeds != 0)
+    {
+      problem << " " << numberOfChangedSeeds << " seeds changed their label";
+    }
+
+    if(energy < reference.Energy && !EnergiesMatch(reference.Energy, energy))
+    {
+      problem << " costs less than the minimum cut";
+    }
+
+    // The approximation that is refined is a feasible labeling of the refinement, which can only cost less.
+    if(variant.ApproximationBound)
+    {
+      std::map<std::string, double>::const_iterator bound = approximateEnergies.find(variant.ApproximationBound);
+      if(bound != approximateEnergies.end() && energy > bound->second && !EnergiesMatch(bound->second, energy))
+      {
+        problem << " costs more than " << variant.ApproximationBound << " (" << bound->second << ")";
+      }
+    }
+
+    return problem.str();
+  }
+
+  std::vector<TestCase> CreateSyntheticCases()
+  {
+    struct SyntheticCase
+    {
+      const char* Name;
+      SyntheticImages::SceneType Type;
+      itk::SizeValueType Width;
+      itk::SizeValueType Height;
+      unsigned int NumberOfComponents;
+      double NoiseSigma;
+      double SeedDensity;
+    };
+
+    // Small cases run on one thread inside ParallelFor, the 640x480 ones are large enough to be split.
+    const SyntheticCase syntheticCases[] = {
+      {"shapes_rgb", SyntheticImages::SceneType::SHAPES, 256, 256, 3, 10, 0.01},
+      {"shapes_gray_noisy", SyntheticImages::SceneType::SHAPES, 200, 150, 1, 30, 0.005},
+      {"shapes_rgba_sparse", SyntheticImages::SceneType::SHAPES, 640, 480, 4, 15, 0.0005},
+      {"shapes_clean_dense", SyntheticImages::SceneType::SHAPES, 640, 480, 3, 0, 0.1},
+      {"random_rgb", SyntheticImages::SceneType::RANDOM, 160, 120, 3, 0, 0.02}};
+
+    std::vector<TestCase> testCases;
+    for(const SyntheticCase& syntheticCase : syntheticCases)
+    {
+      SyntheticImages::SceneParameters parameters;
+      parameters.Type = syntheticCase.Type;
+      parameters.Size[0] = syntheticCase.Width;
+      parameters.Size[1] = syntheticCase.Height;
+      parameters.NumberOfComponents = syntheticCase.NumberOfComponents;
+      parameters.NoiseSigma = syntheticCase.NoiseSigma;
+      parameters.SeedDensity = syntheticCase.SeedDensity;
+      SyntheticImages::Scene scene = SyntheticImages::CreateScene(parameters);
+
+      TestCase testCase;
+      testCase.Name = syntheticCase.Name;
+      testCase.Image = scene.Image;
+      testCase.ForegroundSeeds = scene.ForegroundSeeds;
+      testCase.BackgroundSeeds = scene.BackgroundSeeds;
+      if(syntheticCase.Type == SyntheticImages::SceneType::SHAPES)
+      {
+        testCase.GroundTruth = scene.GroundTruth;
+      }
+      testCases.push_back(testCase);
+    }
+
+    return testCases;
+  }
+
+  ForegroundBackgroundSegmentMask::Pointer ReadMask(const std::string& filename)
+  {
+    ForegroundBackgroundSegmentMask::Pointer mask = ForegroundBackgroundSegmentMask::New();
+    const std::string extension = Helpers::GetFileExtension(filename);
+    if(extension == "fbrle" || extension == "fbmask")
+    {
+      mask->Read(filename);
+    }
+    else
+    {
+      mask->ReadFromImage<unsigned char>(filename, ForegroundPixelValueWrapper<unsigned char>(255),
+                                         BackgroundPixelValueWrapper<unsigned char>(0),
+                                         ForegroundBackgroundSegmentMaskReadPolicy::NEAREST);
+    }
+    return mask;
+  }
+
+  std::vector<TestCase> ReadStoredCases(const std::string& corpusFilename)
+  {
+    std::ifstream fin(corpusFilename.c_str());
+    if(!fin)
+    {
+      throw std::runtime_error("Cannot open " + corpusFilename + "!");
+    }
+
+    std::string directory;
+    std::size_t slash = corpusFilename.find_last_of('/');
+    if(slash != std::string::npos)
+    {
+      directory = corpusFilename.substr(0, slash + 1);
+    }
+    auto resolve = [&directory](const std::string& filename)
+    {
+      return filename[0] == '/' ? filename : directory + filename;
+    };
+
+    std::vector<TestCase> testCases;
+    std::string line;
+    while(getline(fin, line))
+    {
+      line = line.substr(0, line.find('#'));
+      std::stringstream ss(line);
+      std::string imageFilename, foregroundFilename, backgroundFilename, baselineFilename;
+      if(!(ss >> imageFilename))
+      {
+        continue;
+      }
+      if(!(ss >> foregroundFilename >> backgroundFilename))
+      {
+        throw std::runtime_error("Invalid corpus line: " + line);
+      }
+      ss >> baselineFilename;
+
+      typedef itk::ImageFileReader<ImageType> ReaderType;
+      ReaderType::Pointer reader = ReaderType::New();
+      reader->SetFileName(resolve(imageFilename));
+      reader->Update();
+
+      TestCase testCase;
+      testCase.Name = imageFilename;
+      testCase.Image = reader->GetOutput();
+      testCase.ForegroundSeeds = ReadMask(resolve(foregroundFilename));
+      testCase.BackgroundSeeds = ReadMask(resolve(backgroundFilename));
+      if(!baselineFilename.empty())
+      {
+        testCase.Baseline = ReadMask(resolve(baselineFilename));
+      }
+      testCases.push_back(testCase);
+    }
+
+    return testCases;
+  }
+
+  /** Segment 'testCase' with the reference path into 'reference'. */
+  void ComputeReference(const TestCase& testCase, Reference& reference)
+  {
+    reference.GraphCut.SetNumberOfThreads(1);
+    reference.GraphCut.SetCutVerification(true);
+    RunReference(reference.GraphCut, testCase);
+    reference.Mask = reference.GraphCut.GetSegmentMask();
+    reference.Energy = reference.GraphCut.ComputeCutEnergy(reference.Mask, &reference.NumberOfCutEdges);
+  }
+
+  /** Run the reference and every variant on a case. Return the number of failures. */
+  unsigned int RunCase(const TestCase& testCase)
+  {
+    unsigned int numberOfFailures = 0;
+
+    // The reference graph is kept to compute the energy of every cut.
+    Reference reference;
+    try
+    {
+      ComputeReference(testCase, reference);
+    }
+    catch(const std::exception& e)
+    {
+      std::cout << "FAIL " << testCase.Name << " reference: " << e.what() << std::endl;
+      return 1;
+    }
+
+    std::cout << testCase.Name << " reference energy " << reference.Energy << std::endl;
+
+    const std::string referenceProblem = CheckReportedEnergy(reference.GraphCut.GetStatistics(), reference.Energy, 0);
+    if(!referenceProblem.empty())
+    {
+      std::cout << "FAIL " << testCase.Name << " reference:" << referenceProblem << std::endl;
+      numberOfFailures++;
+    }
+
+    // The cut is a minimum cut, so no other labeling (such as the ground truth) can cost less.
+    if(testCase.GroundTruth)
+    {
+      const double groundTruthEnergy = reference.GraphCut.ComputeCutEnergy(testCase.GroundTruth);
+      if(reference.Energy > groundTruthEnergy && !EnergiesMatch(reference.Energy, groundTruthEnergy))
+      {
+        std::cout << "FAIL " << testCase.Name << " reference: the ground truth has a lower energy ("
+                  << groundTruthEnergy << ")" << std::endl;
+        numberOfFailures++;
+      }
+    }
+
+    if(testCase.Baseline)
+    {
+      const unsigned int differences = ITKHelpers::CountDifferentPixels(reference.Mask.GetPointer(),
+                                                                        testCase.Baseline.GetPointer());
+      if(differences != 0)
+      {
+        std::cout << "FAIL " << testCase.Name << " reference: " << differences
+                  << " pixels differ from the baseline" << std::endl;
+        numberOfFailures++;
+      }
+    }
+
+    // The energies of the approximate results, by variant, to compare the refined approximations with.
+    std::map<std::string, double> approximateEnergies;
+
+    for(const Variant& variant : Variants)
+    {
+      try
+      {
+        // The reference of a variant with its own reference case only lives for this variant.
+        const Reference* variantReference = &reference;
+        std::unique_ptr<Reference> caseReference;
+        if(variant.CreateReferenceCase)
+        {
+          TestCase referenceCase;
+          if(!variant.CreateReferenceCase(testCase, referenceCase))
+          {
+            std::cout << "SKIP " << testCase.Name << " " << variant.Name << std::endl;
+            continue;
+          }
+          caseReference.reset(new Reference);
+          ComputeReference(referenceCase, *caseReference);
+          variantReference = caseReference.get();
+        }
+
+        SegmentationStatistics statistics;
+        ForegroundBackgroundSegmentMask::Pointer mask = Segment(variant, testCase, statistics);
+        const unsigned int differences = ITKHelpers::CountDifferentPixels(variantReference->Mask.GetPointer(),
+                                                                          mask.GetPointer());
+        std::size_t cutEdges = 0;
+        const double energy = variantReference->GraphCut.ComputeCutEnergy(mask, &cutEdges);
+
+        const bool approximate = variant.Approximate && !statistics.Exact;
+        bool pass;
+        std::string problem;
+        if(approximate)
+        {
+          // The coarse labels have no reported energy or verified cut, so only the energy computed here is checked.
+          problem = CheckApproximation(variant, testCase, mask, energy, *variantReference, approximateEnergies);
+          pass = problem.empty();
+          approximateEnergies[variant.Name] = energy;
+        }
+        else
+        {
+          if(variant.MaximumCapacityError == 0)
+          {
+            pass = differences == 0 && EnergiesMatch(variantReference->Energy, energy);
+          }
+          else
+          {
+            const double tolerance = variant.MaximumCapacityError * (variantReference->NumberOfCutEdges + cutEdges);
+            pass = energy <= variantReference->Energy + tolerance || EnergiesMatch(variantReference->Energy, energy);
+          }
+
+          // The variant reports the energy of its own capacities, which are off by at most the capacity error.
+          problem = CheckReportedEnergy(statistics, energy, variant.MaximumCapacityError * cutEdges);
+          pass = pass && problem.empty();
+        }
+
+        std::cout << (pass ? "PASS " : "FAIL ") << testCase.Name << " " << variant.Name << ": "
+                  << differences << " different pixels, energy " << energy << (approximate ? " (approximate)" : "")
+                  << problem << std::endl;
+        if(!pass)
+        {
+          numberOfFailures++;
+        }
+      }
+      catch(const std::exception& e)
+      {
+        std::cout << "FAIL " << testCase.Name << " " << variant.Name << ": " << e.what() << std::endl;
+        numberOfFailures++;
+      }
+    }
+
+    return numberOfFailures;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  if(argc > 2)
+  {
+    std::cerr << "Usage: " << argv[0] << " [corpus.txt]" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::vector<TestCase> testCases = CreateSyntheticCases();
+  if(argc == 2)
+  {
+    std::vector<TestCase> storedCases = ReadStoredCases(argv[1]);
+    testCases.insert(testCases.end(), storedCases.begin(), storedCases.end());
+  }
+
+  unsigned int numberOfFailures = 0;
+  for(const TestCase& testCase : testCases)
+  {
+    numberOfFailures += RunCase(testCase);
+  }
+
+  std::cout << testCases.size() << " cases, " << Variants.size() << " variants, "
+            << numberOfFailures << " failures" << std::endl;
+
+  return numberOfFailures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
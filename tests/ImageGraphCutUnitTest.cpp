@@ -0,0 +1,1260 @@
+/*
+Copyright (C) 2012 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** Checks the building blocks of the fast paths against the slower code that they replace (or the ITKHelpers
+  * functions that compute the same thing), on small inputs with known edge cases. The whole segmentation is
+  * checked by ImageGraphCutRegressionTest.
+  *
+  * Usage: ImageGraphCutUnitTest
+  */
+
+// Custom
+#include "ColorSpaceConverter.h"
+#include "EdgeMaps.h"
+#include "ImageGraphCut.h"
+#include "MappedImageFile.h"
+#include "Mask/ForegroundBackgroundSegmentMaskRLE.h"
+#include "Mask/PackedForegroundBackgroundSegmentMask.h"
+#include "PixelDifference.h"
+
+// Submodules
+#include "Mask/ITKHelpers/ITKHelpers.h"
+#include "Mask/ITKHelpers/itkRGBToHSVColorSpacePixelAccessor.h"
+#include "Mask/ITKHelpers/itkRGBToLabColorSpacePixelAccessor.h"
+
+// ITK
+#include "itkImageFileReader.h"
+#include "itkImageFileWriter.h"
+#include "itkImageRegionConstIterator.h"
+#include "itkImageRegionIterator.h"
+#include "itkImageRegionIteratorWithIndex.h"
+#include "itkRGBPixel.h"
+#include "itkVariableLengthVector.h"
+#include "itkVectorImage.h"
+
+// STL
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// POSIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace
+{
+  /** A check throws std::runtime_error with the problem if it fails. */
+  struct Check
+  {
+    std::string Name;
+    std::function<void ()> Run;
+  };
+
+  /** Compare the buffer SquaredDifferences() of 'functor' with its per pixel SquaredDifference() on random pixels
+    * with 'numberOfComponents' components of type TComponent. */
+  template <typename TComponent, typename TFunctor>
+  void CheckSquaredDifferences(const TFunctor& functor, const unsigned int numberOfComponents,
+                               const std::string& functorName)
+  {
+    typedef itk::VariableLengthVector<TComponent> PixelType;
+
+    // Enough pixels to run the vectorized loops of every stride, and a tail that does not fill a vector.
+    const std::size_t numberOfPixels = 67;
+    std::mt19937 generator(numberOfComponents);
+    std::uniform_int_distribution<int> distribution(0, 255);
+    std::vector<TComponent> a(numberOfPixels * numberOfComponents);
+    std::vector<TComponent> b(numberOfPixels * numberOfComponents);
+    for(std::size_t i = 0; i < a.size(); ++i)
+    {
+      a[i] = static_cast<TComponent>(distribution(generator));
+      b[i] = static_cast<TComponent>(distribution(generator));
+    }
+    // The largest difference of every component.
+    std::fill(a.begin(), a.begin() + numberOfComponents, static_cast<TComponent>(255));
+    std::fill(b.begin(), b.begin() + numberOfComponents, static_cast<TComponent>(0));
+
+    std::vector<float> squaredDifferences(numberOfPixels);
+    functor.SquaredDifferences(a.data(), b.data(), numberOfPixels, numberOfComponents, squaredDifferences.data());
+
+    for(std::size_t pixelId = 0; pixelId < numberOfPixels; ++pixelId)
+    {
+      PixelType pixelA(numberOfComponents);
+      PixelType pixelB(numberOfComponents);
+      for(unsigned int component = 0; component < numberOfComponents; ++component)
+      {
+        pixelA[component] = a[pixelId * numberOfComponents + component];
+        pixelB[component] = b[pixelId * numberOfComponents + component];
+      }
+
+      const float expected = functor.SquaredDifference(pixelA, pixelB);
+      if(std::abs(squaredDifferences[pixelId] - expected) > 1e-5f * std::max(1.0f, expected))
+      {
+        std::stringstream ss;
+        ss << functorName << " with " << numberOfComponents << " components of " << sizeof(TComponent)
+           << " bytes: SquaredDifferences() gives " << squaredDifferences[pixelId] << " for pixel " << pixelId
+           << " but SquaredDifference() gives " << expected << "!";
+        throw std::runtime_error(ss.str());
+      }
+    }
+  }
+
+  template <typename TComponent>
+  void CheckPixelDifferences()
+  {
+    typedef itk::VariableLengthVector<TComponent> PixelType;
+    for(const unsigned int numberOfComponents : {1u, 3u, 4u, 5u})
+    {
+      CheckSquaredDifferences<TComponent>(RGBPixelDifference<PixelType>(), numberOfComponents,
+                                          "RGBPixelDifference");
+      CheckSquaredDifferences<TComponent>(NDPixelDifference<PixelType>(0.7f), numberOfComponents,
+                                          "NDPixelDifference");
+    }
+  }
+
+  /** A pixel difference functor written for the per pixel n-links, which only has a (non-const) Difference(). */
+  template <typename TPixel>
+  struct DifferenceOnlyPixelDifference
+  {
+    float Difference(const TPixel& a, const TPixel& b)
+    {
+      return RGBPixelDifference<TPixel>().Difference(a, b);
+    }
+  };
+
+  /** Sets the pixel at 'index' of an image from 3 RGB components. */
+  typedef std::function<void (const itk::Index<2>& index, const unsigned char* const rgb)> SetRGBPixelFunction;
+
+  /** The type of the RGB images of the squares. */
+  typedef itk::VectorImage<unsigned char, 2> SquareImageType;
+
+  /** Create an allocated RGB image of the size of the squares. */
+  SquareImageType::Pointer CreateSquareImage()
+  {
+    const itk::Size<2> size = {{24, 18}};
+    SquareImageType::Pointer image = SquareImageType::New();
+    image->SetRegions(itk::ImageRegion<2>(size));
+    image->SetNumberOfComponentsPerPixel(3);
+    image->Allocate();
+    return image;
+  }
+
+  /** Get a function that sets the pixels of 'image' to the RGB components converted to 'colorSpace' one pixel at a
+    * time, as the per pixel baseline of the conversion of whole images. */
+  SetRGBPixelFunction GetSquarePixelSetter(SquareImageType* const image, const ColorSpace colorSpace = ColorSpace::RGB)
+  {
+    const ColorSpaceConverter converter(colorSpace);
+    return [image, converter](const itk::Index<2>& index, const unsigned char* const rgb)
+           {
+             SquareImageType::PixelType pixel(3);
+             converter.Convert(rgb, pixel.GetDataPointer(), 1, 3, 1);
+             image->SetPixel(index, pixel);
+           };
+  }
+
+  /** Fill 'image' (which must be allocated) with a noisy square through 'setPixel', and 'seeds' with foreground
+    * seeds inside of the square and background seeds on the top and left borders. */
+  template <typename TImage>
+  void CreateSquare(TImage* const image, const SetRGBPixelFunction& setPixel,
+                    ForegroundBackgroundSegmentMask::Pointer seeds[2])
+  {
+    const itk::ImageRegion<2> region = image->GetLargestPossibleRegion();
+    for(unsigned int seedType = 0; seedType < 2; ++seedType)
+    {
+      seeds[seedType] = ForegroundBackgroundSegmentMask::New();
+      seeds[seedType]->SetRegions(region);
+      seeds[seedType]->Allocate();
+      seeds[seedType]->FillBuffer(ForegroundBackgroundSegmentMaskPixelTypeEnum::BACKGROUND);
+    }
+
+    std::mt19937 generator(7);
+    std::uniform_int_distribution<int> noise(-50, 50);
+    itk::ImageRegionConstIteratorWithIndex<TImage> iterator(image, region);
+    for(; !iterator.IsAtEnd(); ++iterator)
+    {
+      const itk::Index<2> index = iterator.GetIndex();
+      const itk::IndexValueType x = index[0];
+      const itk::IndexValueType y = index[1];
+      const bool inside = x >= 6 && x < 18 && y >= 4 && y < 14;
+      unsigned char rgb[3];
+      for(unsigned int component = 0; component < 3; ++component)
+      {
+        rgb[component] = static_cast<unsigned char>(std::min(255, std::max(0, (inside ? 190 : 70) +
+                                                                                noise(generator))));
+      }
+      setPixel(index, rgb);
+
+      if(x >= 10 && x < 14 && y >= 8 && y < 10)
+      {
+        seeds[0]->SetPixel(index, ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND);
+      }
+      else if(x == 0 || y == 0)
+      {
+        seeds[1]->SetPixel(index, ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND);
+      }
+    }
+  }
+
+  /** Segment a noisy square (see CreateSquare()) with ImageGraphCut<TImage, TFunctor> in 'colorSpace' and return
+    * the segment mask. */
+  template <typename TImage, typename TFunctor>
+  ForegroundBackgroundSegmentMask::Pointer SegmentSquare(TImage* const image, const SetRGBPixelFunction& setPixel,
+                                                         const ColorSpace colorSpace = ColorSpace::RGB)
+  {
+    ForegroundBackgroundSegmentMask::Pointer seeds[2];
+    CreateSquare(image, setPixel, seeds);
+
+    ImageGraphCut<TImage, TFunctor> graphCut;
+    graphCut.SetImage(image);
+    graphCut.SetSeedsFromMasks(seeds[0], seeds[1]);
+    graphCut.SetColorSpace(colorSpace);
+    graphCut.PerformSegmentation();
+    return graphCut.GetSegmentMask();
+  }
+
+  /** The images that are not buffers of scalar components (an itk::Image of itk::RGBPixel) and the functors that
+    * only have Difference() compute the n-links per pixel. They must segment like the buffer path. */
+  void CheckPerPixelDifferences()
+  {
+    typedef SquareImageType VectorImageType;
+    typedef itk::Image<itk::RGBPixel<unsigned char>, 2> RGBImageType;
+
+    static_assert(HasSquaredDifferences<RGBPixelDifference<VectorImageType::PixelType>, unsigned char>::value,
+                  "RGBPixelDifference must have the buffer SquaredDifferences()!");
+    static_assert(!HasSquaredDifferences<DifferenceOnlyPixelDifference<VectorImageType::PixelType>,
+                                         unsigned char>::value,
+                  "A functor with only Difference() must not be called with buffers!");
+
+    VectorImageType::Pointer vectorImage = CreateSquareImage();
+    const itk::ImageRegion<2> region = vectorImage->GetLargestPossibleRegion();
+    const SetRGBPixelFunction setVectorPixel = GetSquarePixelSetter(vectorImage);
+
+    RGBImageType::Pointer rgbImage = RGBImageType::New();
+    rgbImage->SetRegions(region);
+    rgbImage->Allocate();
+    const SetRGBPixelFunction setRGBPixel =
+        [&rgbImage](const itk::Index<2>& index, const unsigned char* const rgb)
+        {
+          itk::RGBPixel<unsigned char> pixel;
+          pixel.Set(rgb[0], rgb[1], rgb[2]);
+          rgbImage->SetPixel(index, pixel);
+        };
+
+    const ForegroundBackgroundSegmentMask::Pointer bufferMask =
+        SegmentSquare<VectorImageType, RGBPixelDifference<VectorImageType::PixelType> >(vectorImage, setVectorPixel);
+    const ForegroundBackgroundSegmentMask::Pointer rgbPixelMask =
+        SegmentSquare<RGBImageType, RGBPixelDifference<RGBImageType::PixelType> >(rgbImage, setRGBPixel);
+    const ForegroundBackgroundSegmentMask::Pointer differenceOnlyMask =
+        SegmentSquare<VectorImageType, DifferenceOnlyPixelDifference<VectorImageType::PixelType> >(vectorImage,
+                                                                                                 setVectorPixel);
+
+    if(ITKHelpers::CountDifferentPixels(bufferMask.GetPointer(), rgbPixelMask.GetPointer()) != 0)
+    {
+      throw std::runtime_error("The segmentation of the itk::RGBPixel image differs from the buffer path!");
+    }
+    if(ITKHelpers::CountDifferentPixels(bufferMask.GetPointer(), differenceOnlyMask.GetPointer()) != 0)
+    {
+      throw std::runtime_error("The segmentation with a functor with only Difference() differs from the buffer path!");
+    }
+  }
+
+  /** Throw if the converted component 'actual' is more than one level of the 8 bit output from 'expected'. */
+  void CheckConvertedComponent(const char* const colorSpaceName, const unsigned char* const rgb,
+                               const unsigned int component, const unsigned char actual, const double expected)
+  {
+    const double clampedExpected = std::min(255.0, std::max(0.0, expected));
+    if(std::abs(actual - clampedExpected) > 1)
+    {
+      std::stringstream ss;
+      ss << "RGB (" << static_cast<int>(rgb[0]) << ", " << static_cast<int>(rgb[1]) << ", "
+         << static_cast<int>(rgb[2]) << ") has " << colorSpaceName << " component " << component << " "
+         << static_cast<int>(actual) << " but the accessor gives " << clampedExpected << "!";
+      throw std::runtime_error(ss.str());
+    }
+  }
+
+  /** Compare ColorSpaceConverter with the double precision pixel accessors of ITKHelpers on a dense sample of the
+    * RGB cube, in the 8 bit encodings of ColorSpaceConverter. The pixels have an alpha, which must be copied. */
+  void CheckColorSpaceConverter()
+  {
+    // Every multiple of 3, so that 0 and 255 are included.
+    const unsigned int step = 3;
+    const unsigned int numberOfValues = 255 / step + 1;
+    const std::size_t numberOfPixels = numberOfValues * numberOfValues * numberOfValues;
+    const unsigned int numberOfComponents = 4;
+
+    std::vector<unsigned char> rgb(numberOfPixels * numberOfComponents);
+    for(std::size_t pixelId = 0; pixelId < numberOfPixels; ++pixelId)
+    {
+      unsigned char* const pixel = rgb.data() + pixelId * numberOfComponents;
+      pixel[0] = static_cast<unsigned char>(step * (pixelId / (numberOfValues * numberOfValues)));
+      pixel[1] = static_cast<unsigned char>(step * (pixelId / numberOfValues % numberOfValues));
+      pixel[2] = static_cast<unsigned char>(step * (pixelId % numberOfValues));
+      pixel[3] = static_cast<unsigned char>(pixelId);
+    }
+
+    std::vector<unsigned char> lab(rgb.size());
+    std::vector<unsigned char> hsv(rgb.size());
+    ColorSpaceConverter(ColorSpace::CIELAB).Convert(rgb.data(), lab.data(), numberOfPixels, numberOfComponents);
+    ColorSpaceConverter(ColorSpace::HSV).Convert(rgb.data(), hsv.data(), numberOfPixels, numberOfComponents);
+
+    typedef itk::Accessor::RGBToLabColorSpacePixelAccessor<unsigned char, double> LabAccessorType;
+    typedef itk::Accessor::RGBToHSVColorSpacePixelAccessor<unsigned char, double> HSVAccessorType;
+    const double pi = 3.14159265358979323846;
+
+    for(std::size_t pixelId = 0; pixelId < numberOfPixels; ++pixelId)
+    {
+      const std::size_t offset = pixelId * numberOfComponents;
+      itk::RGBPixel<unsigned char> pixel;
+      pixel[0] = rgb[offset];
+      pixel[1] = rgb[offset + 1];
+      pixel[2] = rgb[offset + 2];
+
+      // L * 255 / 100, a + 128 and b + 128.
+      const LabAccessorType::ExternalType expectedLab = LabAccessorType().Get(pixel);
+      CheckConvertedComponent("CIELab", &rgb[offset], 0, lab[offset], expectedLab[0] * 255.0 / 100.0);
+      CheckConvertedComponent("CIELab", &rgb[offset], 1, lab[offset + 1], expectedLab[1] + 128.0);
+      CheckConvertedComponent("CIELab", &rgb[offset], 2, lab[offset + 2], expectedLab[2] + 128.0);
+
+      // The point (S cos H, S sin H) of the HSV cone, with H in turns, and V.
+      const HSVAccessorType::ExternalType expectedHSV = HSVAccessorType().Get(pixel);
+      const double hue = 2 * pi * expectedHSV[0];
+      CheckConvertedComponent("HSV", &rgb[offset], 0, hsv[offset], 127.5 + 127.5 * expectedHSV[1] * std::cos(hue));
+      CheckConvertedComponent("HSV", &rgb[offset], 1, hsv[offset + 1], 127.5 + 127.5 * expectedHSV[1] * std::sin(hue));
+      CheckConvertedComponent("HSV", &rgb[offset], 2, hsv[offset + 2], 255.0 * expectedHSV[2]);
+
+      if(lab[offset + 3] != rgb[offset + 3] || hsv[offset + 3] != rgb[offset + 3])
+      {
+        throw std::runtime_error("The alpha component was not copied!");
+      }
+    }
+  }
+
+  /** Compare EdgeMaps::ComputeGradientMagnitude on a random 'width' x 'height' image with 'numberOfComponents'
+    * components with the gradient magnitude of ITKHelpers, computed per component with ComputeGradients() and
+    * MagnitudeImage(). */
+  void CheckGradientMagnitude(const unsigned int width, const unsigned int height,
+                              const unsigned int numberOfComponents)
+  {
+    typedef itk::VectorImage<unsigned char, 2> ImageType;
+
+    itk::Size<2> size = {{width, height}};
+    itk::ImageRegion<2> region(size);
+    ImageType::Pointer image = ImageType::New();
+    image->SetNumberOfComponentsPerPixel(numberOfComponents);
+    image->SetRegions(region);
+    image->Allocate();
+
+    std::mt19937 generator(width * 16 + height);
+    std::uniform_int_distribution<int> distribution(0, 255);
+    unsigned char* const buffer = image->GetBufferPointer();
+    for(std::size_t i = 0; i < region.GetNumberOfPixels() * numberOfComponents; ++i)
+    {
+      buffer[i] = static_cast<unsigned char>(distribution(generator));
+    }
+
+    // Several threads, so that the rows of a large image are split between them.
+    EdgeMaps::ImageType::Pointer edgeMap = EdgeMaps::ImageType::New();
+    EdgeMaps::ComputeGradientMagnitude(image.GetPointer(), edgeMap.GetPointer(), 4);
+
+    std::vector<float> expectedSquaredMagnitudes(region.GetNumberOfPixels(), 0);
+    for(unsigned int component = 0; component < numberOfComponents; ++component)
+    {
+      ITKHelpersTypes::FloatScalarImageType::Pointer channel = ITKHelpersTypes::FloatScalarImageType::New();
+      ITKHelpers::ExtractChannel(image.GetPointer(), component, channel.GetPointer());
+
+      ITKHelpersTypes::FloatVector2ImageType::Pointer gradients = ITKHelpersTypes::FloatVector2ImageType::New();
+      ITKHelpers::ComputeGradients(channel.GetPointer(), gradients.GetPointer());
+
+      // At the borders, ITK pads the image with its border pixels, which halves the one-sided differences of
+      // EdgeMaps. An image of width or height 1 has no derivative in that direction with either.
+      itk::ImageRegionIteratorWithIndex<ITKHelpersTypes::FloatVector2ImageType> gradientIterator(gradients, region);
+      while(!gradientIterator.IsAtEnd())
+      {
+        const itk::Index<2> index = gradientIterator.GetIndex();
+        ITKHelpersTypes::FloatVector2Type gradient = gradientIterator.Get();
+        for(unsigned int dimension = 0; dimension < 2; ++dimension)
+        {
+          const itk::IndexValueType last = static_cast<itk::IndexValueType>(size[dimension]) - 1;
+          if(index[dimension] == 0 || index[dimension] == last)
+          {
+            gradient[dimension] *= 2;
+          }
+        }
+        gradientIterator.Set(gradient);
+        ++gradientIterator;
+      }
+
+      ITKHelpersTypes::FloatScalarImageType::Pointer magnitudes = ITKHelpersTypes::FloatScalarImageType::New();
+      ITKHelpers::MagnitudeImage(gradients.GetPointer(), magnitudes.GetPointer());
+
+      const float* const magnitudeBuffer = magnitudes->GetBufferPointer();
+      for(std::size_t pixelId = 0; pixelId < expectedSquaredMagnitudes.size(); ++pixelId)
+      {
+        expectedSquaredMagnitudes[pixelId] += magnitudeBuffer[pixelId] * magnitudeBuffer[pixelId];
+      }
+    }
+
+    if(edgeMap->GetLargestPossibleRegion() != region)
+    {
+      throw std::runtime_error("The edge map does not have the size of the image!");
+    }
+
+    const float* const edges = edgeMap->GetBufferPointer();
+    for(std::size_t pixelId = 0; pixelId < expectedSquaredMagnitudes.size(); ++pixelId)
+    {
+      const float expected = std::sqrt(expectedSquaredMagnitudes[pixelId]);
+      if(std::abs(edges[pixelId] - expected) > 1e-4f * std::max(1.0f, expected))
+      {
+        std::stringstream ss;
+        ss << "A " << width << " x " << height << " image with " << numberOfComponents
+           << " components has the gradient magnitude " << edges[pixelId] << " at (" << pixelId % width << ", "
+           << pixelId / width << ") but ITKHelpers gives " << expected << "!";
+        throw std::runtime_error(ss.str());
+      }
+    }
+  }
+
+  void CheckGradientMagnitudes()
+  {
+    // The interior, the borders, the images of a single row or column (or pixel), and an image large enough to be
+    // computed in parallel.
+    const unsigned int sizes[][2] = {{7, 5}, {2, 3}, {1, 4}, {6, 1}, {1, 1}, {301, 257}};
+    for(const auto& size : sizes)
+    {
+      for(const unsigned int numberOfComponents : {1u, 3u})
+      {
+        CheckGradientMagnitude(size[0], size[1], numberOfComponents);
+      }
+    }
+  }
+
+  /** Segment the noisy square in 'colorSpace', and in RGB after converting it pixel by pixel (see
+    * GetSquarePixelSetter()). The two are the same problem, so they must give the same mask. */
+  void CheckColorSpaceSegmentation()
+  {
+    for(const ColorSpace colorSpace : {ColorSpace::CIELAB, ColorSpace::HSV})
+    {
+      SquareImageType::Pointer image = CreateSquareImage();
+      SquareImageType::Pointer convertedImage = CreateSquareImage();
+
+      typedef RGBPixelDifference<SquareImageType::PixelType> DifferenceType;
+      const ForegroundBackgroundSegmentMask::Pointer mask =
+          SegmentSquare<SquareImageType, DifferenceType>(image, GetSquarePixelSetter(image), colorSpace);
+      const ForegroundBackgroundSegmentMask::Pointer convertedMask =
+          SegmentSquare<SquareImageType, DifferenceType>(convertedImage,
+                                                         GetSquarePixelSetter(convertedImage, colorSpace));
+
+      const unsigned int differences = ITKHelpers::CountDifferentPixels(mask.GetPointer(), convertedMask.GetPointer());
+      if(differences != 0)
+      {
+        std::stringstream ss;
+        ss << "The segmentation in " << ColorSpaceConverter::GetColorSpaceName(colorSpace) << " differs from the "
+           << "segmentation of the converted image in " << differences << " pixels!";
+        throw std::runtime_error(ss.str());
+      }
+    }
+  }
+
+  /** Create a mask of 'size' whose pixels are FOREGROUND with probability 'foregroundProbability'. */
+  ForegroundBackgroundSegmentMask::Pointer CreateRandomMask(const itk::Size<2>& size,
+                                                            const double foregroundProbability,
+                                                            const unsigned int seed)
+  {
+    ForegroundBackgroundSegmentMask::Pointer mask = ForegroundBackgroundSegmentMask::New();
+    mask->SetRegions(itk::ImageRegion<2>(size));
+    mask->Allocate();
+
+    std::mt19937 generator(seed);
+    std::bernoulli_distribution isForeground(foregroundProbability);
+    itk::ImageRegionIterator<ForegroundBackgroundSegmentMask> iterator(mask, mask->GetLargestPossibleRegion());
+    for(; !iterator.IsAtEnd(); ++iterator)
+    {
+      iterator.Set(isForeground(generator) ? ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND :
+                                             ForegroundBackgroundSegmentMaskPixelTypeEnum::BACKGROUND);
+    }
+    return mask;
+  }
+
+  /** A mask and the description of how it was created, for the messages of the checks. */
+  struct RandomMask
+  {
+    std::string Description;
+    ForegroundBackgroundSegmentMask::Pointer Mask;
+  };
+
+  /** Random masks of sizes that do and do not fill the words of the packed masks, of a single pixel, and large
+    * enough to be processed in parallel, with every pixel, no pixel, half of the pixels and few pixels FOREGROUND. */
+  std::vector<RandomMask> CreateRandomMasks()
+  {
+    const itk::SizeValueType sizes[][2] = {{1, 1}, {64, 2}, {67, 5}, {1, 130}, {301, 257}};
+    const double foregroundProbabilities[] = {0, 1, 0.5, 0.02};
+
+    std::vector<RandomMask> masks;
+    unsigned int seed = 0;
+    for(const auto& size : sizes)
+    {
+      for(const double foregroundProbability : foregroundProbabilities)
+      {
+        const itk::Size<2> maskSize = {{size[0], size[1]}};
+        RandomMask mask;
+        std::stringstream description;
+        description << "a " << size[0] << " x " << size[1] << " mask with foreground probability "
+                    << foregroundProbability;
+        mask.Description = description.str();
+        mask.Mask = CreateRandomMask(maskSize, foregroundProbability, seed++);
+        masks.push_back(mask);
+      }
+    }
+    return masks;
+  }
+
+  /** Compute the runs of 'mask' in 'order' pixel by pixel with ITK, as the baseline of the encoder. */
+  ForegroundBackgroundSegmentMaskRLE::CountsType ComputeRuns(const ForegroundBackgroundSegmentMask* const mask,
+                                                             const ForegroundBackgroundSegmentMaskRLE::Order order)
+  {
+    const itk::Size<2> size = mask->GetLargestPossibleRegion().GetSize();
+    std::vector<bool> foreground;
+    if(order == ForegroundBackgroundSegmentMaskRLE::Order::RowMajor)
+    {
+      itk::ImageRegionConstIterator<ForegroundBackgroundSegmentMask> iterator(mask, mask->GetLargestPossibleRegion());
+      for(; !iterator.IsAtEnd(); ++iterator)
+      {
+        foreground.push_back(iterator.Get() == ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND);
+      }
+    }
+    else
+    {
+      for(itk::IndexValueType x = 0; x < static_cast<itk::IndexValueType>(size[0]); ++x)
+      {
+        for(itk::IndexValueType y = 0; y < static_cast<itk::IndexValueType>(size[1]); ++y)
+        {
+          const itk::Index<2> index = {{x, y}};
+          foreground.push_back(mask->IsForeground(index));
+        }
+      }
+    }
+
+    // The runs start with a (possibly empty) background run.
+    ForegroundBackgroundSegmentMaskRLE::CountsType counts(1, 0);
+    bool runIsForeground = false;
+    for(const bool pixelIsForeground : foreground)
+    {
+      if(pixelIsForeground != runIsForeground)
+      {
+        counts.push_back(0);
+        runIsForeground = pixelIsForeground;
+      }
+      counts.back()++;
+    }
+    return counts;
+  }
+
+  void CheckRLE()
+  {
+    typedef ForegroundBackgroundSegmentMaskRLE::Order Order;
+    typedef ForegroundBackgroundSegmentMaskRLE::CountsType CountsType;
+
+    for(const RandomMask& randomMask : CreateRandomMasks())
+    {
+      const ForegroundBackgroundSegmentMask* const mask = randomMask.Mask.GetPointer();
+      const itk::Size<2> size = mask->GetLargestPossibleRegion().GetSize();
+      for(const Order order : {Order::RowMajor, Order::ColumnMajor})
+      {
+        const std::string description = randomMask.Description +
+                                        (order == Order::RowMajor ? " in row major order" : " in column major order");
+
+        const CountsType counts = ForegroundBackgroundSegmentMaskRLE::Encode(mask, order);
+        if(counts != ComputeRuns(mask, order))
+        {
+          throw std::runtime_error("The runs of " + description + " are not the runs of its pixels!");
+        }
+
+        ForegroundBackgroundSegmentMask::Pointer decoded = ForegroundBackgroundSegmentMask::New();
+        ForegroundBackgroundSegmentMaskRLE::Decode(counts, size, decoded, order);
+        if(ITKHelpers::CountDifferentPixels(mask, decoded.GetPointer()) != 0)
+        {
+          throw std::runtime_error("The decoded runs of " + description + " are not the mask!");
+        }
+
+        std::stringstream stream;
+        ForegroundBackgroundSegmentMaskRLE::Write(mask, stream, order);
+        ForegroundBackgroundSegmentMask::Pointer read = ForegroundBackgroundSegmentMask::New();
+        ForegroundBackgroundSegmentMaskRLE::Read(stream, size, read);
+        if(ITKHelpers::CountDifferentPixels(mask, read.GetPointer()) != 0)
+        {
+          throw std::runtime_error("The written and read runs of " + description + " are not the mask!");
+        }
+
+        if(order == Order::ColumnMajor &&
+           ForegroundBackgroundSegmentMaskRLE::COCOStringToCounts(
+               ForegroundBackgroundSegmentMaskRLE::CountsToCOCOString(counts)) != counts)
+        {
+          throw std::runtime_error("The COCO string of the runs of " + description + " has other runs!");
+        }
+      }
+    }
+
+    // Runs that need every character of the COCO encoding, and a value longer than any count.
+    const CountsType largeCounts = {0, 1, 31, 32, std::uint64_t(1) << 40, 5, std::uint64_t(1) << 50, 0, 7};
+    if(ForegroundBackgroundSegmentMaskRLE::COCOStringToCounts(
+           ForegroundBackgroundSegmentMaskRLE::CountsToCOCOString(largeCounts)) != largeCounts)
+    {
+      throw std::runtime_error("The COCO string of large runs has other runs!");
+    }
+
+    bool rejected = false;
+    try
+    {
+      // Every 'P' continues the value.
+      ForegroundBackgroundSegmentMaskRLE::COCOStringToCounts(std::string(13, 'P') + "0");
+    }
+    catch(const std::runtime_error&)
+    {
+      rejected = true;
+    }
+    if(!rejected)
+    {
+      throw std::runtime_error("A COCO value of 14 characters was not rejected!");
+    }
+  }
+
+  /** Write an image of 'values' (cycled, then random values between them) as TComponent, and compare every read
+    * policy of ForegroundBackgroundSegmentMask::ReadFromImage() with its definition evaluated on the pixels of the
+    * image read by ITK. */
+  template <typename TComponent>
+  void CheckReadPoliciesOfType(const TComponent foregroundValue, const TComponent backgroundValue,
+                               const double threshold, const std::vector<TComponent>& values)
+  {
+    typedef itk::Image<TComponent, 2> ImageType;
+    typedef ForegroundBackgroundSegmentMaskReadPolicy Policy;
+
+    const itk::Size<2> size = {{301, 257}};
+    typename ImageType::Pointer image = ImageType::New();
+    image->SetRegions(itk::ImageRegion<2>(size));
+    image->Allocate();
+
+    const double minimum = std::min(foregroundValue, backgroundValue);
+    const double maximum = std::max(foregroundValue, backgroundValue);
+    std::mt19937 generator(static_cast<unsigned int>(maximum));
+    std::uniform_real_distribution<double> distribution(minimum, maximum);
+    std::size_t pixelId = 0;
+    itk::ImageRegionIterator<ImageType> imageIterator(image, image->GetLargestPossibleRegion());
+    for(; !imageIterator.IsAtEnd(); ++imageIterator, ++pixelId)
+    {
+      imageIterator.Set(pixelId < 4 * values.size() ? values[pixelId % values.size()] :
+                                                      static_cast<TComponent>(distribution(generator)));
+    }
+
+    const std::string filename = "ImageGraphCutUnitTest_policies.mha";
+    typedef itk::ImageFileWriter<ImageType> WriterType;
+    typename WriterType::Pointer writer = WriterType::New();
+    writer->SetFileName(filename);
+    writer->SetInput(image);
+    writer->Update();
+
+    typedef itk::ImageFileReader<ImageType> ReaderType;
+    typename ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName(filename);
+    reader->Update();
+
+    const char* const policyNames[] = {"EXACT", "NEAREST", "THRESHOLD"};
+    for(const Policy policy : {Policy::EXACT, Policy::NEAREST, Policy::THRESHOLD})
+    {
+      std::stringstream description;
+      description << policyNames[static_cast<int>(policy)] << " with foreground "
+                  << static_cast<double>(foregroundValue) << ", background " << static_cast<double>(backgroundValue)
+                  << " and threshold " << threshold;
+
+      ForegroundBackgroundSegmentMask::Pointer mask = ForegroundBackgroundSegmentMask::New();
+      const std::size_t numberOfUnknownPixels =
+          mask->ReadFromImage(filename, ForegroundPixelValueWrapper<TComponent>(foregroundValue),
+                              BackgroundPixelValueWrapper<TComponent>(backgroundValue), policy, threshold);
+
+      std::size_t expectedNumberOfUnknownPixels = 0;
+      itk::ImageRegionConstIteratorWithIndex<ImageType> iterator(reader->GetOutput(),
+                                                                 reader->GetOutput()->GetLargestPossibleRegion());
+      for(; !iterator.IsAtEnd(); ++iterator)
+      {
+        const double value = iterator.Get();
+        bool expectedForeground;
+        switch(policy)
+        {
+          case Policy::EXACT:
+            expectedForeground = value == foregroundValue;
+            expectedNumberOfUnknownPixels += value != foregroundValue && value != backgroundValue;
+            break;
+          case Policy::NEAREST:
+            expectedForeground = std::abs(value - foregroundValue) < std::abs(value - backgroundValue);
+            break;
+          default:
+            expectedForeground = foregroundValue > backgroundValue ? value >= threshold : value <= threshold;
+            break;
+        }
+
+        if(mask->IsForeground(iterator.GetIndex()) != expectedForeground)
+        {
+          std::stringstream ss;
+          ss << description.str() << ": the pixel " << value << " at " << iterator.GetIndex() << " is "
+             << (expectedForeground ? "not " : "") << "read as foreground!";
+          throw std::runtime_error(ss.str());
+        }
+      }
+
+      if(numberOfUnknownPixels != expectedNumberOfUnknownPixels)
+      {
+        std::stringstream ss;
+        ss << description.str() << ": " << numberOfUnknownPixels << " unknown pixels instead of "
+           << expectedNumberOfUnknownPixels << "!";
+        throw std::runtime_error(ss.str());
+      }
+    }
+
+    std::remove(filename.c_str());
+  }
+
+  void CheckReadPolicies()
+  {
+    // The values, their midpoint (a tie of NEAREST, which goes to the background) and the threshold itself.
+    CheckReadPoliciesOfType<unsigned char>(255, 0, 100, {255, 0, 127, 128, 100, 99, 101, 1});
+    CheckReadPoliciesOfType<unsigned char>(0, 255, 100, {255, 0, 127, 128, 100, 99, 101, 1});
+    CheckReadPoliciesOfType<unsigned short>(1000, 10, 500, {1000, 10, 505, 504, 506, 500, 0, 65535});
+    CheckReadPoliciesOfType<float>(1.0f, 0.0f, 0.25, {1.0f, 0.0f, 0.5f, 0.25f, 0.2f, -1.0f, 2.0f});
+  }
+
+  /** Compare ApplyToImage() on a copy of 'image' with the pixels that it should have, pixel by pixel. */
+  template <typename TImage>
+  void CheckAppliedMask(const TImage* const image, ForegroundBackgroundSegmentMask* const mask,
+                        const typename TImage::PixelType& backgroundValue, const std::string& description)
+  {
+    typename TImage::Pointer maskedImage = TImage::New();
+    ITKHelpers::DeepCopy(image, maskedImage.GetPointer());
+    mask->ApplyToImage(maskedImage.GetPointer(), backgroundValue);
+
+    itk::ImageRegionConstIteratorWithIndex<TImage> iterator(image, image->GetLargestPossibleRegion());
+    for(; !iterator.IsAtEnd(); ++iterator)
+    {
+      const itk::Index<2> index = iterator.GetIndex();
+      const typename TImage::PixelType expected = mask->IsForeground(index) ? iterator.Get() : backgroundValue;
+      if(maskedImage->GetPixel(index) != expected)
+      {
+        std::stringstream ss;
+        ss << "ApplyToImage() on " << description << " gives " << maskedImage->GetPixel(index) << " at " << index
+           << " instead of " << expected << "!";
+        throw std::runtime_error(ss.str());
+      }
+    }
+  }
+
+  void CheckApplyToImage()
+  {
+    typedef itk::VectorImage<unsigned char, 2> VectorImageType;
+    typedef itk::Image<float, 2> ScalarImageType;
+
+    std::mt19937 generator(3);
+    std::uniform_int_distribution<int> distribution(0, 255);
+    for(const RandomMask& randomMask : CreateRandomMasks())
+    {
+      ForegroundBackgroundSegmentMask* const mask = randomMask.Mask.GetPointer();
+      const itk::ImageRegion<2> region = mask->GetLargestPossibleRegion();
+
+      for(const unsigned int numberOfComponents : {1u, 3u, 4u})
+      {
+        VectorImageType::Pointer image = VectorImageType::New();
+        image->SetRegions(region);
+        image->SetNumberOfComponentsPerPixel(numberOfComponents);
+        image->Allocate();
+        for(std::size_t i = 0; i < region.GetNumberOfPixels() * numberOfComponents; ++i)
+        {
+          image->GetBufferPointer()[i] = static_cast<unsigned char>(distribution(generator));
+        }
+
+        VectorImageType::PixelType backgroundValue(numberOfComponents);
+        for(unsigned int component = 0; component < numberOfComponents; ++component)
+        {
+          backgroundValue[component] = static_cast<unsigned char>(7 * component + 1);
+        }
+
+        std::stringstream description;
+        description << randomMask.Description << " and " << numberOfComponents << " components";
+        CheckAppliedMask(image.GetPointer(), mask, backgroundValue, description.str());
+
+        // The alpha channel follows the components of the image.
+        VectorImageType::Pointer output = VectorImageType::New();
+        mask->ApplyToImageAsAlpha<unsigned char>(image, output, 255, 0);
+        itk::ImageRegionConstIteratorWithIndex<VectorImageType> iterator(image, region);
+        for(; !iterator.IsAtEnd(); ++iterator)
+        {
+          const VectorImageType::PixelType pixel = iterator.Get();
+          const VectorImageType::PixelType outputPixel = output->GetPixel(iterator.GetIndex());
+          bool correct = outputPixel.GetSize() == numberOfComponents + 1 &&
+                         outputPixel[numberOfComponents] == (mask->IsForeground(iterator.GetIndex()) ? 255 : 0);
+          for(unsigned int component = 0; correct && component < numberOfComponents; ++component)
+          {
+            correct = outputPixel[component] == pixel[component];
+          }
+          if(!correct)
+          {
+            std::stringstream ss;
+            ss << "ApplyToImageAsAlpha() on " << description.str() << " gives " << outputPixel << " at "
+               << iterator.GetIndex() << " for the pixel " << pixel << "!";
+            throw std::runtime_error(ss.str());
+          }
+        }
+      }
+
+      ScalarImageType::Pointer scalarImage = ScalarImageType::New();
+      scalarImage->SetRegions(region);
+      scalarImage->Allocate();
+      for(std::size_t i = 0; i < region.GetNumberOfPixels(); ++i)
+      {
+        scalarImage->GetBufferPointer()[i] = distribution(generator) / 3.0f;
+      }
+      CheckAppliedMask(scalarImage.GetPointer(), mask, -1.0f, randomMask.Description + " and a float image");
+    }
+  }
+
+  /** Compare CountForegroundPixels() and CountBackgroundPixels() with the pixels counted by an ITK iterator. */
+  void CheckMaskCounting()
+  {
+    for(const RandomMask& randomMask : CreateRandomMasks())
+    {
+      const ForegroundBackgroundSegmentMask* const mask = randomMask.Mask.GetPointer();
+      std::size_t numberOfForegroundPixels = 0;
+      std::size_t numberOfBackgroundPixels = 0;
+      itk::ImageRegionConstIterator<ForegroundBackgroundSegmentMask> iterator(mask, mask->GetLargestPossibleRegion());
+      for(; !iterator.IsAtEnd(); ++iterator)
+      {
+        if(iterator.Get() == ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND)
+        {
+          numberOfForegroundPixels++;
+        }
+        else
+        {
+          numberOfBackgroundPixels++;
+        }
+      }
+
+      if(mask->CountForegroundPixels() != numberOfForegroundPixels ||
+         mask->CountBackgroundPixels() != numberOfBackgroundPixels)
+      {
+        std::stringstream ss;
+        ss << randomMask.Description << " counts " << mask->CountForegroundPixels() << " foreground and "
+           << mask->CountBackgroundPixels() << " background pixels instead of " << numberOfForegroundPixels
+           << " and " << numberOfBackgroundPixels << "!";
+        throw std::runtime_error(ss.str());
+      }
+    }
+  }
+
+  /** Compare a boolean operation of two packed masks, unpacked with ToMask(), and the counts of the result with the
+    * operation evaluated pixel by pixel on the two masks. */
+  void CheckPackedOperation(const PackedForegroundBackgroundSegmentMask& result,
+                            const ForegroundBackgroundSegmentMask* const mask1,
+                            const ForegroundBackgroundSegmentMask* const mask2,
+                            const std::function<bool (const bool foreground1, const bool foreground2)>& operation,
+                            const std::string& description)
+  {
+    ForegroundBackgroundSegmentMask::Pointer resultMask = ForegroundBackgroundSegmentMask::New();
+    result.ToMask(resultMask);
+
+    std::size_t numberOfForegroundPixels = 0;
+    itk::ImageRegionConstIteratorWithIndex<ForegroundBackgroundSegmentMask>
+        iterator(mask1, mask1->GetLargestPossibleRegion());
+    for(; !iterator.IsAtEnd(); ++iterator)
+    {
+      const itk::Index<2> index = iterator.GetIndex();
+      const bool expected = operation(mask1->IsForeground(index), mask2->IsForeground(index));
+      numberOfForegroundPixels += expected;
+      if(resultMask->IsForeground(index) != expected || result.IsForeground(index) != expected)
+      {
+        std::stringstream ss;
+        ss << description << " is " << (expected ? "background" : "foreground") << " at " << index << "!";
+        throw std::runtime_error(ss.str());
+      }
+    }
+
+    if(result.CountForegroundPixels() != numberOfForegroundPixels ||
+       result.CountBackgroundPixels() != result.GetNumberOfPixels() - numberOfForegroundPixels)
+    {
+      std::stringstream ss;
+      ss << description << " counts " << result.CountForegroundPixels() << " foreground pixels instead of "
+         << numberOfForegroundPixels << "!";
+      throw std::runtime_error(ss.str());
+    }
+
+    // The padding bits of the last word must stay 0, or they would be counted.
+    const std::size_t numberOfPaddingBits =
+        result.GetNumberOfWords() * PackedForegroundBackgroundSegmentMask::PixelsPerWord - result.GetNumberOfPixels();
+    if(numberOfPaddingBits > 0 &&
+       (result.GetWords()[result.GetNumberOfWords() - 1] >>
+        (PackedForegroundBackgroundSegmentMask::PixelsPerWord - numberOfPaddingBits)) != 0)
+    {
+      throw std::runtime_error(description + " sets padding bits!");
+    }
+  }
+
+  bool AndOperation(const bool foreground1, const bool foreground2)
+  {
+    return foreground1 && foreground2;
+  }
+
+  bool OrOperation(const bool foreground1, const bool foreground2)
+  {
+    return foreground1 || foreground2;
+  }
+
+  bool XorOperation(const bool foreground1, const bool foreground2)
+  {
+    return foreground1 != foreground2;
+  }
+
+  bool SubtractOperation(const bool foreground1, const bool foreground2)
+  {
+    return foreground1 && !foreground2;
+  }
+
+  bool InvertOperation(const bool foreground1, const bool)
+  {
+    return !foreground1;
+  }
+
+  bool CopyOperation(const bool foreground1, const bool)
+  {
+    return foreground1;
+  }
+
+  void CheckPackedMasks()
+  {
+    const std::vector<RandomMask> masks = CreateRandomMasks();
+    for(std::size_t maskId = 0; maskId < masks.size(); ++maskId)
+    {
+      // The masks come in groups of one size, so the next mask of the group has the same size.
+      const RandomMask& randomMask1 = masks[maskId];
+      const RandomMask& randomMask2 = masks[maskId % 4 == 3 ? maskId - 3 : maskId + 1];
+      const ForegroundBackgroundSegmentMask* const mask1 = randomMask1.Mask.GetPointer();
+      const ForegroundBackgroundSegmentMask* const mask2 = randomMask2.Mask.GetPointer();
+      const std::string description = randomMask1.Description + " and " + randomMask2.Description;
+
+      PackedForegroundBackgroundSegmentMask packedMask1;
+      packedMask1.FromMask(mask1);
+      PackedForegroundBackgroundSegmentMask packedMask2;
+      packedMask2.FromMask(mask2);
+      CheckPackedOperation(packedMask1, mask1, mask2, CopyOperation, "The packed " + randomMask1.Description);
+
+      PackedForegroundBackgroundSegmentMask result = packedMask1;
+      result.And(packedMask2);
+      CheckPackedOperation(result, mask1, mask2, AndOperation, "And of " + description);
+
+      result = packedMask1;
+      result.Or(packedMask2);
+      CheckPackedOperation(result, mask1, mask2, OrOperation, "Or of " + description);
+
+      result = packedMask1;
+      result.Xor(packedMask2);
+      CheckPackedOperation(result, mask1, mask2, XorOperation, "Xor of " + description);
+
+      result = packedMask1;
+      result.Subtract(packedMask2);
+      CheckPackedOperation(result, mask1, mask2, SubtractOperation, "Subtract of " + description);
+
+      result = packedMask1;
+      result.Invert();
+      CheckPackedOperation(result, mask1, mask2, InvertOperation, "Invert of " + randomMask1.Description);
+
+      const bool equal = ITKHelpers::CountDifferentPixels(mask1, mask2) == 0;
+      if((packedMask1 == packedMask2) != equal || (packedMask1 != packedMask2) == equal)
+      {
+        throw std::runtime_error("The comparison of the packed " + description + " is wrong!");
+      }
+    }
+  }
+
+  /** A POSIX shared memory object of a given size that is removed when this object is destroyed. */
+  class ScopedSharedMemory
+  {
+  public:
+    ScopedSharedMemory(const std::string& name, const std::size_t size) : Name(name)
+    {
+      const int fileDescriptor = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+      if(fileDescriptor < 0)
+      {
+        throw std::runtime_error("Cannot create the shared memory object " + name + "!");
+      }
+      const bool resized = ftruncate(fileDescriptor, static_cast<off_t>(size)) == 0;
+      close(fileDescriptor);
+      if(!resized)
+      {
+        shm_unlink(name.c_str());
+        throw std::runtime_error("Cannot resize the shared memory object " + name + "!");
+      }
+    }
+
+    ~ScopedSharedMemory()
+    {
+      shm_unlink(this->Name.c_str());
+    }
+
+    ScopedSharedMemory(const ScopedSharedMemory&) = delete;
+    ScopedSharedMemory& operator=(const ScopedSharedMemory&) = delete;
+
+  private:
+    std::string Name;
+  };
+
+  /** Segment the noisy square in shared memory (MappedBuffer::CreateVectorImage() and SetImageNoCopy()) with the
+    * output in another shared memory object (SetOutputBuffer()), and compare the mapped image, the output and the
+    * mask with the image, the mask and the segmentation of a copied image, pixel by pixel. */
+  void CheckMappedBuffers()
+  {
+    SquareImageType::Pointer image = CreateSquareImage();
+    ForegroundBackgroundSegmentMask::Pointer seeds[2];
+    CreateSquare(image.GetPointer(), GetSquarePixelSetter(image), seeds);
+    const itk::ImageRegion<2> region = image->GetLargestPossibleRegion();
+    const std::size_t numberOfPixels = region.GetNumberOfPixels();
+
+    std::stringstream prefix;
+    prefix << "/ImageGraphCutUnitTest_" << getpid();
+    const std::string inputName = prefix.str() + "_input";
+    const std::string outputName = prefix.str() + "_output";
+    ScopedSharedMemory inputMemory(inputName, numberOfPixels * 3);
+    ScopedSharedMemory outputMemory(outputName, numberOfPixels);
+
+    {
+      MappedBuffer inputBuffer = MappedBuffer::OpenSharedMemory(inputName, MappedBuffer::Mode::SHARED);
+      std::copy(image->GetBufferPointer(), image->GetBufferPointer() + numberOfPixels * 3, inputBuffer.GetData());
+    }
+
+    // The input is mapped copy-on-write, so writing to the mapped image must not change the shared memory.
+    {
+      MappedBuffer inputBuffer = MappedBuffer::OpenSharedMemory(inputName);
+      SquareImageType::Pointer mappedImage = inputBuffer.CreateVectorImage<unsigned char>(region.GetSize(), 3);
+      mappedImage->GetBufferPointer()[0] ^= 0xff;
+    }
+
+    MappedBuffer inputBuffer = MappedBuffer::OpenSharedMemory(inputName);
+    SquareImageType::Pointer mappedImage = inputBuffer.CreateVectorImage<unsigned char>(region.GetSize(), 3);
+    itk::ImageRegionConstIteratorWithIndex<SquareImageType> iterator(image, region);
+    for(; !iterator.IsAtEnd(); ++iterator)
+    {
+      if(mappedImage->GetPixel(iterator.GetIndex()) != iterator.Get())
+      {
+        std::stringstream ss;
+        ss << "The mapped image has the pixel " << mappedImage->GetPixel(iterator.GetIndex()) << " at "
+           << iterator.GetIndex() << " instead of " << iterator.Get() << "!";
+        throw std::runtime_error(ss.str());
+      }
+    }
+
+    typedef ImageGraphCut<SquareImageType> GraphCutType;
+    GraphCutType copiedGraphCut;
+    copiedGraphCut.SetImage(image);
+    copiedGraphCut.SetSeedsFromMasks(seeds[0], seeds[1]);
+    copiedGraphCut.PerformSegmentation();
+
+    MappedBuffer outputBuffer = MappedBuffer::OpenSharedMemory(outputName, MappedBuffer::Mode::SHARED);
+    GraphCutType mappedGraphCut;
+    mappedGraphCut.SetImageNoCopy(mappedImage);
+    mappedGraphCut.SetSeedsFromMasks(seeds[0], seeds[1]);
+    mappedGraphCut.SetOutputBuffer(reinterpret_cast<unsigned char*>(outputBuffer.GetData()), 255, 0);
+    mappedGraphCut.PerformSegmentation();
+
+    const ForegroundBackgroundSegmentMask* const mask = mappedGraphCut.GetSegmentMask();
+    if(ITKHelpers::CountDifferentPixels(mask, copiedGraphCut.GetSegmentMask()) != 0)
+    {
+      throw std::runtime_error("The segmentation of the mapped image differs from the segmentation of its copy!");
+    }
+
+    // The output is read back through another mapping of the shared memory.
+    const MappedBuffer output = MappedBuffer::OpenSharedMemory(outputName);
+    const unsigned char* const outputPixels = output.GetPointer<unsigned char>(0, numberOfPixels);
+    itk::ImageRegionConstIteratorWithIndex<ForegroundBackgroundSegmentMask> maskIterator(mask, region);
+    for(std::size_t pixelId = 0; !maskIterator.IsAtEnd(); ++maskIterator, ++pixelId)
+    {
+      const unsigned char expected =
+          maskIterator.Get() == ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND ? 255 : 0;
+      if(outputPixels[pixelId] != expected)
+      {
+        std::stringstream ss;
+        ss << "The output buffer has " << static_cast<int>(outputPixels[pixelId]) << " at " << maskIterator.GetIndex()
+           << " instead of " << static_cast<int>(expected) << "!";
+        throw std::runtime_error(ss.str());
+      }
+    }
+  }
+
+  /** Compare 'mapped' with rows [firstRow, firstRow + rows of 'mapped') of 'expected': the components, and the spacing
+    * and the physical position of the rows. */
+  template <typename TImage>
+  void CompareMappedImage(const TImage* const expected, const TImage* const mapped, const itk::IndexValueType firstRow,
+                          const std::string& description)
+  {
+    const itk::Size<2> expectedSize = expected->GetLargestPossibleRegion().GetSize();
+    const itk::Size<2> mappedSize = mapped->GetLargestPossibleRegion().GetSize();
+    if(mappedSize[0] != expectedSize[0] ||
+       expected->GetNumberOfComponentsPerPixel() != mapped->GetNumberOfComponentsPerPixel())
+    {
+      std::stringstream ss;
+      ss << description << ": the mapped image has size " << mappedSize << " and "
+         << mapped->GetNumberOfComponentsPerPixel() << " components but ITK reads size " << expectedSize << " and "
+         << expected->GetNumberOfComponentsPerPixel() << " components!";
+      throw std::runtime_error(ss.str());
+    }
+
+    itk::Index<2> firstIndex = {{0, firstRow}};
+    typename TImage::PointType expectedOrigin;
+    expected->TransformIndexToPhysicalPoint(firstIndex, expectedOrigin);
+    if(mapped->GetSpacing() != expected->GetSpacing() ||
+       mapped->GetOrigin().EuclideanDistanceTo(expectedOrigin) > 1e-6)
+    {
+      std::stringstream ss;
+      ss << description << ": the mapped image has spacing " << mapped->GetSpacing() << " and origin "
+         << mapped->GetOrigin() << " but ITK reads spacing " << expected->GetSpacing() << " and origin "
+         << expectedOrigin << "!";
+      throw std::runtime_error(ss.str());
+    }
+
+    const std::size_t valuesPerRow = expectedSize[0] * expected->GetNumberOfComponentsPerPixel();
+    if(std::memcmp(mapped->GetBufferPointer(), expected->GetBufferPointer() + firstRow * valuesPerRow,
+                   mappedSize[1] * valuesPerRow * sizeof(typename TImage::InternalPixelType)) != 0)
+    {
+      throw std::runtime_error(description + ": the mapped pixels are not the pixels ITK reads!");
+    }
+  }
+
+  /** Write an image of random components with ITK, map it with MappedImageFile, and compare the mapped image and
+    * a band of its rows with the image ITK reads back. The files are only removed if the check passes. */
+  template <typename TComponent>
+  void CheckMappedImageFile(const std::string& extension, const unsigned int numberOfComponents,
+                            const double originX)
+  {
+    typedef itk::VectorImage<TComponent, 2> ImageType;
+
+    itk::Size<2> size = {{13, 7}};
+    typename ImageType::Pointer image = ImageType::New();
+    image->SetRegions(itk::ImageRegion<2>(size));
+    image->SetNumberOfComponentsPerPixel(numberOfComponents);
+    image->Allocate();
+    const double spacing[2] = {0.5, 2.0};
+    const double origin[2] = {originX, -2.5};
+    image->SetSpacing(spacing);
+    image->SetOrigin(origin);
+
+    std::mt19937 generator(numberOfComponents);
+    std::uniform_int_distribution<int> distribution(0, 255);
+    const std::size_t numberOfValues = size[0] * size[1] * numberOfComponents;
+    for(std::size_t i = 0; i < numberOfValues; ++i)
+    {
+      image->GetBufferPointer()[i] = static_cast<TComponent>(distribution(generator) / 2.0);
+    }
+
+    const std::string filename = "ImageGraphCutUnitTest_mapped" + extension;
+    typedef itk::ImageFileWriter<ImageType> WriterType;
+    typename WriterType::Pointer writer = WriterType::New();
+    writer->SetFileName(filename);
+    writer->SetInput(image);
+    writer->Update();
+
+    typedef itk::ImageFileReader<ImageType> ReaderType;
+    typename ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName(filename);
+    reader->Update();
+
+    std::stringstream description;
+    description << filename << " with " << numberOfComponents << " components of " << sizeof(TComponent)
+                << " bytes and origin " << originX;
+
+    MappedImageFile imageFile = MappedImageFile::OpenMetaImage(filename);
+    CompareMappedImage(reader->GetOutput(), imageFile.GetImage<TComponent>().GetPointer(), 0, description.str());
+    CompareMappedImage(reader->GetOutput(), imageFile.GetRows<TComponent>(2, 4).GetPointer(), 2,
+                       description.str() + " (rows 2 to 6)");
+
+    std::remove(filename.c_str());
+    if(extension == ".mhd")
+    {
+      std::remove((filename.substr(0, filename.size() - extension.size()) + ".raw").c_str());
+    }
+  }
+
+  void CheckMappedImageFiles()
+  {
+    // The number of digits of the origin moves the end of the .mha header by a character, so the pixels of the
+    // larger components start both aligned and unaligned.
+    for(const double originX : {0.0, 10.0, 100.0, 1000.0})
+    {
+      for(const std::string extension : {".mha", ".mhd"})
+      {
+        CheckMappedImageFile<unsigned char>(extension, 3, originX);
+        CheckMappedImageFile<unsigned short>(extension, 1, originX);
+        CheckMappedImageFile<float>(extension, 2, originX);
+      }
+    }
+  }
+
+  const std::vector<Check> Checks = {
+    {"pixel_differences_uchar", CheckPixelDifferences<unsigned char>},
+    {"pixel_differences_float", CheckPixelDifferences<float>},
+    {"per_pixel_differences", CheckPerPixelDifferences},
+    {"color_space_converter", CheckColorSpaceConverter},
+    {"color_space_segmentation", CheckColorSpaceSegmentation},
+    {"gradient_magnitude", CheckGradientMagnitudes},
+    {"rle", CheckRLE},
+    {"read_policies", CheckReadPolicies},
+    {"apply_to_image", CheckApplyToImage},
+    {"mask_counting", CheckMaskCounting},
+    {"packed_masks", CheckPackedMasks},
+    {"mapped_buffers", CheckMappedBuffers},
+    {"mapped_image_file", CheckMappedImageFiles}};
+}
+
+int main(int argc, char* argv[])
+{
+  if(argc > 1)
+  {
+    std::cerr << "Usage: " << argv[0] << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  unsigned int numberOfFailures = 0;
+  for(const Check& check : Checks)
+  {
+    try
+    {
+      check.Run();
+      std::cout << "PASS " << check.Name << std::endl;
+    }
+    catch(const std::exception& e)
+    {
+      std::cout << "FAIL " << check.Name << ": " << e.what() << std::endl;
+      numberOfFailures++;
+    }
+  }
+
+  std::cout << Checks.size() << " checks, " << numberOfFailures << " failures" << std::endl;
+
+  return numberOfFailures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}